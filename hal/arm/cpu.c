@@ -21,6 +21,9 @@
 #include "../../include/errno.h"
 
 
+void *_cpu_current;
+
+
 /* Function creates new cpu context on top of given thread kernel stack */
 int hal_cpuCreateContext(cpu_context_t **nctx, void *start, void *kstack, size_t kstacksz, void *ustack, void *arg)
 {
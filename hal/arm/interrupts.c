@@ -19,6 +19,7 @@
 #include "interrupts.h"
 
 #include "../../proc/userintr.h"
+#include "../../proc/trace.h"
 #include "../../include/errno.h"
 
 extern int threads_schedule(unsigned int n, cpu_context_t *context, void *arg);
@@ -97,6 +98,7 @@ void interrupts_dispatch(unsigned int n, cpu_context_t *ctx)
 	hal_spinlockSet(&interrupts.spinlock[n], &sc);
 
 	interrupts.counters[n]++;
+	trace_event(trace_evIrqEnter, n, 0);
 
 	if ((h = interrupts.handlers[n]) != NULL) {
 		do
@@ -104,6 +106,8 @@ void interrupts_dispatch(unsigned int n, cpu_context_t *ctx)
 		while ((h = h->next) != interrupts.handlers[n]);
 	}
 
+	trace_event(trace_evIrqExit, n, 0);
+
 	if (reschedule)
 		threads_schedule(n, ctx, NULL);
 
@@ -196,6 +200,31 @@ int hal_interruptsDeleteHandler(intr_handler_t *h)
 }
 
 
+int hal_interruptsMask(unsigned int n, int mask)
+{
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	if (mask)
+		interrupts_disableIRQ(n);
+	else
+		interrupts_enableIRQ(n);
+
+	return EOK;
+}
+
+
+int hal_interruptsCounter(unsigned int n, unsigned int *count)
+{
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	*count = interrupts.counters[n];
+
+	return EOK;
+}
+
+
 /* Function initializes interrupt handling */
 void _hal_interruptsInit(void)
 {
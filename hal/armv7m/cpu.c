@@ -43,6 +43,9 @@ struct {
 volatile cpu_context_t *_cpu_nctx;
 
 
+void *_cpu_current;
+
+
 /* context management */
 
 
@@ -284,6 +284,18 @@ static inline int hal_cpuSupervisorMode(cpu_context_t *ctx)
 }
 
 
+/* Frame layout isn't fixed by the ABI, only interrupted instruction is reported */
+static inline int hal_cpuBacktrace(cpu_context_t *ctx, void *kstack, size_t kstacksz, void **pcs, int n)
+{
+	if (n <= 0)
+		return 0;
+
+	pcs[0] = (void *)ctx->pc;
+
+	return 1;
+}
+
+
 static inline u32 hal_cpuGetPC(void)
 {
 	void *pc;
@@ -375,6 +387,27 @@ static inline unsigned int hal_cpuGetCount(void)
 }
 
 
+static inline void hal_cpuSendReschedule(unsigned int cpu)
+{
+}
+
+
+/* Single core, so per-CPU data is a plain variable */
+extern void *_cpu_current;
+
+
+static inline void *hal_cpuGetCurrent(void)
+{
+	return _cpu_current;
+}
+
+
+static inline void hal_cpuSetCurrent(void *current)
+{
+	_cpu_current = current;
+}
+
+
 extern void hal_cpuRestart(void);
 
 
@@ -30,6 +30,7 @@
 
 
 #include "../../proc/userintr.h"
+#include "../../proc/trace.h"
 
 #include "../../include/errno.h"
 
@@ -90,6 +91,7 @@ void interrupts_dispatch(unsigned int n, cpu_context_t *ctx)
 	hal_spinlockSet(&interrupts.spinlock, &sc);
 
 	interrupts.counters[n]++;
+	trace_event(trace_evIrqEnter, n, 0);
 
 	if ((h = interrupts.handlers[n]) != NULL) {
 		do {
@@ -99,6 +101,7 @@ void interrupts_dispatch(unsigned int n, cpu_context_t *ctx)
 		} while ((h = h->next) != interrupts.handlers[n]);
 	}
 
+	trace_event(trace_evIrqExit, n, 0);
 	hal_spinlockClear(&interrupts.spinlock, &sc);
 
 	if (reschedule)
@@ -147,6 +150,29 @@ int hal_interruptsDeleteHandler(intr_handler_t *h)
 }
 
 
+/* Only external interrupts can be masked */
+int hal_interruptsMask(unsigned int n, int mask)
+{
+	if (n < 0x10 || n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	_imxrt_nvicSetIRQ(n - 0x10, !mask);
+
+	return EOK;
+}
+
+
+int hal_interruptsCounter(unsigned int n, unsigned int *count)
+{
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	*count = interrupts.counters[n];
+
+	return EOK;
+}
+
+
 char *hal_interruptsFeatures(char *features, unsigned int len)
 {
 	hal_strncpy(features, "Using NVIC interrupt controller", len);
@@ -34,6 +34,7 @@ typedef struct _intr_handler_t {
 	int (*f)(unsigned int, cpu_context_t *, void *);
 	void *data;
 	void *got;
+	unsigned int cpus;
 } intr_handler_t;
 
 
@@ -48,6 +49,14 @@ extern int hal_interruptsSetHandler(intr_handler_t *h);
 extern int hal_interruptsDeleteHandler(intr_handler_t *h);
 
 
+/* Masks or unmasks line n at interrupt controller, also from interrupt context */
+extern int hal_interruptsMask(unsigned int n, int mask);
+
+
+/* Returns number of interrupts taken on line n */
+extern int hal_interruptsCounter(unsigned int n, unsigned int *count);
+
+
 extern char *hal_interruptsFeatures(char *features, unsigned int len);
 
 
@@ -20,6 +20,7 @@
 #include "stm32.h"
 
 #include "../../../proc/userintr.h"
+#include "../../../proc/trace.h"
 
 #include "../../../include/errno.h"
 
@@ -92,6 +93,7 @@ void interrupts_dispatch(unsigned int n, cpu_context_t *ctx)
 	hal_spinlockSet(&interrupts.spinlock, &sc);
 
 	interrupts.counters[n]++;
+	trace_event(trace_evIrqEnter, n, 0);
 
 	if ((h = interrupts.handlers[n]) != NULL) {
 		do {
@@ -101,6 +103,7 @@ void interrupts_dispatch(unsigned int n, cpu_context_t *ctx)
 		} while ((h = h->next) != interrupts.handlers[n]);
 	}
 
+	trace_event(trace_evIrqExit, n, 0);
 	hal_spinlockClear(&interrupts.spinlock, &sc);
 
 	if (reschedule)
@@ -149,6 +152,29 @@ int hal_interruptsDeleteHandler(intr_handler_t *h)
 }
 
 
+/* Only external interrupts can be masked */
+int hal_interruptsMask(unsigned int n, int mask)
+{
+	if (n < 0x10 || n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	_stm32_nvicSetIRQ(n - 0x10, !mask);
+
+	return EOK;
+}
+
+
+int hal_interruptsCounter(unsigned int n, unsigned int *count)
+{
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	*count = interrupts.counters[n];
+
+	return EOK;
+}
+
+
 char *hal_interruptsFeatures(char *features, unsigned int len)
 {
 	hal_strncpy(features, "Using NVIC interrupt controller", len);
@@ -27,11 +27,44 @@
 extern int threads_schedule(unsigned int n, cpu_context_t *context, void *arg);
 
 
+extern void _interrupts_sysenter(void);
+
+
+#define CR0_MP    0x00000002
+#define CR0_EM    0x00000004
+#define CR0_TS    0x00000008
+#define CR0_NE    0x00000020
+
+#define CR4_OSFXSR     0x00000200
+#define CR4_OSXMMEXCPT 0x00000400
+#define CR4_OSXSAVE    0x00040000
+
+/* XCR0 components saved: x87, SSE and AVX */
+#define XCR0_MASK 0x7
+
+
+enum { fpuNone = 0, fpuFnsave, fpuFxsave, fpuXsave, fpuXsaveopt };
+
+
+/* SYSENTER stack words, the last one holds esp0 to switch to */
+#define CPU_ENTRYSZ 256
+
+/* GDT has 256 descriptors, 5 fixed, then TSS ones and per-CPU data ones SEL_LOCALOFFS / 8 further */
+#define CPU_MAX (256 - 5 - SEL_LOCALOFFS / 8)
+
+
 struct {
 	tss_t tss[256];
 	char stacks[256][512];
+	u32 entry[256][CPU_ENTRYSZ];
+	void *local[256];
+	void *fpuOwner[256];
 	u32 dr5;
 	volatile unsigned int ncpus;
+
+	unsigned int fpuMode;
+	size_t fpuAreaSize;
+	u32 fpuMask;
 } cpu;
 
 
@@ -200,6 +233,209 @@ void _hal_cpuSetKernelStack(void *kstack)
 {
 	cpu.tss[hal_cpuGetID()].ss0 = SEL_KDATA;
 	cpu.tss[hal_cpuGetID()].esp0 = (u32)kstack;
+	cpu.entry[hal_cpuGetID()][CPU_ENTRYSZ - 1] = (u32)kstack;
+}
+
+
+/* FPU context */
+
+
+static inline u32 _cpu_getCR0(void)
+{
+	u32 cr0;
+
+	__asm__ volatile ("movl %%cr0, %0" : "=r" (cr0));
+
+	return cr0;
+}
+
+
+static inline void _cpu_setCR0(u32 cr0)
+{
+	__asm__ volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+
+/* State starts with id of CPU which registers hold it, save area follows aligned for XSAVE */
+static inline void *_cpu_fpuArea(void *fpu)
+{
+	return (void *)(((u32)fpu + sizeof(u32) + 63) & ~63);
+}
+
+
+static void _cpu_fpuSave(void *fpu)
+{
+	void *area = _cpu_fpuArea(fpu);
+
+	switch (cpu.fpuMode) {
+		case fpuXsaveopt:
+			__asm__ volatile ("xsaveopt (%0)" : : "r" (area), "a" (cpu.fpuMask), "d" (0) : "memory");
+			break;
+
+		case fpuXsave:
+			__asm__ volatile ("xsave (%0)" : : "r" (area), "a" (cpu.fpuMask), "d" (0) : "memory");
+			break;
+
+		case fpuFxsave:
+			__asm__ volatile ("fxsave (%0)" : : "r" (area) : "memory");
+			break;
+
+		default:
+			__asm__ volatile ("fnsave (%0); fwait" : : "r" (area) : "memory");
+			break;
+	}
+}
+
+
+static void _cpu_fpuLoad(void *fpu)
+{
+	void *area = _cpu_fpuArea(fpu);
+
+	switch (cpu.fpuMode) {
+		case fpuXsaveopt:
+		case fpuXsave:
+			__asm__ volatile ("xrstor (%0)" : : "r" (area), "a" (cpu.fpuMask), "d" (0) : "memory");
+			break;
+
+		case fpuFxsave:
+			__asm__ volatile ("fxrstor (%0)" : : "r" (area) : "memory");
+			break;
+
+		default:
+			__asm__ volatile ("frstor (%0)" : : "r" (area) : "memory");
+			break;
+	}
+}
+
+
+size_t hal_cpuFpuSize(void)
+{
+	if (cpu.fpuMode == fpuNone)
+		return 0;
+
+	return sizeof(u32) + 63 + cpu.fpuAreaSize;
+}
+
+
+void hal_cpuFpuInit(void *fpu)
+{
+	u8 *area = _cpu_fpuArea(fpu);
+
+	/* Zeroed XSAVE header loads initial state of all components but control registers */
+	hal_memset(fpu, 0, hal_cpuFpuSize());
+	*(u32 *)fpu = (u32)-1;
+	*(u16 *)area = 0x37f;
+
+	if (cpu.fpuMode == fpuFnsave)
+		*(u16 *)(area + 8) = 0xffff;
+	else
+		*(u32 *)(area + 24) = 0x1f80;
+}
+
+
+void hal_cpuFpuSwitch(void *fpu)
+{
+	unsigned int id = hal_cpuGetID();
+	void *owner = cpu.fpuOwner[id];
+	u32 cr0;
+
+	if (cpu.fpuMode == fpuNone)
+		return;
+
+	cr0 = _cpu_getCR0();
+
+	/* TS is clear only while owner runs, its state has to be saved as it may be resumed on other CPU */
+	if (!(cr0 & CR0_TS)) {
+		if (fpu == owner)
+			return;
+
+		_cpu_fpuSave(owner);
+
+		/* FNSAVE reinitializes FPU */
+		if (cpu.fpuMode == fpuFnsave)
+			cpu.fpuOwner[id] = NULL;
+	}
+	else if (fpu != NULL && fpu == owner && *(u32 *)fpu == id) {
+		/* Registers still hold selected thread state */
+		__asm__ volatile ("clts");
+		return;
+	}
+
+	_cpu_setCR0(cr0 | CR0_TS);
+}
+
+
+void hal_cpuFpuRestore(void *fpu)
+{
+	unsigned int id = hal_cpuGetID();
+
+	__asm__ volatile ("clts");
+
+	if (cpu.fpuOwner[id] == fpu && *(u32 *)fpu == id)
+		return;
+
+	_cpu_fpuLoad(fpu);
+	*(u32 *)fpu = id;
+	cpu.fpuOwner[id] = fpu;
+}
+
+
+void hal_cpuFpuCopy(void *dst, void *src)
+{
+	/* Areas are aligned within their buffers, offsets may differ */
+	hal_memcpy(_cpu_fpuArea(dst), _cpu_fpuArea(src), cpu.fpuAreaSize);
+	*(u32 *)dst = (u32)-1;
+}
+
+
+/* Sets FPU up on current core, TS is set so that first use traps */
+static void _cpu_fpuInit(void)
+{
+	u32 eax, ebx, ecx, edx, cr4;
+
+	cpu.fpuOwner[hal_cpuGetID()] = NULL;
+
+	hal_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+	if (!(edx & 1)) {
+		cpu.fpuMode = fpuNone;
+		return;
+	}
+
+	_cpu_setCR0((_cpu_getCR0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+
+	cpu.fpuMode = fpuFnsave;
+	cpu.fpuAreaSize = 108;
+
+	if (!(edx & (1 << 24)))
+		return;
+
+	__asm__ volatile ("movl %%cr4, %0" : "=r" (cr4));
+	cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+
+	cpu.fpuMode = fpuFxsave;
+	cpu.fpuAreaSize = 512;
+
+	if (ecx & (1 << 26)) {
+		cr4 |= CR4_OSXSAVE;
+		__asm__ volatile ("movl %0, %%cr4" : : "r" (cr4));
+
+		hal_cpuid(0xd, 0, &eax, &ebx, &ecx, &edx);
+		cpu.fpuMask = eax & XCR0_MASK;
+		__asm__ volatile ("xsetbv" : : "c" (0), "a" (cpu.fpuMask), "d" (0));
+
+		/* Size of area for components enabled in XCR0 */
+		hal_cpuid(0xd, 0, &eax, &ebx, &ecx, &edx);
+		cpu.fpuMode = fpuXsave;
+		cpu.fpuAreaSize = ebx;
+
+		hal_cpuid(0xd, 1, &eax, &ebx, &ecx, &edx);
+		if (eax & 1)
+			cpu.fpuMode = fpuXsaveopt;
+	}
+	else {
+		__asm__ volatile ("movl %0, %%cr4" : : "r" (cr4));
+	}
 }
 
 
@@ -237,6 +473,14 @@ void _cpu_gdtInsert(unsigned int idx, u32 base, u32 limit, u32 type)
 
 void *_cpu_initCore(void)
 {
+	u32 eax, ebx, ecx, edx;
+
+	/* No descriptors left, core stays halted and isn't counted */
+	if (cpu.ncpus == CPU_MAX) {
+		for (;;)
+			__asm__ volatile ("cli; hlt");
+	}
+
 	cpu.ncpus++;
 
 	u32 a = *(u32 *)0xfee000f0;
@@ -248,10 +492,29 @@ void *_cpu_initCore(void)
 
 	cpu.tss[hal_cpuGetID()].ss0 = SEL_KDATA;
 	cpu.tss[hal_cpuGetID()].esp0 = (u32)&cpu.stacks[hal_cpuGetID()][511];
+	cpu.entry[hal_cpuGetID()][CPU_ENTRYSZ - 1] = cpu.tss[hal_cpuGetID()].esp0;
 
 	/* Set task register */
 	__asm__ volatile ("ltr %%ax" : : "a" ((4 + cpu.ncpus) * 8));
 
+	/* Set per-CPU data segment */
+	cpu.local[hal_cpuGetID()] = NULL;
+	_cpu_gdtInsert(4 + cpu.ncpus + SEL_LOCALOFFS / 8, (u32)&cpu.local[hal_cpuGetID()], sizeof(void *) - 1, DESCR_KLOCAL);
+	__asm__ volatile ("movw %%ax, %%gs" : : "a" ((4 + cpu.ncpus) * 8 + SEL_LOCALOFFS));
+
+	/*
+	 * Set fast system call entry. It starts on a small stack of its own, an exception or NMI
+	 * taken before the switch to esp0 lands there instead of over the TSS.
+	 */
+	hal_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if (edx & (1 << 11)) {
+		hal_wrmsr(0x174, SEL_KCODE);
+		hal_wrmsr(0x175, (u32)&cpu.entry[hal_cpuGetID()][CPU_ENTRYSZ - 1]);
+		hal_wrmsr(0x176, (u32)_interrupts_sysenter);
+	}
+
+	_cpu_fpuInit();
+
 	return (void *)cpu.tss[hal_cpuGetID()].esp0;
 }
 
@@ -89,6 +89,9 @@
 /* Descriptor of user task data segment */
 #define DESCR_KDATA  (DBITS_4KB | DBITS_PRESENT | DBITS_DPL0 | DBITS_APP | DBITS_DATA | DBITS_WRT)
 
+/* Descriptor of per-CPU data segment */
+#define DESCR_KLOCAL (DBITS_1B | DBITS_PRESENT | DBITS_DPL0 | DBITS_APP | DBITS_DATA | DBITS_WRT)
+
 
 /* Segment selectors */
 #define SEL_KCODE    8
@@ -96,6 +99,9 @@
 #define SEL_UCODE    27
 #define SEL_UDATA    35
 
+/* Per-CPU data descriptor lies at fixed distance from CPU's TSS descriptor, so its selector is derived from task register */
+#define SEL_LOCALOFFS (128 * 8)
+
 
 #define NULL 0
 
@@ -560,6 +566,31 @@ static inline void *hal_cpuGetUserSP(cpu_context_t *ctx)
 }
 
 
+/* Fills pcs with interrupted instruction and return addresses found by following frame pointers (built with PROFILE=y) */
+static inline int hal_cpuBacktrace(cpu_context_t *ctx, void *kstack, size_t kstacksz, void **pcs, int n)
+{
+	u32 *fp = (u32 *)ctx->ebp;
+	int i = 0;
+
+	if (n > 0)
+		pcs[i++] = (void *)ctx->eip;
+
+	if (!hal_cpuSupervisorMode(ctx))
+		return i;
+
+	while (i < n && (void *)fp >= kstack && (void *)(fp + 2) <= kstack + kstacksz) {
+		pcs[i++] = (void *)fp[1];
+
+		if ((u32 *)fp[0] <= fp)
+			break;
+
+		fp = (u32 *)fp[0];
+	}
+
+	return i;
+}
+
+
 static inline int hal_cpuPushSignal(void *kstack, void (*handler)(void), int n)
 {
 	cpu_context_t *ctx = (void *)((char *)kstack - sizeof(cpu_context_t));
@@ -647,6 +678,29 @@ static inline void hal_jmp(void *f, void *kstack, void *stack, int argc)
 }
 
 
+/* FPU and SIMD state is switched lazily, on first use after context switch */
+#define HAL_LAZYFPU
+
+
+/* Size of thread FPU state, 0 if there's no FPU */
+extern size_t hal_cpuFpuSize(void);
+
+
+extern void hal_cpuFpuInit(void *fpu);
+
+
+/* Called by scheduler with interrupts disabled, fpu is state of selected thread */
+extern void hal_cpuFpuSwitch(void *fpu);
+
+
+/* Called on device not available exception with interrupts disabled */
+extern void hal_cpuFpuRestore(void *fpu);
+
+
+/* Copies saved state, owner of src must not be running */
+extern void hal_cpuFpuCopy(void *dst, void *src);
+
+
 /* core management */
 
 
@@ -685,6 +739,31 @@ static inline unsigned int hal_cpuGetID(void)
 }
 
 
+/* Running thread is kept in per-CPU data, addressed with %gs in kernel mode */
+static inline void *hal_cpuGetCurrent(void)
+{
+	void *current;
+
+	__asm__ volatile
+	(" \
+		movl %%gs:0, %0"
+	: "=r" (current));
+
+	return current;
+}
+
+
+static inline void hal_cpuSetCurrent(void *current)
+{
+	__asm__ volatile
+	(" \
+		movl %0, %%gs:0"
+	:
+	: "r" (current)
+	: "memory");
+}
+
+
 static inline void cpu_sendIPI(unsigned int cpu, unsigned int intr)
 {
 	if (_hal_cpuGetID() == 0xffffffff)
@@ -703,6 +782,29 @@ static inline void cpu_sendIPI(unsigned int cpu, unsigned int intr)
 }
 
 
+/* Vector of reschedule IPI, follows hardware interrupts */
+#define CPU_RESCHEDIPI (32 + 16)
+
+
+/* Makes cpu run scheduler now, not on its next tick */
+static inline void hal_cpuSendReschedule(unsigned int cpu)
+{
+	if (_hal_cpuGetID() == 0xffffffff)
+		return;
+
+	__asm__ volatile
+	(" \
+		movl %0, (0xfee00310); \
+		movl %1, (0xfee00300); \
+	1:; \
+		btl $12, (0xfee00300); \
+		jc 1b"
+	:
+	: "r" (cpu << 24), "r" (0x4000 | CPU_RESCHEDIPI)
+	: "memory");
+}
+
+
 extern void _hal_cpuInitCores(void);
 
 
@@ -26,6 +26,7 @@
 #define EXC_DEFAULT    128
 
 #define EXC_UNDEFINED  6
+#define EXC_FPU        7
 #define EXC_PAGEFAULT  14
 
 #define SIZE_CTXDUMP   512    /* Size of dumped context */
@@ -21,6 +21,7 @@
 #include "pmap.h"
 
 #include "../../proc/userintr.h"
+#include "../../proc/trace.h"
 
 #include "../../include/errno.h"
 
@@ -45,6 +46,8 @@ extern void _interrupts_irq15(void);
 
 extern void _interrupts_unexpected(void);
 
+extern void _interrupts_resched(void);
+
 extern void _interrupts_syscall(void);
 
 
@@ -89,6 +92,7 @@ struct {
 	spinlock_t spinlocks[SIZE_INTERRUPTS];
 	intr_handler_t *handlers[SIZE_INTERRUPTS];
 	unsigned int counters[SIZE_INTERRUPTS];
+	spinlock_t pic;
 } interrupts;
 
 
@@ -113,6 +117,16 @@ if (hal_cpuGetID()) {
 	return;
 }
 
+/* Sent by hal_cpuSendReschedule, scheduler runs on return */
+int _interrupts_reschedIPI(unsigned int n, cpu_context_t *ctx)
+{
+	__asm__ volatile
+	("movl $0, (0xfee000b0)"::);
+
+	return 1;
+}
+
+
 int interrupts_dispatchIRQ(unsigned int n, cpu_context_t *ctx)
 {
 	intr_handler_t *h;
@@ -125,14 +139,16 @@ int interrupts_dispatchIRQ(unsigned int n, cpu_context_t *ctx)
 	hal_spinlockSet(&interrupts.spinlocks[n], &sc);
 
 	interrupts.counters[n]++;
+	trace_event(trace_evIrqEnter, n, 0);
 
 	if ((h = interrupts.handlers[n]) != NULL) {
 		do
-			if (h->f(n, ctx, h->data))
+			if ((!h->cpus || (h->cpus & (1 << hal_cpuGetID()))) && h->f(n, ctx, h->data))
 				reschedule = 1;
 		while ((h = h->next) != interrupts.handlers[n]);
 	}
 
+	trace_event(trace_evIrqExit, n, 0);
 	hal_spinlockClear(&interrupts.spinlocks[n], &sc);
 
 	if (n == 0)
@@ -148,6 +164,10 @@ int hal_interruptsSetHandler(intr_handler_t *h)
 	if (h == NULL || h->f == NULL || h->n >= SIZE_INTERRUPTS)
 		return -EINVAL;
 
+	/* 8259 delivers device interrupts to CPU 0 only, timer is broadcast to others by IPI */
+	if (h->n != 0 && h->cpus && !(h->cpus & 1))
+		return -EINVAL;
+
 	hal_spinlockSet(&interrupts.spinlocks[h->n], &sc);
 	_intr_add(&interrupts.handlers[h->n], h);
 	hal_spinlockClear(&interrupts.spinlocks[h->n], &sc);
@@ -171,6 +191,35 @@ int hal_interruptsDeleteHandler(intr_handler_t *h)
 }
 
 
+/* 8259 mask registers are shared by lines, so they're changed under own spinlock */
+int hal_interruptsMask(unsigned int n, int mask)
+{
+	void *port = (n < 8) ? (void *)0x21 : (void *)0xa1;
+	u8 bit = 1 << (n & 7);
+	spinlock_ctx_t sc;
+
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	hal_spinlockSet(&interrupts.pic, &sc);
+	hal_outb(port, mask ? (hal_inb(port) | bit) : (hal_inb(port) & ~bit));
+	hal_spinlockClear(&interrupts.pic, &sc);
+
+	return EOK;
+}
+
+
+int hal_interruptsCounter(unsigned int n, unsigned int *count)
+{
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	*count = interrupts.counters[n];
+
+	return EOK;
+}
+
+
 /* Function setups interrupt stub in IDT */
 __attribute__ ((section (".init"))) int _interrupts_setIDTEntry(unsigned int n, void *addr, u32 type)
 {
@@ -242,10 +291,14 @@ __attribute__ ((section (".init"))) void _hal_interruptsInit(void)
 		hal_spinlockCreate(&interrupts.spinlocks[k], "interrupts.spinlocks[]");
 	}
 
+	hal_spinlockCreate(&interrupts.pic, "interrupts.pic");
+
 	/* Set stubs for unhandled interrupts */
 	for (; k < 256 - SIZE_INTERRUPTS; k++)
 		_interrupts_setIDTEntry(32 + k, _interrupts_unexpected, IGBITS_IRQEXC);
 
+	_interrupts_setIDTEntry(CPU_RESCHEDIPI, _interrupts_resched, IGBITS_IRQEXC);
+
 	/* Set stub for syscall */
 /*	_interrupts_setIDTEntry(0x80, _interrupts_syscall, IGBITS_TRAP); */
 	_interrupts_setIDTEntry(0x80, _interrupts_syscall, IGBITS_IRQEXC);
@@ -32,6 +32,7 @@ typedef struct _intr_handler_t {
 	unsigned int n;
 	int (*f)(unsigned int, cpu_context_t *, void *);
 	void *data;
+	unsigned int cpus;   /* CPUs running handler, 0 for any */
 } intr_handler_t;
 
 
@@ -42,6 +43,14 @@ extern int hal_interruptsSetHandler(intr_handler_t *h);
 extern int hal_interruptsDeleteHandler(intr_handler_t *h);
 
 
+/* Masks or unmasks line n at interrupt controller, also from interrupt context */
+extern int hal_interruptsMask(unsigned int n, int mask);
+
+
+/* Returns number of interrupts taken on line n */
+extern int hal_interruptsCounter(unsigned int n, unsigned int *count);
+
+
 extern char *hal_interruptsFeatures(char *features, unsigned int len);
 
 
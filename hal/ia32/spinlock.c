@@ -16,6 +16,8 @@
 
 #include "spinlock.h"
 #include "cpu.h"
+#include "string.h"
+#include "../../include/errno.h"
 
 
 struct {
@@ -33,6 +35,10 @@ static void _hal_spinlockCreate(spinlock_t *spinlock, const char *name)
 	spinlock->dmin = (cycles_t)-1;
 	spinlock->dmax = (cycles_t)0;
 
+#ifdef LOCKSTAT
+	hal_memset(&spinlock->stat, 0, sizeof(spinlock->stat));
+#endif
+
 
 	if (spinlocks.first != NULL) {
 		spinlocks.first->prev->next = spinlock;
@@ -78,6 +84,67 @@ void hal_spinlockDestroy(spinlock_t *spinlock)
 }
 
 
+#ifdef LOCKSTAT
+__attribute__ ((noinline)) void _hal_spinlockContended(spinlock_t *spinlock)
+{
+	cycles_t b, e;
+	u32 v;
+
+	hal_cpuGetCycles((void *)&b);
+
+	do {
+		v = 0;
+		__asm__ volatile
+		(" \
+			pause; \
+			xchgl %0, %1"
+		: "+r" (v), "+m" (spinlock->lock)
+		:
+		: "memory");
+	} while (v == 0);
+
+	hal_cpuGetCycles((void *)&e);
+	lockstat_contended(&spinlock->stat, e - b, __builtin_return_address(0));
+}
+
+
+/* Snapshots i-th spinlock, info may be user memory so it's never written with the spinlock set */
+int hal_spinlockInfo(int i, lockinfo_t *info)
+{
+	spinlock_t *s;
+	lockinfo_t li;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&spinlocks.spinlock, &sc);
+
+	if ((s = spinlocks.first) != NULL) {
+		for (; i > 0; --i) {
+			if ((s = s->next) == spinlocks.first) {
+				s = NULL;
+				break;
+			}
+		}
+	}
+
+	if (s != NULL) {
+		hal_strncpy(li.name, s->name, sizeof(li.name) - 1);
+		li.name[sizeof(li.name) - 1] = '\0';
+		li.type = lockinfo_spinlock;
+		hal_memcpy(&li.stat, &s->stat, sizeof(li.stat));
+	}
+
+	hal_spinlockClear(&spinlocks.spinlock, &sc);
+
+	if (s == NULL)
+		return -ENOENT;
+
+	hal_memcpy(info, &li, sizeof(li));
+
+	return EOK;
+}
+#endif
+
+
 __attribute__ ((section (".init"))) void _hal_spinlockInit(void)
 {
 	spinlocks.first = NULL;
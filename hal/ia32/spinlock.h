@@ -21,6 +21,13 @@
 
 #include "cpu.h"
 
+#ifdef LOCKSTAT
+#include "../../proc/lockstat.h"
+
+/* Spinlocks keep contention statistics */
+#define HAL_LOCKSTAT
+#endif
+
 
 typedef struct _spinlock_t {
 	const char *name;
@@ -31,6 +38,10 @@ typedef struct _spinlock_t {
 	struct _spinlock_t *next;
 	struct _spinlock_t *prev;
 
+#ifdef LOCKSTAT
+	lockstat_t stat;
+#endif
+
 	u32 lock;
 } spinlock_t;
 
@@ -38,6 +49,36 @@ typedef struct _spinlock_t {
 typedef u32 spinlock_ctx_t;
 
 
+#ifdef LOCKSTAT
+extern void _hal_spinlockContended(spinlock_t *spinlock);
+
+
+static inline void hal_spinlockSet(spinlock_t *spinlock, spinlock_ctx_t *sc)
+{
+	u32 v = 0;
+
+	__asm__ volatile
+	(" \
+		pushf; \
+		popl %0; \
+		cli"
+	: "=r" (*sc)
+	:
+	: "memory");
+
+	__asm__ volatile
+	("xchgl %0, %1"
+	: "+r" (v), "+m" (spinlock->lock)
+	:
+	: "memory");
+
+	/* Slow path out of line, so that it can tell the call site */
+	if (v == 0)
+		_hal_spinlockContended(spinlock);
+
+	hal_cpuGetCycles((void *)&spinlock->b);
+}
+#else
 static inline void hal_spinlockSet(spinlock_t *spinlock, spinlock_ctx_t *sc)
 {
 	__asm__ volatile
@@ -57,6 +98,7 @@ static inline void hal_spinlockSet(spinlock_t *spinlock, spinlock_ctx_t *sc)
 
 	hal_cpuGetCycles((void *)&spinlock->b);
 }
+#endif
 
 
 static inline void hal_spinlockClear(spinlock_t *spinlock, spinlock_ctx_t *sc)
@@ -70,6 +112,10 @@ static inline void hal_spinlockClear(spinlock_t *spinlock, spinlock_ctx_t *sc)
 	if (spinlock->e - spinlock->b < spinlock->dmin)
 		spinlock->dmin = spinlock->e - spinlock->b;
 
+#ifdef LOCKSTAT
+	lockstat_released(&spinlock->stat, spinlock->e - spinlock->b);
+#endif
+
 	__asm__ volatile
 	(" \
 		xorl %%eax, %%eax; \
@@ -92,6 +138,11 @@ extern void hal_spinlockCreate(spinlock_t *spinlock, const char *name);
 extern void hal_spinlockDestroy(spinlock_t *spinlock);
 
 
+#ifdef LOCKSTAT
+extern int hal_spinlockInfo(int i, lockinfo_t *info);
+#endif
+
+
 extern void _hal_spinlockInit(void);
 
 
@@ -25,6 +25,9 @@
 extern int threads_schedule(unsigned int n, cpu_context_t *context, void *arg);
 
 
+void *_cpu_current;
+
+
 int hal_platformctl(void *ptr)
 {
 	return EOK;
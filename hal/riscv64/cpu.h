@@ -444,6 +444,32 @@ static inline int hal_cpuSupervisorMode(cpu_context_t *ctx)
 	return (ctx->sscratch == 0);
 }
 
+
+/* Fills pcs with interrupted instruction and return addresses found by following frame pointers (built with PROFILE=y) */
+static inline int hal_cpuBacktrace(cpu_context_t *ctx, void *kstack, size_t kstacksz, void **pcs, int n)
+{
+	u64 *fp = (u64 *)ctx->s0;
+	int i = 0;
+
+	if (n > 0)
+		pcs[i++] = (void *)ctx->pc;
+
+	if (!hal_cpuSupervisorMode(ctx))
+		return i;
+
+	/* Return address and previous frame pointer are stored just below the frame */
+	while (i < n && (void *)(fp - 2) >= kstack && (void *)fp <= kstack + kstacksz) {
+		pcs[i++] = (void *)fp[-1];
+
+		if ((u64 *)fp[-2] <= fp)
+			break;
+
+		fp = (u64 *)fp[-2];
+	}
+
+	return i;
+}
+
 /* core management */
 
 
@@ -453,12 +479,33 @@ static inline unsigned int hal_cpuGetCount(void)
 }
 
 
+static inline void hal_cpuSendReschedule(unsigned int cpu)
+{
+}
+
+
 static inline unsigned int hal_cpuGetID(void)
 {
 	return 0;
 }
 
 
+/* Single core, so per-CPU data is a plain variable */
+extern void *_cpu_current;
+
+
+static inline void *hal_cpuGetCurrent(void)
+{
+	return _cpu_current;
+}
+
+
+static inline void hal_cpuSetCurrent(void *current)
+{
+	_cpu_current = current;
+}
+
+
 extern void _hal_cpuInitCores(void);
 
 
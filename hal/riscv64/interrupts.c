@@ -23,6 +23,7 @@
 #include "dtb.h"
 
 #include "../../proc/userintr.h"
+#include "../../proc/trace.h"
 
 #include "../../include/errno.h"
 
@@ -94,6 +95,7 @@ if (dtb_getPLIC() && (n != 0)) {
 	hal_spinlockSet(&interrupts.spinlocks[n], &sc);
 
 	interrupts.counters[n]++;
+	trace_event(trace_evIrqEnter, n, 0);
 
 	if ((h = interrupts.handlers[n]) != NULL) {
 		do
@@ -103,6 +105,7 @@ if (dtb_getPLIC() && (n != 0)) {
 		while ((h = h->next) != interrupts.handlers[n]);
 	}
 
+	trace_event(trace_evIrqExit, n, 0);
 	hal_spinlockClear(&interrupts.spinlocks[n], &sc);
 
 if (cn != 0) {
@@ -152,6 +155,26 @@ int hal_interruptsDeleteHandler(intr_handler_t *h)
 }
 
 
+int hal_interruptsMask(unsigned int n, int mask)
+{
+	if (n == 0 || n >= SIZE_INTERRUPTS || !dtb_getPLIC())
+		return -EINVAL;
+
+	return plic_enableInterrupt(1, n, !mask);
+}
+
+
+int hal_interruptsCounter(unsigned int n, unsigned int *count)
+{
+	if (n >= SIZE_INTERRUPTS)
+		return -EINVAL;
+
+	*count = interrupts.counters[n];
+
+	return EOK;
+}
+
+
 __attribute__((aligned(4))) void handler(cpu_context_t *ctx)
 {
 	cycles_t c, d;
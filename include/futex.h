@@ -0,0 +1,23 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Futexes
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PHOENIX_FUTEX_H_
+#define _PHOENIX_FUTEX_H_
+
+
+/* Futex word is in memory shared between processes, it's keyed by physical address */
+#define FUTEX_SHARED 0x1
+
+
+#endif
@@ -35,6 +35,10 @@ enum {
 } type;
 
 
+/* Object attributes, mtSetAttr/mtGetAttr */
+enum { atMode = 0, atUid, atGid, atSize, atType, atPort, atPollStatus, atEventMask, atCTime, atMTime, atATime, atLinks, atDev };
+
+
 #pragma pack(push, 8)
 
 
@@ -119,6 +119,60 @@ struct timeval {
 #define MSG_OOB        0x04
 #define MSG_DONTWAIT   0x08
 #define MSG_MORE       0x10
+#define MSG_TRUNC      0x20
+#define MSG_CTRUNC     0x40
+#define MSG_CMSG_CLOEXEC 0x80
+
+#define IOV_MAX 1024
+
+
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+
+struct msghdr {
+	void *msg_name;
+	socklen_t msg_namelen;
+	struct iovec *msg_iov;
+	int msg_iovlen;
+	void *msg_control;
+	socklen_t msg_controllen;
+	int msg_flags;
+};
+
+
+#define SOL_SOCKET 0xffff
+
+#define SCM_RIGHTS      0x01
+#define SCM_CREDENTIALS 0x02
+
+
+struct cmsghdr {
+	socklen_t cmsg_len;
+	int cmsg_level;
+	int cmsg_type;
+};
+
+
+struct ucred {
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+};
+
+
+#define CMSG_ALIGN(len) (((len) + sizeof(socklen_t) - 1) & ~(sizeof(socklen_t) - 1))
+#define CMSG_DATA(cmsg) ((unsigned char *)(cmsg) + CMSG_ALIGN(sizeof(struct cmsghdr)))
+#define CMSG_LEN(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + (len))
+#define CMSG_SPACE(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + CMSG_ALIGN(len))
+
+
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
 
 
 #define POLLIN         0x1
@@ -143,4 +197,26 @@ struct pollfd {
 };
 
 
+/* Event queue registration (in) and ready descriptor (out) */
+struct pollevent {
+	int fd;
+	unsigned short flags;
+	unsigned short events;
+	void *data;
+};
+
+
+#define TFD_NONBLOCK O_NONBLOCK
+#define TFD_CLOEXEC  O_CLOEXEC
+
+#define TFD_TIMER_ABSTIME 1
+
+
+/* Timer setting in us on the uptime clock, zero value disarms */
+struct timerspec {
+	time_t value;
+	time_t interval;
+};
+
+
 #endif
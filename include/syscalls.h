@@ -59,9 +59,9 @@
 	ID(fileRemove) \
 	ID(threadsinfo) \
 	ID(meminfo) \
-	ID(perf_start) \
-	ID(perf_read) \
-	ID(perf_finish) \
+	ID(trace_start) \
+	ID(trace_read) \
+	ID(trace_stop) \
 	ID(syspageprog) \
 	ID(va2pa) \
 	ID(signalHandle) \
@@ -114,4 +114,35 @@
 	ID(sys_spawn) \
 	ID(release) \
 	ID(sbi_putchar) \
-	ID(sbi_getchar)
+	ID(sbi_getchar) \
+	ID(sys_pollNotify) \
+	ID(sys_eventQueue) \
+	ID(sys_eventCtl) \
+	ID(sys_eventWait) \
+	ID(sys_sendfile) \
+	ID(sys_readv) \
+	ID(sys_writev) \
+	ID(sys_preadv) \
+	ID(sys_pwritev) \
+	ID(sys_sendmmsg) \
+	ID(sys_recvmmsg) \
+	ID(dcacheinfo) \
+	ID(sys_sendmsg) \
+	ID(sys_recvmsg) \
+	ID(getrusage) \
+	ID(trace_map) \
+	ID(lockinfo) \
+	ID(profile_start) \
+	ID(profile_read) \
+	ID(profile_stop) \
+	ID(syscallstat) \
+	ID(futexWait) \
+	ID(futexWake) \
+	ID(sys_timerCreate) \
+	ID(sys_timerSet) \
+	ID(sys_timerGet) \
+	ID(threadAffinity) \
+	ID(threadDeadline) \
+	ID(interruptThread) \
+	ID(irqinfo) \
+	ID(threadsusage)
@@ -28,6 +28,26 @@ typedef struct _syspageprog_t {
 } syspageprog_t;
 
 
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN -1
+#define RUSAGE_THREAD    1
+
+
+typedef struct _usageinfo_t {
+	time_t cpuTime;
+	time_t waitTime;     /* Blocked on a queue or sleeping */
+	time_t readyTime;    /* Runnable but not running */
+
+	unsigned int nvcsw;  /* Context switches on blocking */
+	unsigned int nivcsw; /* Context switches on preemption */
+	unsigned int minflt;
+	unsigned int majflt; /* Faults which read the page from a server */
+	unsigned int msgsnd;
+	unsigned int msgrcv;
+	unsigned long long mapped; /* Message data mapped on receive */
+} usageinfo_t;
+
+
 typedef struct _threadinfo_t {
 	unsigned int pid;
 	unsigned int tid;
@@ -44,6 +64,13 @@ typedef struct _threadinfo_t {
 } threadinfo_t;
 
 
+typedef struct _threadusage_t {
+	unsigned int pid;
+	unsigned int tid;
+	usageinfo_t usage;
+} threadusage_t;
+
+
 typedef struct _entryinfo_t {
 	void *vaddr;
 	size_t size;
@@ -80,72 +107,118 @@ typedef struct _meminfo_t {
 } meminfo_t;
 
 
-enum { perf_evScheduling, perf_evEnqueued, perf_evWaking, perf_evPreempted };
+typedef struct _dcacheinfo_t {
+	unsigned int size;
+	unsigned int entries;
+	unsigned int negative;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long invalidations;
+} dcacheinfo_t;
 
 
-typedef struct {
-	unsigned deltaTimestamp : 12;
-	unsigned type : 2;
-	unsigned tid : 18;
-} __attribute__((packed)) perf_event_t;
+enum { trace_evScheduling = 0, trace_evEnqueued, trace_evWaking, trace_evPreempted,
+	trace_evBegin, trace_evEnd, trace_evFork, trace_evKill, trace_evExec,
+	trace_evMsgSend, trace_evMsgRecv, trace_evMsgRespond, trace_evPageFault, trace_evLockContended,
+	trace_evIrqEnter, trace_evIrqExit, trace_evSyscallEnter, trace_evSyscallExit, trace_evCount };
+
 
+#define TRACE_EVMASK(type) (1u << (type))
+#define TRACE_EVALL ((1u << trace_evCount) - 1)
 
-enum { perf_levBegin, perf_levEnd, perf_levFork, perf_levKill, perf_levExec };
 
+typedef struct {
+	unsigned long long timestamp; /* us since boot */
+	unsigned short type;
+	unsigned short cpu;
+	unsigned int pid;
+	unsigned int tid;
+	unsigned int data;            /* Priority, message type, interrupt or syscall number */
+	unsigned long long addr;      /* Port, fault or lock address, syscall result */
+} trace_event_t;
 
+
+/*
+ * Per-CPU ring, written only by the kernel at head, consumed by the reader at tail.
+ * Mapped read-only to the reader except the page holding tail, at tailoffs from the ring.
+ */
 typedef struct {
-	unsigned sbz;
+	volatile unsigned int head;
+	unsigned int size;            /* Capacity in events, power of 2 */
+	volatile unsigned int lost;   /* Events dropped while the ring was full */
+	unsigned int tailoffs;
+	trace_event_t events[];
+} trace_ring_t;
 
-	unsigned deltaTimestamp : 12;
-	unsigned type : 3;
 
-	unsigned prio : 3;
-	unsigned tid : 18;
-	unsigned pid : 18;
-} __attribute__((packed)) perf_levent_begin_t;
+#define LOCKSTAT_BUCKETS 16
+#define LOCKSTAT_SITES 4
 
 
+/* Histogram bucket i counts times of 4^i up to 4^(i + 1) - 1 cycles */
 typedef struct {
-	unsigned sbz;
+	unsigned long long acquired;
+	unsigned long long contended;
+	unsigned long long waitMax;
+	unsigned long long holdMax;
+	unsigned int wait[LOCKSTAT_BUCKETS];
+	unsigned int hold[LOCKSTAT_BUCKETS];
+
+	/* Most frequent contending callers, counts are upper bounds */
+	struct {
+		unsigned long long pc;
+		unsigned int count;
+	} sites[LOCKSTAT_SITES];
+} lockstat_t;
 
-	unsigned deltaTimestamp : 12;
-	unsigned type : 3;
 
-	unsigned tid : 18;
-} __attribute__((packed)) perf_levent_end_t;
+enum { lockinfo_spinlock, lockinfo_lock };
 
 
 typedef struct {
-	unsigned sbz;
+	char name[32];
+	int type;
+	lockstat_t stat;
+} lockinfo_t;
 
-	unsigned deltaTimestamp : 12;
-	unsigned type : 3;
 
-	unsigned tid: 18;
-	unsigned ppid : 18;
-	unsigned pid : 18;
-} __attribute__((packed)) perf_levent_fork_t;
+#define PROFILE_DEPTH 8
 
 
+/* Folded stacks are made by joining pcs from the last one to pcs[0] */
 typedef struct {
-	unsigned sbz;
+	unsigned long long timestamp;
+	unsigned int pid;
+	unsigned int tid;
+	unsigned short cpu;
+	unsigned char user;           /* pcs[0] is a user space address */
+	unsigned char depth;          /* Number of valid pcs, pcs[0] is the interrupted instruction */
+	unsigned long long pcs[PROFILE_DEPTH];
+} profile_sample_t;
 
-	unsigned deltaTimestamp : 12;
-	unsigned type : 3;
 
-	unsigned tid: 18;
-	unsigned pid : 18;
-} __attribute__((packed)) perf_levent_kill_t;
+#define SYSCALLSTAT_BUCKETS 24
 
 
+/* Histogram bucket i counts latencies of 2^i up to 2^(i + 1) - 1 cycles */
 typedef struct {
-	unsigned sbz;
+	unsigned long long count;
+	unsigned int max;
+	unsigned int hist[SYSCALLSTAT_BUCKETS];
+} syscallstat_t;
 
-	unsigned deltaTimestamp : 12;
-	unsigned type : 3;
 
-	unsigned tid: 18;
-	char path[32];
-} __attribute__((packed)) perf_levent_exec_t;
+#define IRQSTAT_BUCKETS 16
+
+
+/* Latency is from interrupt to its handler thread, bucket i counts 2^i up to 2^(i + 1) - 1 us */
+typedef struct {
+	unsigned int irq;
+	unsigned int count;           /* Interrupts taken, by all handlers of the line */
+	unsigned int threads;         /* Threaded handlers installed */
+	unsigned long long runs;      /* Handler thread runs, interrupts arriving meanwhile are coalesced */
+	unsigned int latencyMax;
+	unsigned int latency[IRQSTAT_BUCKETS];
+} irqinfo_t;
 
 #endif
@@ -47,6 +47,50 @@ static inline int _cbuffer_discard(cbuffer_t *buf, size_t sz)
 }
 
 
+/* Contiguous free space at write position, for filling the buffer in place */
+static inline size_t _cbuffer_wspace(cbuffer_t *buf, void **data)
+{
+	*data = buf->data + buf->w;
+
+	if (buf->full)
+		return 0;
+
+	return (buf->r > buf->w) ? buf->r - buf->w : buf->sz - buf->w;
+}
+
+
+static inline void _cbuffer_wadvance(cbuffer_t *buf, size_t sz)
+{
+	if (!sz)
+		return;
+
+	buf->w = (buf->w + sz) & (buf->sz - 1);
+	buf->full = buf->w == buf->r;
+}
+
+
+/* Contiguous data at read position, for draining the buffer in place */
+static inline size_t _cbuffer_rspace(cbuffer_t *buf, void **data)
+{
+	*data = buf->data + buf->r;
+
+	if (buf->r == buf->w && !buf->full)
+		return 0;
+
+	return (buf->w > buf->r) ? buf->w - buf->r : buf->sz - buf->r;
+}
+
+
+static inline void _cbuffer_radvance(cbuffer_t *buf, size_t sz)
+{
+	if (!sz)
+		return;
+
+	buf->r = (buf->r + sz) & (buf->sz - 1);
+	buf->full = 0;
+}
+
+
 extern int _cbuffer_init(cbuffer_t *buf, void *data, size_t sz);
 
 
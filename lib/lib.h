@@ -26,12 +26,28 @@
 #include "list.h"
 
 
+#define lib_containerof(type, field, ptr) ((type *)((char *)(ptr) - (long)&((type *)0)->field))
+
+
 #define lib_atomicIncrement(ptr) __atomic_add_fetch(ptr, 1, __ATOMIC_RELAXED)
 
 
 #define lib_atomicDecrement(ptr) __atomic_add_fetch(ptr, -1, __ATOMIC_ACQ_REL)
 
 
+#define lib_atomicLoad(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+
+
+#define lib_atomicStore(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+
+#define lib_atomicCompareExchange(ptr, expected, desired) \
+	__atomic_compare_exchange_n(ptr, expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+
+#define lib_atomicExchange(ptr, val) __atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL)
+
+
 #define max(a, b) ({ \
 	__typeof__ (a) _a = (a); \
 	__typeof__ (b) _b = (b); \
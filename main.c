@@ -104,6 +104,10 @@ void main_initthr(void *unused)
 				}
 			}
 		}
+		else if (!hal_strcmp(cmdline, "bench")) {
+			/* Runs in the background, results are printed as each benchmark ends */
+			test_proc_benchmarks();
+		}
 
 		cmdline = end;
 	}
@@ -143,6 +147,7 @@ int main(void)
 	lib_printf("hal: %s\n", hal_cpuFeatures(s, sizeof(s)));
 	lib_printf("hal: %s\n", hal_interruptsFeatures(s, sizeof(s)));
 
+	_lockstat_init();
 	_vm_init(&main_common.kmap, &main_common.kernel);
 	_proc_init(&main_common.kmap, &main_common.kernel);
 	_syscalls_init();
@@ -19,6 +19,34 @@
 
 #include "posix.h"
 #include "posix_private.h"
+#include "sockdefs.h"
+
+
+/* Corked writes and read-ahead kept per stream socket */
+#define INET_SNDBUF SIZE_PAGE
+#define INET_RCVBUF SIZE_PAGE
+
+
+typedef struct {
+	rbnode_t linkage;
+	unsigned port;
+	int refs;
+
+	lock_t lock;    /* Guards send buffer */
+	char *sbuf;
+	size_t slen;
+
+	lock_t rlock;   /* Guards receive buffer */
+	char *rbuf;
+	size_t rpos;
+	size_t rlen;
+} inetsock_t;
+
+
+static struct {
+	spinlock_t spinlock;
+	rbtree_t socks;
+} inet_common;
 
 
 static int socksrvcall(msg_t *msg)
@@ -83,6 +111,263 @@ static ssize_t sockdestcall(unsigned socket, msg_t *msg, const struct sockaddr *
 }
 
 
+static int inetsock_cmp(rbnode_t *n1, rbnode_t *n2)
+{
+	inetsock_t *s1 = lib_treeof(inetsock_t, linkage, n1);
+	inetsock_t *s2 = lib_treeof(inetsock_t, linkage, n2);
+
+	if (s1->port != s2->port)
+		return (s1->port < s2->port) ? -1 : 1;
+
+	return 0;
+}
+
+
+static void inetsock_add(unsigned port)
+{
+	inetsock_t *s;
+	spinlock_ctx_t sc;
+
+	/* Buffering is an optimization only, the socket works without it */
+	if ((s = vm_kmalloc(sizeof(inetsock_t))) == NULL)
+		return;
+
+	hal_memset(s, 0, sizeof(inetsock_t));
+	s->port = port;
+	s->refs = 1;
+	proc_lockInit(&s->lock, "inetsock.lock");
+	proc_lockInit(&s->rlock, "inetsock.rlock");
+
+	hal_spinlockSet(&inet_common.spinlock, &sc);
+	if (lib_rbInsert(&inet_common.socks, &s->linkage) < 0) {
+		hal_spinlockClear(&inet_common.spinlock, &sc);
+		proc_lockDone(&s->lock);
+		proc_lockDone(&s->rlock);
+		vm_kfree(s);
+		return;
+	}
+	hal_spinlockClear(&inet_common.spinlock, &sc);
+}
+
+
+static inetsock_t *inetsock_get(unsigned port)
+{
+	inetsock_t t, *s;
+	spinlock_ctx_t sc;
+
+	t.port = port;
+
+	hal_spinlockSet(&inet_common.spinlock, &sc);
+	if ((s = lib_treeof(inetsock_t, linkage, lib_rbFind(&inet_common.socks, &t.linkage))) != NULL)
+		s->refs++;
+	hal_spinlockClear(&inet_common.spinlock, &sc);
+
+	return s;
+}
+
+
+static void inetsock_put(inetsock_t *s)
+{
+	int remaining;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&inet_common.spinlock, &sc);
+	remaining = --s->refs;
+	hal_spinlockClear(&inet_common.spinlock, &sc);
+
+	if (remaining)
+		return;
+
+	proc_lockDone(&s->lock);
+	proc_lockDone(&s->rlock);
+
+	if (s->sbuf != NULL)
+		vm_kfree(s->sbuf);
+
+	if (s->rbuf != NULL)
+		vm_kfree(s->rbuf);
+
+	vm_kfree(s);
+}
+
+
+static ssize_t _inet_send(unsigned socket, const void *message, size_t length, int flags)
+{
+	msg_t msg;
+	sockport_msg_t *smi = (void *)msg.i.raw;
+
+	hal_memset(&msg, 0, sizeof(msg));
+	msg.type = sockmSend;
+	smi->send.flags = flags & ~MSG_MORE;
+	msg.i.data = (void *)message;
+	msg.i.size = length;
+
+	return sockcall(socket, &msg);
+}
+
+
+/* Drops n bytes from the front of the send buffer */
+static void _inet_consume(inetsock_t *s, size_t n)
+{
+	size_t i;
+
+	for (i = n; i < s->slen; ++i)
+		s->sbuf[i - n] = s->sbuf[i];
+
+	s->slen -= n;
+}
+
+
+/* Sends corked data, called with s->lock held */
+static int _inet_flush(inetsock_t *s, int flags)
+{
+	ssize_t n;
+
+	while (s->slen) {
+		if ((n = _inet_send(s->port, s->sbuf, s->slen, flags)) <= 0)
+			return n ? n : -EWOULDBLOCK;
+
+		_inet_consume(s, n);
+	}
+
+	return EOK;
+}
+
+
+static ssize_t inet_bufferedSend(inetsock_t *s, const void *message, size_t length, int flags)
+{
+	size_t corked;
+	ssize_t n;
+
+	proc_lockSet(&s->lock);
+
+	do {
+		if (s->sbuf == NULL && (flags & MSG_MORE) && (s->sbuf = vm_kmalloc(INET_SNDBUF)) == NULL)
+			flags &= ~MSG_MORE;
+
+		if (s->slen + length > INET_SNDBUF) {
+			if ((n = _inet_flush(s, flags)) < 0)
+				break;
+		}
+
+		/* Corked data is held until a send without MSG_MORE */
+		if ((flags & MSG_MORE) && s->slen + length <= INET_SNDBUF) {
+			hal_memcpy(s->sbuf + s->slen, message, length);
+			s->slen += length;
+			n = length;
+			break;
+		}
+
+		if (!s->slen) {
+			n = _inet_send(s->port, message, length, flags);
+			break;
+		}
+
+		/* Go out with what was corked in one message */
+		corked = s->slen;
+		hal_memcpy(s->sbuf + s->slen, message, length);
+		s->slen += length;
+
+		if ((n = _inet_send(s->port, s->sbuf, s->slen, flags)) < 0) {
+			s->slen = corked;
+			break;
+		}
+
+		if (n >= corked) {
+			s->slen = 0;
+			n -= corked;
+
+			if (n || !length)
+				break;
+		}
+		else {
+			s->slen = corked;
+			_inet_consume(s, n);
+		}
+
+		/* None of the caller's data went out */
+		if (flags & MSG_DONTWAIT) {
+			n = -EWOULDBLOCK;
+			break;
+		}
+
+		/* Blocking callers wait for the corked rest to go, then send their own */
+		if ((n = _inet_flush(s, flags)) < 0)
+			break;
+
+		n = _inet_send(s->port, message, length, flags);
+	} while (0);
+
+	proc_lockClear(&s->lock);
+
+	return n;
+}
+
+
+static ssize_t _inet_recv(unsigned socket, void *message, size_t length, int flags)
+{
+	msg_t msg;
+	sockport_msg_t *smi = (void *)msg.i.raw;
+
+	hal_memset(&msg, 0, sizeof(msg));
+	msg.type = sockmRecv;
+	smi->send.flags = flags;
+	msg.o.data = message;
+	msg.o.size = length;
+
+	return sockcall(socket, &msg);
+}
+
+
+/* Small reads take what has arrived in one message and are served from it until it is drained */
+static ssize_t inet_bufferedRecv(inetsock_t *s, void *message, size_t length, int flags)
+{
+	ssize_t n;
+
+	/* Request and response protocols expect the request out before waiting */
+	proc_lockSet(&s->lock);
+	n = _inet_flush(s, 0);
+	proc_lockClear(&s->lock);
+
+	if (n < 0 && n != -EWOULDBLOCK)
+		return n;
+
+	proc_lockSet(&s->rlock);
+
+	do {
+		if (!s->rlen) {
+			if ((flags & (MSG_PEEK | MSG_OOB | MSG_WAITALL)) || length >= INET_RCVBUF) {
+				n = _inet_recv(s->port, message, length, flags);
+				break;
+			}
+
+			if (s->rbuf == NULL && (s->rbuf = vm_kmalloc(INET_RCVBUF)) == NULL) {
+				n = _inet_recv(s->port, message, length, flags);
+				break;
+			}
+
+			if ((n = _inet_recv(s->port, s->rbuf, INET_RCVBUF, flags)) <= 0)
+				break;
+
+			s->rpos = 0;
+			s->rlen = n;
+		}
+
+		n = min(length, s->rlen);
+		hal_memcpy(message, s->rbuf + s->rpos, n);
+
+		if (!(flags & MSG_PEEK)) {
+			s->rpos += n;
+			s->rlen -= n;
+		}
+	} while (0);
+
+	proc_lockClear(&s->rlock);
+
+	return n;
+}
+
+
 int inet_accept(unsigned socket, struct sockaddr *address, socklen_t *address_len)
 {
 	ssize_t err;
@@ -98,6 +383,8 @@ int inet_accept(unsigned socket, struct sockaddr *address, socklen_t *address_le
 	if ((err = socknamecall(socket, &msg, address, address_len)) < 0)
 		return err;
 
+	inetsock_add(err);
+
 	return err;
 }
 
@@ -186,6 +473,22 @@ ssize_t inet_recvfrom(unsigned socket, void *message, size_t length, int flags,
 {
 	msg_t msg;
 	sockport_msg_t *smi = (void *)msg.i.raw;
+	inetsock_t *s;
+	ssize_t err;
+
+	if ((s = inetsock_get(socket)) != NULL) {
+		/* Read-ahead goes first, it has no source address to report */
+		if (src_addr == NULL || lib_atomicLoad(&s->rlen)) {
+			if (src_len != NULL)
+				*src_len = 0;
+
+			err = inet_bufferedRecv(s, message, length, flags);
+			inetsock_put(s);
+			return err;
+		}
+
+		inetsock_put(s);
+	}
 
 	hal_memset(&msg, 0, sizeof(msg));
 	msg.type = sockmRecv;
@@ -201,14 +504,32 @@ ssize_t inet_sendto(unsigned socket, const void *message, size_t length, int fla
 {
 	msg_t msg;
 	sockport_msg_t *smi = (void *)msg.i.raw;
+	inetsock_t *s;
+	ssize_t err;
+
+	if ((s = inetsock_get(socket)) != NULL && dest_addr == NULL) {
+		err = inet_bufferedSend(s, message, length, flags);
+		inetsock_put(s);
+		return err;
+	}
 
 	hal_memset(&msg, 0, sizeof(msg));
 	msg.type = sockmSend;
-	smi->send.flags = flags;
+	smi->send.flags = flags & ~MSG_MORE;
 	msg.i.data = (void *)message;
 	msg.i.size = length;
 
-	return sockdestcall(socket, &msg, dest_addr, dest_len);
+	if (s == NULL)
+		return sockdestcall(socket, &msg, dest_addr, dest_len);
+
+	/* Corked data goes out first, the lock keeps anything from overtaking it */
+	proc_lockSet(&s->lock);
+	if ((err = _inet_flush(s, flags)) == EOK)
+		err = sockdestcall(socket, &msg, dest_addr, dest_len);
+	proc_lockClear(&s->lock);
+
+	inetsock_put(s);
+	return err;
 }
 
 
@@ -227,7 +548,13 @@ int inet_socket(int domain, int type, int protocol)
 	if ((err = socksrvcall(&msg)) < 0)
 		return err;
 
-	return msg.o.lookup.err < 0 ? msg.o.lookup.err : msg.o.lookup.dev.port;
+	if (msg.o.lookup.err < 0)
+		return msg.o.lookup.err;
+
+	if ((type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == SOCK_STREAM)
+		inetsock_add(msg.o.lookup.dev.port);
+
+	return msg.o.lookup.dev.port;
 }
 
 
@@ -236,6 +563,8 @@ int inet_shutdown(unsigned socket, int how)
 	msg_t msg;
 	sockport_msg_t *smi = (void *)msg.i.raw;
 
+	inet_flush(socket, 0);
+
 	hal_memset(&msg, 0, sizeof(msg));
 	msg.type = sockmShutdown;
 	smi->send.flags = how;
@@ -258,3 +587,74 @@ int inet_setsockopt(unsigned socket, int level, int optname, const void *optval,
 
 	return sockcall(socket, &msg);
 }
+
+
+int inet_flush(unsigned socket, int flags)
+{
+	inetsock_t *s;
+	int err;
+
+	if ((s = inetsock_get(socket)) == NULL)
+		return EOK;
+
+	proc_lockSet(&s->lock);
+	err = _inet_flush(s, flags);
+	proc_lockClear(&s->lock);
+
+	inetsock_put(s);
+	return err;
+}
+
+
+int inet_poll(unsigned socket)
+{
+	inetsock_t *s;
+	int revents = 0;
+
+	if ((s = inetsock_get(socket)) == NULL)
+		return 0;
+
+	/* Lockless peek, a stale answer is fine for readiness */
+	if (s->rlen)
+		revents |= POLLIN | POLLRDNORM;
+
+	/* Push corked data out if that doesn't wait, a sender holding the lock flushes it anyway */
+	if (s->slen && proc_lockTry(&s->lock) == EOK) {
+		_inet_flush(s, MSG_DONTWAIT);
+		proc_lockClear(&s->lock);
+	}
+
+	inetsock_put(s);
+
+	return revents;
+}
+
+
+int inet_close(unsigned socket)
+{
+	inetsock_t *s;
+	spinlock_ctx_t sc;
+	int err;
+
+	if ((s = inetsock_get(socket)) == NULL)
+		return EOK;
+
+	proc_lockSet(&s->lock);
+	err = _inet_flush(s, 0);
+	proc_lockClear(&s->lock);
+
+	hal_spinlockSet(&inet_common.spinlock, &sc);
+	lib_rbRemove(&inet_common.socks, &s->linkage);
+	s->refs--;
+	hal_spinlockClear(&inet_common.spinlock, &sc);
+
+	inetsock_put(s);
+	return err;
+}
+
+
+void inet_sockets_init(void)
+{
+	hal_spinlockCreate(&inet_common.spinlock, "inet sockets");
+	lib_rbInit(&inet_common.socks, inetsock_cmp, NULL);
+}
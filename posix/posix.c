@@ -24,8 +24,10 @@
 
 #ifdef CPU_STM32
 #define MAX_FD_COUNT 8
+#define FD_TABLE_MIN 8
 #else
-#define MAX_FD_COUNT 512
+#define MAX_FD_COUNT 1024
+#define FD_TABLE_MIN 32
 #endif
 
 //#define TRACE(str, ...) lib_printf("posix %x: " str "\n", proc_current()->process->id, ##__VA_ARGS__)
@@ -33,9 +35,8 @@
 
 #define POLL_INTERVAL 100000
 
-
-enum { atMode = 0, atUid, atGid, atSize, atType, atPort, atPollStatus, atEventMask, atCTime, atMTime, atATime, atLinks, atDev };
-
+/* Largest vector gathered into a single message */
+#define IOV_BOUNCE (4 * SIZE_PAGE)
 
 /* TODO: copied from libphoenix/posixsrv/posixsrv.h */
 enum { evAdd = 0x1, evDelete = 0x2, evEnable = 0x4, evDisable = 0x8, evOneshot = 0x10, evClear = 0x20, evDispatch = 0x40 };
@@ -58,13 +59,98 @@ typedef struct _event_t {
 
 
 
+typedef struct {
+	rbnode_t linkage;
+	oid_t oid;
+	int refs;
+	pollhead_t head;
+} pollobj_t;
+
+
+typedef struct {
+	pollwait_t wait;
+	pollobj_t *obj;
+	open_file_t *file;
+	oid_t oid;
+	char type;
+	char legacy;
+} polldesc_t;
+
+
+/* Persistent interest in one descriptor, keyed by the process, descriptor and file behind it */
+typedef struct _evnote_t {
+	rbnode_t linkage;
+	struct _evnote_t *next, *prev;
+	struct _evnote_t *lnext, *lprev;
+	struct _evnote_t *fnext, *fprev;   /* On file notes list, protected by posix_common.pollSpinlock */
+	struct _evqueue_t *queue;
+
+	process_info_t *owner;
+	open_file_t *file;
+	polldesc_t desc;
+	void *data;
+	int fd;
+	unsigned flags;
+	char queued;
+} evnote_t;
+
+
+typedef struct _evqueue_t {
+	rbtree_t notes;
+	lock_t lock;
+
+	/* Notes not posting readiness, polled periodically (protected by lock) */
+	evnote_t *legacy;
+
+	/* Protected by posix_common.pollSpinlock */
+	evnote_t *ready;
+	thread_t *waitq;
+	pollhead_t poll;
+} evqueue_t;
+
+
+/* Interval timer, expirations are counted for readers and optionally signalled */
+typedef struct _ptimer_t {
+	ktimer_t timer;
+	pid_t pid;          /* Signal target, looked up when it fires */
+	int tid;
+	int sig;
+
+	/* Protected by posix_common.pollSpinlock */
+	struct _ptimer_t *next, *prev;
+	time_t expires;
+	time_t interval;
+	u64 count;
+	thread_t *waitq;
+	pollhead_t poll;
+} ptimer_t;
+
+
 struct {
 	rbtree_t pid;
 	lock_t lock;
 	id_t fresh;
+
+	/* Synchronizes all poll heads, waiters and the pollobjs tree */
+	spinlock_t pollSpinlock;
+	rbtree_t pollobjs;
+
+	/* Released open files, never returned to kmalloc */
+	spinlock_t fileSpinlock;
+	open_file_t *files;
+
+	/* Keeps queues alive while closing descriptors they watch, taken before any queue lock */
+	lock_t evlock;
+
+	/* Timers to be signalled, protected by pollSpinlock */
+	ptimer_t *fired;
+	thread_t *timerq;
 } posix_common;
 
 
+static void evqueue_fdClosed(process_info_t *p, int fd, open_file_t *f);
+
+
 process_info_t *_pinfo_find(unsigned int pid)
 {
 	process_info_t pi, *r;
@@ -87,14 +173,27 @@ process_info_t *pinfo_find(unsigned int pid)
 }
 
 
+/* Process info of the calling process, valid as long as the process lives */
+static process_info_t *pinfo_current(void)
+{
+	return proc_current()->process->posix;
+}
+
+
 void posix_destroy(process_info_t *p)
 {
+	fdtable_t *t;
+
 	// lib_printf("removing %d\n", p->process);
 	proc_lockSet(&posix_common.lock);
 	lib_rbRemove(&posix_common.pid, &p->linkage);
 	proc_lockClear(&posix_common.lock);
 
-	vm_kfree(p->fds);
+	while ((t = p->fdt) != NULL) {
+		p->fdt = t->retired;
+		vm_kfree(t);
+	}
+
 	proc_lockDone(&p->lock);
 	vm_kfree(p);
 }
@@ -113,6 +212,149 @@ void pinfo_put(process_info_t *p)
 }
 
 
+/*
+ * Readiness notification
+ */
+
+
+void poll_headInit(pollhead_t *head)
+{
+	head->waiters = NULL;
+}
+
+
+void poll_subscribe(pollhead_t *head, pollwait_t *wait)
+{
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	wait->head = head;
+	wait->revents = 0;
+	LIST_ADD(&head->waiters, wait);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+}
+
+
+void poll_unsubscribe(pollwait_t *wait)
+{
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if (wait->head != NULL) {
+		LIST_REMOVE(&wait->head->waiters, wait);
+		wait->head = NULL;
+	}
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+}
+
+
+static void poll_wakeSync(pollwait_t *wait)
+{
+	wait->sync->woken = 1;
+	proc_threadWakeup(&wait->sync->queue);
+}
+
+
+static void _poll_notify(pollhead_t *head, unsigned events)
+{
+	pollwait_t *w;
+
+	if ((w = head->waiters) == NULL)
+		return;
+
+	do {
+		w->revents = events;
+
+		if (events & (w->events | POLLERR | POLLHUP | POLLNVAL))
+			w->notify(w);
+	} while ((w = w->next) != head->waiters);
+}
+
+
+void poll_notify(pollhead_t *head, unsigned events)
+{
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	_poll_notify(head, events);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+}
+
+
+static int pollobj_cmp(rbnode_t *n1, rbnode_t *n2)
+{
+	pollobj_t *o1 = lib_treeof(pollobj_t, linkage, n1);
+	pollobj_t *o2 = lib_treeof(pollobj_t, linkage, n2);
+
+	if (o1->oid.port != o2->oid.port)
+		return (o1->oid.port < o2->oid.port) ? -1 : 1;
+
+	if (o1->oid.id != o2->oid.id)
+		return (o1->oid.id < o2->oid.id) ? -1 : 1;
+
+	return 0;
+}
+
+
+static pollobj_t *_poll_objFind(oid_t *oid)
+{
+	pollobj_t t, *o;
+
+	hal_memcpy(&t.oid, oid, sizeof(oid_t));
+
+	if ((o = lib_treeof(pollobj_t, linkage, lib_rbFind(&posix_common.pollobjs, &t.linkage))) != NULL)
+		o->refs++;
+
+	return o;
+}
+
+
+static pollobj_t *poll_objGet(oid_t *oid)
+{
+	pollobj_t *o, *n;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	o = _poll_objFind(oid);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	if (o != NULL)
+		return o;
+
+	if ((n = vm_kmalloc(sizeof(pollobj_t))) == NULL)
+		return NULL;
+
+	hal_memcpy(&n->oid, oid, sizeof(oid_t));
+	n->refs = 1;
+	poll_headInit(&n->head);
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if ((o = _poll_objFind(oid)) == NULL)
+		lib_rbInsert(&posix_common.pollobjs, &(o = n)->linkage);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	if (o != n)
+		vm_kfree(n);
+
+	return o;
+}
+
+
+static void poll_objPut(pollobj_t *o)
+{
+	int remaining;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if (!(remaining = --o->refs))
+		lib_rbRemove(&posix_common.pollobjs, &o->linkage);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	if (!remaining)
+		vm_kfree(o);
+}
+
+
 static char *strrchr(const char *s, int c)
 {
 	const char *p = NULL;
@@ -149,34 +391,141 @@ void splitname(char *path, char **base, char **dir)
 }
 
 
+static void evqueue_destroy(evqueue_t *q);
+
+
+static void ptimer_destroy(ptimer_t *t);
+
+
+static int ptimer_read(ptimer_t *t, void *buf, size_t nbyte, int nonblock);
+
+
+static int posix_kernelPipe(open_file_t *f);
+
+
+/*
+ * Open files
+ *
+ * Descriptor lookup takes no locks. Memory of open files is reused only for open
+ * files, so a reader holding a stale pointer can safely try to take a reference:
+ * it fails on a released file and notices a reused one, as it is no longer in the
+ * descriptor slot.
+ */
+
+
+static open_file_t *file_alloc(void)
+{
+	open_file_t *f;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.fileSpinlock, &sc);
+	if ((f = posix_common.files) != NULL)
+		posix_common.files = f->next;
+	hal_spinlockClear(&posix_common.fileSpinlock, &sc);
+
+	if (f == NULL && (f = vm_kmalloc(sizeof(open_file_t))) == NULL)
+		return NULL;
+
+	/* Stale readers never modify refs while it is zero */
+	hal_memset(f, 0, sizeof(open_file_t));
+	proc_lockInit(&f->lock, "file.lock");
+	lib_atomicStore(&f->refs, 1);
+
+	return f;
+}
+
+
+static void file_free(open_file_t *f)
+{
+	spinlock_ctx_t sc;
+
+	proc_lockDone(&f->lock);
+
+	hal_spinlockSet(&posix_common.fileSpinlock, &sc);
+	f->next = posix_common.files;
+	posix_common.files = f;
+	hal_spinlockClear(&posix_common.fileSpinlock, &sc);
+}
+
+
 static int posix_fileDeref(open_file_t *f)
 {
-	int err = EOK;
+	int err = EOK, flushed = EOK;
 
-	proc_lockSet(&f->lock);
-	if (!--f->refs) {
-		if (f->type != ftUnixSocket) {
-			while ((err = proc_close(f->oid, f->status)) == -EINTR) ;
-		}
+	if (lib_atomicDecrement(&f->refs))
+		return EOK;
 
-		proc_lockDone(&f->lock);
-		vm_kfree(f);
+	if (f->type == ftEventQueue) {
+		evqueue_destroy(f->evqueue);
 	}
-	else {
-		proc_lockClear(&f->lock);
+	else if (f->type == ftTimer) {
+		ptimer_destroy(f->ptimer);
+	}
+	else if (posix_kernelPipe(f)) {
+		unix_pipeClose(f->oid.id);
+	}
+	else if (f->type != ftUnixSocket && f->type != ftNone) {
+		if (f->type == ftInetSocket)
+			flushed = inet_close(f->oid.port);
+
+		while ((err = proc_close(f->oid, f->status)) == -EINTR) ;
+
+		/* Corked data which couldn't be sent is lost, close reports it */
+		if (err == EOK)
+			err = flushed;
 	}
+
+	file_free(f);
 	return err;
 }
 
 
-static void posix_putUnusedFile(process_info_t *p, int fd)
+/*
+ * Drops a file that never got installed. A stale reader may hold a reference
+ * for a moment, then its posix_fileDeref frees the file instead.
+ */
+static void file_discard(open_file_t *f)
+{
+	f->type = ftNone;
+	posix_fileDeref(f);
+}
+
+
+/* Takes a reference unless file has already been released */
+static int file_tryRef(open_file_t *f)
+{
+	unsigned refs = lib_atomicLoad(&f->refs);
+
+	while (refs != 0) {
+		if (lib_atomicCompareExchange(&f->refs, &refs, refs + 1))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static open_file_t *fd_get(process_info_t *p, int fd)
 {
+	fdtable_t *t;
 	open_file_t *f;
 
-	f = p->fds[fd].file;
-	proc_lockDone(&f->lock);
-	vm_kfree(f);
-	p->fds[fd].file = NULL;
+	for (;;) {
+		t = lib_atomicLoad(&p->fdt);
+
+		if (fd < 0 || fd >= t->size || (f = lib_atomicLoad(&t->fds[fd].file)) == NULL)
+			return NULL;
+
+		if (!file_tryRef(f))
+			continue;
+
+		t = lib_atomicLoad(&p->fdt);
+		if (lib_atomicLoad(&t->fds[fd].file) == f)
+			return f;
+
+		/* Descriptor closed or reused meanwhile */
+		posix_fileDeref(f);
+	}
 }
 
 
@@ -184,55 +533,178 @@ static int posix_getOpenFile(int fd, open_file_t **f)
 {
 	process_info_t *p;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -ENOSYS;
 
-	proc_lockSet(&p->lock);
-	if (fd < 0 || fd > p->maxfd || (*f = p->fds[fd].file) == NULL) {
-		proc_lockClear(&p->lock);
-		pinfo_put(p);
+	if ((*f = fd_get(p, fd)) == NULL)
 		return -EBADF;
+
+	return 0;
+}
+
+
+/*
+ * Descriptor table, modified with p->lock held
+ */
+
+
+static fdtable_t *fd_tableAlloc(int size)
+{
+	fdtable_t *t;
+	int words = (size + 31) / 32;
+
+	if ((t = vm_kmalloc(sizeof(fdtable_t) + size * sizeof(fildes_t) + words * sizeof(u32))) == NULL)
+		return NULL;
+
+	t->retired = NULL;
+	t->size = size;
+	t->used = (u32 *)(t->fds + size);
+
+	hal_memset(t->fds, 0, size * sizeof(fildes_t));
+	hal_memset(t->used, 0, words * sizeof(u32));
+
+	/* Bits past the end are never free */
+	if (size & 31)
+		t->used[words - 1] = ~((1u << (size & 31)) - 1);
+
+	return t;
+}
+
+
+static int _fd_grow(process_info_t *p)
+{
+	fdtable_t *t = p->fdt, *n;
+	int words = (t->size + 31) / 32;
+
+	if (t->size >= MAX_FD_COUNT)
+		return -EMFILE;
+
+	if ((n = fd_tableAlloc(min(2 * t->size, MAX_FD_COUNT))) == NULL)
+		return -ENOMEM;
+
+	hal_memcpy(n->fds, t->fds, t->size * sizeof(fildes_t));
+	hal_memcpy(n->used, t->used, words * sizeof(u32));
+
+	/* Padding of the old bitmap now covers real descriptors */
+	if (t->size & 31) {
+		n->used[words - 1] &= (1u << (t->size & 31)) - 1;
+
+		if (n->size & 31)
+			n->used[(n->size - 1) / 32] |= ~((1u << (n->size & 31)) - 1);
 	}
 
-	proc_lockSet(&(*f)->lock);
-	(*f)->refs++;
-	proc_lockClear(&(*f)->lock);
-	proc_lockClear(&p->lock);
+	n->retired = t;
+	lib_atomicStore(&p->fdt, n);
 
-	pinfo_put(p);
-	return 0;
+	return EOK;
 }
 
 
-int posix_newFile(process_info_t *p, int fd)
+/* Reserves lowest free descriptor not lower than fd */
+static int _fd_alloc(process_info_t *p, int fd)
 {
-	open_file_t *f;
+	fdtable_t *t;
+	u32 w;
+	int i, err;
 
-	proc_lockSet(&p->lock);
+	if (fd < 0)
+		return -EINVAL;
 
-	while (p->fds[fd].file != NULL && fd++ < p->maxfd);
+	for (;;) {
+		t = p->fdt;
 
-	if (fd > p->maxfd) {
-		proc_lockClear(&p->lock);
-		return -ENFILE;
+		for (i = fd / 32; i < (t->size + 31) / 32; ++i) {
+			w = t->used[i];
+
+			if (i == fd / 32)
+				w |= (1u << (fd & 31)) - 1;
+
+			if (w != ~0u) {
+				fd = i * 32 + hal_cpuGetFirstBit(~w);
+				t->used[i] |= 1u << (fd & 31);
+				return fd;
+			}
+		}
+
+		if ((err = _fd_grow(p)) < 0)
+			return err;
 	}
+}
 
-	if ((f = p->fds[fd].file = vm_kmalloc(sizeof(open_file_t))) == NULL) {
-		proc_lockClear(&p->lock);
-		return -ENOMEM;
+
+/* Reserves given descriptor, file already installed there is left in place */
+static int _fd_reserve(process_info_t *p, int fd)
+{
+	int err;
+
+	if (fd < 0 || fd >= MAX_FD_COUNT)
+		return -EBADF;
+
+	while (fd >= p->fdt->size) {
+		if ((err = _fd_grow(p)) < 0)
+			return err;
 	}
 
-	proc_lockClear(&p->lock);
+	p->fdt->used[fd / 32] |= 1u << (fd & 31);
+	return fd;
+}
 
-	hal_memset(f, 0, sizeof(open_file_t));
-	proc_lockInit(&f->lock);
-	f->refs = 1;
-	f->offset = 0;
+
+static open_file_t *_fd_file(process_info_t *p, int fd)
+{
+	if (fd < 0 || fd >= p->fdt->size)
+		return NULL;
+
+	return p->fdt->fds[fd].file;
+}
+
+
+static void _fd_install(process_info_t *p, int fd, open_file_t *f, unsigned flags)
+{
+	p->fdt->fds[fd].flags = flags;
+	lib_atomicStore(&p->fdt->fds[fd].file, f);
+}
+
+
+/* Frees descriptor, returns file that was installed there */
+static open_file_t *_fd_release(process_info_t *p, int fd)
+{
+	open_file_t *f = p->fdt->fds[fd].file;
+
+	lib_atomicStore(&p->fdt->fds[fd].file, NULL);
+	p->fdt->fds[fd].flags = 0;
+	p->fdt->used[fd / 32] &= ~(1u << (fd & 31));
+
+	return f;
+}
+
+
+static int posix_fdAlloc(process_info_t *p, int fd)
+{
+	proc_lockSet(&p->lock);
+	fd = _fd_alloc(p, fd);
+	proc_lockClear(&p->lock);
 
 	return fd;
 }
 
 
+static void posix_fdInstall(process_info_t *p, int fd, open_file_t *f, unsigned flags)
+{
+	proc_lockSet(&p->lock);
+	_fd_install(p, fd, f, flags);
+	proc_lockClear(&p->lock);
+}
+
+
+static void posix_fdCancel(process_info_t *p, int fd)
+{
+	proc_lockSet(&p->lock);
+	_fd_release(p, fd);
+	proc_lockClear(&p->lock);
+}
+
+
 static int pinfo_cmp(rbnode_t *n1, rbnode_t *n2)
 {
 	process_info_t *p1 = lib_treeof(process_info_t, linkage, n1);
@@ -274,6 +746,7 @@ int posix_clone(int ppid)
 	int i;
 	oid_t console;
 	open_file_t *f;
+	fdtable_t *t;
 
 	proc = proc_current()->process;
 
@@ -281,28 +754,29 @@ int posix_clone(int ppid)
 		return -ENOMEM;
 
 	hal_memset(&console, 0, sizeof(oid_t));
-	proc_lockInit(&p->lock);
+	proc_lockInit(&p->lock, "process_info.lock");
 	p->children = NULL;
 	p->zombies = NULL;
 	p->wait = NULL;
 	p->next = p->prev = NULL;
-	p->refs = 1;
+	hal_memset(&p->usage, 0, sizeof(p->usage));
+	hal_memset(&p->cusage, 0, sizeof(p->cusage));
+
+	/* Referenced by the tree and by the process */
+	p->refs = 2;
 
 	if ((pp = pinfo_find(ppid)) != NULL) {
 		TRACE("clone: got parent");
 		proc_lockSet(&pp->lock);
-		p->maxfd = pp->maxfd;
-		LIST_ADD(&pp->children, p);
-		p->parent = ppid;
+		t = fd_tableAlloc(pp->fdt->size);
 	}
 	else {
-		p->parent = 0;
-		p->maxfd = MAX_FD_COUNT - 1;
+		t = fd_tableAlloc(FD_TABLE_MIN);
 	}
 
 	p->process = proc->id;
 
-	if ((p->fds = vm_kmalloc((p->maxfd + 1) * sizeof(fildes_t))) == NULL) {
+	if ((p->fdt = t) == NULL) {
 		vm_kfree(p);
 		if (pp != NULL) {
 			proc_lockClear(&pp->lock);
@@ -312,36 +786,39 @@ int posix_clone(int ppid)
 	}
 
 	if (pp != NULL) {
-		hal_memcpy(p->fds, pp->fds, (pp->maxfd + 1) * sizeof(fildes_t));
+		LIST_ADD(&pp->children, p);
+		p->parent = ppid;
 
-		for (i = 0; i <= p->maxfd; ++i) {
-			if ((f = p->fds[i].file) != NULL) {
-				proc_lockSet(&f->lock);
-				++f->refs;
-				proc_lockClear(&f->lock);
-			}
+		hal_memcpy(t->fds, pp->fdt->fds, t->size * sizeof(fildes_t));
+		hal_memcpy(t->used, pp->fdt->used, ((t->size + 31) / 32) * sizeof(u32));
+
+		for (i = 0; i < t->size; ++i) {
+			/* Signalling timers stay with the process which created them, as with timer_create() */
+			if ((f = t->fds[i].file) != NULL && f->type == ftTimer && f->ptimer->sig)
+				t->fds[i].file = f = NULL;
+
+			if (f != NULL)
+				lib_atomicIncrement(&f->refs);
+			else
+				t->used[i / 32] &= ~(1u << (i & 31));
 		}
 
 		proc_lockClear(&pp->lock);
 	}
 	else {
-		hal_memset(p->fds, 0, (p->maxfd + 1) * sizeof(fildes_t));
+		p->parent = 0;
 
 		for (i = 0; i < 3; ++i) {
-			if ((f = p->fds[i].file = vm_kmalloc(sizeof(open_file_t))) == NULL)
+			if ((f = file_alloc()) == NULL)
 				return -ENOMEM;
 
-			proc_lockInit(&f->lock);
-			f->refs = 1;
-			f->offset = 0;
 			f->type = ftTty;
-			p->fds[i].flags = 0;
 			hal_memcpy(&f->oid, &console, sizeof(oid_t));
-		}
+			f->status = i ? O_WRONLY : O_RDONLY;
 
-		p->fds[0].file->status = O_RDONLY;
-		p->fds[1].file->status = O_WRONLY;
-		p->fds[2].file->status = O_WRONLY;
+			_fd_reserve(p, i);
+			_fd_install(p, i, f, 0);
+		}
 	}
 
 	if (pp != NULL) {
@@ -356,6 +833,8 @@ int posix_clone(int ppid)
 	lib_rbInsert(&posix_common.pid, &p->linkage);
 	proc_lockClear(&posix_common.lock);
 
+	proc->posix = p;
+
 	return EOK;
 }
 
@@ -385,19 +864,23 @@ int posix_exec(void)
 	open_file_t *f;
 	int fd;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
 	proc_lockSet(&p->lock);
-	for (fd = 0; fd <= p->maxfd; ++fd) {
-		if ((f = p->fds[fd].file) != NULL && p->fds[fd].flags & FD_CLOEXEC) {
+	for (fd = 0; fd < p->fdt->size; ++fd) {
+		if (p->fdt->fds[fd].file != NULL && p->fdt->fds[fd].flags & FD_CLOEXEC) {
+			f = _fd_release(p, fd);
+			proc_lockClear(&p->lock);
+
+			evqueue_fdClosed(p, fd, f);
 			posix_fileDeref(f);
-			p->fds[fd].file = NULL;
+
+			proc_lockSet(&p->lock);
 		}
 	}
 	proc_lockClear(&p->lock);
 
-	pinfo_put(p);
 	return 0;
 }
 
@@ -410,9 +893,15 @@ int posix_exit(process_info_t *p, int code)
 	p->exitcode = code;
 
 	proc_lockSet(&p->lock);
-	for (fd = 0; fd <= p->maxfd; ++fd) {
-		if ((f = p->fds[fd].file) != NULL)
+	for (fd = 0; fd < p->fdt->size; ++fd) {
+		if ((f = _fd_release(p, fd)) != NULL) {
+			proc_lockClear(&p->lock);
+
+			evqueue_fdClosed(p, fd, f);
 			posix_fileDeref(f);
+
+			proc_lockSet(&p->lock);
+		}
 	}
 	proc_lockClear(&p->lock);
 
@@ -455,7 +944,7 @@ int posix_open(const char *filename, int oflag, char *ustack)
 {
 	TRACE("open(%s, %d, %d)", filename, oflag);
 	oid_t ln, oid, dev, pipesrv;
-	int fd = 0, err = 0;
+	int fd = 0, err = 0, fifo = 0;
 	process_info_t *p;
 	open_file_t *f;
 	mode_t mode;
@@ -465,23 +954,22 @@ int posix_open(const char *filename, int oflag, char *ustack)
 	if ((proc_lookup("/dev/posix/pipes", NULL, &pipesrv)) < 0)
 		; /* that's fine */
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
 	hal_memset(&dev, 0, sizeof(oid_t));
 
-	proc_lockSet(&p->lock);
-
 	do {
-		while (p->fds[fd].file != NULL && fd++ < p->maxfd);
-
-		if (fd > p->maxfd || (f = p->fds[fd].file = vm_kmalloc(sizeof(open_file_t))) == NULL) {
-			err = -EBADF;
+		if ((fd = posix_fdAlloc(p, 0)) < 0) {
+			err = fd;
 			break;
 		}
 
-		proc_lockInit(&f->lock);
-		proc_lockClear(&p->lock);
+		if ((f = file_alloc()) == NULL) {
+			posix_fdCancel(p, fd);
+			err = -ENOMEM;
+			break;
+		}
 
 		do {
 			if ((err = proc_lookup(filename, &ln, &oid)) == EOK) {
@@ -503,9 +991,14 @@ int posix_open(const char *filename, int oflag, char *ustack)
 			if (oid.port != US_PORT && (err = proc_open(oid, oflag)) < 0)
 				break;
 
-			proc_lockSet(&p->lock);
-			p->fds[fd].flags = oflag & O_CLOEXEC ? FD_CLOEXEC : 0;
-			proc_lockClear(&p->lock);
+			/* FIFO opens one of its ends */
+			if (oid.port == US_PORT && (fifo = unix_isFifo(oid.id))) {
+				if ((err = unix_fifoOpen(oid.id, oflag)) < 0)
+					break;
+
+				oid.id = err;
+				err = EOK;
+			}
 
 			if (!err) {
 				hal_memcpy(&f->oid, &oid, sizeof(oid));
@@ -518,10 +1011,10 @@ int posix_open(const char *filename, int oflag, char *ustack)
 
 			hal_memcpy(&f->ln, &ln, sizeof(ln));
 
-			f->refs = 1;
-
 			/* TODO: check for other types */
-			if (oid.port == US_PORT)
+			if (fifo)
+				f->type = ftFifo;
+			else if (oid.port == US_PORT)
 				f->type = ftUnixSocket;
 			else if (oid.port == pipesrv.port)
 				f->type = ftPipe;
@@ -538,19 +1031,14 @@ int posix_open(const char *filename, int oflag, char *ustack)
 
 			f->status = oflag & ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC | O_CLOEXEC);
 
-			pinfo_put(p);
+			posix_fdInstall(p, fd, f, oflag & O_CLOEXEC ? FD_CLOEXEC : 0);
 			return fd;
 		} while (0);
 
-		proc_lockSet(&p->lock);
-		p->fds[fd].file = NULL;
-		proc_lockDone(&f->lock);
-		vm_kfree(f);
-
+		file_discard(f);
+		posix_fdCancel(p, fd);
 	} while (0);
 
-	proc_lockClear(&p->lock);
-	pinfo_put(p);
 	return err;
 }
 
@@ -562,27 +1050,24 @@ int posix_close(int fildes)
 	process_info_t *p;
 	int err = -EBADF;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
 	proc_lockSet(&p->lock);
 
 	do {
-		if (fildes < 0 || fildes > p->maxfd)
-			break;
-
-		if ((f = p->fds[fildes].file) == NULL)
+		if (_fd_file(p, fildes) == NULL)
 			break;
 
-		p->fds[fildes].file = NULL;
+		f = _fd_release(p, fildes);
 		proc_lockClear(&p->lock);
 
-		pinfo_put(p);
+		evqueue_fdClosed(p, fildes, f);
+
 		return posix_fileDeref(f);
 	} while (0);
 
 	proc_lockClear(&p->lock);
-	pinfo_put(p);
 	return err;
 }
 
@@ -609,12 +1094,21 @@ int posix_read(int fildes, void *buf, size_t nbyte)
 	status = f->status;
 	proc_lockClear(&f->lock);
 
-	if (f->type == ftUnixSocket) {
-		if (status & O_NONBLOCK)
-			flags = MSG_DONTWAIT;
+	if (status & O_NONBLOCK)
+		flags = MSG_DONTWAIT;
 
+	if (f->type == ftUnixSocket) {
 		rcnt = unix_recvfrom(f->oid.id, buf, nbyte, flags, NULL, 0);
 	}
+	else if (f->type == ftInetSocket) {
+		rcnt = inet_recvfrom(f->oid.port, buf, nbyte, flags, NULL, 0);
+	}
+	else if (posix_kernelPipe(f)) {
+		rcnt = unix_pipeRead(f->oid.id, buf, nbyte, (status & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+	}
+	else if (f->type == ftTimer) {
+		rcnt = ptimer_read(f->ptimer, buf, nbyte, status & O_NONBLOCK);
+	}
 	else {
 		rcnt = proc_read(f->oid, offs, buf, nbyte, status);
 	}
@@ -654,12 +1148,22 @@ int posix_write(int fildes, void *buf, size_t nbyte)
 	status = f->status;
 	proc_lockClear(&f->lock);
 
-	if (f->type == ftUnixSocket) {
-		if (status & O_NONBLOCK)
-			flags = MSG_DONTWAIT;
+	if (status & O_NONBLOCK)
+		flags = MSG_DONTWAIT;
 
+	if (f->type == ftUnixSocket) {
 		rcnt = unix_sendto(f->oid.id, buf, nbyte, flags, NULL, 0);
 	}
+	else if (f->type == ftInetSocket) {
+		rcnt = inet_sendto(f->oid.port, buf, nbyte, flags, NULL, 0);
+	}
+	else if (posix_kernelPipe(f)) {
+		if ((rcnt = unix_pipeWrite(f->oid.id, buf, nbyte, (status & O_NONBLOCK) ? MSG_DONTWAIT : 0)) == -EPIPE)
+			threads_sigpost(proc_current()->process, proc_current(), SIGPIPE);
+	}
+	else if (f->type == ftTimer) {
+		rcnt = -EINVAL;
+	}
 	else {
 		rcnt = proc_write(f->oid, offs, buf, nbyte, status);
 	}
@@ -676,73 +1180,296 @@ int posix_write(int fildes, void *buf, size_t nbyte)
 }
 
 
+static ssize_t posix_iovLen(const struct iovec *iov, int iovcnt)
+{
+	ssize_t len = 0;
+	int i;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < iovcnt; ++i) {
+		if ((ssize_t)(len + iov[i].iov_len) < len)
+			return -EINVAL;
+
+		len += iov[i].iov_len;
+	}
+
+	return len;
+}
+
+
+static void posix_iovGather(void *buf, const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; buf += iov[i++].iov_len)
+		hal_memcpy(buf, iov[i].iov_base, iov[i].iov_len);
+}
+
+
+static void posix_iovScatter(const struct iovec *iov, int iovcnt, const void *buf, size_t len)
+{
+	size_t n;
+	int i;
+
+	for (i = 0; i < iovcnt && len; ++i, buf += n, len -= n)
+		hal_memcpy(iov[i].iov_base, buf, n = min(len, iov[i].iov_len));
+}
+
+
+static ssize_t posix_kernelIo(open_file_t *f, void *buf, size_t len, int flags, int write)
+{
+	if (f->type == ftInetSocket)
+		return write ? inet_sendto(f->oid.port, buf, len, flags, NULL, 0) : inet_recvfrom(f->oid.port, buf, len, flags, NULL, 0);
+
+	if (f->type == ftUnixSocket)
+		return write ? unix_sendto(f->oid.id, buf, len, flags, NULL, 0) : unix_recvfrom(f->oid.id, buf, len, flags, NULL, 0);
+
+	return write ? unix_pipeWrite(f->oid.id, buf, len, flags) : unix_pipeRead(f->oid.id, buf, len, flags);
+}
+
+
+/*
+ * Goes buffer by buffer and doesn't block once something was read. Inet sockets
+ * keep their buffers so nothing overtakes corked data, all but the last
+ * buffer are corked and go out to the server together.
+ */
+static ssize_t posix_iovKernel(open_file_t *f, const struct iovec *iov, int iovcnt, int flags, int write, ssize_t *done)
+{
+	ssize_t err = 0;
+	int i, last;
+
+	for (last = iovcnt - 1; last > 0 && !iov[last].iov_len; --last)
+		;
+
+	for (i = 0; i < iovcnt; ++i) {
+		if (!iov[i].iov_len)
+			continue;
+
+		if (write && f->type == ftInetSocket && i < last)
+			flags |= MSG_MORE;
+		else
+			flags &= ~MSG_MORE;
+
+		if ((err = posix_kernelIo(f, iov[i].iov_base, iov[i].iov_len, (*done && !write) ? flags | MSG_DONTWAIT : flags, write)) <= 0)
+			break;
+
+		*done += err;
+
+		if (err < iov[i].iov_len)
+			break;
+	}
+
+	return err;
+}
+
+
+static ssize_t posix_iovIo(int fildes, const struct iovec *iov, int iovcnt, off_t *offset, int write)
+{
+	open_file_t *f;
+	ssize_t len, err, done = 0;
+	off_t offs;
+	unsigned int status;
+	int i, flags;
+	void *buf;
+
+	if ((len = posix_iovLen(iov, iovcnt)) < 0)
+		return len;
+
+	if ((err = posix_getOpenFile(fildes, &f)))
+		return err;
+
+	do {
+		if (f->status & (write ? O_RDONLY : O_WRONLY)) {
+			err = -EBADF;
+			break;
+		}
+
+		proc_lockSet(&f->lock);
+		offs = (offset != NULL) ? *offset : f->offset;
+		status = f->status;
+		proc_lockClear(&f->lock);
+
+		if (f->type == ftUnixSocket || f->type == ftInetSocket || posix_kernelPipe(f)) {
+			if (offset != NULL) {
+				err = -ESPIPE;
+				break;
+			}
+
+			flags = (status & O_NONBLOCK) ? MSG_DONTWAIT : 0;
+
+			/* Datagram stays in one piece, pipe write up to PIPE_BUF doesn't interleave with other writers */
+			if (iovcnt > 1 && ((f->type == ftUnixSocket && !unix_isStream(f->oid.id)) || (write && posix_kernelPipe(f) && len <= US_PIPE_BUF))) {
+				if ((buf = vm_kmalloc(len ? len : 1)) == NULL) {
+					err = -ENOMEM;
+					break;
+				}
+
+				if (write)
+					posix_iovGather(buf, iov, iovcnt);
+
+				if ((err = posix_kernelIo(f, buf, len, flags, write)) > 0) {
+					if (!write)
+						posix_iovScatter(iov, iovcnt, buf, min(err, len));
+
+					done = min(err, len);
+				}
+
+				vm_kfree(buf);
+			}
+			else {
+				err = posix_iovKernel(f, iov, iovcnt, flags, write, &done);
+			}
+		}
+		else if (len <= IOV_BOUNCE) {
+			/* Whole vector goes to the server in a single message */
+			if ((buf = vm_kmalloc(len ? len : 1)) == NULL) {
+				err = -ENOMEM;
+				break;
+			}
+
+			if (write) {
+				posix_iovGather(buf, iov, iovcnt);
+				err = proc_write(f->oid, offs, buf, len, status);
+			}
+			else if ((err = proc_read(f->oid, offs, buf, len, status)) > 0) {
+				posix_iovScatter(iov, iovcnt, buf, err);
+			}
+
+			vm_kfree(buf);
+
+			if (err > 0)
+				done = err;
+		}
+		else {
+			/* Large buffers are mapped into the server anyway, copying them costs more than the messages */
+			for (i = 0, err = 0; i < iovcnt; ++i) {
+				if (!iov[i].iov_len)
+					continue;
+
+				if (write)
+					err = proc_write(f->oid, offs + done, iov[i].iov_base, iov[i].iov_len, status);
+				else
+					err = proc_read(f->oid, offs + done, iov[i].iov_base, iov[i].iov_len, status);
+
+				if (err <= 0)
+					break;
+
+				done += err;
+
+				if (err < iov[i].iov_len)
+					break;
+			}
+		}
+
+		if (err == -EPIPE && write)
+			threads_sigpost(proc_current()->process, proc_current(), SIGPIPE);
+
+		if (done) {
+			err = done;
+
+			if (offset == NULL) {
+				proc_lockSet(&f->lock);
+				f->offset += done;
+				proc_lockClear(&f->lock);
+			}
+		}
+	} while (0);
+
+	posix_fileDeref(f);
+
+	return err;
+}
+
+
+ssize_t posix_readv(int fildes, const struct iovec *iov, int iovcnt)
+{
+	TRACE("readv(%d, %p, %d)", fildes, iov, iovcnt);
+
+	return posix_iovIo(fildes, iov, iovcnt, NULL, 0);
+}
+
+
+ssize_t posix_writev(int fildes, const struct iovec *iov, int iovcnt)
+{
+	TRACE("writev(%d, %p, %d)", fildes, iov, iovcnt);
+
+	return posix_iovIo(fildes, iov, iovcnt, NULL, 1);
+}
+
+
+ssize_t posix_preadv(int fildes, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	TRACE("preadv(%d, %p, %d, %d)", fildes, iov, iovcnt, offset);
+
+	if (offset < 0)
+		return -EINVAL;
+
+	return posix_iovIo(fildes, iov, iovcnt, &offset, 0);
+}
+
+
+ssize_t posix_pwritev(int fildes, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	TRACE("pwritev(%d, %p, %d, %d)", fildes, iov, iovcnt, offset);
+
+	if (offset < 0)
+		return -EINVAL;
+
+	return posix_iovIo(fildes, iov, iovcnt, &offset, 1);
+}
+
+
 int posix_dup(int fildes)
 {
 	TRACE("dup(%d)", fildes);
 
 	process_info_t *p;
-	int newfd = 0;
+	int newfd;
 	open_file_t *f;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
 	proc_lockSet(&p->lock);
 
 	do {
-		if (fildes < 0 || fildes > p->maxfd)
-			break;
-
-		if ((f = p->fds[fildes].file) == NULL)
+		if ((f = _fd_file(p, fildes)) == NULL)
 			break;
 
-		while (p->fds[newfd].file != NULL && newfd++ < p->maxfd);
-
-		if (newfd > p->maxfd)
+		if ((newfd = _fd_alloc(p, 0)) < 0)
 			break;
 
-		p->fds[newfd].file = f;
-		p->fds[newfd].flags = 0;
-		proc_lockSet(&f->lock);
-		f->refs++;
-		proc_lockClear(&f->lock);
+		lib_atomicIncrement(&f->refs);
+		_fd_install(p, newfd, f, 0);
 		proc_lockClear(&p->lock);
-		pinfo_put(p);
 
 		return newfd;
 	} while (0);
 
 	proc_lockClear(&p->lock);
-	pinfo_put(p);
 	return -EBADF;
 }
 
 
 /* FIXME: handle fildes == fildes2 */
-int _posix_dup2(process_info_t *p, int fildes, int fildes2)
+static int _posix_dup2(process_info_t *p, int fildes, int fildes2, open_file_t **replaced)
 {
-	open_file_t *f, *f2;
-
-	if (fildes < 0 || fildes > p->maxfd)
-		return -EBADF;
-
-	if (fildes2 < 0 || fildes2 > p->maxfd)
-		return -EBADF;
+	open_file_t *f;
+	int err;
 
-	if ((f = p->fds[fildes].file) == NULL)
+	if ((f = _fd_file(p, fildes)) == NULL)
 		return -EBADF;
 
-	if ((f2 = p->fds[fildes2].file) != NULL) {
-		p->fds[fildes2].file = NULL;
-		posix_fileDeref(f2);
-	}
+	if ((err = _fd_reserve(p, fildes2)) < 0)
+		return err;
 
-	p->fds[fildes2].file = f;
-	p->fds[fildes2].flags = 0;
+	/* Caller closes the replaced file outside the lock */
+	*replaced = _fd_file(p, fildes2);
 
-	proc_lockSet(&f->lock);
-	f->refs++;
-	proc_lockClear(&f->lock);
+	lib_atomicIncrement(&f->refs);
+	_fd_install(p, fildes2, f, 0);
 
 	return fildes2;
 }
@@ -753,96 +1480,96 @@ int posix_dup2(int fildes, int fildes2)
 	TRACE("dup2(%d, %d)", fildes, fildes2);
 
 	process_info_t *p;
+	open_file_t *f2 = NULL;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
 	proc_lockSet(&p->lock);
-	fildes2 = _posix_dup2(p, fildes, fildes2);
+	fildes2 = _posix_dup2(p, fildes, fildes2, &f2);
 	proc_lockClear(&p->lock);
-	pinfo_put(p);
+
+	if (f2 != NULL) {
+		if (fildes2 != fildes)
+			evqueue_fdClosed(p, fildes2, f2);
+
+		posix_fileDeref(f2);
+	}
 
 	return fildes2;
 }
 
 
+static int posix_kernelPipe(open_file_t *f)
+{
+	return (f->type == ftPipe || f->type == ftFifo) && f->oid.port == US_PORT;
+}
+
+
 int posix_pipe(int fildes[2])
 {
 	TRACE("pipe(%p)", fildes);
 
 	process_info_t *p;
 	open_file_t *fi, *fo;
-	oid_t oid;
-	oid_t pipesrv;
+	unsigned socket[2];
 	int res;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
-	hal_memset(&oid, 0, sizeof(oid));
-
-	if ((res = proc_lookup("/dev/posix/pipes", NULL, &pipesrv)) < 0) {
-		pinfo_put(p);
-		return res == -EINTR ? res : -ENOSYS;
-	}
-
-	if ((res = proc_create(pipesrv.port, pxBufferedPipe, O_RDONLY | O_WRONLY, oid, pipesrv, NULL, &oid)) < 0) {
-		pinfo_put(p);
+	/* Pipes live in the kernel, data never goes through posixsrv */
+	if ((res = unix_pipe(socket)) < 0)
 		return res;
-	}
 
-	if ((fo = vm_kmalloc(sizeof(open_file_t))) == NULL) {
-		pinfo_put(p);
-		/* FIXME: destroy pipe */
-		return -ENOMEM;
-	}
-
-	if ((fi = vm_kmalloc(sizeof(open_file_t))) == NULL) {
-		vm_kfree(fo);
-		pinfo_put(p);
-		/* FIXME: destroy pipe */
-		return -ENOMEM;
-	}
+	fo = fi = NULL;
 
-	fildes[0] = 0;
+	do {
+		if ((fo = file_alloc()) == NULL || (fi = file_alloc()) == NULL) {
+			res = -ENOMEM;
+			break;
+		}
 
-	proc_lockSet(&p->lock);
-	while (p->fds[fildes[0]].file != NULL && fildes[0]++ < p->maxfd);
+		fo->oid.port = US_PORT;
+		fo->oid.id = socket[0];
+		fo->type = ftPipe;
+		fo->status = O_RDONLY;
 
-	fildes[1] = fildes[0] + 1;
-	while (p->fds[fildes[1]].file != NULL && fildes[1]++ < p->maxfd);
+		fi->oid.port = US_PORT;
+		fi->oid.id = socket[1];
+		fi->type = ftPipe;
+		fi->status = O_WRONLY;
 
-	if (fildes[0] > p->maxfd || fildes[1] > p->maxfd) {
-		proc_lockClear(&p->lock);
+		proc_lockSet(&p->lock);
+		if ((fildes[0] = _fd_alloc(p, 0)) < 0) {
+			proc_lockClear(&p->lock);
+			res = fildes[0];
+			break;
+		}
 
-		vm_kfree(fo);
-		vm_kfree(fi);
+		if ((fildes[1] = _fd_alloc(p, fildes[0] + 1)) < 0) {
+			_fd_release(p, fildes[0]);
+			proc_lockClear(&p->lock);
+			res = fildes[1];
+			break;
+		}
 
-		pinfo_put(p);
-		return -EMFILE;
-	}
+		_fd_install(p, fildes[0], fo, 0);
+		_fd_install(p, fildes[1], fi, 0);
+		proc_lockClear(&p->lock);
 
-	p->fds[fildes[0]].flags = p->fds[fildes[1]].flags = 0;
+		return 0;
+	} while (0);
 
-	p->fds[fildes[0]].file = fo;
-	proc_lockInit(&fo->lock);
-	hal_memcpy(&fo->oid, &oid, sizeof(oid));
-	fo->refs = 1;
-	fo->offset = 0;
-	fo->type = ftPipe;
-	fo->status = O_RDONLY;
+	if (fo != NULL)
+		file_discard(fo);
+	if (fi != NULL)
+		file_discard(fi);
 
-	p->fds[fildes[1]].file = fi;
-	proc_lockInit(&fi->lock);
-	hal_memcpy(&fi->oid, &oid, sizeof(oid));
-	fi->refs = 1;
-	fi->offset = 0;
-	fi->type = ftPipe;
-	fi->status = O_WRONLY;
+	unix_pipeClose(socket[0]);
+	unix_pipeClose(socket[1]);
 
-	proc_lockClear(&p->lock);
-	pinfo_put(p);
-	return 0;
+	return res;
 }
 
 
@@ -851,31 +1578,209 @@ int posix_mkfifo(const char *pathname, mode_t mode)
 	TRACE("mkfifo(%s, %x)", pathname, mode);
 
 	oid_t oid, file;
-	oid_t pipesrv;
-
-	hal_memset(&oid, 0, sizeof(oid));
-
-	if ((proc_lookup("/dev/posix/pipes", NULL, &pipesrv)) < 0)
-		return -ENOSYS;
+	unsigned socket;
+	int err;
 
-	if (proc_create(pipesrv.port, pxBufferedPipe, 0, oid, pipesrv, NULL, &oid) < 0)
-		return -EIO;
+	if ((err = unix_fifo(&socket)) < 0)
+		return err;
 
-	/* link pipe in posix server */
-	if (proc_link(oid, oid, pathname) < 0)
-		return -EIO;
+	oid.port = US_PORT;
+	oid.id = socket;
 
 	/* create pipe in filesystem */
-	if (posix_create(pathname, 2 /* otDev */, mode | S_IFIFO, oid, &file) < 0)
-		return -EIO;
+	if ((err = posix_create(pathname, 2 /* otDev */, mode | S_IFIFO, oid, &file)) < 0) {
+		unix_unlink(socket);
+		return err;
+	}
 
 	return 0;
 }
 
 
-int posix_chmod(const char *pathname, mode_t mode)
-{
-	TRACE("chmod(%s, %x)", pathname, mode);
+/*
+ * sendfile/splice
+ */
+
+
+#define SPLICE_CHUNK (4 * SIZE_PAGE)
+
+
+typedef struct {
+	open_file_t *file;
+	off_t offs;
+	unsigned status;
+} splice_t;
+
+
+static int posix_spliceFill(void *arg, void *data, size_t len)
+{
+	splice_t *sp = arg;
+	int err;
+
+	if ((err = proc_read(sp->file->oid, sp->offs, data, len, sp->status)) > 0)
+		sp->offs += err;
+
+	return err;
+}
+
+
+static int posix_spliceDrain(void *arg, void *data, size_t len)
+{
+	splice_t *sp = arg;
+	int err;
+
+	if ((err = proc_write(sp->file->oid, sp->offs, data, len, sp->status)) > 0)
+		sp->offs += err;
+
+	return err;
+}
+
+
+static ssize_t posix_spliceServers(splice_t *src, splice_t *dst, size_t count)
+{
+	void *buf;
+	size_t done = 0, want, wr;
+	int rd, err = EOK;
+
+	/* Page aligned bounce buffer, loaned by msg_map to both servers instead of being copied */
+	if ((buf = vm_kmalloc(min(count, SPLICE_CHUNK))) == NULL)
+		return -ENOMEM;
+
+	while (done < count) {
+		want = min(count - done, SPLICE_CHUNK);
+
+		if ((rd = err = posix_spliceFill(src, buf, want)) <= 0)
+			break;
+
+		for (wr = 0; wr < rd; wr += err) {
+			if ((err = posix_spliceDrain(dst, buf + wr, rd - wr)) <= 0)
+				break;
+		}
+
+		done += wr;
+
+		if (wr < rd) {
+			/* Not consumed by the sink, source is a regular file so it is read again next time */
+			src->offs -= rd - wr;
+			break;
+		}
+
+		if (rd < want)
+			break;
+	}
+
+	vm_kfree(buf);
+	return done ? done : err;
+}
+
+
+static int posix_kernelStream(open_file_t *f)
+{
+	return f->type == ftUnixSocket || posix_kernelPipe(f);
+}
+
+
+ssize_t posix_sendfile(int outfd, int infd, off_t *offset, size_t count)
+{
+	TRACE("sendfile(%d, %d, %p, %u)", outfd, infd, offset, count);
+
+	open_file_t *in, *out;
+	splice_t src, dst;
+	ssize_t done = 0, err;
+
+	if ((err = posix_getOpenFile(infd, &in)) < 0)
+		return err;
+
+	if ((err = posix_getOpenFile(outfd, &out)) < 0) {
+		posix_fileDeref(in);
+		return err;
+	}
+
+	do {
+		if ((in->status & O_WRONLY) || (out->status & O_RDONLY)) {
+			err = -EBADF;
+			break;
+		}
+
+		/* One end has to be a server object, kernel to kernel transfers are plain read/write */
+		if (in->type == ftEventQueue || out->type == ftEventQueue || in->type == ftTimer || out->type == ftTimer ||
+				(posix_kernelStream(in) && posix_kernelStream(out))) {
+			err = -EINVAL;
+			break;
+		}
+
+		if (offset != NULL && posix_kernelStream(in)) {
+			err = -ESPIPE;
+			break;
+		}
+
+		src.file = in;
+		proc_lockSet(&in->lock);
+		src.offs = (offset != NULL) ? *offset : in->offset;
+		src.status = in->status;
+		proc_lockClear(&in->lock);
+
+		dst.file = out;
+		proc_lockSet(&out->lock);
+		dst.offs = out->offset;
+		dst.status = out->status;
+		proc_lockClear(&out->lock);
+
+		/* Data corked on the socket goes out before the spliced data */
+		if (out->type == ftInetSocket && (err = inet_flush(out->oid.port, (dst.status & O_NONBLOCK) ? MSG_DONTWAIT : 0)) < 0)
+			break;
+
+		if (posix_kernelStream(out)) {
+			/* Source server writes directly into the pipe or socket buffer */
+			err = unix_spliceWrite(out->oid.id, posix_spliceFill, &src, count, (dst.status & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+		}
+		else if (posix_kernelStream(in)) {
+			/* Sink server reads directly from the pipe or socket buffer, block for the first chunk only */
+			while (done < count) {
+				if ((err = unix_spliceRead(in->oid.id, posix_spliceDrain, &dst, count - done, (done || (src.status & O_NONBLOCK)) ? MSG_DONTWAIT : 0)) <= 0)
+					break;
+
+				done += err;
+			}
+
+			if (done)
+				err = done;
+		}
+		else if (in->type != ftRegular) {
+			/* Bytes the sink doesn't take can't be given back to a stream source */
+			err = -EINVAL;
+		}
+		else {
+			err = posix_spliceServers(&src, &dst, count);
+		}
+
+		if (err == -EPIPE)
+			threads_sigpost(proc_current()->process, proc_current(), SIGPIPE);
+
+		if (offset != NULL) {
+			*offset = src.offs;
+		}
+		else {
+			proc_lockSet(&in->lock);
+			in->offset = src.offs;
+			proc_lockClear(&in->lock);
+		}
+
+		proc_lockSet(&out->lock);
+		out->offset = dst.offs;
+		proc_lockClear(&out->lock);
+	} while (0);
+
+	posix_fileDeref(out);
+	posix_fileDeref(in);
+
+	return err;
+}
+
+
+int posix_chmod(const char *pathname, mode_t mode)
+{
+	TRACE("chmod(%s, %x)", pathname, mode);
 
 	oid_t oid, ln;
 	msg_t msg;
@@ -1041,8 +1946,10 @@ int posix_ftruncate(int fildes, off_t length)
 	open_file_t *f;
 	int err;
 
-	if (!(err = posix_getOpenFile(fildes, &f)))
-		err = posix_truncate(&f->oid, length);
+	if ((err = posix_getOpenFile(fildes, &f)) < 0)
+		return err;
+
+	err = posix_truncate(&f->oid, length);
 
 	posix_fileDeref(f);
 	return err;
@@ -1148,25 +2055,28 @@ int posix_fstat(int fd, struct stat *buf)
 static int posix_fcntlDup(int fd, int fd2, int cloexec)
 {
 	process_info_t *p;
+	open_file_t *unused;
 	int err;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
 	proc_lockSet(&p->lock);
-	if (fd < 0 || fd > p->maxfd || fd2 < 0 || fd > p->maxfd) {
+	if (_fd_file(p, fd) == NULL || fd2 < 0) {
 		proc_lockClear(&p->lock);
-		pinfo_put(p);
 		return -EBADF;
 	}
 
-	while (p->fds[fd2].file != NULL && fd2++ < p->maxfd);
+	if ((fd2 = _fd_alloc(p, fd2)) < 0) {
+		proc_lockClear(&p->lock);
+		return fd2;
+	}
 
-	if ((err = _posix_dup2(p, fd, fd2)) == fd2 && cloexec)
-		p->fds[fd2].flags = FD_CLOEXEC;
+	/* Slot is fresh, nothing gets replaced */
+	if ((err = _posix_dup2(p, fd, fd2, &unused)) == fd2 && cloexec)
+		p->fdt->fds[fd2].flags = FD_CLOEXEC;
 
 	proc_lockClear(&p->lock);
-	pinfo_put(p);
 	return err;
 }
 
@@ -1176,22 +2086,16 @@ static int posix_fcntlSetFd(int fd, unsigned flags)
 	process_info_t *p;
 	int err = EOK;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -ENOSYS;
 
 	proc_lockSet(&p->lock);
-	if (fd < 0 || fd > p->maxfd) {
-		proc_lockClear(&p->lock);
-		pinfo_put(p);
-		return -EBADF;
-	}
-
-	if (p->fds[fd].file != NULL)
-		p->fds[fd].flags = flags;
+	if (_fd_file(p, fd) != NULL)
+		p->fdt->fds[fd].flags = flags;
 	else
 		err = -EBADF;
 	proc_lockClear(&p->lock);
-	pinfo_put(p);
+
 	return err;
 }
 
@@ -1201,22 +2105,16 @@ static int posix_fcntlGetFd(int fd)
 	process_info_t *p;
 	int err;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -ENOSYS;
 
 	proc_lockSet(&p->lock);
-	if (fd < 0 || fd > p->maxfd) {
-		proc_lockClear(&p->lock);
-		pinfo_put(p);
-		return -EBADF;
-	}
-
-	if (p->fds[fd].file != NULL)
-		err = p->fds[fd].flags;
+	if (_fd_file(p, fd) != NULL)
+		err = p->fdt->fds[fd].flags;
 	else
 		err = -EBADF;
 	proc_lockClear(&p->lock);
-	pinfo_put(p);
+
 	return err;
 }
 
@@ -1459,30 +2357,34 @@ int posix_socket(int domain, int type, int protocol)
 	TRACE("socket(%d, %d, %d)", domain, type, protocol);
 
 	process_info_t *p;
+	open_file_t *f;
 	int err, fd;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
-	if ((fd = posix_newFile(p, 0)) < 0) {
-		pinfo_put(p);
+	if ((fd = posix_fdAlloc(p, 0)) < 0)
 		return -EMFILE;
+
+	if ((f = file_alloc()) == NULL) {
+		posix_fdCancel(p, fd);
+		return -ENOMEM;
 	}
 
 	switch (domain) {
 	case AF_UNIX:
 		if ((err = unix_socket(domain, type, protocol)) >= 0) {
-			p->fds[fd].file->type = ftUnixSocket;
-			p->fds[fd].file->oid.port = -1;
-			p->fds[fd].file->oid.id = err;
+			f->type = ftUnixSocket;
+			f->oid.port = -1;
+			f->oid.id = err;
 		}
 		break;
 	case AF_INET:
 	case AF_INET6:
 		if ((err = inet_socket(domain, type, protocol)) >= 0) {
-			p->fds[fd].file->type = ftInetSocket;
-			p->fds[fd].file->oid.port = err;
-			p->fds[fd].file->oid.id = 0;
+			f->type = ftInetSocket;
+			f->oid.port = err;
+			f->oid.id = 0;
 		}
 		break;
 	default:
@@ -1491,12 +2393,12 @@ int posix_socket(int domain, int type, int protocol)
 	}
 
 	if (err < 0) {
-		posix_putUnusedFile(p, fd);
-		pinfo_put(p);
+		file_discard(f);
+		posix_fdCancel(p, fd);
 		return err;
 	}
 
-	pinfo_put(p);
+	posix_fdInstall(p, fd, f, 0);
 	return fd;
 }
 
@@ -1506,32 +2408,34 @@ int posix_accept4(int socket, struct sockaddr *address, socklen_t *address_len,
 	TRACE("accept4(%d, %s)", socket, address == NULL ? NULL : address->sa_data);
 
 	process_info_t *p;
-	open_file_t *f;
+	open_file_t *f, *nf;
 	int err, fd;
 
-	if ((p = pinfo_find(proc_current()->process->id)) == NULL)
+	if ((p = pinfo_current()) == NULL)
 		return -1;
 
-	if ((fd = posix_newFile(p, 0)) < 0) {
-		pinfo_put(p);
-
+	if ((fd = posix_fdAlloc(p, 0)) < 0)
 		return -EMFILE;
+
+	if ((nf = file_alloc()) == NULL) {
+		posix_fdCancel(p, fd);
+		return -ENOMEM;
 	}
 
 	if (!(err = posix_getOpenFile(socket, &f))) {
 		switch (f->type) {
 		case ftInetSocket:
 			if ((err = inet_accept(f->oid.port, address, address_len)) >= 0) {
-				p->fds[fd].file->type = ftInetSocket;
-				p->fds[fd].file->oid.port = err;
-				p->fds[fd].file->oid.id = 0;
+				nf->type = ftInetSocket;
+				nf->oid.port = err;
+				nf->oid.id = 0;
 			}
 			break;
 		case ftUnixSocket:
 			if ((err = unix_accept(f->oid.id, address, address_len)) >= 0) {
-				p->fds[fd].file->type = ftUnixSocket;
-				p->fds[fd].file->oid.port = -1;
-				p->fds[fd].file->oid.id = err;
+				nf->type = ftUnixSocket;
+				nf->oid.port = -1;
+				nf->oid.id = err;
 			}
 			break;
 		default:
@@ -1539,25 +2443,21 @@ int posix_accept4(int socket, struct sockaddr *address, socklen_t *address_len,
 			break;
 		}
 
-		if (err >= 0 && flags && !posix_getOpenFile(fd, &f)) {
-			if (flags & SOCK_NONBLOCK) {
-				f->status |= O_NONBLOCK;
-				_sock_setfl(f, f->status);
-			}
-			if (flags & SOCK_CLOEXEC)
-				posix_fcntlSetFd(fd, FD_CLOEXEC);
+		if (err >= 0 && (flags & SOCK_NONBLOCK)) {
+			nf->status |= O_NONBLOCK;
+			_sock_setfl(nf, nf->status);
 		}
 
 		posix_fileDeref(f);
 	}
 
 	if (err < 0) {
-		posix_putUnusedFile(p, fd);
-		pinfo_put(p);
+		file_discard(nf);
+		posix_fdCancel(p, fd);
 		return err;
 	}
 
-	pinfo_put(p);
+	posix_fdInstall(p, fd, nf, (flags & SOCK_CLOEXEC) ? FD_CLOEXEC : 0);
 	return fd;
 }
 
@@ -1699,333 +2599,1596 @@ int posix_getsockopt(int socket, int level, int optname, void *optval, socklen_t
 		posix_fileDeref(f);
 	}
 
-	return err;
+	return err;
+}
+
+
+int posix_listen(int socket, int backlog)
+{
+	TRACE("listen(%d, %d)", socket, backlog);
+
+	open_file_t *f;
+	int err;
+
+	if (!(err = posix_getOpenFile(socket, &f))) {
+		switch (f->type) {
+		case ftInetSocket:
+			err = inet_listen(f->oid.port, backlog);
+			break;
+		case ftUnixSocket:
+			err = unix_listen(f->oid.id, backlog);
+			break;
+		default:
+			err = -ENOTSOCK;
+			break;
+		}
+
+		posix_fileDeref(f);
+	}
+
+	return err;
+}
+
+
+ssize_t posix_recvfrom(int socket, void *message, size_t length, int flags, struct sockaddr *src_addr, socklen_t *src_len)
+{
+	TRACE("recvfrom(%d, %d, %s)", socket, length, src_addr == NULL ? NULL : src_addr->sa_data);
+
+	open_file_t *f;
+	int err;
+
+	if (!(err = posix_getOpenFile(socket, &f))) {
+		switch (f->type) {
+		case ftInetSocket:
+			err = inet_recvfrom(f->oid.port, message, length, flags, src_addr, src_len);
+			break;
+		case ftUnixSocket:
+			err = unix_recvfrom(f->oid.id, message, length, flags, src_addr, src_len);
+			break;
+		default:
+			err = -ENOTSOCK;
+			break;
+		}
+
+		posix_fileDeref(f);
+	}
+
+	return err;
+}
+
+
+ssize_t posix_sendto(int socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len)
+{
+	TRACE("sendto(%d, %s, %d, %s)", socket, message, length, dest_addr == NULL ? NULL : dest_addr->sa_data);
+
+	open_file_t *f;
+	int err;
+
+	if (!(err = posix_getOpenFile(socket, &f))) {
+		switch (f->type) {
+		case ftInetSocket:
+			err = inet_sendto(f->oid.port, message, length, flags, dest_addr, dest_len);
+			break;
+		case ftUnixSocket:
+			err = unix_sendto(f->oid.id, message, length, flags, dest_addr, dest_len);
+			break;
+		default:
+			err = -ENOTSOCK;
+			break;
+		}
+
+		posix_fileDeref(f);
+	}
+
+	return err;
+}
+
+
+/*
+ * Ancillary data, passed only over unix sockets
+ */
+
+
+void posix_ctlFree(unixctl_t *ctl)
+{
+	int i;
+
+	for (i = 0; i < ctl->nfiles; ++i) {
+		if (ctl->files[i] != NULL)
+			posix_fileDeref(ctl->files[i]);
+	}
+
+	vm_kfree(ctl);
+}
+
+
+static struct cmsghdr *posix_cmsgNext(const struct msghdr *msg, struct cmsghdr *cmsg)
+{
+	char *end = (char *)msg->msg_control + msg->msg_controllen;
+
+	if (cmsg == NULL)
+		cmsg = msg->msg_control;
+	else
+		cmsg = (struct cmsghdr *)((char *)cmsg + CMSG_ALIGN(cmsg->cmsg_len));
+
+	if ((char *)cmsg + sizeof(struct cmsghdr) > end)
+		return NULL;
+
+	return cmsg;
+}
+
+
+/*
+ * Takes references to the files being passed. Files in flight are kept open by
+ * the receiving socket, so a unix socket passed over itself, or sockets passed
+ * to each other in a loop, are never released - there is no collector for such
+ * cycles. unix_sendmsg refuses queueing a socket on itself, longer loops leak.
+ */
+static int posix_ctlGet(const struct msghdr *msg, unixctl_t **ctl)
+{
+	process_info_t *p;
+	struct cmsghdr *cmsg;
+	struct ucred *cred = NULL;
+	unixctl_t *c;
+	int *fds, nfds = 0, i, n;
+
+	*ctl = NULL;
+
+	if (msg->msg_control == NULL || !msg->msg_controllen)
+		return EOK;
+
+	if ((p = pinfo_current()) == NULL)
+		return -ENOSYS;
+
+	for (cmsg = posix_cmsgNext(msg, NULL); cmsg != NULL; cmsg = posix_cmsgNext(msg, cmsg)) {
+		if (cmsg->cmsg_len < CMSG_LEN(0) || (char *)cmsg + cmsg->cmsg_len > (char *)msg->msg_control + msg->msg_controllen)
+			return -EINVAL;
+
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			return -EINVAL;
+
+		if (cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds += (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		}
+		else if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+			if (cmsg->cmsg_len != CMSG_LEN(sizeof(struct ucred)))
+				return -EINVAL;
+
+			cred = (struct ucred *)CMSG_DATA(cmsg);
+
+			/* There are no users, only the sender's own pid may be claimed */
+			if (cred->pid != p->process || cred->uid || cred->gid)
+				return -EPERM;
+		}
+		else {
+			return -EINVAL;
+		}
+	}
+
+	if (nfds > SCM_MAX_FD)
+		return -EINVAL;
+
+	if (!nfds && cred == NULL)
+		return EOK;
+
+	if ((c = vm_kmalloc(sizeof(unixctl_t) + nfds * sizeof(open_file_t *))) == NULL)
+		return -ENOMEM;
+
+	c->next = c->prev = NULL;
+	c->pos = 0;
+	c->nfiles = 0;
+
+	if ((c->hascred = (cred != NULL)))
+		hal_memcpy(&c->cred, cred, sizeof(struct ucred));
+
+	for (cmsg = posix_cmsgNext(msg, NULL); cmsg != NULL; cmsg = posix_cmsgNext(msg, cmsg)) {
+		if (cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		fds = (int *)CMSG_DATA(cmsg);
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+		for (i = 0; i < n; ++i) {
+			if ((c->files[c->nfiles] = fd_get(p, fds[i])) == NULL) {
+				posix_ctlFree(c);
+				return -EBADF;
+			}
+
+			c->nfiles++;
+		}
+	}
+
+	*ctl = c;
+	return EOK;
+}
+
+
+/* Installs passed files in the receiver's table, what doesn't fit in msg_control is dropped */
+static void posix_ctlPut(struct msghdr *msg, unixctl_t *ctl, int flags)
+{
+	process_info_t *p = pinfo_current();
+	struct cmsghdr *cmsg;
+	socklen_t space = (msg->msg_control != NULL) ? msg->msg_controllen : 0, used = 0;
+	int *fds, i, n, fd;
+
+	if (ctl->hascred) {
+		if (space - used >= CMSG_LEN(sizeof(struct ucred))) {
+			cmsg = (struct cmsghdr *)((char *)msg->msg_control + used);
+			cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_CREDENTIALS;
+			hal_memcpy(CMSG_DATA(cmsg), &ctl->cred, sizeof(struct ucred));
+			used = min(space, used + CMSG_SPACE(sizeof(struct ucred)));
+		}
+		else {
+			msg->msg_flags |= MSG_CTRUNC;
+		}
+	}
+
+	if (ctl->nfiles) {
+		n = (p == NULL || space - used < CMSG_LEN(sizeof(int))) ? 0 : min(ctl->nfiles, (space - used - CMSG_LEN(0)) / sizeof(int));
+
+		cmsg = (struct cmsghdr *)((char *)msg->msg_control + used);
+		fds = (int *)CMSG_DATA(cmsg);
+
+		for (i = 0; i < n; ++i) {
+			if ((fd = posix_fdAlloc(p, 0)) < 0)
+				break;
+
+			posix_fdInstall(p, fd, ctl->files[i], (flags & MSG_CMSG_CLOEXEC) ? FD_CLOEXEC : 0);
+			ctl->files[i] = NULL;
+			fds[i] = fd;
+		}
+
+		if (i) {
+			cmsg->cmsg_len = CMSG_LEN(i * sizeof(int));
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			used = min(space, used + CMSG_SPACE(i * sizeof(int)));
+		}
+
+		if (i < ctl->nfiles)
+			msg->msg_flags |= MSG_CTRUNC;
+	}
+
+	msg->msg_controllen = used;
+	posix_ctlFree(ctl);
+}
+
+
+static ssize_t posix_msgSend(open_file_t *f, const struct msghdr *msg, int flags)
+{
+	ssize_t len, err;
+	unixctl_t *ctl = NULL;
+	void *buf;
+
+	if ((len = posix_iovLen(msg->msg_iov, msg->msg_iovlen)) < 0)
+		return len;
+
+	if (f->type == ftUnixSocket && (err = posix_ctlGet(msg, &ctl)) < 0)
+		return err;
+
+	/* Datagram has to stay in one piece */
+	if (msg->msg_iovlen == 1) {
+		buf = msg->msg_iov[0].iov_base;
+	}
+	else if ((buf = vm_kmalloc(len ? len : 1)) == NULL) {
+		if (ctl != NULL)
+			posix_ctlFree(ctl);
+		return -ENOMEM;
+	}
+	else {
+		posix_iovGather(buf, msg->msg_iov, msg->msg_iovlen);
+	}
+
+	switch (f->type) {
+	case ftInetSocket:
+		err = inet_sendto(f->oid.port, buf, len, flags, msg->msg_name, msg->msg_namelen);
+		break;
+	case ftUnixSocket:
+		err = unix_sendmsg(f->oid.id, buf, len, flags, msg->msg_name, msg->msg_namelen, ctl);
+		break;
+	default:
+		err = -ENOTSOCK;
+		break;
+	}
+
+	/* Ancillary data is consumed only with the data it is attached to */
+	if (err < 0 && ctl != NULL)
+		posix_ctlFree(ctl);
+
+	if (msg->msg_iovlen != 1)
+		vm_kfree(buf);
+
+	return err;
+}
+
+
+static ssize_t posix_msgRecv(open_file_t *f, struct msghdr *msg, int flags)
+{
+	ssize_t len, err;
+	socklen_t *namelen = (msg->msg_name != NULL) ? &msg->msg_namelen : NULL;
+	unixctl_t *ctl = NULL;
+	void *buf;
+
+	if ((len = posix_iovLen(msg->msg_iov, msg->msg_iovlen)) < 0)
+		return len;
+
+	if (msg->msg_iovlen == 1)
+		buf = msg->msg_iov[0].iov_base;
+	else if ((buf = vm_kmalloc(len ? len : 1)) == NULL)
+		return -ENOMEM;
+
+	msg->msg_flags = 0;
+
+	switch (f->type) {
+	case ftInetSocket:
+		err = inet_recvfrom(f->oid.port, buf, len, flags, msg->msg_name, namelen);
+		break;
+	case ftUnixSocket:
+		err = unix_recvmsg(f->oid.id, buf, len, flags, msg->msg_name, namelen, &ctl, &msg->msg_flags);
+		break;
+	default:
+		err = -ENOTSOCK;
+		break;
+	}
+
+	if (msg->msg_iovlen != 1) {
+		if (err > 0)
+			posix_iovScatter(msg->msg_iov, msg->msg_iovlen, buf, min(err, len));
+
+		vm_kfree(buf);
+	}
+
+	if (ctl != NULL)
+		posix_ctlPut(msg, ctl, flags);
+	else
+		msg->msg_controllen = 0;
+
+	return err;
+}
+
+
+ssize_t posix_sendmsg(int socket, const struct msghdr *msg, int flags)
+{
+	TRACE("sendmsg(%d, %p, %x)", socket, msg, flags);
+
+	open_file_t *f;
+	ssize_t err;
+
+	if ((err = posix_getOpenFile(socket, &f)) < 0)
+		return err;
+
+	err = posix_msgSend(f, msg, flags);
+	posix_fileDeref(f);
+
+	return err;
+}
+
+
+ssize_t posix_recvmsg(int socket, struct msghdr *msg, int flags)
+{
+	TRACE("recvmsg(%d, %p, %x)", socket, msg, flags);
+
+	open_file_t *f;
+	ssize_t err;
+
+	if ((err = posix_getOpenFile(socket, &f)) < 0)
+		return err;
+
+	err = posix_msgRecv(f, msg, flags);
+	posix_fileDeref(f);
+
+	return err;
+}
+
+
+int posix_sendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	TRACE("sendmmsg(%d, %p, %u, %x)", socket, msgvec, vlen, flags);
+
+	open_file_t *f;
+	ssize_t err;
+	unsigned int i;
+
+	if ((err = posix_getOpenFile(socket, &f)) < 0)
+		return err;
+
+	vlen = min(vlen, IOV_MAX);
+
+	/* Only the descriptor lookup is shared, each message is sent as if by sendmsg */
+	for (i = 0; i < vlen; ++i) {
+		if ((err = posix_msgSend(f, &msgvec[i].msg_hdr, flags)) < 0)
+			break;
+
+		msgvec[i].msg_len = err;
+	}
+
+	posix_fileDeref(f);
+
+	return i ? i : err;
+}
+
+
+int posix_recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	TRACE("recvmmsg(%d, %p, %u, %x)", socket, msgvec, vlen, flags);
+
+	open_file_t *f;
+	ssize_t err;
+	unsigned int i;
+
+	if ((err = posix_getOpenFile(socket, &f)) < 0)
+		return err;
+
+	vlen = min(vlen, IOV_MAX);
+
+	/* Wait for the first message only, then take what is already queued */
+	for (i = 0; i < vlen; ++i) {
+		if ((err = posix_msgRecv(f, &msgvec[i].msg_hdr, i ? flags | MSG_DONTWAIT : flags)) < 0)
+			break;
+
+		msgvec[i].msg_len = err;
+	}
+
+	posix_fileDeref(f);
+
+	return i ? i : err;
+}
+
+
+int posix_shutdown(int socket, int how)
+{
+	TRACE("shutdown(%d, %d)", socket, how);
+
+	open_file_t *f;
+	int err;
+
+	if (!(err = posix_getOpenFile(socket, &f))) {
+		switch (f->type) {
+		case ftInetSocket:
+			err = inet_shutdown(f->oid.port, how);
+			break;
+		case ftUnixSocket:
+			err = unix_shutdown(f->oid.id, how);
+			break;
+		default:
+			err = -ENOTSOCK;
+			break;
+		}
+
+		posix_fileDeref(f);
+	}
+
+	return err;
+}
+
+
+int posix_setsockopt(int socket, int level, int optname, const void *optval, socklen_t optlen)
+{
+	open_file_t *f;
+	int err;
+
+	if (!(err = posix_getOpenFile(socket, &f))) {
+		switch (f->type) {
+		case ftInetSocket:
+			err = inet_setsockopt(f->oid.port, level, optname, optval, optlen);
+			break;
+		case ftUnixSocket:
+			err = unix_setsockopt(f->oid.id, level, optname, optval, optlen);
+			break;
+		default:
+			err = -ENOTSOCK;
+			break;
+		}
+
+		posix_fileDeref(f);
+	}
+
+	return err;
+}
+
+
+/* Just a stub to support busybox' touch */
+int posix_utimes(const char *filename, const struct timeval *times)
+{
+	oid_t oid;
+
+	if (proc_lookup(filename, NULL, &oid) < 0)
+		return -ENOENT;
+
+	return 0;
+}
+
+
+static int poll_objStatus(oid_t *oid, unsigned events)
+{
+	msg_t msg;
+	int err;
+
+	hal_memset(&msg, 0, sizeof(msg));
+
+	msg.type = mtGetAttr;
+	msg.i.attr.type = atPollStatus;
+	msg.i.attr.val = events;
+	hal_memcpy(&msg.i.attr.oid, oid, sizeof(oid_t));
+
+	if (!(err = proc_send(oid->port, &msg)))
+		err = msg.o.attr.val;
+
+	if (err == -EINTR)
+		return err;
+
+	return (err < 0) ? POLLHUP : err;
+}
+
+
+static int poll_portNotifies(u32 id)
+{
+	port_t *port;
+	int notifies;
+
+	if ((port = proc_portGet(id)) == NULL)
+		return 0;
+
+	notifies = port->pollnotify;
+	port_put(port, 0);
+
+	return notifies;
+}
+
+
+static int poll_queueStatus(evqueue_t *q)
+{
+	spinlock_ctx_t sc;
+	int revents;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	revents = (q->ready != NULL) ? (POLLIN | POLLRDNORM) : 0;
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	return revents;
+}
+
+
+static int poll_timerStatus(ptimer_t *t)
+{
+	spinlock_ctx_t sc;
+	int revents;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	revents = (t->count != 0) ? (POLLIN | POLLRDNORM) : 0;
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	return revents;
+}
+
+
+static int poll_descInit(polldesc_t *pd, int fd, int subscribe)
+{
+	open_file_t *f;
+	int revents, res;
+
+	if (posix_getOpenFile(fd, &f) < 0)
+		return POLLNVAL;
+
+	pd->type = f->type;
+	hal_memcpy(&pd->oid, &f->oid, sizeof(oid_t));
+
+	/* Kernel pipes are unix sockets underneath */
+	if (posix_kernelPipe(f))
+		pd->type = ftUnixSocket;
+
+	/* Event queue is readable when it has ready notes, timer when it has expired, keep them open while subscribed */
+	if (pd->type == ftEventQueue || pd->type == ftTimer) {
+		if (subscribe) {
+			pd->file = f;
+			poll_subscribe((pd->type == ftTimer) ? &f->ptimer->poll : &f->evqueue->poll, &pd->wait);
+		}
+
+		revents = (pd->type == ftTimer) ? poll_timerStatus(f->ptimer) : poll_queueStatus(f->evqueue);
+
+		if (!subscribe)
+			posix_fileDeref(f);
+
+		return revents;
+	}
+
+	posix_fileDeref(f);
+
+	/* Kernel sockets answer directly */
+	if (pd->type == ftUnixSocket)
+		return unix_poll(pd->oid.id, subscribe ? &pd->wait : NULL);
+
+	/* Subscribe before asking the server so a change racing with the query is not lost */
+	if (subscribe) {
+		if ((pd->obj = poll_objGet(&pd->oid)) != NULL)
+			poll_subscribe(&pd->obj->head, &pd->wait);
+
+		pd->legacy = (pd->obj == NULL) || !poll_portNotifies(pd->oid.port);
+	}
+
+	/* Data already buffered in the kernel is readable regardless of the server */
+	revents = (pd->type == ftInetSocket) ? inet_poll(pd->oid.port) : 0;
+
+	if ((res = poll_objStatus(&pd->oid, pd->wait.events)) < 0)
+		return res;
+
+	return res | revents;
+}
+
+
+static void poll_descDone(polldesc_t *pd)
+{
+	if (pd->wait.head == NULL)
+		return;
+
+	if (pd->type == ftUnixSocket) {
+		unix_pollDone(pd->oid.id, &pd->wait);
+	}
+	else if (pd->type == ftEventQueue || pd->type == ftTimer) {
+		poll_unsubscribe(&pd->wait);
+		posix_fileDeref(pd->file);
+	}
+	else {
+		poll_unsubscribe(&pd->wait);
+		poll_objPut(pd->obj);
+	}
+}
+
+
+static int poll_descUpdate(polldesc_t *pd, int timedout)
+{
+	spinlock_ctx_t sc;
+	int revents;
+
+	if (pd->type == ftUnixSocket)
+		return unix_poll(pd->oid.id, NULL);
+
+	if (pd->type == ftEventQueue)
+		return poll_queueStatus(pd->file->evqueue);
+
+	if (pd->type == ftTimer)
+		return poll_timerStatus(pd->file->ptimer);
+
+	/* Servers which don't post readiness are still polled, but only when the interval expires */
+	if (pd->legacy)
+		return timedout ? poll_objStatus(&pd->oid, pd->wait.events) : 0;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	revents = pd->wait.revents;
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	return revents;
+}
+
+
+static int poll_revents(struct pollfd *pfd, int revents)
+{
+	if (revents < 0)
+		return revents;
+
+	pfd->revents = revents & ~(~pfd->events & (POLLIN|POLLOUT|POLLPRI|POLLRDNORM|POLLWRNORM|POLLRDBAND|POLLWRBAND));
+
+	return !!pfd->revents;
+}
+
+
+int posix_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+{
+	polldesc_t pdstack[4], *pd = pdstack;
+	pollsync_t sync;
+	time_t deadline = 0, now, unused, wait;
+	int ready = 0, legacy = 0, err = EOK, res;
+	nfds_t i;
+	spinlock_ctx_t sc;
+
+	if (nfds > sizeof(pdstack) / sizeof(pdstack[0]) && (pd = vm_kmalloc(nfds * sizeof(polldesc_t))) == NULL)
+		return -ENOMEM;
+
+	sync.queue = NULL;
+	sync.woken = 0;
+
+	if (timeout_ms > 0) {
+		proc_gettime(&deadline, &unused);
+		deadline += timeout_ms * 1000LL;
+	}
+
+	for (i = 0; i < nfds; ++i) {
+		fds[i].revents = 0;
+
+		pd[i].wait.head = NULL;
+		pd[i].wait.sync = &sync;
+		pd[i].wait.notify = poll_wakeSync;
+		pd[i].wait.events = fds[i].events;
+		pd[i].obj = NULL;
+		pd[i].file = NULL;
+		pd[i].legacy = 0;
+
+		if (fds[i].fd < 0 || ready < 0)
+			continue;
+
+		/* Once something is ready we won't sleep, no need to subscribe the rest */
+		if ((res = poll_revents(&fds[i], poll_descInit(&pd[i], fds[i].fd, timeout_ms && !ready))) < 0)
+			ready = res;
+		else
+			ready += res;
+
+		legacy |= pd[i].legacy;
+	}
+
+	while (!ready && timeout_ms) {
+		wait = 0;
+
+		if (timeout_ms > 0) {
+			proc_gettime(&now, &unused);
+			if (now >= deadline)
+				break;
+
+			wait = deadline - now;
+		}
+
+		if (legacy && (!wait || wait > POLL_INTERVAL))
+			wait = POLL_INTERVAL;
+
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		while (!sync.woken && err == EOK)
+			err = proc_threadWaitInterruptible(&sync.queue, &posix_common.pollSpinlock, wait, &sc);
+		sync.woken = 0;
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+		if (err == -EINTR) {
+			ready = -EINTR;
+			break;
+		}
+
+		for (i = 0; i < nfds && ready >= 0; ++i) {
+			if (fds[i].fd < 0)
+				continue;
+
+			if ((res = poll_revents(&fds[i], poll_descUpdate(&pd[i], err == -ETIME))) < 0)
+				ready = res;
+			else
+				ready += res;
+		}
+
+		err = EOK;
+	}
+
+	for (i = 0; i < nfds; ++i) {
+		if (fds[i].fd >= 0)
+			poll_descDone(&pd[i]);
+	}
+
+	if (pd != pdstack)
+		vm_kfree(pd);
+
+	return ready;
+}
+
+
+int posix_pollNotify(oid_t *oid, unsigned events)
+{
+	port_t *port;
+	pollobj_t *o, t;
+	spinlock_ctx_t sc;
+
+	if ((port = proc_portGet(oid->port)) == NULL)
+		return -EINVAL;
+
+	if (port->owner != proc_current()->process) {
+		port_put(port, 0);
+		return -EPERM;
+	}
+
+	/* From now on pollers rely on notifications from this port instead of polling it */
+	port->pollnotify = 1;
+	port_put(port, 0);
+
+	hal_memcpy(&t.oid, oid, sizeof(oid_t));
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if ((o = lib_treeof(pollobj_t, linkage, lib_rbFind(&posix_common.pollobjs, &t.linkage))) != NULL)
+		_poll_notify(&o->head, events);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	return EOK;
+}
+
+
+/*
+ * Event queues
+ */
+
+
+static int evnote_cmp(rbnode_t *n1, rbnode_t *n2)
+{
+	evnote_t *e1 = lib_treeof(evnote_t, linkage, n1);
+	evnote_t *e2 = lib_treeof(evnote_t, linkage, n2);
+
+	if (e1->owner != e2->owner)
+		return (e1->owner < e2->owner) ? -1 : 1;
+
+	if (e1->fd != e2->fd)
+		return (e1->fd < e2->fd) ? -1 : 1;
+
+	if (e1->file != e2->file)
+		return (e1->file < e2->file) ? -1 : 1;
+
+	return 0;
+}
+
+
+/* Called with pollSpinlock held */
+static evnote_t *_evnote_find(open_file_t *f, process_info_t *p, int fd)
+{
+	evnote_t *n;
+
+	if ((n = f->notes) != NULL) {
+		do {
+			if (n->owner == p && n->fd == fd)
+				return n;
+		} while ((n = n->fnext) != f->notes);
+	}
+
+	return NULL;
+}
+
+
+static void _evnote_queue(evnote_t *n)
+{
+	evqueue_t *q = n->queue;
+
+	LIST_ADD(&q->ready, n);
+	n->queued = 1;
+
+	proc_threadWakeup(&q->waitq);
+	_poll_notify(&q->poll, POLLIN | POLLRDNORM);
+}
+
+
+/* Called with pollSpinlock held when the watched object posts readiness */
+static void evnote_notify(pollwait_t *wait)
+{
+	evnote_t *n = lib_containerof(evnote_t, desc.wait, wait);
+
+	if (!n->queued && !(n->flags & evDisable))
+		_evnote_queue(n);
+}
+
+
+static void evnote_check(evnote_t *n, int revents)
+{
+	spinlock_ctx_t sc;
+
+	if (revents <= 0)
+		return;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if ((revents & (n->desc.wait.events | POLLERR | POLLHUP | POLLNVAL)) && !n->queued && !(n->flags & evDisable))
+		_evnote_queue(n);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+}
+
+
+static int evnote_status(evnote_t *n)
+{
+	spinlock_ctx_t sc;
+	int revents;
+
+	if (n->desc.type == ftUnixSocket)
+		return unix_poll(n->desc.oid.id, NULL);
+
+	if (n->desc.legacy)
+		return poll_objStatus(&n->desc.oid, n->desc.wait.events);
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	revents = n->desc.wait.revents;
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	return revents;
+}
+
+
+static void evnote_remove(evqueue_t *q, evnote_t *n)
+{
+	spinlock_ctx_t sc;
+
+	/* No notifications arrive after this */
+	poll_descDone(&n->desc);
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if (n->queued)
+		LIST_REMOVE(&q->ready, n);
+
+	if (n->fnext != NULL)
+		LIST_REMOVE_EX(&n->file->notes, n, fnext, fprev);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	if (n->desc.legacy)
+		LIST_REMOVE_EX(&q->legacy, n, lnext, lprev);
+
+	lib_rbRemove(&q->notes, &n->linkage);
+	vm_kfree(n);
+}
+
+
+static int evnote_add(evqueue_t *q, process_info_t *p, open_file_t *f, const struct pollevent *ev)
+{
+	evnote_t *n;
+	int revents;
+	spinlock_ctx_t sc;
+
+	/* Queues can't watch each other, keeps notification from recursing */
+	if (f->type == ftEventQueue)
+		return -EINVAL;
+
+	if ((n = vm_kmalloc(sizeof(evnote_t))) == NULL)
+		return -ENOMEM;
+
+	hal_memset(n, 0, sizeof(evnote_t));
+	n->queue = q;
+	n->owner = p;
+	n->file = f;
+	n->fd = ev->fd;
+	n->data = ev->data;
+	n->flags = ev->flags & (evDisable | evOneshot | evClear | evDispatch);
+	n->desc.wait.notify = evnote_notify;
+	n->desc.wait.events = ev->events;
+
+	lib_rbInsert(&q->notes, &n->linkage);
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	LIST_ADD_EX(&f->notes, n, fnext, fprev);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	if ((revents = poll_descInit(&n->desc, ev->fd, 1)) < 0) {
+		evnote_remove(q, n);
+		return revents;
+	}
+
+	/* Descriptor closed meanwhile, closing missed this note */
+	proc_lockSet(&p->lock);
+	revents = (_fd_file(p, ev->fd) == f) ? revents : -EBADF;
+	proc_lockClear(&p->lock);
+
+	if (revents < 0) {
+		evnote_remove(q, n);
+		return revents;
+	}
+
+	if (n->desc.legacy)
+		LIST_ADD_EX(&q->legacy, n, lnext, lprev);
+
+	/* Readiness may have been posted meanwhile, don't lose either */
+	if (n->desc.type != ftUnixSocket && !n->desc.legacy) {
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		n->desc.wait.revents |= revents;
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+	}
+
+	evnote_check(n, revents);
+
+	return EOK;
+}
+
+
+static void evqueue_pollLegacy(evqueue_t *q)
+{
+	evnote_t *n;
+
+	if ((n = q->legacy) == NULL)
+		return;
+
+	do
+		evnote_check(n, poll_objStatus(&n->desc.oid, n->desc.wait.events));
+	while ((n = n->lnext) != q->legacy);
+}
+
+
+static int evqueue_harvest(evqueue_t *q, struct pollevent *evs, int maxevents)
+{
+	evnote_t *n, *requeue = NULL;
+	int count = 0, revents;
+	spinlock_ctx_t sc;
+
+	while (count < maxevents) {
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		if ((n = q->ready) != NULL) {
+			LIST_REMOVE(&q->ready, n);
+			n->queued = 0;
+		}
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+		if (n == NULL)
+			break;
+
+		/* Report current state, readiness might have been consumed since it was posted */
+		if ((revents = evnote_status(n)) < 0) {
+			evnote_check(n, n->desc.wait.events);
+			if (!count)
+				count = revents;
+			break;
+		}
+
+		if (!(revents &= ~(~n->desc.wait.events & (POLLIN|POLLOUT|POLLPRI|POLLRDNORM|POLLWRNORM|POLLRDBAND|POLLWRBAND))))
+			continue;
+
+		evs[count].fd = n->fd;
+		evs[count].flags = 0;
+		evs[count].events = revents;
+		evs[count].data = n->data;
+		++count;
+
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		if (n->flags & evDispatch) {
+			n->flags |= evDisable;
+		}
+		else if (!(n->flags & (evClear | evOneshot))) {
+			/* Level triggered - check again on next wait, keep notifications off meanwhile */
+			n->queued = 1;
+			LIST_ADD(&requeue, n);
+		}
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+		if (n->flags & evOneshot)
+			evnote_remove(q, n);
+	}
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	while ((n = requeue) != NULL) {
+		LIST_REMOVE(&requeue, n);
+		LIST_ADD(&q->ready, n);
+	}
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	return count;
+}
+
+
+static void evqueue_destroy(evqueue_t *q)
+{
+	rbnode_t *node;
+
+	proc_lockSet(&posix_common.evlock);
+	proc_lockSet(&q->lock);
+	while ((node = q->notes.root) != NULL)
+		evnote_remove(q, lib_treeof(evnote_t, linkage, node));
+	proc_lockClear(&q->lock);
+	proc_lockClear(&posix_common.evlock);
+
+	proc_lockDone(&q->lock);
+	vm_kfree(q);
+}
+
+
+/* Notes go away with the descriptor, called before the file is dereferenced and with p->lock released */
+static void evqueue_fdClosed(process_info_t *p, int fd, open_file_t *f)
+{
+	evqueue_t *q;
+	evnote_t *n, t;
+	spinlock_ctx_t sc;
+
+	t.owner = p;
+	t.file = f;
+	t.fd = fd;
+
+	/* Files never watched cost a spinlock only */
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	n = _evnote_find(f, p, fd);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	if (n == NULL)
+		return;
+
+	proc_lockSet(&posix_common.evlock);
+
+	for (;;) {
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		q = ((n = _evnote_find(f, p, fd)) != NULL) ? n->queue : NULL;
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+		if (q == NULL)
+			break;
+
+		/* Note may be removed before the queue lock is taken, look it up again */
+		proc_lockSet(&q->lock);
+		if ((n = lib_treeof(evnote_t, linkage, lib_rbFind(&q->notes, &t.linkage))) != NULL)
+			evnote_remove(q, n);
+		proc_lockClear(&q->lock);
+	}
+
+	proc_lockClear(&posix_common.evlock);
+}
+
+
+static int evqueue_get(int evfd, open_file_t **f)
+{
+	int err;
+
+	if ((err = posix_getOpenFile(evfd, f)) < 0)
+		return err;
+
+	if ((*f)->type != ftEventQueue) {
+		posix_fileDeref(*f);
+		return -EINVAL;
+	}
+
+	return EOK;
+}
+
+
+int posix_eventQueue(void)
+{
+	TRACE("eventQueue()");
+
+	process_info_t *p;
+	open_file_t *f;
+	evqueue_t *q;
+	int fd;
+
+	if ((p = pinfo_current()) == NULL)
+		return -1;
+
+	if ((q = vm_kmalloc(sizeof(evqueue_t))) == NULL)
+		return -ENOMEM;
+
+	if ((f = file_alloc()) == NULL) {
+		vm_kfree(q);
+		return -ENOMEM;
+	}
+
+	if ((fd = posix_fdAlloc(p, 0)) < 0) {
+		file_discard(f);
+		vm_kfree(q);
+		return -EMFILE;
+	}
+
+	lib_rbInit(&q->notes, evnote_cmp, NULL);
+	proc_lockInit(&q->lock, "evqueue.lock");
+	q->legacy = NULL;
+	q->ready = NULL;
+	q->waitq = NULL;
+	poll_headInit(&q->poll);
+
+	f->type = ftEventQueue;
+	f->oid.port = US_PORT;
+	f->oid.id = 0;
+	f->evqueue = q;
+
+	posix_fdInstall(p, fd, f, 0);
+	return fd;
 }
 
 
-int posix_listen(int socket, int backlog)
+int posix_eventCtl(int evfd, const struct pollevent *ev)
 {
-	TRACE("listen(%d, %d)", socket, backlog);
+	TRACE("eventCtl(%d, %d, %x)", evfd, ev->fd, ev->flags);
 
-	open_file_t *f;
+	process_info_t *p;
+	open_file_t *f, *wf;
+	evqueue_t *q;
+	evnote_t *n, t;
 	int err;
+	spinlock_ctx_t sc;
 
-	if (!(err = posix_getOpenFile(socket, &f))) {
-		switch (f->type) {
-		case ftInetSocket:
-			err = inet_listen(f->oid.port, backlog);
-			break;
-		case ftUnixSocket:
-			err = unix_listen(f->oid.id, backlog);
-			break;
-		default:
-			err = -ENOTSOCK;
-			break;
-		}
+	if ((p = pinfo_current()) == NULL)
+		return -1;
+
+	if ((err = evqueue_get(evfd, &f)) < 0)
+		return err;
 
+	if ((err = posix_getOpenFile(ev->fd, &wf)) < 0) {
 		posix_fileDeref(f);
+		return err;
 	}
 
-	return err;
-}
-
+	q = f->evqueue;
+	t.owner = p;
+	t.file = wf;
+	t.fd = ev->fd;
 
-ssize_t posix_recvfrom(int socket, void *message, size_t length, int flags, struct sockaddr *src_addr, socklen_t *src_len)
-{
-	TRACE("recvfrom(%d, %d, %s)", socket, length, src_addr == NULL ? NULL : src_addr->sa_data);
+	proc_lockSet(&q->lock);
 
-	open_file_t *f;
-	int err;
+	do {
+		n = lib_treeof(evnote_t, linkage, lib_rbFind(&q->notes, &t.linkage));
 
-	if (!(err = posix_getOpenFile(socket, &f))) {
-		switch (f->type) {
-		case ftInetSocket:
-			err = inet_recvfrom(f->oid.port, message, length, flags, src_addr, src_len);
-			break;
-		case ftUnixSocket:
-			err = unix_recvfrom(f->oid.id, message, length, flags, src_addr, src_len);
+		if (ev->flags & evDelete) {
+			if (n == NULL)
+				err = -ENOENT;
+			else
+				evnote_remove(q, n);
 			break;
-		default:
-			err = -ENOTSOCK;
+		}
+
+		if (n == NULL) {
+			err = (ev->flags & evAdd) ? evnote_add(q, p, wf, ev) : -ENOENT;
 			break;
 		}
 
-		posix_fileDeref(f);
-	}
+		/* Modify existing note, evAdd also re-arms it */
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		if (ev->flags & evAdd) {
+			n->desc.wait.events = ev->events;
+			n->data = ev->data;
+			n->flags = ev->flags & (evDisable | evOneshot | evClear | evDispatch);
+		}
+		else if (ev->flags & evDisable) {
+			n->flags |= evDisable;
+		}
+		else if (ev->flags & evEnable) {
+			n->flags &= ~evDisable;
+		}
+
+		if ((n->flags & evDisable) && n->queued) {
+			LIST_REMOVE(&q->ready, n);
+			n->queued = 0;
+		}
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+		if (!(n->flags & evDisable))
+			evnote_check(n, evnote_status(n));
+	} while (0);
+
+	proc_lockClear(&q->lock);
+	posix_fileDeref(wf);
+	posix_fileDeref(f);
 
 	return err;
 }
 
 
-ssize_t posix_sendto(int socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len)
+int posix_eventWait(int evfd, struct pollevent *evs, int maxevents, int timeout_ms)
 {
-	TRACE("sendto(%d, %s, %d, %s)", socket, message, length, dest_addr == NULL ? NULL : dest_addr->sa_data);
-
 	open_file_t *f;
-	int err;
+	evqueue_t *q;
+	time_t deadline = 0, now, unused, wait;
+	int ready = 0, err = EOK;
+	spinlock_ctx_t sc;
 
-	if (!(err = posix_getOpenFile(socket, &f))) {
-		switch (f->type) {
-		case ftInetSocket:
-			err = inet_sendto(f->oid.port, message, length, flags, dest_addr, dest_len);
-			break;
-		case ftUnixSocket:
-			err = unix_sendto(f->oid.id, message, length, flags, dest_addr, dest_len);
-			break;
-		default:
-			err = -ENOTSOCK;
-			break;
-		}
+	if (maxevents <= 0)
+		return -EINVAL;
 
-		posix_fileDeref(f);
-	}
+	if ((err = evqueue_get(evfd, &f)) < 0)
+		return err;
 
-	return err;
-}
+	q = f->evqueue;
 
+	if (timeout_ms > 0) {
+		proc_gettime(&deadline, &unused);
+		deadline += timeout_ms * 1000LL;
+	}
 
-int posix_shutdown(int socket, int how)
-{
-	TRACE("shutdown(%d, %d)", socket, how);
+	proc_lockSet(&q->lock);
 
-	open_file_t *f;
-	int err;
+	/* Cost depends on number of ready notes only, unless some servers don't post readiness */
+	while (!(ready = evqueue_harvest(q, evs, maxevents)) && timeout_ms) {
+		wait = 0;
 
-	if (!(err = posix_getOpenFile(socket, &f))) {
-		switch (f->type) {
-		case ftInetSocket:
-			err = inet_shutdown(f->oid.port, how);
-			break;
-		case ftUnixSocket:
-			err = unix_shutdown(f->oid.id, how);
-			break;
-		default:
-			err = -ENOTSOCK;
-			break;
+		if (timeout_ms > 0) {
+			proc_gettime(&now, &unused);
+			if (now >= deadline)
+				break;
+
+			wait = deadline - now;
 		}
 
-		posix_fileDeref(f);
-	}
+		if (q->legacy != NULL && (!wait || wait > POLL_INTERVAL))
+			wait = POLL_INTERVAL;
 
-	return err;
-}
+		proc_lockClear(&q->lock);
 
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		while (q->ready == NULL && err == EOK)
+			err = proc_threadWaitInterruptible(&q->waitq, &posix_common.pollSpinlock, wait, &sc);
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
 
-int posix_setsockopt(int socket, int level, int optname, const void *optval, socklen_t optlen)
-{
-	open_file_t *f;
-	int err;
+		proc_lockSet(&q->lock);
 
-	if (!(err = posix_getOpenFile(socket, &f))) {
-		switch (f->type) {
-		case ftInetSocket:
-			err = inet_setsockopt(f->oid.port, level, optname, optval, optlen);
-			break;
-		case ftUnixSocket:
-			err = unix_setsockopt(f->oid.id, level, optname, optval, optlen);
-			break;
-		default:
-			err = -ENOTSOCK;
+		if (err == -EINTR) {
+			ready = -EINTR;
 			break;
 		}
 
-		posix_fileDeref(f);
+		if (err == -ETIME)
+			evqueue_pollLegacy(q);
+
+		err = EOK;
 	}
 
-	return err;
+	proc_lockClear(&q->lock);
+	posix_fileDeref(f);
+
+	return ready;
 }
 
 
-/* Just a stub to support busybox' touch */
-int posix_utimes(const char *filename, const struct timeval *times)
+/*
+ * Timers
+ */
+
+
+/* Called from timer interrupt */
+static void ptimer_expire(ktimer_t *timer)
 {
-	oid_t oid;
+	ptimer_t *t = lib_containerof(ptimer_t, timer, timer);
+	time_t now = proc_timestamp();
+	u64 n = 0;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+
+	/* Timer may have been set again meanwhile */
+	if (t->expires && t->expires <= now) {
+		n = 1;
+
+		/* Next deadline follows the previous one, not now, so periodic timer doesn't drift */
+		if (t->interval) {
+			n += (now - t->expires) / t->interval;
+			t->expires += n * t->interval;
+			ktimer_arm(&t->timer, TIMER_US2CYC(t->expires), 0);
+		}
+		else {
+			t->expires = 0;
+		}
 
-	if (proc_lookup(filename, NULL, &oid) < 0)
-		return -ENOENT;
+		t->count += n;
+		proc_threadWakeup(&t->waitq);
+		_poll_notify(&t->poll, POLLIN | POLLRDNORM);
 
-	return 0;
+		/* Target can't be looked up from interrupt, ptimer_thread signals it */
+		if (t->sig && t->next == NULL) {
+			LIST_ADD(&posix_common.fired, t);
+			proc_threadWakeup(&posix_common.timerq);
+		}
+	}
+
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
 }
 
 
-static int do_poll_iteration(struct pollfd *fds, nfds_t nfds)
+/* Target is looked up by id, so a timer doesn't keep its process or thread alive */
+static void ptimer_thread(void *arg)
 {
-	msg_t msg;
-	size_t ready, i;
-	int err;
-	open_file_t *f;
+	ptimer_t *t;
+	process_t *process;
+	thread_t *thread;
+	pid_t pid;
+	int tid, sig;
+	spinlock_ctx_t sc;
 
-	hal_memset(&msg, 0, sizeof(msg));
+	for (;;) {
+		hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+		while ((t = posix_common.fired) == NULL)
+			proc_threadWait(&posix_common.timerq, &posix_common.pollSpinlock, 0, &sc);
 
-	msg.type = mtGetAttr;
-	msg.i.attr.type = atPollStatus;
+		LIST_REMOVE(&posix_common.fired, t);
+		pid = t->pid;
+		tid = t->tid;
+		sig = t->sig;
+		hal_spinlockClear(&posix_common.pollSpinlock, &sc);
 
-	for (ready = i = 0; i < nfds; ++i) {
-		if (fds[i].fd < 0)
+		if ((process = proc_find(pid)) == NULL)
 			continue;
 
-		msg.i.attr.val = fds[i].events;
+		thread = (tid != 0) ? threads_findThread(tid) : NULL;
 
-		if (posix_getOpenFile(fds[i].fd, &f) < 0) {
-			err = POLLNVAL;
-		}
-		else {
-			hal_memcpy(&msg.i.attr.oid, &f->oid, sizeof(oid_t));
-			posix_fileDeref(f);
+		/* Thread which is gone takes its timer's signals with it */
+		if (tid == 0 || (thread != NULL && thread->process == process))
+			threads_sigpend(process, thread, sig);
 
-			if (!(err = proc_send(msg.i.attr.oid.port, &msg)))
-				err = msg.o.attr.val;
-		}
+		if (thread != NULL)
+			threads_put(thread);
+
+		proc_put(process);
+	}
+}
 
-		if (err == -EINTR)
-			return err;
 
-		if (err < 0)
-			fds[i].revents |= POLLHUP;
-		else if (err > 0)
-			fds[i].revents |= err;
+static void ptimer_destroy(ptimer_t *t)
+{
+	spinlock_ctx_t sc;
 
-		fds[i].revents &= ~(~fds[i].events & (POLLIN|POLLOUT|POLLPRI|POLLRDNORM|POLLWRNORM|POLLRDBAND|POLLWRBAND));
+	/* Running handler won't arm it again */
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	t->expires = 0;
+	t->interval = 0;
+	ktimer_cancel(&t->timer);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
 
-		if (fds[i].revents)
-			++ready;
-	}
+	ktimer_done(&t->timer);
 
-	return ready;
+	/* Handler which was running may have queued it */
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	if (t->next != NULL)
+		LIST_REMOVE(&posix_common.fired, t);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	vm_kfree(t);
 }
 
-#if 1
-int posix_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+
+/* Returns number of expirations since last read, buf may be user memory */
+static int ptimer_read(ptimer_t *t, void *buf, size_t nbyte, int nonblock)
 {
-	size_t i, n, ready;
-	time_t timeout, now, unused;
+	u64 count;
+	int err = EOK;
+	spinlock_ctx_t sc;
 
-	for (i = n = 0; i < nfds; ++i) {
-		fds[i].revents = 0;
-		if (fds[i].fd >= 0)
-			++n;
-	}
+	if (nbyte < sizeof(count))
+		return -EINVAL;
 
-	if (!n) {
-		if (timeout_ms > 0)
-			proc_threadSleep(timeout_ms * 1000LL);
-		return 0;
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	while (t->count == 0 && !nonblock && err == EOK)
+		err = proc_threadWaitInterruptible(&t->waitq, &posix_common.pollSpinlock, 0, &sc);
+
+	if ((count = t->count) != 0) {
+		t->count = 0;
+		_poll_notify(&t->poll, 0);
 	}
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
 
-	if (timeout_ms >= 0) {
-		proc_gettime(&timeout, &unused);
-		timeout += timeout_ms * 1000LL + !timeout_ms;
-	} else
-		timeout = 0;
+	if (count == 0)
+		return (err < 0) ? err : -EAGAIN;
 
-	while (!(ready = do_poll_iteration(fds, nfds))) {
-		if (timeout) {
-			proc_gettime(&now, &unused);
-			if (now > timeout)
-				break;
+	hal_memcpy(buf, &count, sizeof(count));
+
+	return sizeof(count);
+}
+
+
+static int ptimer_get(int fd, open_file_t **f)
+{
+	int err;
 
-			now = timeout - now;
-			if (now > POLL_INTERVAL)
-				now = POLL_INTERVAL;
-		} else
-			now = POLL_INTERVAL;
+	if ((err = posix_getOpenFile(fd, f)) < 0)
+		return err;
 
-		proc_threadSleep(now);
+	if ((*f)->type != ftTimer) {
+		posix_fileDeref(*f);
+		return -EINVAL;
 	}
 
-	return ready;
+	return EOK;
 }
 
-#else
 
-int posix_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+int posix_timerCreate(int sig, int tid, int flags)
 {
-	int err, i, j;
-	int queue;
-	msg_t msg;
-	open_file_t *f, *q;
+	TRACE("timerCreate(%d, %d, %x)", sig, tid, flags);
+
+	process_info_t *p;
+	open_file_t *f;
+	ptimer_t *t;
+	thread_t *thread;
+	int fd, err = EOK;
+
+	if (sig < 0 || sig >= NSIG)
+		return -EINVAL;
+
+	if ((p = pinfo_current()) == NULL)
+		return -1;
+
+	if ((t = vm_kmalloc(sizeof(ptimer_t))) == NULL)
+		return -ENOMEM;
+
+	hal_memset(t, 0, sizeof(ptimer_t));
+	ktimer_init(&t->timer, ptimer_expire);
+	poll_headInit(&t->poll);
+	t->sig = sig;
+
+	/* Signal goes to the creating process, or its thread */
+	t->pid = proc_current()->process->id;
+
+	if (sig && tid) {
+		if ((thread = threads_findThread(tid)) == NULL || thread->process != proc_current()->process)
+			err = -EINVAL;
+		else
+			t->tid = tid;
+
+		if (thread != NULL)
+			threads_put(thread);
+	}
 
-	evsub_t subs_stack[4];
-	evsub_t *subs = subs_stack;
-	event_t events[8];
+	if (err == EOK && (f = file_alloc()) == NULL)
+		err = -ENOMEM;
 
-	/* fast path */
-	if ((err = do_poll_iteration(fds, nfds)))
+	if (err < 0) {
+		ptimer_destroy(t);
 		return err;
-	else if (!timeout_ms)
-		return 0;
+	}
 
-	if ((queue = posix_open("/dev/event/queue", O_RDWR, NULL)) < 0)
-		return queue;
+	if ((fd = posix_fdAlloc(p, 0)) < 0) {
+		file_discard(f);
+		ptimer_destroy(t);
+		return -EMFILE;
+	}
 
-	do {
-		if (posix_getOpenFile(queue, &q) < 0)
-			return -EAGAIN; /* should not happen? */
+	f->type = ftTimer;
+	f->oid.port = US_PORT;
+	f->oid.id = 0;
+	f->status = O_RDONLY | (flags & TFD_NONBLOCK);
+	f->ptimer = t;
 
-		if ((nfds > sizeof(subs_stack) / sizeof(evsub_t)) && (subs = vm_kmalloc(nfds * sizeof(evsub_t))) == NULL)
-			return -ENOMEM;
+	posix_fdInstall(p, fd, f, (flags & TFD_CLOEXEC) ? FD_CLOEXEC : 0);
+	return fd;
+}
 
-		hal_memset(subs, 0, nfds * sizeof(evsub_t));
 
-		do {
-			err = EOK;
+/* Absolute value is compared with proc_uptime(), ovalue is relative */
+int posix_timerSet(int fd, int flags, const struct timerspec *value, struct timerspec *ovalue)
+{
+	TRACE("timerSet(%d, %x)", fd, flags);
 
-			for (i = 0; i < nfds; ++i) {
-				if (fds[i].fd < 0)
-					continue;
+	open_file_t *f;
+	ptimer_t *t;
+	struct timerspec ts, ots;
+	time_t now;
+	int err;
+	spinlock_ctx_t sc;
 
-				if ((err = posix_getOpenFile(fds[i].fd, &f))) {
-					fds[i].revents = POLLNVAL;
-					continue;
-				}
+	if ((err = ptimer_get(fd, &f)) < 0)
+		return err;
 
-				hal_memcpy(&subs[i].oid, &f->oid, sizeof(oid_t));
-				subs[i].flags = evAdd;
-				subs[i].types = fds[i].events;
-			}
+	t = f->ptimer;
+	hal_memcpy(&ts, value, sizeof(ts));
+	now = proc_uptime();
 
-			if (err)
-				break;
+	if (ts.value && !(flags & TFD_TIMER_ABSTIME))
+		ts.value += now;
 
-			msg.type = mtRead;
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	ots.value = (t->expires > now) ? t->expires - now : 0;
+	ots.interval = t->interval;
 
-			hal_memcpy(&msg.i.io.oid, &q->oid, sizeof(oid_t));
-			msg.i.io.len = (unsigned)timeout_ms;
+	t->expires = ts.value;
+	t->interval = ts.interval;
+	t->count = 0;
+	_poll_notify(&t->poll, 0);
 
-			msg.i.data = subs;
-			msg.i.size = nfds * sizeof(evsub_t);
+	if (ts.value)
+		ktimer_arm(&t->timer, TIMER_US2CYC(ts.value), 0);
+	else
+		ktimer_cancel(&t->timer);
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
 
-			msg.o.data = events;
-			msg.o.size = sizeof(events);
+	if (ts.value)
+		proc_wakeupUpdate();
 
-			if ((err = proc_send(q->oid.port, &msg)))
-				break;
+	if (ovalue != NULL)
+		hal_memcpy(ovalue, &ots, sizeof(ots));
 
-			if ((err = msg.o.io.err) < 0)
-				break;
+	posix_fileDeref(f);
 
-			if (!err)
-				break;
+	return EOK;
+}
 
-			for (i = 0; i < msg.o.io.err; ++i) {
-				for (j = 0; j < nfds; ++j) {
-					if (hal_memcmp(&events[i].oid, &subs[j].oid, sizeof(oid_t)))
-						continue;
 
-					fds[j].revents |= 1 << events[i].type;
-				}
-			}
+int posix_timerGet(int fd, struct timerspec *value)
+{
+	open_file_t *f;
+	ptimer_t *t;
+	struct timerspec ts;
+	time_t now;
+	int err;
+	spinlock_ctx_t sc;
 
-		} while (0);
+	if ((err = ptimer_get(fd, &f)) < 0)
+		return err;
 
-		if (subs != subs_stack)
-			vm_kfree(subs);
-	} while (0);
+	t = f->ptimer;
+	now = proc_uptime();
 
-	posix_close(queue);
-	return err;
+	hal_spinlockSet(&posix_common.pollSpinlock, &sc);
+	ts.value = (t->expires > now) ? t->expires - now : 0;
+	ts.interval = t->interval;
+	hal_spinlockClear(&posix_common.pollSpinlock, &sc);
+
+	hal_memcpy(value, &ts, sizeof(ts));
+	posix_fileDeref(f);
+
+	return EOK;
 }
-#endif
 
 
 static int posix_killOne(pid_t pid, int tid, int sig)
@@ -2229,6 +4392,11 @@ int posix_waitpid(pid_t child, int *status, int options)
 		if (status != NULL)
 			*status = c->exitcode;
 
+		proc_lockSet(&pinfo->lock);
+		proc_usageAdd(&pinfo->cusage, &c->usage);
+		proc_usageAdd(&pinfo->cusage, &c->cusage);
+		proc_lockClear(&pinfo->lock);
+
 		pinfo_put(c);
 	}
 
@@ -2237,7 +4405,7 @@ int posix_waitpid(pid_t child, int *status, int options)
 }
 
 
-void posix_died(pid_t pid, int exit)
+void posix_died(pid_t pid, int exit, const usageinfo_t *usage)
 {
 	process_info_t *pinfo, *ppinfo;
 
@@ -2246,6 +4414,8 @@ void posix_died(pid_t pid, int exit)
 
 	posix_exit(pinfo, exit);
 
+	hal_memcpy(&pinfo->usage, usage, sizeof(usageinfo_t));
+
 	if ((ppinfo = pinfo_find(pinfo->parent)) == NULL) {
 		// posix_destroy(pinfo);
 	}
@@ -2261,7 +4431,25 @@ void posix_died(pid_t pid, int exit)
 		pinfo_put(ppinfo);
 	}
 
+	/* Reference cached by the process */
+	pinfo_put(pinfo);
+	pinfo_put(pinfo);
+}
+
+
+int posix_childrenUsage(pid_t pid, usageinfo_t *info)
+{
+	process_info_t *pinfo;
+
+	if ((pinfo = pinfo_find(pid)) == NULL)
+		return -ESRCH;
+
+	proc_lockSet(&pinfo->lock);
+	hal_memcpy(info, &pinfo->cusage, sizeof(usageinfo_t));
+	proc_lockClear(&pinfo->lock);
+
 	pinfo_put(pinfo);
+	return EOK;
 }
 
 
@@ -2283,8 +4471,17 @@ pid_t posix_getppid(pid_t pid)
 
 void posix_init(void)
 {
-	proc_lockInit(&posix_common.lock);
+	proc_lockInit(&posix_common.lock, "posix_common.lock");
 	lib_rbInit(&posix_common.pid, pinfo_cmp, NULL);
+	hal_spinlockCreate(&posix_common.pollSpinlock, "posix_common.pollSpinlock");
+	lib_rbInit(&posix_common.pollobjs, pollobj_cmp, NULL);
+	hal_spinlockCreate(&posix_common.fileSpinlock, "posix_common.fileSpinlock");
+	posix_common.files = NULL;
+	proc_lockInit(&posix_common.evlock, "posix_common.evlock");
 	unix_sockets_init();
+	inet_sockets_init();
 	posix_common.fresh = 0;
+	posix_common.fired = NULL;
+	posix_common.timerq = NULL;
+	proc_threadCreate(NULL, ptimer_thread, NULL, 0, SIZE_KSTACK, NULL, 0, NULL);
 }
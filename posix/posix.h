@@ -17,6 +17,7 @@
 #define _PROC_POSIX_H_
 
 #include "../include/posix.h"
+#include "../include/sysinfo.h"
 #include "sockport.h"
 
 typedef int off_t;
@@ -35,6 +36,18 @@ extern int posix_read(int fildes, void *buf, size_t nbyte);
 extern int posix_write(int fildes, void *buf, size_t nbyte);
 
 
+extern ssize_t posix_readv(int fildes, const struct iovec *iov, int iovcnt);
+
+
+extern ssize_t posix_writev(int fildes, const struct iovec *iov, int iovcnt);
+
+
+extern ssize_t posix_preadv(int fildes, const struct iovec *iov, int iovcnt, off_t offset);
+
+
+extern ssize_t posix_pwritev(int fildes, const struct iovec *iov, int iovcnt, off_t offset);
+
+
 extern int posix_dup(int fildes);
 
 
@@ -62,6 +75,10 @@ extern int posix_fork(void);
 extern int posix_pipe(int fildes[2]);
 
 
+/* Moves data between descriptors without passing it through user space */
+extern ssize_t posix_sendfile(int outfd, int infd, off_t *offset, size_t count);
+
+
 extern int posix_mkfifo(const char *path, mode_t mode);
 
 
@@ -110,6 +127,18 @@ extern ssize_t posix_recvfrom(int socket, void *message, size_t length, int flag
 extern ssize_t posix_sendto(int socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len);
 
 
+extern int posix_sendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+
+extern int posix_recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+
+extern ssize_t posix_sendmsg(int socket, const struct msghdr *msg, int flags);
+
+
+extern ssize_t posix_recvmsg(int socket, struct msghdr *msg, int flags);
+
+
 extern int posix_socket(int domain, int type, int protocol);
 
 
@@ -125,6 +154,28 @@ extern int posix_ioctl(int fildes, unsigned long request, char *ustack);
 extern int posix_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms);
 
 
+/* Posts readiness of a server object (oid) to threads polling it */
+extern int posix_pollNotify(oid_t *oid, unsigned events);
+
+
+extern int posix_eventQueue(void);
+
+
+extern int posix_eventCtl(int evfd, const struct pollevent *ev);
+
+
+extern int posix_eventWait(int evfd, struct pollevent *evs, int maxevents, int timeout_ms);
+
+
+extern int posix_timerCreate(int sig, int tid, int flags);
+
+
+extern int posix_timerSet(int fd, int flags, const struct timerspec *value, struct timerspec *ovalue);
+
+
+extern int posix_timerGet(int fd, struct timerspec *value);
+
+
 extern int posix_utimes(const char *filename, const struct timeval *times);
 
 
@@ -146,7 +197,10 @@ extern pid_t posix_getppid(pid_t pid);
 extern pid_t posix_setsid(void);
 
 
-extern void posix_died(pid_t pid, int exit);
+extern void posix_died(pid_t pid, int exit, const usageinfo_t *usage);
+
+
+extern int posix_childrenUsage(pid_t pid, usageinfo_t *info);
 
 
 extern int posix_waitpid(pid_t child, int *status, int options);
@@ -6,6 +6,12 @@
 
 #define US_PORT (-1) /* FIXME */
 
+/* Largest kernel pipe write guaranteed not to interleave (PIPE_BUF) */
+#define US_PIPE_BUF SIZE_PAGE
+
+/* Most descriptors passed in one message */
+#define SCM_MAX_FD 64
+
 
 #define SIGHUP     1
 #define SIGINT     2
@@ -47,14 +53,15 @@
 #define SIG_IGN (-3)
 
 
-enum { ftRegular, ftPipe, ftFifo, ftInetSocket, ftUnixSocket, ftTty };
+/* ftNone marks files released before being installed, there is nothing to close */
+enum { ftRegular, ftPipe, ftFifo, ftInetSocket, ftUnixSocket, ftTty, ftEventQueue, ftTimer, ftNone };
 
 
 /* FIXME: share with posixsrv */
 enum { pxBufferedPipe, pxPipe, pxPTY };
 
 
-typedef struct {
+typedef struct _open_file_t {
 	oid_t ln;
 	oid_t oid;
 	unsigned refs;
@@ -62,6 +69,10 @@ typedef struct {
 	unsigned status;
 	lock_t lock;
 	char type;
+	struct _evqueue_t *evqueue;
+	struct _ptimer_t *ptimer;
+	struct _evnote_t *notes;
+	struct _open_file_t *next;
 } open_file_t;
 
 
@@ -71,6 +82,54 @@ typedef struct {
 } fildes_t;
 
 
+/* Descriptor table, read without locking - replaced tables are kept until process is destroyed */
+typedef struct _fdtable_t {
+	struct _fdtable_t *retired;
+	int size;
+	u32 *used;
+	fildes_t fds[];
+} fdtable_t;
+
+
+/* Readiness notification: object side */
+typedef struct {
+	struct _pollwait_t *waiters;
+} pollhead_t;
+
+
+/* Readiness notification: subscriber side, one per polled descriptor */
+typedef struct _pollwait_t {
+	struct _pollwait_t *next, *prev;
+	struct _pollsync_t *sync;
+	pollhead_t *head;
+	void (*notify)(struct _pollwait_t *wait);
+
+	unsigned events;
+	unsigned revents;
+} pollwait_t;
+
+
+typedef struct _pollsync_t {
+	thread_t *queue;
+	volatile int woken;
+} pollsync_t;
+
+
+/* Ancillary data travelling with a unix socket message, owns references to the passed files */
+typedef struct _unixctl_t {
+	struct _unixctl_t *next, *prev;
+	size_t pos;     /* Stream offset of the first byte it is attached to */
+	int hascred;
+	struct ucred cred;
+	int nfiles;
+	open_file_t *files[];
+} unixctl_t;
+
+
+/* Moves data to or from a kernel buffer in place, returns bytes moved */
+typedef int (*splicefn_t)(void *arg, void *data, size_t len);
+
+
 typedef struct _process_info_t {
 	rbnode_t linkage;
 	int process;
@@ -86,8 +145,11 @@ typedef struct _process_info_t {
 
 	pid_t pgid;
 	lock_t lock;
-	int maxfd;
-	fildes_t *fds;
+	fdtable_t *fdt;
+
+	/* Own usage at exit, and usage of children waited for */
+	usageinfo_t usage;
+	usageinfo_t cusage;
 } process_info_t;
 
 
@@ -114,10 +176,22 @@ struct rtentry
 extern void splitname(char *path, char **base, char **dir);
 
 
-extern int posix_newFile(process_info_t *p, int fd);
+extern process_info_t *pinfo_find(unsigned int pid);
 
 
-extern process_info_t *pinfo_find(unsigned int pid);
+extern void posix_ctlFree(unixctl_t *ctl);
+
+
+extern void poll_headInit(pollhead_t *head);
+
+
+extern void poll_subscribe(pollhead_t *head, pollwait_t *wait);
+
+
+extern void poll_unsubscribe(pollwait_t *wait);
+
+
+extern void poll_notify(pollhead_t *head, unsigned events);
 
 
 extern int inet_accept(unsigned socket, struct sockaddr *address, socklen_t *address_len);
@@ -156,6 +230,18 @@ extern int inet_shutdown(unsigned socket, int how);
 extern int inet_setsockopt(unsigned socket, int level, int optname, const void *optval, socklen_t optlen);
 
 
+extern int inet_flush(unsigned socket, int flags);
+
+
+extern int inet_poll(unsigned socket);
+
+
+extern int inet_close(unsigned socket);
+
+
+extern void inet_sockets_init(void);
+
+
 extern int unix_accept(unsigned socket, struct sockaddr *address, socklen_t *address_len);
 
 
@@ -183,6 +269,12 @@ extern ssize_t unix_recvfrom(unsigned socket, void *message, size_t length, int
 extern ssize_t unix_sendto(unsigned socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len);
 
 
+extern ssize_t unix_recvmsg(unsigned socket, void *message, size_t length, int flags, struct sockaddr *src_addr, socklen_t *src_len, unixctl_t **ctl, int *msgflags);
+
+
+extern ssize_t unix_sendmsg(unsigned socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len, unixctl_t *ctl);
+
+
 extern int unix_socket(int domain, int type, int protocol);
 
 
@@ -198,4 +290,40 @@ extern int unix_unlink(unsigned socket);
 extern int unix_setsockopt(unsigned socket, int level, int optname, const void *optval, socklen_t optlen);
 
 
+extern int unix_poll(unsigned socket, pollwait_t *wait);
+
+
+extern void unix_pollDone(unsigned socket, pollwait_t *wait);
+
+
+extern int unix_pipe(unsigned socket[2]);
+
+
+extern int unix_fifo(unsigned *socket);
+
+
+extern int unix_isFifo(unsigned socket);
+
+
+extern int unix_isStream(unsigned socket);
+
+
+extern int unix_fifoOpen(unsigned socket, int oflag);
+
+
+extern int unix_pipeClose(unsigned socket);
+
+
+extern ssize_t unix_pipeRead(unsigned socket, void *buf, size_t len, int flags);
+
+
+extern ssize_t unix_pipeWrite(unsigned socket, const void *buf, size_t len, int flags);
+
+
+extern ssize_t unix_spliceWrite(unsigned socket, splicefn_t fill, void *arg, size_t len, int flags);
+
+
+extern ssize_t unix_spliceRead(unsigned socket, splicefn_t drain, void *arg, size_t len, int flags);
+
+
 extern void unix_sockets_init(void);
@@ -24,200 +24,409 @@
 #define US_LISTENING (1 << 1)
 #define US_ACCEPTING (1 << 2)
 #define US_CONNECTING (1 << 3)
+#define US_PIPE_R (1 << 4)
+#define US_PIPE_W (1 << 5)
+#define US_NAMED (1 << 6)
+#define US_PIPE_WOPENED (1 << 7)   /* Reading end had a writer, hang up is reported once it leaves */
+#define US_CLOSED (1 << 8)         /* Descriptor is gone, writers to it fail */
 
+/* Pipe buffer size */
+#define US_PIPESZ (4 * SIZE_PAGE)
 
-typedef struct _unixsock_t {
-	rbnode_t linkage;
-	unsigned id;
-	unsigned int lmaxgap;
-	unsigned int rmaxgap;
+/* Stream socket buffer size, stream writes this large are loaned to the reader instead of copied */
+#define US_STREAMSZ (4 * SIZE_PAGE)
+#define US_LOAN_MIN (2 * SIZE_PAGE)
+
+/* Spliced data is moved to the reader in chunks this large, up to two of them queued */
+#define US_SPLICESZ (4 * SIZE_PAGE)
+
+/* Bytes of datagrams queued on a socket */
+#define US_DGRAMSZ (4 * SIZE_PAGE)
+
+/* Socket table doubles from its initial size up to the limit */
+#define US_TABLE_MIN 64
+#define US_TABLE_MAX 4096
+
+
+/* Byte ring with one producer and one consumer at a time, head and tail run freely */
+typedef struct {
+	void *data;
+	size_t sz;
+	size_t head;
+	size_t tail;
+} usring_t;
 
-	struct _unixsock_t *next, *prev;
 
+typedef struct _usdgram_t {
+	struct _usdgram_t *next, *prev;
+	unixctl_t *ctl;
+	size_t len;
+	char data[];
+} usdgram_t;
+
+
+/* Buffer read directly by the receiver - writer's pages mapped into the kernel or spliced pages owned by the socket */
+typedef struct _usloan_t {
+	struct _usloan_t *next, *prev;
+	const void *data;
+	size_t len;
+	size_t done;
+	char owned;
+} usloan_t;
+
+
+typedef struct _unixsock_t {
+	struct _unixsock_t *next, *prev;
+	unsigned id;
 	int refs;
 
-	lock_t lock;
-	cbuffer_t buffer;
+	lock_t lock;    /* Serializes producers */
+	lock_t rlock;   /* Serializes consumers */
+	usring_t ring;
 	char type;
-	char state;
+	unsigned short state;
+	unsigned opens;
 
 	spinlock_t spinlock;
 
+	/* Protected by spinlock, loans are also removed only with rlock held, ring is not written while there are any */
+	usdgram_t *dgrams;
+	size_t dgramsz;
+	usloan_t *loans;
+	size_t loansz;
+	unixctl_t *ctls;  /* Stream ancillary data in ring order */
+
+	/* Protected by unix_common.ctlSpinlock */
+	unsigned inflight;  /* Queued messages passing its descriptor */
+	unsigned sockctls;  /* Socket descriptors passed in messages queued on it */
+
 	struct _unixsock_t *connect;
 	thread_t *queue;
 	thread_t *writeq;
+
+	pollhead_t poll;
 } unixsock_t;
 
 
+/* Socket table, read without locking - replaced tables are never freed */
+typedef struct _ustable_t {
+	struct _ustable_t *retired;
+	unsigned size;
+	u32 *used;
+	unixsock_t *socks[];
+} ustable_t;
+
+
 static struct {
-	rbtree_t tree;
+	ustable_t *table;
 	lock_t lock;
+
+	/* Released sockets, never returned to kmalloc */
+	spinlock_t spinlock;
+	unixsock_t *free;
+
+	spinlock_t ctlSpinlock;
 } unix_common;
 
 
+/*
+ * Rings
+ */
+
+
+static size_t usring_avail(usring_t *r)
+{
+	return lib_atomicLoad(&r->head) - lib_atomicLoad(&r->tail);
+}
+
+
+static size_t usring_free(usring_t *r)
+{
+	return r->sz - usring_avail(r);
+}
+
 
-static int unixsock_cmp(rbnode_t *n1, rbnode_t *n2)
+static size_t usring_wspace(usring_t *r, void **data)
 {
-	unixsock_t *r1 = lib_treeof(unixsock_t, linkage, n1);
-	unixsock_t *r2 = lib_treeof(unixsock_t, linkage, n2);
+	size_t offs = r->head & (r->sz - 1);
+
+	*data = r->data + offs;
 
-	return (r1->id - r2->id);
+	return min(usring_free(r), r->sz - offs);
 }
 
 
-static int unixsock_gapcmp(rbnode_t *n1, rbnode_t *n2)
+static void usring_wadvance(usring_t *r, size_t sz)
 {
-	unixsock_t *r1 = lib_treeof(unixsock_t, linkage, n1);
-	unixsock_t *r2 = lib_treeof(unixsock_t, linkage, n2);
-	rbnode_t *child = NULL;
-	int ret = 1;
+	lib_atomicStore(&r->head, r->head + sz);
+}
 
-	if (r1->lmaxgap > 0 && r1->rmaxgap > 0) {
-		if (r2->id > r1->id) {
-			child = n1->right;
-			ret = -1;
-		}
-		else {
-			child = n1->left;
-			ret = 1;
-		}
-	}
-	else if (r1->lmaxgap > 0) {
-		child = n1->left;
-		ret = 1;
-	}
-	else if (r1->rmaxgap > 0) {
-		child = n1->right;
-		ret = -1;
-	}
 
-	if (child == NULL)
-		return 0;
+static size_t usring_rspace(usring_t *r, void **data)
+{
+	size_t offs = r->tail & (r->sz - 1);
 
-	return ret;
+	*data = r->data + offs;
+
+	return min(usring_avail(r), r->sz - offs);
 }
 
 
-static void unixsock_augment(rbnode_t *node)
+static void usring_radvance(usring_t *r, size_t sz)
 {
-	rbnode_t *it;
-	unixsock_t *n = lib_treeof(unixsock_t, linkage, node);
-	unixsock_t *p = n, *r, *l;
+	lib_atomicStore(&r->tail, r->tail + sz);
+}
 
-	if (node->left == NULL) {
-		for (it = node; it->parent != NULL; it = it->parent) {
-			p = lib_treeof(unixsock_t, linkage, it->parent);
-			if (it->parent->right == it)
-				break;
-		}
 
-		n->lmaxgap = (n->id <= p->id) ? n->id : n->id - p->id - 1;
+static size_t usring_write(usring_t *r, const void *buf, size_t len)
+{
+	size_t done = 0, n;
+	void *data;
+
+	while (done < len && (n = usring_wspace(r, &data)) > 0) {
+		n = min(n, len - done);
+		hal_memcpy(data, buf + done, n);
+		usring_wadvance(r, n);
+		done += n;
 	}
-	else {
-		l = lib_treeof(unixsock_t, linkage, node->left);
-		n->lmaxgap = max(l->lmaxgap, l->rmaxgap);
+
+	return done;
+}
+
+
+static size_t usring_read(usring_t *r, void *buf, size_t len)
+{
+	size_t done = 0, n;
+	void *data;
+
+	while (done < len && (n = usring_rspace(r, &data)) > 0) {
+		n = min(n, len - done);
+		hal_memcpy(buf + done, data, n);
+		usring_radvance(r, n);
+		done += n;
 	}
 
-	if (node->right == NULL) {
-		for (it = node; it->parent != NULL; it = it->parent) {
-			p = lib_treeof(unixsock_t, linkage, it->parent);
-			if (it->parent->left == it)
-				break;
+	return done;
+}
+
+
+static int usring_init(usring_t *r, size_t sz)
+{
+	if ((r->data = vm_kmalloc(sz)) == NULL)
+		return -ENOMEM;
+
+	r->sz = sz;
+	r->head = r->tail = 0;
+
+	return EOK;
+}
+
+
+/*
+ * Socket table
+ */
+
+
+static ustable_t *unixsock_tableAlloc(unsigned size)
+{
+	ustable_t *t;
+	unsigned words = (size + 31) / 32;
+
+	if ((t = vm_kmalloc(sizeof(ustable_t) + size * sizeof(unixsock_t *) + words * sizeof(u32))) == NULL)
+		return NULL;
+
+	t->retired = NULL;
+	t->size = size;
+	t->used = (u32 *)(t->socks + size);
+
+	hal_memset(t->socks, 0, size * sizeof(unixsock_t *));
+	hal_memset(t->used, 0, words * sizeof(u32));
+
+	return t;
+}
+
+
+static int _unixsock_id(unsigned *id)
+{
+	ustable_t *t = unix_common.table, *n;
+	unsigned i;
+
+	for (;;) {
+		for (i = 0; i < t->size / 32; ++i) {
+			if (t->used[i] != ~0u) {
+				*id = i * 32 + hal_cpuGetFirstBit(~t->used[i]);
+				t->used[i] |= 1u << (*id & 31);
+				return EOK;
+			}
 		}
 
-		n->rmaxgap = (n->id >= p->id) ? (unsigned)-1 - n->id - 1 : p->id - n->id - 1;
-	}
-	else {
-		r = lib_treeof(unixsock_t, linkage, node->right);
-		n->rmaxgap = max(r->lmaxgap, r->rmaxgap);
-	}
+		if (2 * t->size > US_TABLE_MAX)
+			return -ENFILE;
 
-	for (it = node; it->parent != NULL; it = it->parent) {
-		n = lib_treeof(unixsock_t, linkage, it);
-		p = lib_treeof(unixsock_t, linkage, it->parent);
+		if ((n = unixsock_tableAlloc(2 * t->size)) == NULL)
+			return -ENOMEM;
 
-		if (it->parent->left == it)
-			p->lmaxgap = max(n->lmaxgap, n->rmaxgap);
-		else
-			p->rmaxgap = max(n->lmaxgap, n->rmaxgap);
+		hal_memcpy(n->socks, t->socks, t->size * sizeof(unixsock_t *));
+		hal_memcpy(n->used, t->used, (t->size / 32) * sizeof(u32));
+
+		n->retired = t;
+		lib_atomicStore(&unix_common.table, n);
+		t = n;
 	}
 }
 
 
+/* Puts socket on the free list, stale readers see it as being released */
+static void unixsock_free(unixsock_t *r)
+{
+	spinlock_ctx_t sc;
+
+	proc_lockDone(&r->lock);
+	proc_lockDone(&r->rlock);
+	hal_spinlockDestroy(&r->spinlock);
+
+	lib_atomicStore(&r->refs, -1);
+
+	hal_spinlockSet(&unix_common.spinlock, &sc);
+	r->next = unix_common.free;
+	unix_common.free = r;
+	hal_spinlockClear(&unix_common.spinlock, &sc);
+}
+
+
 static unixsock_t *unixsock_alloc(unsigned *id, int type)
 {
-	unixsock_t *r, t;
+	unixsock_t *r;
+	spinlock_ctx_t sc;
 
-	*id = 0;
-	proc_lockSet(&unix_common.lock);
-	if (unix_common.tree.root != NULL) {
-		t.id = 0;
-		r = lib_treeof(unixsock_t, linkage, lib_rbFindEx(unix_common.tree.root, &t.linkage, unixsock_gapcmp));
-		if (r != NULL) {
-			if (r->lmaxgap > 0)
-				*id = r->id - 1;
-			else
-				*id = r->id + 1;
-		}
-		else {
-			proc_lockClear(&unix_common.lock);
-			return NULL;
-		}
-	}
+	hal_spinlockSet(&unix_common.spinlock, &sc);
+	if ((r = unix_common.free) != NULL)
+		unix_common.free = r->next;
+	hal_spinlockClear(&unix_common.spinlock, &sc);
 
-	if ((r = vm_kmalloc(sizeof(unixsock_t))) == NULL) {
-		proc_lockClear(&unix_common.lock);
+	if (r == NULL && (r = vm_kmalloc(sizeof(unixsock_t))) == NULL)
 		return NULL;
-	}
 
-	proc_lockInit(&r->lock);
+	proc_lockInit(&r->lock, "unixsock.lock");
+	proc_lockInit(&r->rlock, "unixsock.rlock");
 
-	r->id = *id;
-	r->refs = 1;
 	r->type = type;
 	r->connect = NULL;
 	r->queue = NULL;
 	r->writeq = NULL;
 	r->state = 0;
+	r->opens = 0;
 	r->next = NULL;
 	r->prev = NULL;
+	r->dgrams = NULL;
+	r->dgramsz = 0;
+	r->loans = NULL;
+	r->loansz = 0;
+	r->inflight = 0;
+	r->sockctls = 0;
+	r->ctls = NULL;
+	hal_memset(&r->ring, 0, sizeof(r->ring));
+	poll_headInit(&r->poll);
 	hal_spinlockCreate(&r->spinlock, "unix socket");
 
-	lib_rbInsert(&unix_common.tree, &r->linkage);
+	proc_lockSet(&unix_common.lock);
+	if (_unixsock_id(id) < 0) {
+		proc_lockClear(&unix_common.lock);
+		unixsock_free(r);
+		return NULL;
+	}
+
+	r->id = *id;
+	lib_atomicStore(&r->refs, 1);
+	lib_atomicStore(&unix_common.table->socks[*id], r);
 	proc_lockClear(&unix_common.lock);
 
 	return r;
 }
 
 
+static void unixsock_put(unixsock_t *r);
+
+
+static void unix_ctlDequeue(unixctl_t *ctl, unixsock_t *conn);
+
+
+/* Frees spliced pages owned by the socket */
+static void usloan_free(usloan_t *loan)
+{
+	vm_kfree((void *)loan->data);
+	vm_kfree(loan);
+}
+
+
+/* Lockless, released sockets are only reused as sockets so a stale pointer is safe to inspect */
 static unixsock_t *unixsock_get(unsigned id)
 {
-	unixsock_t *r, t;
+	ustable_t *t;
+	unixsock_t *r;
+	int refs;
 
-	t.id = id;
+	for (;;) {
+		t = lib_atomicLoad(&unix_common.table);
 
-	proc_lockSet(&unix_common.lock);
-	if ((r = lib_treeof(unixsock_t, linkage, lib_rbFind(&unix_common.tree, &t.linkage))) != NULL)
-		r->refs++;
-	proc_lockClear(&unix_common.lock);
+		if (id >= t->size || (r = lib_atomicLoad(&t->socks[id])) == NULL)
+			return NULL;
 
-	return r;
+		/* Being released */
+		refs = lib_atomicLoad(&r->refs);
+		do {
+			if (refs < 0)
+				return NULL;
+		} while (!lib_atomicCompareExchange(&r->refs, &refs, refs + 1));
+
+		if (lib_atomicLoad(&lib_atomicLoad(&unix_common.table)->socks[id]) == r)
+			return r;
+
+		/* Released and reused meanwhile */
+		unixsock_put(r);
+	}
 }
 
 
 static void unixsock_put(unixsock_t *r)
 {
-	proc_lockSet(&unix_common.lock);
-	if (--r->refs < 0) {
-		lib_rbRemove(&unix_common.tree, &r->linkage);
-		proc_lockClear(&unix_common.lock);
+	usdgram_t *d;
+	unixctl_t *c;
+	usloan_t *l;
 
-		proc_lockDone(&r->lock);
-		hal_spinlockDestroy(&r->spinlock);
-		vm_kfree(r);
+	if (lib_atomicDecrement(&r->refs) >= 0)
 		return;
-	}
+
+	proc_lockSet(&unix_common.lock);
+	lib_atomicStore(&unix_common.table->socks[r->id], NULL);
+	unix_common.table->used[r->id / 32] &= ~(1u << (r->id & 31));
 	proc_lockClear(&unix_common.lock);
+
+	while ((d = r->dgrams) != NULL) {
+		LIST_REMOVE(&r->dgrams, d);
+		if (d->ctl != NULL) {
+			unix_ctlDequeue(d->ctl, r);
+			posix_ctlFree(d->ctl);
+		}
+		vm_kfree(d);
+	}
+
+	while ((c = r->ctls) != NULL) {
+		LIST_REMOVE(&r->ctls, c);
+		unix_ctlDequeue(c, r);
+		posix_ctlFree(c);
+	}
+
+	/* Writers with loans of their own hold a reference, only spliced pages are left */
+	while ((l = r->loans) != NULL) {
+		LIST_REMOVE(&r->loans, l);
+		usloan_free(l);
+	}
+
+	if (r->ring.data != NULL)
+		vm_kfree(r->ring.data);
+
+	unixsock_free(r);
 }
 
 
@@ -256,7 +465,6 @@ int unix_accept(unsigned socket, struct sockaddr *address, socklen_t *address_le
 	unixsock_t *s, *conn, *new;
 	int err;
 	unsigned newid;
-	void *v;
 	spinlock_ctx_t sc;
 
 	if ((s = unixsock_get(socket)) == NULL)
@@ -273,19 +481,17 @@ int unix_accept(unsigned socket, struct sockaddr *address, socklen_t *address_le
 			break;
 		}
 
-		if ((v = vm_kmalloc(SIZE_PAGE)) == NULL) {
+		if ((new = unixsock_alloc(&newid, s->type)) == NULL) {
 			err = -ENOMEM;
 			break;
 		}
 
-		if ((new = unixsock_alloc(&newid, s->type)) == NULL) {
-			vm_kfree(v);
-			err = -ENOMEM;
+		if ((err = usring_init(&new->ring, US_STREAMSZ)) < 0) {
+			unixsock_put(new);
+			unixsock_put(new);
 			break;
 		}
 
-		_cbuffer_init(&new->buffer, v, SIZE_PAGE);
-
 		hal_spinlockSet(&s->spinlock, &sc);
 		s->state |= US_ACCEPTING;
 
@@ -301,6 +507,8 @@ int unix_accept(unsigned socket, struct sockaddr *address, socklen_t *address_le
 		proc_threadWakeup(&conn->queue);
 		hal_spinlockClear(&s->spinlock, &sc);
 
+		poll_notify(&conn->poll, POLLOUT | POLLWRNORM);
+
 		err = new->id;
 		unixsock_put(new);
 	} while (0);
@@ -317,7 +525,6 @@ int unix_bind(unsigned socket, const struct sockaddr *address, socklen_t address
 	int err;
 	oid_t odir, dev;
 	unixsock_t *s;
-	void *v = NULL;
 
 	if ((s = unixsock_get(socket)) == NULL)
 		return -ENOTSOCK;
@@ -344,15 +551,6 @@ int unix_bind(unsigned socket, const struct sockaddr *address, socklen_t address
 				break;
 			}
 
-			if (s->type == SOCK_DGRAM) {
-				if ((v = vm_kmalloc(SIZE_PAGE)) == NULL) {
-					err = -ENOMEM;
-					break;
-				}
-
-				_cbuffer_init(&s->buffer, v, SIZE_PAGE);
-			}
-
 			dev.port = US_PORT;
 			dev.id = socket;
 			err = proc_create(odir.port, 2 /* otDev */, S_IFSOCK, dev, odir, name, &dev);
@@ -402,7 +600,6 @@ int unix_connect(unsigned socket, const struct sockaddr *address, socklen_t addr
 	unixsock_t *s, *remote;
 	int err;
 	oid_t oid;
-	void *v;
 	spinlock_ctx_t sc;
 
 	if ((s = unixsock_get(socket)) == NULL)
@@ -440,18 +637,16 @@ int unix_connect(unsigned socket, const struct sockaddr *address, socklen_t addr
 				break;
 			}
 
-			if ((v = vm_kmalloc(SIZE_PAGE)) == NULL) {
-				err = -ENOMEM;
+			if (s->ring.data == NULL && (err = usring_init(&s->ring, US_STREAMSZ)) < 0)
 				break;
-			}
-
-			_cbuffer_init(&s->buffer, v, SIZE_PAGE);
 
 			hal_spinlockSet(&remote->spinlock, &sc);
 			LIST_ADD(&remote->connect, s);
 			proc_threadWakeup(&remote->queue);
 			hal_spinlockClear(&remote->spinlock, &sc);
 
+			poll_notify(&remote->poll, POLLIN | POLLRDNORM);
+
 			hal_spinlockSet(&s->spinlock, &sc);
 			s->state |= US_CONNECTING;
 
@@ -490,35 +685,192 @@ int unix_getsockopt(unsigned socket, int level, int optname, void *optval, sockl
 }
 
 
-ssize_t unix_recvfrom(unsigned socket, void *message, size_t length, int flags, struct sockaddr *src_addr, socklen_t *src_len)
+static int unix_copyOut(void *arg, void *data, size_t len)
 {
-	unixsock_t *s;
-	size_t rlen = 0;
-	int err = 0;
+	hal_memcpy(arg, data, len);
+	return len;
+}
+
+
+/* Drains the oldest loan, called with s->rlock held */
+static int _unix_loanRead(unixsock_t *s, splicefn_t drain, void *arg, size_t len)
+{
+	usloan_t *loan;
+	int n;
+	spinlock_ctx_t sc;
+
+	if ((loan = lib_atomicLoad(&s->loans)) == NULL)
+		return 0;
+
+	if ((n = drain(arg, (void *)loan->data + loan->done, min(len, loan->len - loan->done))) <= 0)
+		return n;
+
+	hal_spinlockSet(&s->spinlock, &sc);
+	if ((loan->done += n) < loan->len) {
+		loan = NULL;
+	}
+	else {
+		LIST_REMOVE(&s->loans, loan);
+		proc_threadBroadcast(&s->writeq);
+
+		/* Writer takes its own loan back as soon as it is woken */
+		if (loan->owned)
+			s->loansz -= loan->len;
+		else
+			loan = NULL;
+	}
+	hal_spinlockClear(&s->spinlock, &sc);
+
+	if (loan != NULL)
+		usloan_free(loan);
+
+	return n;
+}
+
+
+/* Lets the reader copy straight from the writer's pages, returns 0 if the buffer can't be loaned */
+static ssize_t unix_loanWrite(unixsock_t *conn, const void *message, size_t length)
+{
+	usloan_t loan;
+	vm_loan_t *pages;
+	process_t *process = proc_current()->process;
+	int err = EOK;
+	spinlock_ctx_t sc;
+
+	if (process == NULL || (loan.data = vm_mapLoan(process->mapp, (void *)message, length, &pages)) == NULL)
+		return 0;
+
+	loan.len = length;
+	loan.done = 0;
+	loan.owned = 0;
+
+	/*
+	 * Producer lock is held only while queueing, so the loan can't overtake data being written
+	 * into the ring. Nothing is written there until queued loans are read.
+	 */
+	proc_lockSet(&conn->lock);
+	hal_spinlockSet(&conn->spinlock, &sc);
+	LIST_ADD(&conn->loans, &loan);
+	proc_threadWakeup(&conn->queue);
+	hal_spinlockClear(&conn->spinlock, &sc);
+	proc_lockClear(&conn->lock);
+
+	poll_notify(&conn->poll, POLLIN | POLLRDNORM);
+
+	hal_spinlockSet(&conn->spinlock, &sc);
+	while (loan.done < loan.len && err == EOK) {
+		if (conn->state & US_CLOSED)
+			err = -EPIPE;
+		else
+			err = proc_threadWaitInterruptible(&conn->writeq, &conn->spinlock, 0, &sc);
+	}
+	hal_spinlockClear(&conn->spinlock, &sc);
+
+	/* Take the loan back, no reader can be copying from it then */
+	if (err < 0) {
+		proc_lockSet(&conn->rlock);
+		hal_spinlockSet(&conn->spinlock, &sc);
+		if (loan.done < loan.len)
+			LIST_REMOVE(&conn->loans, &loan);
+		hal_spinlockClear(&conn->spinlock, &sc);
+		proc_lockClear(&conn->rlock);
+	}
+
+	vm_mapUnloan(pages);
+
+	return loan.done ? loan.done : err;
+}
+
+
+/* Bounds stream read so it doesn't cross data with other ancillary data attached, called with s->rlock held */
+static size_t _unix_ctlLimit(unixsock_t *s, size_t length, unixctl_t **ctl)
+{
+	unixctl_t *c;
+	size_t tail = s->ring.tail;
+	spinlock_ctx_t sc;
+
+	*ctl = NULL;
+
+	hal_spinlockSet(&s->spinlock, &sc);
+	if ((c = s->ctls) != NULL) {
+		if (c->pos == tail) {
+			*ctl = c;
+			c = (c->next != s->ctls) ? c->next : NULL;
+		}
+
+		if (c != NULL)
+			length = min(length, c->pos - tail);
+	}
+	hal_spinlockClear(&s->spinlock, &sc);
+
+	return length;
+}
+
+
+ssize_t unix_recvmsg(unsigned socket, void *message, size_t length, int flags, struct sockaddr *src_addr, socklen_t *src_len, unixctl_t **ctl, int *msgflags)
+{
+	unixsock_t *s, *conn;
+	usdgram_t *d = NULL;
+	unixctl_t *c = NULL;
+	int err = 0, got;
 	spinlock_ctx_t sc;
 
 	if ((s = unixsock_get(socket)) == NULL)
 		return -ENOTSOCK;
 
 	for (;;) {
-		proc_lockSet(&s->lock);
 		if (s->type == SOCK_STREAM) {
-			err = _cbuffer_read(&s->buffer, message, length);
+			proc_lockSet(&s->rlock);
+			if (s->ring.data != NULL && !(err = usring_read(&s->ring, message, _unix_ctlLimit(s, length, &c))))
+				err = _unix_loanRead(s, unix_copyOut, message, length);
+
+			/* Ancillary data goes with the read returning its first byte */
+			if (err > 0 && c != NULL) {
+				hal_spinlockSet(&s->spinlock, &sc);
+				LIST_REMOVE(&s->ctls, c);
+				hal_spinlockClear(&s->spinlock, &sc);
+			}
+			else {
+				c = NULL;
+			}
+			proc_lockClear(&s->rlock);
+
+			got = err > 0;
 		}
-		else if (_cbuffer_avail(&s->buffer) > 0) { /* SOCK_DGRAM or SOCK_SEQPACKET */
-			_cbuffer_read(&s->buffer, &rlen, sizeof(rlen));
-			_cbuffer_read(&s->buffer, message, err = min(length, rlen));
+		else { /* SOCK_DGRAM or SOCK_SEQPACKET */
+			hal_spinlockSet(&s->spinlock, &sc);
+			if ((d = s->dgrams) != NULL) {
+				LIST_REMOVE(&s->dgrams, d);
+				s->dgramsz -= d->len;
+			}
+			hal_spinlockClear(&s->spinlock, &sc);
+
+			/* Part not fitting in the buffer is discarded, MSG_TRUNC asks for the real length */
+			if ((got = (d != NULL))) {
+				hal_memcpy(message, d->data, err = min(length, d->len));
+
+				if (d->len > length) {
+					if (msgflags != NULL)
+						*msgflags |= MSG_TRUNC;
+
+					if (flags & MSG_TRUNC)
+						err = d->len;
+				}
 
-			if (length < rlen)
-				_cbuffer_discard(&s->buffer, rlen - length);
+				c = d->ctl;
+				vm_kfree(d);
+			}
 		}
-		proc_lockClear(&s->lock);
 
-		if (err > 0) {
+		if (got) {
 			hal_spinlockSet(&s->spinlock, &sc);
 			proc_threadWakeup(&s->writeq);
 			hal_spinlockClear(&s->spinlock, &sc);
 
+			/* Stream peers write into our buffer */
+			if (s->type == SOCK_STREAM && (conn = s->connect) != NULL)
+				poll_notify(&conn->poll, POLLOUT | POLLWRNORM);
+
 			break;
 		}
 		else if (flags & MSG_DONTWAIT) {
@@ -531,56 +883,226 @@ ssize_t unix_recvfrom(unsigned socket, void *message, size_t length, int flags,
 		hal_spinlockClear(&s->spinlock, &sc);
 	}
 
+	if (c != NULL)
+		unix_ctlDequeue(c, s);
+
+	if (ctl != NULL)
+		*ctl = c;
+	else if (c != NULL)
+		posix_ctlFree(c);
+
 	unixsock_put(s);
 	return err;
 }
 
 
-ssize_t unix_sendto(unsigned socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len)
+ssize_t unix_recvfrom(unsigned socket, void *message, size_t length, int flags, struct sockaddr *src_addr, socklen_t *src_len)
 {
-	unixsock_t *s, *conn;
+	return unix_recvmsg(socket, message, length, flags, src_addr, src_len, NULL, NULL);
+}
+
+
+static ssize_t unix_dgramSend(unixsock_t *conn, const void *message, size_t length, int flags, unixctl_t *ctl)
+{
+	usdgram_t *d;
 	int err;
 	spinlock_ctx_t sc;
 
-	if ((s = unixsock_get(socket)) == NULL)
-		return -ENOTSOCK;
+	if (length > US_DGRAMSZ)
+		return -EMSGSIZE;
 
-	do {
-		if (s->type == SOCK_DGRAM) {
-			conn = s;
+	if ((d = vm_kmalloc(sizeof(usdgram_t) + length)) == NULL)
+		return -ENOMEM;
+
+	d->ctl = ctl;
+	d->len = length;
+	hal_memcpy(d->data, message, length);
+
+	hal_spinlockSet(&conn->spinlock, &sc);
+	for (;;) {
+		if (conn->state & US_CLOSED) {
+			err = -ECONNREFUSED;
+			break;
 		}
-		else if (s->connect == NULL && dest_addr != NULL) {
-			if ((err = unix_lookupSocket(dest_addr->sa_data)) < 0)
-				break;
 
-			if ((conn = unixsock_get(err)) == NULL) {
-				err = -ENOTSOCK;
-				break;
-			}
+		if (conn->dgramsz + length <= US_DGRAMSZ) {
+			LIST_ADD(&conn->dgrams, d);
+			conn->dgramsz += length;
+			proc_threadWakeup(&conn->queue);
+			err = length;
+			break;
 		}
-		else if ((conn = s->connect) == NULL) {
-			err = -ENOTCONN;
+
+		if (flags & MSG_DONTWAIT) {
+			err = -EWOULDBLOCK;
 			break;
 		}
 
-		err = 0;
-		for (;;) {
-			proc_lockSet(&conn->lock);
-			if (s->type == SOCK_STREAM) {
-				err = _cbuffer_write(&conn->buffer, message, length);
-			}
-			else if (_cbuffer_free(&conn->buffer) >= length + sizeof(length)) {
-				_cbuffer_write(&conn->buffer, &length, sizeof(length));
-				_cbuffer_write(&conn->buffer, message, err = length);
-				proc_threadWakeup(&conn->queue);
-			}
-			proc_lockClear(&conn->lock);
+		if ((err = proc_threadWaitInterruptible(&conn->writeq, &conn->spinlock, 0, &sc)) < 0)
+			break;
+	}
+	hal_spinlockClear(&conn->spinlock, &sc);
 
-			if (err > 0) {
+	if (err < 0)
+		vm_kfree(d);
+	else
+		poll_notify(&conn->poll, POLLIN | POLLRDNORM);
+
+	return err;
+}
+
+
+/* Takes references to unix sockets passed in ctl */
+static int unix_ctlSockets(unixctl_t *ctl, unixsock_t **socks)
+{
+	int i, n = 0;
+
+	for (i = 0; i < ctl->nfiles; ++i) {
+		if (ctl->files[i]->type == ftUnixSocket && (socks[n] = unixsock_get(ctl->files[i]->oid.id)) != NULL)
+			++n;
+	}
+
+	return n;
+}
+
+
+/*
+ * Socket whose descriptor is in flight can't receive socket descriptors and socket
+ * with socket descriptors queued on it can't be passed, nor can a socket be queued
+ * on itself. Passed descriptors then never form a cycle keeping each other open.
+ */
+static int unix_ctlQueue(unixctl_t *ctl, unixsock_t *conn)
+{
+	unixsock_t *socks[SCM_MAX_FD];
+	int i, n, err = EOK;
+	spinlock_ctx_t sc;
+
+	if (!(n = unix_ctlSockets(ctl, socks)))
+		return EOK;
+
+	hal_spinlockSet(&unix_common.ctlSpinlock, &sc);
+	if (conn->inflight)
+		err = -ETOOMANYREFS;
+
+	for (i = 0; i < n && err == EOK; ++i) {
+		if (socks[i] == conn || socks[i]->sockctls)
+			err = -ETOOMANYREFS;
+	}
+
+	if (err == EOK) {
+		conn->sockctls += n;
+		for (i = 0; i < n; ++i)
+			socks[i]->inflight++;
+	}
+	hal_spinlockClear(&unix_common.ctlSpinlock, &sc);
+
+	for (i = 0; i < n; ++i)
+		unixsock_put(socks[i]);
+
+	return err;
+}
+
+
+/* Called when ctl queued by unix_ctlQueue leaves conn */
+static void unix_ctlDequeue(unixctl_t *ctl, unixsock_t *conn)
+{
+	unixsock_t *socks[SCM_MAX_FD];
+	int i, n;
+	spinlock_ctx_t sc;
+
+	if (!(n = unix_ctlSockets(ctl, socks)))
+		return;
+
+	hal_spinlockSet(&unix_common.ctlSpinlock, &sc);
+	conn->sockctls -= n;
+	for (i = 0; i < n; ++i)
+		socks[i]->inflight--;
+	hal_spinlockClear(&unix_common.ctlSpinlock, &sc);
+
+	for (i = 0; i < n; ++i)
+		unixsock_put(socks[i]);
+}
+
+
+/* Takes ownership of ctl if data was sent */
+ssize_t unix_sendmsg(unsigned socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len, unixctl_t *ctl)
+{
+	unixsock_t *s, *conn, *dest = NULL, *queued = NULL;
+	int err;
+	spinlock_ctx_t sc;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return -ENOTSOCK;
+
+	do {
+		if ((s->connect == NULL || s->type == SOCK_DGRAM) && dest_addr != NULL) {
+			if ((err = unix_lookupSocket(dest_addr->sa_data)) < 0)
+				break;
+
+			if ((conn = dest = unixsock_get(err)) == NULL) {
+				err = -ENOTSOCK;
+				break;
+			}
+		}
+		else if ((conn = s->connect) == NULL) {
+			err = -ENOTCONN;
+			break;
+		}
+
+		if (ctl != NULL) {
+			if ((err = unix_ctlQueue(ctl, conn)) < 0)
+				break;
+
+			queued = conn;
+		}
+
+		if (s->type != SOCK_STREAM) {
+			err = unix_dgramSend(conn, message, length, flags, ctl);
+			break;
+		}
+
+		if (conn->ring.data == NULL) {
+			err = -ENOTCONN;
+			break;
+		}
+
+		/* Ancillary data needs at least one byte to travel with */
+		if (ctl != NULL && !length) {
+			err = -EINVAL;
+			break;
+		}
+
+		/* Loaned data doesn't pass the ring, so it can't carry ancillary data */
+		if (ctl == NULL && length >= US_LOAN_MIN && !(flags & MSG_DONTWAIT) && (err = unix_loanWrite(conn, message, length)) != 0)
+			break;
+
+		for (;;) {
+			proc_lockSet(&conn->lock);
+			if (ctl != NULL) {
+				ctl->pos = conn->ring.head;
+
+				hal_spinlockSet(&conn->spinlock, &sc);
+				LIST_ADD(&conn->ctls, ctl);
+				hal_spinlockClear(&conn->spinlock, &sc);
+			}
+
+			/* Loaned data is ahead, the ring waits for it to be read */
+			err = (conn->loans == NULL) ? usring_write(&conn->ring, message, length) : 0;
+
+			/* Nothing was written so the reader can't have taken it */
+			if (ctl != NULL && !err) {
+				hal_spinlockSet(&conn->spinlock, &sc);
+				LIST_REMOVE(&conn->ctls, ctl);
+				hal_spinlockClear(&conn->spinlock, &sc);
+			}
+			proc_lockClear(&conn->lock);
+
+			if (err > 0) {
 				hal_spinlockSet(&conn->spinlock, &sc);
 				proc_threadWakeup(&conn->queue);
 				hal_spinlockClear(&conn->spinlock, &sc);
 
+				poll_notify(&conn->poll, POLLIN | POLLRDNORM);
 				break;
 			}
 			else if (flags & MSG_DONTWAIT) {
@@ -589,25 +1111,50 @@ ssize_t unix_sendto(unsigned socket, const void *message, size_t length, int fla
 			}
 
 			hal_spinlockSet(&conn->spinlock, &sc);
-			proc_threadWait(&conn->writeq, &conn->spinlock, 0, &sc);
+			if (conn->state & US_CLOSED)
+				err = -EPIPE;
+			else
+				proc_threadWait(&conn->writeq, &conn->spinlock, 0, &sc);
 			hal_spinlockClear(&conn->spinlock, &sc);
-		}
 
+			if (err < 0)
+				break;
+		}
 	} while (0);
 
+	/* Message wasn't sent, ancillary data stays with the caller */
+	if (err < 0 && queued != NULL)
+		unix_ctlDequeue(ctl, queued);
+
+	if (dest != NULL)
+		unixsock_put(dest);
+
 	unixsock_put(s);
 	return err;
 }
 
 
+ssize_t unix_sendto(unsigned socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len)
+{
+	return unix_sendmsg(socket, message, length, flags, dest_addr, dest_len, NULL);
+}
+
+
 /* TODO: proper shutdown, link, unlink */
 int unix_shutdown(unsigned socket, int how)
 {
 	unixsock_t *s;
+	spinlock_ctx_t sc;
 
 	if ((s = unixsock_get(socket)) == NULL)
 		return -ENOTSOCK;
 
+	/* Writers still holding a reference give up */
+	hal_spinlockSet(&s->spinlock, &sc);
+	s->state |= US_CLOSED;
+	proc_threadBroadcast(&s->writeq);
+	hal_spinlockClear(&s->spinlock, &sc);
+
 	unixsock_put(s);
 	unixsock_put(s);
 	return EOK;
@@ -620,11 +1167,602 @@ int unix_setsockopt(unsigned socket, int level, int optname, const void *optval,
 }
 
 
+static unsigned _unix_pollStatus(unixsock_t *s)
+{
+	unixsock_t *conn;
+	unsigned revents = 0;
+
+	/* Lockless peek, a stale answer is fine for readiness */
+	if (s->state & US_LISTENING) {
+		if (s->connect != NULL)
+			revents |= POLLIN | POLLRDNORM;
+	}
+	else {
+		if ((s->ring.data != NULL && usring_avail(&s->ring) > 0) || s->loans != NULL || s->dgrams != NULL)
+			revents |= POLLIN | POLLRDNORM;
+
+		/* Datagrams go to a destination chosen per send */
+		if (s->type == SOCK_DGRAM)
+			revents |= POLLOUT | POLLWRNORM;
+		else if ((conn = s->connect) != NULL && conn->ring.data != NULL && conn->loans == NULL && usring_free(&conn->ring) > 0)
+			revents |= POLLOUT | POLLWRNORM;
+
+		if ((s->state & US_PIPE_WOPENED) && !s->connect->opens)
+			revents |= POLLHUP;
+		else if ((s->state & US_PIPE_W) && !s->connect->opens)
+			revents |= POLLERR;
+	}
+
+	return revents;
+}
+
+
+int unix_poll(unsigned socket, pollwait_t *wait)
+{
+	unixsock_t *s;
+	int revents;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return POLLNVAL;
+
+	/* Subscribe before checking the state so no transition is lost, the reference is kept until unix_pollDone() */
+	if (wait != NULL)
+		poll_subscribe(&s->poll, wait);
+
+	revents = _unix_pollStatus(s);
+
+	if (wait == NULL)
+		unixsock_put(s);
+
+	return revents;
+}
+
+
+void unix_pollDone(unsigned socket, pollwait_t *wait)
+{
+	unixsock_t *s;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return;
+
+	poll_unsubscribe(wait);
+
+	unixsock_put(s);
+	unixsock_put(s);
+}
+
+
+/*
+ * Pipes and FIFOs
+ *
+ * A pipe is a pair of stream sockets: the read end owns the buffer and the
+ * write end is connected to it. Both ends are kept until neither is open and
+ * the pair is not linked in the filesystem. All waiting is done on the read
+ * end's queues, with the read end's spinlock guarding open counts and state.
+ */
+
+
+static int unixpipe_alloc(unixsock_t **rp, unixsock_t **wp)
+{
+	unixsock_t *r, *w;
+	unsigned id;
+
+	if ((r = unixsock_alloc(&id, SOCK_STREAM)) == NULL)
+		return -ENOMEM;
+
+	if (usring_init(&r->ring, US_PIPESZ) < 0 || (w = unixsock_alloc(&id, SOCK_STREAM)) == NULL) {
+		unixsock_put(r);
+		unixsock_put(r);
+		return -ENOMEM;
+	}
+
+	r->state = US_PIPE_R;
+	w->state = US_PIPE_W;
+	r->connect = w;
+	w->connect = r;
+
+	/* Leave only the reference owned by the pair */
+	unixsock_put(r);
+	unixsock_put(w);
+
+	*rp = r;
+	*wp = w;
+
+	return EOK;
+}
+
+
+static void unixpipe_release(unixsock_t *r)
+{
+	unixsock_t *w = r->connect;
+
+	unixsock_put(w);
+	unixsock_put(r);
+}
+
+
+/* Drops filesystem link, called with a reference taken */
+static int unix_fifoUnlink(unixsock_t *r)
+{
+	spinlock_ctx_t sc;
+	int release;
+
+	hal_spinlockSet(&r->spinlock, &sc);
+	release = (r->state & US_NAMED) && !r->opens && !r->connect->opens;
+	r->state &= ~US_NAMED;
+	hal_spinlockClear(&r->spinlock, &sc);
+
+	unixsock_put(r);
+
+	if (release)
+		unixpipe_release(r);
+
+	return EOK;
+}
+
+
+int unix_pipe(unsigned socket[2])
+{
+	unixsock_t *r, *w;
+	int err;
+
+	if ((err = unixpipe_alloc(&r, &w)) < 0)
+		return err;
+
+	/* References for descriptors */
+	r->opens = w->opens = 1;
+	r->state |= US_PIPE_WOPENED;
+	unixsock_get(r->id);
+	unixsock_get(w->id);
+
+	socket[0] = r->id;
+	socket[1] = w->id;
+
+	return EOK;
+}
+
+
+int unix_fifo(unsigned *socket)
+{
+	unixsock_t *r, *w;
+	int err;
+
+	if ((err = unixpipe_alloc(&r, &w)) < 0)
+		return err;
+
+	r->state |= US_NAMED;
+	*socket = r->id;
+
+	return EOK;
+}
+
+
+int unix_isFifo(unsigned socket)
+{
+	unixsock_t *s;
+	int fifo;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return 0;
+
+	fifo = !!(s->state & US_PIPE_R);
+	unixsock_put(s);
+
+	return fifo;
+}
+
+
+int unix_isStream(unsigned socket)
+{
+	unixsock_t *s;
+	int stream;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return 0;
+
+	stream = (s->type == SOCK_STREAM);
+	unixsock_put(s);
+
+	return stream;
+}
+
+
+int unix_fifoOpen(unsigned socket, int oflag)
+{
+	unixsock_t *r, *s, *peer;
+	int err = EOK;
+	spinlock_ctx_t sc;
+
+	if ((r = unixsock_get(socket)) == NULL)
+		return -ENOENT;
+
+	if (!(r->state & US_PIPE_R) || (oflag & O_RDWR) || !(oflag & (O_RDONLY | O_WRONLY)) || (oflag & O_RDONLY && oflag & O_WRONLY)) {
+		unixsock_put(r);
+		return -EINVAL;
+	}
+
+	s = (oflag & O_WRONLY) ? r->connect : r;
+	peer = s->connect;
+
+	hal_spinlockSet(&r->spinlock, &sc);
+	s->opens++;
+	if (s != r)
+		r->state |= US_PIPE_WOPENED;
+	proc_threadBroadcast(&r->queue);
+	proc_threadBroadcast(&r->writeq);
+
+	/* Open blocks until the other side is opened too */
+	if (!(oflag & O_NONBLOCK)) {
+		while (!peer->opens && err == EOK)
+			err = proc_threadWaitInterruptible((s == r) ? &r->queue : &r->writeq, &r->spinlock, 0, &sc);
+	}
+	else if (s != r && !peer->opens) {
+		err = -ENXIO;
+	}
+
+	/* Writer giving up waiting for a reader never connected */
+	if (err < 0 && !--s->opens && s != r)
+		r->state &= ~US_PIPE_WOPENED;
+	hal_spinlockClear(&r->spinlock, &sc);
+
+	if (err < 0) {
+		unixsock_put(r);
+		return err;
+	}
+
+	if (s != r) {
+		unixsock_get(s->id);
+		unixsock_put(r);
+	}
+
+	return s->id;
+}
+
+
+int unix_pipeClose(unsigned socket)
+{
+	unixsock_t *s, *r, *w;
+	usloan_t *loans = NULL, *l;
+	spinlock_ctx_t sc;
+	int release;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return -EBADF;
+
+	/* Peer may be released by its closer as soon as our end is closed */
+	unixsock_get(s->connect->id);
+
+	r = (s->state & US_PIPE_R) ? s : s->connect;
+	w = r->connect;
+
+	hal_spinlockSet(&r->spinlock, &sc);
+	--s->opens;
+	proc_threadBroadcast(&r->queue);
+	proc_threadBroadcast(&r->writeq);
+	release = !r->opens && !w->opens && !(r->state & US_NAMED);
+
+	/* Unused FIFO starts over, data left is discarded before anyone opens it again */
+	if (!r->opens && !w->opens) {
+		usring_radvance(&r->ring, usring_avail(&r->ring));
+		r->state &= ~US_PIPE_WOPENED;
+
+		loans = r->loans;
+		r->loans = NULL;
+		r->loansz = 0;
+	}
+	hal_spinlockClear(&r->spinlock, &sc);
+
+	while ((l = loans) != NULL) {
+		LIST_REMOVE(&loans, l);
+		usloan_free(l);
+	}
+
+	if (s == r)
+		poll_notify(&w->poll, POLLERR);
+	else
+		poll_notify(&r->poll, POLLHUP);
+
+	unixsock_put(s->connect);
+	unixsock_put(s);
+	unixsock_put(s);
+
+	if (release)
+		unixpipe_release(r);
+
+	return EOK;
+}
+
+
+ssize_t unix_pipeRead(unsigned socket, void *buf, size_t len, int flags)
+{
+	unixsock_t *r, *w;
+	int err;
+	spinlock_ctx_t sc;
+
+	if ((r = unixsock_get(socket)) == NULL)
+		return -EBADF;
+
+	if (!(r->state & US_PIPE_R)) {
+		unixsock_put(r);
+		return -EBADF;
+	}
+
+	w = r->connect;
+
+	for (;;) {
+		proc_lockSet(&r->rlock);
+		if (!(err = usring_read(&r->ring, buf, len)))
+			err = _unix_loanRead(r, unix_copyOut, buf, len);
+		proc_lockClear(&r->rlock);
+
+		if (err > 0) {
+			hal_spinlockSet(&r->spinlock, &sc);
+			proc_threadBroadcast(&r->writeq);
+			hal_spinlockClear(&r->spinlock, &sc);
+
+			poll_notify(&w->poll, POLLOUT | POLLWRNORM);
+			break;
+		}
+
+		/* End of file when no writers are left */
+		if (!len || !w->opens)
+			break;
+
+		if (flags & MSG_DONTWAIT) {
+			err = -EWOULDBLOCK;
+			break;
+		}
+
+		/* Recheck under the spinlock, broadcast doesn't leave pending wakeups */
+		hal_spinlockSet(&r->spinlock, &sc);
+		if (!usring_avail(&r->ring) && r->loans == NULL && w->opens)
+			err = proc_threadWaitInterruptible(&r->queue, &r->spinlock, 0, &sc);
+		hal_spinlockClear(&r->spinlock, &sc);
+
+		if (err == -EINTR)
+			break;
+	}
+
+	unixsock_put(r);
+	return err;
+}
+
+
+ssize_t unix_pipeWrite(unsigned socket, const void *buf, size_t len, int flags)
+{
+	unixsock_t *w, *r;
+	size_t done = 0, need;
+	int err = EOK, n;
+	spinlock_ctx_t sc;
+
+	if ((w = unixsock_get(socket)) == NULL)
+		return -EBADF;
+
+	if (!(w->state & US_PIPE_W)) {
+		unixsock_put(w);
+		return -EBADF;
+	}
+
+	r = w->connect;
+
+	/* Writes up to US_PIPE_BUF are atomic, they wait for room for the whole data */
+	need = (len <= US_PIPE_BUF) ? len : 1;
+
+	while (done < len) {
+		if (!r->opens) {
+			err = -EPIPE;
+			break;
+		}
+
+		proc_lockSet(&r->lock);
+		if (usring_free(&r->ring) < need || r->loans != NULL)
+			n = 0;
+		else
+			n = usring_write(&r->ring, buf + done, len - done);
+		proc_lockClear(&r->lock);
+
+		if (n > 0) {
+			done += n;
+
+			hal_spinlockSet(&r->spinlock, &sc);
+			proc_threadBroadcast(&r->queue);
+			hal_spinlockClear(&r->spinlock, &sc);
+
+			poll_notify(&r->poll, POLLIN | POLLRDNORM);
+			continue;
+		}
+
+		if (flags & MSG_DONTWAIT) {
+			err = -EWOULDBLOCK;
+			break;
+		}
+
+		hal_spinlockSet(&r->spinlock, &sc);
+		if ((usring_free(&r->ring) < need || r->loans != NULL) && r->opens)
+			err = proc_threadWaitInterruptible(&r->writeq, &r->spinlock, 0, &sc);
+		hal_spinlockClear(&r->spinlock, &sc);
+
+		if (err == -EINTR)
+			break;
+	}
+
+	unixsock_put(w);
+	return done ? done : err;
+}
+
+
+/*
+ * Splicing - data is moved straight between kernel buffers and servers,
+ * whole pages of the buffer are loaned to the server by msg_map.
+ * The ring is read in place under rlock. Written data is filled into pages
+ * without any producer lock held, then the pages are queued on the socket
+ * as a loan it owns, the reader copies from them and frees them.
+ */
+
+
+ssize_t unix_spliceWrite(unsigned socket, splicefn_t fill, void *arg, size_t len, int flags)
+{
+	unixsock_t *s, *conn;
+	usloan_t *loan;
+	void *data;
+	size_t done = 0, want;
+	int n, err = EOK, pipe;
+	spinlock_ctx_t sc;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return -EBADF;
+
+	pipe = s->state & US_PIPE_W;
+
+	if ((!pipe && s->type != SOCK_STREAM) || (s->state & US_PIPE_R) || (conn = s->connect) == NULL) {
+		unixsock_put(s);
+		return -EINVAL;
+	}
+
+	while (done < len) {
+		/* Next chunk is filled while the reader drains the previous one */
+		hal_spinlockSet(&conn->spinlock, &sc);
+		while (conn->loansz >= US_SPLICESZ && (pipe ? conn->opens : !(conn->state & US_CLOSED)) && err == EOK) {
+			if (flags & MSG_DONTWAIT)
+				err = -EWOULDBLOCK;
+			else
+				err = proc_threadWaitInterruptible(&conn->writeq, &conn->spinlock, 0, &sc);
+		}
+
+		if (pipe ? !conn->opens : (conn->state & US_CLOSED))
+			err = -EPIPE;
+		hal_spinlockClear(&conn->spinlock, &sc);
+
+		if (err < 0)
+			break;
+
+		want = min(len - done, US_SPLICESZ);
+
+		/* The source is read without any socket lock held, its server may write to this socket itself */
+		if ((loan = vm_kmalloc(sizeof(usloan_t))) == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+
+		if ((data = vm_kmalloc(want)) == NULL) {
+			vm_kfree(loan);
+			err = -ENOMEM;
+			break;
+		}
+
+		if ((n = fill(arg, data, want)) <= 0) {
+			vm_kfree(data);
+			vm_kfree(loan);
+			err = n;
+			break;
+		}
+
+		loan->data = data;
+		loan->len = n;
+		loan->done = 0;
+		loan->owned = 1;
+
+		/* Pages move to the socket, data taken from the source is never lost */
+		hal_spinlockSet(&conn->spinlock, &sc);
+		LIST_ADD(&conn->loans, loan);
+		conn->loansz += n;
+		if (pipe)
+			proc_threadBroadcast(&conn->queue);
+		else
+			proc_threadWakeup(&conn->queue);
+		hal_spinlockClear(&conn->spinlock, &sc);
+
+		poll_notify(&conn->poll, POLLIN | POLLRDNORM);
+
+		done += n;
+
+		/* Source is exhausted for now */
+		if (n < want)
+			break;
+	}
+
+	unixsock_put(s);
+	return done ? done : err;
+}
+
+
+ssize_t unix_spliceRead(unsigned socket, splicefn_t drain, void *arg, size_t len, int flags)
+{
+	unixsock_t *s, *peer;
+	void *data;
+	size_t n;
+	int err = EOK, pipe;
+	spinlock_ctx_t sc;
+
+	if ((s = unixsock_get(socket)) == NULL)
+		return -EBADF;
+
+	pipe = s->state & US_PIPE_R;
+
+	if ((!pipe && s->type != SOCK_STREAM) || (s->state & US_PIPE_W)) {
+		unixsock_put(s);
+		return -EINVAL;
+	}
+
+	for (;;) {
+		proc_lockSet(&s->rlock);
+		if ((n = usring_rspace(&s->ring, &data)) > 0 && (err = drain(arg, data, min(n, len))) > 0)
+			usring_radvance(&s->ring, err);
+		else if (!n && s->loans != NULL) {
+			err = _unix_loanRead(s, drain, arg, len);
+			n = 1;
+		}
+		proc_lockClear(&s->rlock);
+
+		if (n > 0) {
+			if (err > 0) {
+				hal_spinlockSet(&s->spinlock, &sc);
+				if (pipe)
+					proc_threadBroadcast(&s->writeq);
+				else
+					proc_threadWakeup(&s->writeq);
+				hal_spinlockClear(&s->spinlock, &sc);
+
+				if ((peer = s->connect) != NULL)
+					poll_notify(&peer->poll, POLLOUT | POLLWRNORM);
+			}
+			break;
+		}
+
+		if (!len || (pipe && !s->connect->opens))
+			break;
+
+		if (flags & MSG_DONTWAIT) {
+			err = -EWOULDBLOCK;
+			break;
+		}
+
+		hal_spinlockSet(&s->spinlock, &sc);
+		if (!pipe)
+			proc_threadWait(&s->queue, &s->spinlock, 0, &sc);
+		else if (!usring_avail(&s->ring) && s->loans == NULL && s->connect->opens)
+			err = proc_threadWaitInterruptible(&s->queue, &s->spinlock, 0, &sc);
+		hal_spinlockClear(&s->spinlock, &sc);
+
+		if (err == -EINTR)
+			break;
+	}
+
+	unixsock_put(s);
+	return err;
+}
+
+
 int unix_unlink(unsigned socket)
 {
-	if (unixsock_get(socket) == NULL)
+	unixsock_t *s;
+
+	if ((s = unixsock_get(socket)) == NULL)
 		return -ENOTSOCK;
 
+	if (s->state & US_PIPE_R)
+		return unix_fifoUnlink(s);
+
 	return EOK;
 }
 
@@ -637,6 +1775,9 @@ int unix_link(unsigned socket)
 
 void unix_sockets_init(void)
 {
-	lib_rbInit(&unix_common.tree, unixsock_cmp, unixsock_augment);
-	proc_lockInit(&unix_common.lock);
+	unix_common.table = unixsock_tableAlloc(US_TABLE_MIN);
+	unix_common.free = NULL;
+	proc_lockInit(&unix_common.lock, "unix_common.lock");
+	hal_spinlockCreate(&unix_common.spinlock, "unix_common.spinlock");
+	hal_spinlockCreate(&unix_common.ctlSpinlock, "unix_common.ctlSpinlock");
 }
@@ -55,6 +55,7 @@ int proc_condCreate()
 	}
 	else {
 		cond->queue = NULL;
+		cond->mutex = 0;
 		resource_put(&cond->resource);
 	}
 
@@ -72,6 +73,7 @@ int proc_condWait(unsigned int c, unsigned int m, time_t timeout)
 		return err;
 
 	if ((mutex = mutex_get(m)) != NULL) {
+		cond->mutex = m;
 		err = proc_lockWait(&cond->queue, &mutex->lock, timeout);
 
 		if (!mutex_put(mutex))
@@ -105,12 +107,20 @@ int proc_condSignal(unsigned int c)
 int proc_condBroadcast(unsigned int c)
 {
 	cond_t *cond;
+	mutex_t *mutex;
 	int err = EOK;
 
 	if ((cond = cond_get(c)) == NULL)
 		return -EINVAL;
 
-	proc_threadBroadcastYield(&cond->queue);
+	/* Mutex is looked up by handle, as it may have been destroyed since the last wait */
+	if (cond->mutex && (mutex = mutex_get(cond->mutex)) != NULL) {
+		proc_lockRequeue(&cond->queue, &mutex->lock);
+		mutex_put(mutex);
+	}
+	else {
+		proc_threadBroadcastYield(&cond->queue);
+	}
 
 	if (!cond_put(cond))
 		err = -EINVAL;
@@ -24,6 +24,7 @@
 typedef struct {
 	resource_t resource;
 	thread_t *queue;
+	unsigned int mutex;   /* Handle of mutex last waited with, broadcast requeues waiters onto it */
 } cond_t;
 
 
@@ -0,0 +1,189 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Futexes
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../include/errno.h"
+#include "../lib/lib.h"
+#include "proc.h"
+#include "futex.h"
+
+
+#define FUTEX_BUCKETS 64
+
+
+/* Lives on the waiting thread's stack */
+typedef struct _futex_waiter_t {
+	struct _futex_waiter_t *next, *prev;
+	void *map;
+	addr_t key;
+	thread_t *queue;
+	int woken;
+} futex_waiter_t;
+
+
+/* Lock is sleeping, as the futex word is read with it set and may fault */
+typedef struct {
+	lock_t lock;
+	futex_waiter_t *waiters;
+} futex_bucket_t;
+
+
+static struct {
+	futex_bucket_t buckets[FUTEX_BUCKETS];
+} futex_common;
+
+
+/*
+ * Private futexes are keyed by address space and virtual address, shared ones by physical address.
+ * Page of a shared futex is pinned, so the key stays valid until the caller unpins it.
+ */
+static int futex_key(u32 *addr, int flags, void **map, addr_t *key, vm_pin_t *pin)
+{
+	process_t *process = proc_current()->process;
+
+	pin->anon = NULL;
+	pin->object = NULL;
+
+	if (((unsigned long)addr & (sizeof(*addr) - 1)) != 0)
+		return -EINVAL;
+
+	*map = (process != NULL) ? process->mapp : NULL;
+	*key = (addr_t)(unsigned long)addr;
+
+#ifndef NOMMU
+	/* Word of a process has to be in its own mapped memory */
+	if (process != NULL) {
+		if (flags & FUTEX_SHARED) {
+			*map = NULL;
+			return vm_mapPin(process->mapp, addr, key, pin);
+		}
+
+		if (vm_mapFlags(process->mapp, addr) < 0)
+			return -EFAULT;
+	}
+#else
+	if (flags & FUTEX_SHARED)
+		*map = NULL;
+#endif
+
+	return EOK;
+}
+
+
+static futex_bucket_t *futex_bucket(void *map, addr_t key)
+{
+	return &futex_common.buckets[((key >> 2) ^ ((unsigned long)map >> 4)) % FUTEX_BUCKETS];
+}
+
+
+int proc_futexWait(u32 *addr, u32 val, time_t timeout, int flags)
+{
+	futex_bucket_t *b;
+	futex_waiter_t w;
+	vm_pin_t pin;
+	int err;
+
+	if ((err = futex_key(addr, flags, &w.map, &w.key, &pin)) < 0)
+		return err;
+
+	if (lib_atomicLoad(addr) != val) {
+		vm_mapUnpin(&pin);
+		return -EAGAIN;
+	}
+
+	b = futex_bucket(w.map, w.key);
+	w.queue = NULL;
+	w.woken = 0;
+
+	proc_lockSet(&b->lock);
+
+	/* Wakers change the word before taking the bucket lock, so no wakeup is missed */
+	if (lib_atomicLoad(addr) != val) {
+		proc_lockClear(&b->lock);
+		vm_mapUnpin(&pin);
+		return -EAGAIN;
+	}
+
+	LIST_ADD(&b->waiters, &w);
+
+	if ((err = proc_lockWait(&w.queue, &b->lock, timeout)) == -EINTR)
+		proc_lockSet(&b->lock);
+
+	if (w.woken)
+		err = EOK;
+	else
+		LIST_REMOVE(&b->waiters, &w);
+
+	proc_lockClear(&b->lock);
+	vm_mapUnpin(&pin);
+
+	return err;
+}
+
+
+int proc_futexWake(u32 *addr, int n, int flags)
+{
+	futex_bucket_t *b;
+	futex_waiter_t *w, *next, *last;
+	void *map;
+	addr_t key;
+	vm_pin_t pin;
+	int err, done, woken = 0;
+
+	if (n <= 0)
+		return 0;
+
+	if ((err = futex_key(addr, flags, &map, &key, &pin)) < 0)
+		return err;
+
+	b = futex_bucket(map, key);
+
+	proc_lockSet(&b->lock);
+
+	if ((w = b->waiters) != NULL) {
+		last = w->prev;
+
+		do {
+			next = w->next;
+			done = (w == last);
+
+			if (w->map == map && w->key == key) {
+				LIST_REMOVE(&b->waiters, w);
+				w->woken = 1;
+				proc_threadWakeup(&w->queue);
+
+				if (++woken >= n)
+					break;
+			}
+
+			w = next;
+		} while (!done);
+	}
+
+	proc_lockClear(&b->lock);
+	vm_mapUnpin(&pin);
+
+	return woken;
+}
+
+
+void _futex_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < FUTEX_BUCKETS; ++i) {
+		proc_lockInit(&futex_common.buckets[i].lock, "futex.lock");
+		futex_common.buckets[i].waiters = NULL;
+	}
+}
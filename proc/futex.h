@@ -0,0 +1,33 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Futexes
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PROC_FUTEX_H_
+#define _PROC_FUTEX_H_
+
+#include HAL
+#include "../include/futex.h"
+
+
+/* Sleeps if *addr still equals val, returns -EAGAIN if not */
+extern int proc_futexWait(u32 *addr, u32 val, time_t timeout, int flags);
+
+
+/* Wakes up to n waiters, returns number woken */
+extern int proc_futexWake(u32 *addr, int n, int flags);
+
+
+extern void _futex_init(void);
+
+
+#endif
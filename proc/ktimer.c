@@ -0,0 +1,308 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Kernel timers
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../include/errno.h"
+#include "../lib/lib.h"
+#include "proc.h"
+#include "ktimer.h"
+
+
+/* Wheel tick in timer cycles, lowest level keeps exact expiries within it */
+#define KTIMER_RES    TIMER_US2CYC(SYSTICK_INTERVAL / 8)
+#define KTIMER_LEVELS 4
+
+#ifndef NOMMU
+#define KTIMER_BITS 6
+#else
+#define KTIMER_BITS 5
+#endif
+
+#define KTIMER_SLOTS (1 << KTIMER_BITS)
+#define KTIMER_MASK  (KTIMER_SLOTS - 1)
+
+
+typedef struct {
+	spinlock_t spinlock;
+	time_t clk;                             /* Tick wheel was run up to */
+	unsigned int count[KTIMER_LEVELS + 1];   /* Last one counts firing list */
+	ktimer_t *slots[KTIMER_LEVELS][KTIMER_SLOTS];
+	ktimer_t *firing;
+	ktimer_t *volatile running;
+} ktimerwheel_t;
+
+
+static struct {
+	unsigned int ncpus;
+	ktimerwheel_t *wheels;
+} ktimer_common;
+
+
+static void _ktimer_link(ktimerwheel_t *w, ktimer_t *t, ktimer_t **list, unsigned int level)
+{
+	t->list = list;
+	t->level = level;
+	w->count[level]++;
+	LIST_ADD(list, t);
+}
+
+
+static void _ktimer_unlink(ktimerwheel_t *w, ktimer_t *t)
+{
+	LIST_REMOVE(t->list, t);
+	w->count[t->level]--;
+	t->list = NULL;
+}
+
+
+/* Level is chosen by distance from wheel tick, so current slot of higher level is never used before its cascade */
+static void _ktimer_add(ktimerwheel_t *w, ktimer_t *t)
+{
+	time_t tick, delta, max = ((time_t)1 << (KTIMER_BITS * KTIMER_LEVELS)) - 1;
+	unsigned int l;
+
+	if ((tick = t->expires / KTIMER_RES) < w->clk)
+		tick = w->clk;
+
+	/* Further ones wait in highest level, they're cascaded there again */
+	if ((delta = tick - w->clk) > max) {
+		tick = w->clk + max;
+		delta = max;
+	}
+
+	for (l = 0; (delta >> (KTIMER_BITS * (l + 1))) != 0; ++l)
+		;
+
+	_ktimer_link(w, t, &w->slots[l][(tick >> (KTIMER_BITS * l)) & KTIMER_MASK], l);
+}
+
+
+static void _ktimer_cascade(ktimerwheel_t *w, unsigned int l)
+{
+	ktimer_t **slot = &w->slots[l][(w->clk >> (KTIMER_BITS * l)) & KTIMER_MASK], *t;
+
+	while ((t = *slot) != NULL) {
+		_ktimer_unlink(w, t);
+		_ktimer_add(w, t);
+	}
+}
+
+
+/* Moves timers due at now onto firing list */
+static void _ktimer_expire(ktimerwheel_t *w, ktimer_t **slot, time_t now)
+{
+	ktimer_t *t, *next, *last;
+	int done;
+
+	if ((t = *slot) == NULL)
+		return;
+
+	last = t->prev;
+
+	do {
+		next = t->next;
+		done = (t == last);
+
+		if (t->expires <= now) {
+			_ktimer_unlink(w, t);
+			_ktimer_link(w, t, &w->firing, KTIMER_LEVELS);
+		}
+
+		t = next;
+	} while (!done);
+}
+
+
+void ktimer_init(ktimer_t *timer, void (*handler)(ktimer_t *))
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->list = NULL;
+	timer->wheel = NULL;
+	timer->expires = 0;
+	timer->handler = handler;
+}
+
+
+void ktimer_arm(ktimer_t *timer, time_t expires, time_t slack)
+{
+	ktimerwheel_t *w;
+	time_t rounded;
+	spinlock_ctx_t sc;
+
+	ktimer_cancel(timer);
+
+	/* Rounding up to wheel tick lets nearby timers expire together */
+	rounded = (expires + KTIMER_RES - 1) / KTIMER_RES * KTIMER_RES;
+
+	if (rounded - expires <= slack)
+		expires = rounded;
+
+	w = &ktimer_common.wheels[hal_cpuGetID()];
+
+	hal_spinlockSet(&w->spinlock, &sc);
+	timer->wheel = w;
+	timer->expires = expires;
+	_ktimer_add(w, timer);
+	hal_spinlockClear(&w->spinlock, &sc);
+}
+
+
+int ktimer_cancel(ktimer_t *timer)
+{
+	ktimerwheel_t *w = timer->wheel;
+	int armed = 0;
+	spinlock_ctx_t sc;
+
+	if (w == NULL)
+		return 0;
+
+	hal_spinlockSet(&w->spinlock, &sc);
+
+	if (timer->list != NULL) {
+		_ktimer_unlink(w, timer);
+		armed = 1;
+	}
+
+	hal_spinlockClear(&w->spinlock, &sc);
+
+	return armed;
+}
+
+
+void ktimer_done(ktimer_t *timer)
+{
+	ktimerwheel_t *w = timer->wheel;
+
+	ktimer_cancel(timer);
+
+	if (w == NULL)
+		return;
+
+	/* Handlers run with interrupts disabled, so it's short */
+	while (w->running == timer)
+		;
+}
+
+
+void ktimer_run(time_t now)
+{
+	ktimerwheel_t *w = &ktimer_common.wheels[hal_cpuGetID()];
+	ktimer_t *t;
+	time_t target = now / KTIMER_RES, clk;
+	unsigned int l;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&w->spinlock, &sc);
+
+	for (;;) {
+		_ktimer_expire(w, &w->slots[0][w->clk & KTIMER_MASK], now);
+
+		if (w->clk >= target)
+			break;
+
+		/* Ticks before next cascade of the lowest non-empty level have no timers */
+		for (l = 0; l < KTIMER_LEVELS && w->count[l] == 0; ++l)
+			;
+
+		if (l == KTIMER_LEVELS)
+			clk = target;
+		else
+			clk = (w->clk | (((time_t)1 << (KTIMER_BITS * l)) - 1)) + 1;
+
+		w->clk = (clk < target) ? clk : target;
+
+		for (l = 1; l < KTIMER_LEVELS && (w->clk & (((time_t)1 << (KTIMER_BITS * l)) - 1)) == 0; ++l)
+			_ktimer_cascade(w, l);
+	}
+
+	/* Handlers may take other locks and rearm or cancel timers */
+	while ((t = w->firing) != NULL) {
+		_ktimer_unlink(w, t);
+		w->running = t;
+		hal_spinlockClear(&w->spinlock, &sc);
+
+		t->handler(t);
+
+		hal_spinlockSet(&w->spinlock, &sc);
+		w->running = NULL;
+	}
+
+	hal_spinlockClear(&w->spinlock, &sc);
+}
+
+
+time_t ktimer_next(time_t end)
+{
+	ktimerwheel_t *w = &ktimer_common.wheels[hal_cpuGetID()];
+	ktimer_t *t, *first;
+	time_t next = end, tick, start;
+	unsigned int l, i;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&w->spinlock, &sc);
+
+	for (l = 0; l < KTIMER_LEVELS; ++l) {
+		if (w->count[l] == 0)
+			continue;
+
+		/* Current slot of higher levels was cascaded already, it holds timers of the next round */
+		for (i = (l != 0); i < KTIMER_SLOTS + (l != 0); ++i) {
+			tick = (w->clk >> (KTIMER_BITS * l)) + i;
+			start = (tick << (KTIMER_BITS * l)) * KTIMER_RES;
+
+			if (start >= next)
+				break;
+
+			if ((first = w->slots[l][tick & KTIMER_MASK]) == NULL)
+				continue;
+
+			/* Higher level slot is cascaded at its start */
+			if (l != 0) {
+				next = start;
+				break;
+			}
+
+			t = first;
+			do {
+				if (t->expires < next)
+					next = t->expires;
+			} while ((t = t->next) != first);
+
+			break;
+		}
+	}
+
+	hal_spinlockClear(&w->spinlock, &sc);
+
+	return next;
+}
+
+
+int _ktimer_init(void)
+{
+	unsigned int i;
+
+	ktimer_common.ncpus = hal_cpuGetCount();
+
+	if ((ktimer_common.wheels = vm_kmalloc(ktimer_common.ncpus * sizeof(ktimerwheel_t))) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < ktimer_common.ncpus; ++i) {
+		hal_memset(&ktimer_common.wheels[i], 0, sizeof(ktimerwheel_t));
+		hal_spinlockCreate(&ktimer_common.wheels[i].spinlock, "ktimer.spinlock");
+	}
+
+	return EOK;
+}
@@ -0,0 +1,58 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Kernel timers
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PROC_KTIMER_H_
+#define _PROC_KTIMER_H_
+
+#include HAL
+
+
+/* Embedded in its owner, which serializes calls for it */
+typedef struct _ktimer_t {
+	struct _ktimer_t *next, *prev;
+	struct _ktimer_t **list;
+	void *wheel;
+	time_t expires;
+	unsigned int level;
+	void (*handler)(struct _ktimer_t *timer);
+} ktimer_t;
+
+
+extern void ktimer_init(ktimer_t *timer, void (*handler)(ktimer_t *));
+
+
+/* Arms timer on current CPU to expire at given time in timer cycles, up to slack later */
+extern void ktimer_arm(ktimer_t *timer, time_t expires, time_t slack);
+
+
+/* Returns 1 if timer was armed, its handler may still be running on other CPU */
+extern int ktimer_cancel(ktimer_t *timer);
+
+
+/* Cancels timer and waits for its handler, before timer is freed */
+extern void ktimer_done(ktimer_t *timer);
+
+
+/* Called from timer interrupt on every CPU, handlers are called with no locks set */
+extern void ktimer_run(time_t now);
+
+
+/* Returns earliest expiry on current CPU not later than end */
+extern time_t ktimer_next(time_t end);
+
+
+extern int _ktimer_init(void);
+
+
+#endif
@@ -17,6 +17,7 @@
 #define _PROC_LOCK_H_
 
 #include HAL
+#include "lockstat.h"
 
 
 typedef struct _lock_t {
@@ -27,6 +28,12 @@ typedef struct _lock_t {
 	/* Saved original priority of mutex holder to be restored once mutex is released */
 	unsigned int priority;
 	struct _thread_t *queue;
+
+#ifdef LOCKSTAT
+	lockstat_t stat;
+	cycles_t acquired;
+	struct _lock_t *next, *prev;
+#endif
 } lock_t;
 
 
@@ -42,13 +49,16 @@ extern int proc_lockTry(lock_t *lock);
 extern int proc_lockWait(struct _thread_t **queue, lock_t *lock, time_t timeout);
 
 
+extern void proc_lockRequeue(struct _thread_t **queue, lock_t *lock);
+
+
 extern int proc_lockClear(lock_t *lock);
 
 
 extern int proc_lockSetInterruptible(lock_t *lock);
 
 
-extern int proc_lockInit(lock_t *lock);
+extern int proc_lockInit(lock_t *lock, const char *name);
 
 
 extern int proc_lockDone(lock_t *lock);
@@ -0,0 +1,163 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Lock statistics
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../include/errno.h"
+#include "../lib/lib.h"
+#include "lock.h"
+#include "lockstat.h"
+
+
+static struct {
+	spinlock_t spinlock;
+	lock_t *locks;
+} lockstat_common;
+
+
+static unsigned int lockstat_bucket(unsigned long long t)
+{
+	unsigned int b;
+
+	if (t >> 32)
+		return LOCKSTAT_BUCKETS - 1;
+
+	b = (t != 0) ? hal_cpuGetLastBit((u32)t) / 2 : 0;
+
+	return (b < LOCKSTAT_BUCKETS) ? b : LOCKSTAT_BUCKETS - 1;
+}
+
+
+void lockstat_contended(lockstat_t *stat, unsigned long long wait, void *pc)
+{
+	unsigned int i, min = 0;
+
+	stat->contended++;
+	stat->wait[lockstat_bucket(wait)]++;
+
+	if (wait > stat->waitMax)
+		stat->waitMax = wait;
+
+	/* Space-saving: least frequent site is replaced, its count carried over */
+	for (i = 0; i < LOCKSTAT_SITES; ++i) {
+		if (stat->sites[i].pc == (unsigned long)pc) {
+			stat->sites[i].count++;
+			return;
+		}
+
+		if (stat->sites[i].count < stat->sites[min].count)
+			min = i;
+	}
+
+	stat->sites[min].pc = (unsigned long)pc;
+	stat->sites[min].count++;
+}
+
+
+void lockstat_released(lockstat_t *stat, unsigned long long hold)
+{
+	stat->acquired++;
+	stat->hold[lockstat_bucket(hold)]++;
+
+	if (hold > stat->holdMax)
+		stat->holdMax = hold;
+}
+
+
+#ifdef LOCKSTAT
+void lockstat_register(lock_t *lock)
+{
+	spinlock_ctx_t sc;
+
+	hal_memset(&lock->stat, 0, sizeof(lock->stat));
+
+	hal_spinlockSet(&lockstat_common.spinlock, &sc);
+	LIST_ADD(&lockstat_common.locks, lock);
+	hal_spinlockClear(&lockstat_common.spinlock, &sc);
+}
+
+
+void lockstat_unregister(lock_t *lock)
+{
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&lockstat_common.spinlock, &sc);
+	LIST_REMOVE(&lockstat_common.locks, lock);
+	hal_spinlockClear(&lockstat_common.spinlock, &sc);
+}
+
+
+/* Snapshots i-th lock, info may be user memory so it's never written with the spinlock set */
+static int lockstat_lockInfo(int i, lockinfo_t *info)
+{
+	lock_t *lock;
+	lockinfo_t li;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&lockstat_common.spinlock, &sc);
+
+	if ((lock = lockstat_common.locks) != NULL) {
+		for (; i > 0; --i) {
+			if ((lock = lock->next) == lockstat_common.locks) {
+				lock = NULL;
+				break;
+			}
+		}
+	}
+
+	if (lock != NULL) {
+		hal_strncpy(li.name, lock->spinlock.name, sizeof(li.name) - 1);
+		li.name[sizeof(li.name) - 1] = '\0';
+		li.type = lockinfo_lock;
+		hal_memcpy(&li.stat, &lock->stat, sizeof(li.stat));
+	}
+
+	hal_spinlockClear(&lockstat_common.spinlock, &sc);
+
+	if (lock == NULL)
+		return -ENOENT;
+
+	hal_memcpy(info, &li, sizeof(li));
+
+	return EOK;
+}
+#endif
+
+
+int lockstat_list(int n, lockinfo_t *info)
+{
+#ifdef LOCKSTAT
+	int i = 0, j = 0;
+
+#ifdef HAL_LOCKSTAT
+	while (i < n && hal_spinlockInfo(j, &info[i]) == EOK) {
+		++i;
+		++j;
+	}
+#endif
+
+	for (j = 0; i < n && lockstat_lockInfo(j, &info[i]) == EOK; ++j)
+		++i;
+
+	return i;
+#else
+	return -ENOSYS;
+#endif
+}
+
+
+void _lockstat_init(void)
+{
+	lockstat_common.locks = NULL;
+	hal_spinlockCreate(&lockstat_common.spinlock, "lockstat_common.spinlock");
+}
@@ -0,0 +1,45 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Lock statistics
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PROC_LOCKSTAT_H_
+#define _PROC_LOCKSTAT_H_
+
+/* Included by HAL spinlock.h with LOCKSTAT defined, so it mustn't include HAL itself */
+#include "../include/sysinfo.h"
+
+
+struct _lock_t;
+
+
+/* Records contended acquisition, called with the lock held */
+extern void lockstat_contended(lockstat_t *stat, unsigned long long wait, void *pc);
+
+
+/* Records release, called with the lock still held */
+extern void lockstat_released(lockstat_t *stat, unsigned long long hold);
+
+
+extern void lockstat_register(struct _lock_t *lock);
+
+
+extern void lockstat_unregister(struct _lock_t *lock);
+
+
+extern int lockstat_list(int n, lockinfo_t *info);
+
+
+extern void _lockstat_init(void);
+
+
+#endif
@@ -148,6 +148,8 @@ static void *msg_map(int dir, kmsg_t *kmsg, void *data, size_t size, process_t *
 			return NULL;
 	}
 
+	proc_current()->usage.mapped += size;
+
 	return (w + boffs);
 }
 
@@ -314,6 +316,8 @@ int proc_send(u32 port, msg_t *msg)
 		return -EINVAL;
 
 	sender = proc_current();
+	sender->usage.msgsnd++;
+	trace_event(trace_evMsgSend, msg->type, port);
 
 	hal_memcpy(&kmsg.msg, msg, sizeof(msg_t));
 	kmsg.src = sender->process;
@@ -360,6 +364,9 @@ int proc_send(u32 port, msg_t *msg)
 	if ((kmsg.msg.o.data > (void *)kmsg.msg.o.raw) && (kmsg.msg.o.data < (void *)kmsg.msg.o.raw + sizeof(kmsg.msg.o.raw)))
 		hal_memcpy(msg->o.data, kmsg.msg.o.data, msg->o.size);
 
+	if (kmsg.state == msg_responded)
+		proc_dcacheUpdate(msg);
+
 	return kmsg.state == msg_rejected ? -EINVAL : err;
 }
 
@@ -456,6 +463,9 @@ int proc_recv(u32 port, msg_t *msg, unsigned long int *rid)
 	if (opacked)
 		msg->o.data = msg->o.raw + (kmsg->msg.o.data - (void *)kmsg->msg.o.raw);
 
+	proc_current()->usage.msgrcv++;
+	trace_event(trace_evMsgRecv, msg->type, port);
+
 /* lib_printf("proc_recv 3: %p %d ipacked:%d\n", kmsg, kmsg->i.eoffs, ipacked); */
 
 	port_put(p, 0);
@@ -473,6 +483,8 @@ int proc_respond(u32 port, msg_t *msg, unsigned long int rid)
 	if ((p = proc_portGet(port)) == NULL)
 		return -EINVAL;
 
+	trace_event(trace_evMsgRespond, kmsg->msg.type, port);
+
 	/* Copy shadow pages */
 	if (kmsg->i.bp != NULL)
 		hal_memcpy(kmsg->i.bvaddr + kmsg->i.boffs, kmsg->i.w + kmsg->i.boffs, min(SIZE_PAGE - kmsg->i.boffs, kmsg->msg.i.size));
@@ -18,7 +18,12 @@
 #include "../lib/lib.h"
 #include "proc.h"
 
-#define HASH_LEN 5 /* Number of entries in dcache = 2 ^ HASH_LEN */
+#define HASH_LEN 5 /* Number of registered names buckets = 2 ^ HASH_LEN */
+
+#define DCACHE_SIZE_MIN 64       /* Initial number of dentry buckets */
+#define DCACHE_SIZE_MAX 8192
+#define DCACHE_ENTRIES_MAX 4096  /* Least recently used dentries are evicted above this */
+#define DCACHE_NEGATIVE_TTL (1000 * 1000) /* Servers create names without the kernel seeing it, misses expire */
 
 
 typedef struct _dcache_entry_t {
@@ -28,12 +33,50 @@ typedef struct _dcache_entry_t {
 } dcache_entry_t;
 
 
+/* Directory with cached children */
+typedef struct _ddir_t {
+	struct _ddir_t *next;
+	struct _dentry_t *children;
+	oid_t oid;
+} ddir_t;
+
+
+/* Result of looking up one path component in a directory, err != 0 for negative entries */
+typedef struct _dentry_t {
+	struct _dentry_t *next;
+	struct _dentry_t *lnext, *lprev;
+	struct _dentry_t *dnext, *dprev;
+	ddir_t *dir;
+
+	oid_t fil;
+	oid_t dev;
+	int err;
+	time_t expires;   /* Negative entries only */
+	unsigned int hash;
+	char name[];
+} dentry_t;
+
+
 struct {
 	int root_registered;
 	oid_t root_oid;
 
+	/* Names registered by servers */
 	dcache_entry_t *dcache[1 << HASH_LEN];
 	lock_t dcache_lock;
+
+	/* Path component cache, protected by dcache_lock */
+	dentry_t **dentries;
+	ddir_t **ddirs;
+	dentry_t *lru;
+	unsigned int size;
+	unsigned int entries;
+	unsigned int negative;
+	unsigned int gen;
+
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long invalidations;
 } name_common;
 
 
@@ -61,6 +104,367 @@ static dcache_entry_t *_dcache_entryLookup(unsigned int hash, const char *name)
 }
 
 
+/*
+ * Dentry cache
+ */
+
+
+static unsigned int dentry_oidHash(const oid_t *oid)
+{
+	return (oid->port * 2654435761U) ^ (unsigned int)oid->id ^ (unsigned int)(oid->id >> 32);
+}
+
+
+static unsigned int dentry_hash(const oid_t *dir, const char *name, size_t len)
+{
+	unsigned int hash = dentry_oidHash(dir);
+	unsigned char c;
+
+	while (len--) {
+		c = *name++;
+		hash = hash * 31 + (c << 4) + (c >> 4) * 11;
+	}
+
+	return hash;
+}
+
+
+static int dentry_oidEqual(const oid_t *a, const oid_t *b)
+{
+	return a->port == b->port && a->id == b->id;
+}
+
+
+static ddir_t *_dentry_dirFind(const oid_t *oid)
+{
+	ddir_t *d = name_common.ddirs[dentry_oidHash(oid) & (name_common.size - 1)];
+
+	while (d != NULL && !dentry_oidEqual(&d->oid, oid))
+		d = d->next;
+
+	return d;
+}
+
+
+static dentry_t *_dentry_find(const oid_t *dir, const char *name, size_t len, unsigned int hash)
+{
+	dentry_t *e = name_common.dentries[hash & (name_common.size - 1)];
+
+	for (; e != NULL; e = e->next) {
+		if (e->hash == hash && dentry_oidEqual(&e->dir->oid, dir) && !hal_strncmp(e->name, name, len) && e->name[len] == '\0')
+			break;
+	}
+
+	return e;
+}
+
+
+static void _dentry_remove(dentry_t *e)
+{
+	dentry_t **pe = &name_common.dentries[e->hash & (name_common.size - 1)];
+	ddir_t *d = e->dir, **pd;
+
+	while (*pe != e)
+		pe = &(*pe)->next;
+	*pe = e->next;
+
+	LIST_REMOVE_EX(&name_common.lru, e, lnext, lprev);
+	LIST_REMOVE_EX(&d->children, e, dnext, dprev);
+
+	if (d->children == NULL) {
+		pd = &name_common.ddirs[dentry_oidHash(&d->oid) & (name_common.size - 1)];
+		while (*pd != d)
+			pd = &(*pd)->next;
+		*pd = d->next;
+
+		vm_kfree(d);
+	}
+
+	if (e->err)
+		name_common.negative--;
+	name_common.entries--;
+
+	vm_kfree(e);
+}
+
+
+/* Drops everything cached below directory */
+static void _dentry_dropDir(const oid_t *oid)
+{
+	ddir_t *d;
+
+	if (name_common.dentries == NULL)
+		return;
+
+	while ((d = _dentry_dirFind(oid)) != NULL)
+		_dentry_remove(d->children);
+}
+
+
+static void _dentry_flush(void)
+{
+	while (name_common.lru != NULL)
+		_dentry_remove(name_common.lru);
+}
+
+
+static void _dentry_resize(void)
+{
+	unsigned int size = name_common.size * 2, i, idx;
+	dentry_t **dentries, *e;
+	ddir_t **ddirs, *d;
+
+	if (size > DCACHE_SIZE_MAX)
+		return;
+
+	if ((dentries = vm_kmalloc(size * sizeof(dentry_t *))) == NULL)
+		return;
+
+	if ((ddirs = vm_kmalloc(size * sizeof(ddir_t *))) == NULL) {
+		vm_kfree(dentries);
+		return;
+	}
+
+	hal_memset(dentries, 0, size * sizeof(dentry_t *));
+	hal_memset(ddirs, 0, size * sizeof(ddir_t *));
+
+	for (i = 0; i < name_common.size; ++i) {
+		while ((e = name_common.dentries[i]) != NULL) {
+			name_common.dentries[i] = e->next;
+			idx = e->hash & (size - 1);
+			e->next = dentries[idx];
+			dentries[idx] = e;
+		}
+
+		while ((d = name_common.ddirs[i]) != NULL) {
+			name_common.ddirs[i] = d->next;
+			idx = dentry_oidHash(&d->oid) & (size - 1);
+			d->next = ddirs[idx];
+			ddirs[idx] = d;
+		}
+	}
+
+	vm_kfree(name_common.dentries);
+	vm_kfree(name_common.ddirs);
+
+	name_common.dentries = dentries;
+	name_common.ddirs = ddirs;
+	name_common.size = size;
+}
+
+
+static int dentry_lookup(const oid_t *dir, const char *name, size_t len, oid_t *fil, oid_t *dev, unsigned int *gen)
+{
+	dentry_t *e = NULL;
+	int err = 1;
+	time_t now = proc_timestamp();
+
+	proc_lockSet(&name_common.dcache_lock);
+	*gen = name_common.gen;
+
+	if (name_common.dentries != NULL)
+		e = _dentry_find(dir, name, len, dentry_hash(dir, name, len));
+
+	/* Expired miss goes to the server again */
+	if (e != NULL && e->err && now >= e->expires) {
+		_dentry_remove(e);
+		e = NULL;
+	}
+
+	if (e != NULL) {
+		*fil = e->fil;
+		*dev = e->dev;
+		err = e->err;
+
+		/* Move to the front of LRU list */
+		if (name_common.lru != e) {
+			LIST_REMOVE_EX(&name_common.lru, e, lnext, lprev);
+			LIST_ADD_EX(&name_common.lru, e, lnext, lprev);
+			name_common.lru = e;
+		}
+
+		name_common.hits++;
+	}
+	else {
+		name_common.misses++;
+	}
+	proc_lockClear(&name_common.dcache_lock);
+
+	return err;
+}
+
+
+static void dentry_insert(const oid_t *dir, const char *name, size_t len, const oid_t *fil, const oid_t *dev, int err, unsigned int gen)
+{
+	dentry_t *e, *old;
+	ddir_t *d, *nd;
+	unsigned int hash = dentry_hash(dir, name, len);
+
+	if ((e = vm_kmalloc(sizeof(dentry_t) + len + 1)) == NULL)
+		return;
+
+	if ((nd = vm_kmalloc(sizeof(ddir_t))) == NULL) {
+		vm_kfree(e);
+		return;
+	}
+
+	hal_memcpy(e->name, name, len);
+	e->name[len] = '\0';
+	e->hash = hash;
+	e->err = err;
+	if (!err) {
+		e->fil = *fil;
+		e->dev = *dev;
+	}
+	else {
+		e->expires = proc_timestamp() + DCACHE_NEGATIVE_TTL;
+	}
+
+	proc_lockSet(&name_common.dcache_lock);
+
+	/* Directory changed while server was asked, result may be stale */
+	if (name_common.dentries == NULL || gen != name_common.gen) {
+		proc_lockClear(&name_common.dcache_lock);
+		vm_kfree(nd);
+		vm_kfree(e);
+		return;
+	}
+
+	if ((old = _dentry_find(dir, name, len, hash)) != NULL)
+		_dentry_remove(old);
+
+	if (name_common.entries >= DCACHE_ENTRIES_MAX)
+		_dentry_remove(name_common.lru->lprev);
+
+	if ((d = _dentry_dirFind(dir)) == NULL) {
+		d = nd;
+		nd = NULL;
+		d->oid = *dir;
+		d->children = NULL;
+		d->next = name_common.ddirs[dentry_oidHash(dir) & (name_common.size - 1)];
+		name_common.ddirs[dentry_oidHash(dir) & (name_common.size - 1)] = d;
+	}
+
+	e->dir = d;
+	LIST_ADD_EX(&d->children, e, dnext, dprev);
+	LIST_ADD_EX(&name_common.lru, e, lnext, lprev);
+	name_common.lru = e;
+
+	e->next = name_common.dentries[hash & (name_common.size - 1)];
+	name_common.dentries[hash & (name_common.size - 1)] = e;
+
+	if (err)
+		name_common.negative++;
+
+	if (++name_common.entries > 2 * name_common.size)
+		_dentry_resize();
+
+	proc_lockClear(&name_common.dcache_lock);
+
+	if (nd != NULL)
+		vm_kfree(nd);
+}
+
+
+static void _dentry_invalidate(const oid_t *dir, const char *name, size_t size)
+{
+	dentry_t *e;
+	size_t len;
+	oid_t fil;
+	int err;
+
+	if (name == NULL)
+		return;
+
+	for (len = 0; len < size && name[len] != '\0' && name[len] != '/'; ++len)
+		;
+
+	if ((e = _dentry_find(dir, name, len, dentry_hash(dir, name, len))) != NULL) {
+		fil = e->fil;
+		err = e->err;
+		_dentry_remove(e);
+
+		/* Object might be gone, don't trust what is cached below it */
+		if (!err)
+			_dentry_dropDir(&fil);
+	}
+}
+
+
+/* Only messages changing the namespace are of interest, the rest skips the lock */
+static int dcache_affects(const msg_t *msg)
+{
+	switch (msg->type) {
+		case mtCreate:
+		case mtLink:
+		case mtUnlink:
+		case mtDestroy:
+			return 1;
+
+		case mtSetAttr:
+			return msg->i.attr.type == atDev;
+
+		default:
+			return 0;
+	}
+}
+
+
+void proc_dcacheUpdate(const msg_t *msg)
+{
+	if (!dcache_affects(msg))
+		return;
+
+	proc_lockSet(&name_common.dcache_lock);
+
+	if (name_common.dentries != NULL) {
+		switch (msg->type) {
+			case mtCreate:
+				_dentry_invalidate(&msg->i.create.dir, msg->i.data, msg->i.size);
+				_dentry_dropDir(&msg->o.create.oid);
+				break;
+
+			case mtLink:
+			case mtUnlink:
+				_dentry_invalidate(&msg->i.ln.dir, msg->i.data, msg->i.size);
+				_dentry_dropDir(&msg->i.ln.oid);
+				break;
+
+			case mtDestroy:
+				_dentry_dropDir(&msg->i.destroy.oid);
+				break;
+
+			default:
+				/*
+				 * Mount or unmount - setting atDev redirects lookups through the mountpoint.
+				 * Entries resolving to it are keyed by their parents, not by the mountpoint,
+				 * so the whole cache goes. Mounts are rare enough for that.
+				 */
+				_dentry_flush();
+				break;
+		}
+
+		name_common.gen++;
+		name_common.invalidations++;
+	}
+
+	proc_lockClear(&name_common.dcache_lock);
+}
+
+
+void proc_dcacheInfo(dcacheinfo_t *info)
+{
+	proc_lockSet(&name_common.dcache_lock);
+	info->size = name_common.size;
+	info->entries = name_common.entries;
+	info->negative = name_common.negative;
+	info->hits = name_common.hits;
+	info->misses = name_common.misses;
+	info->invalidations = name_common.invalidations;
+	proc_lockClear(&name_common.dcache_lock);
+}
+
+
 int proc_portRegister(unsigned int port, const char *name, oid_t *oid)
 {
 	dcache_entry_t *entry;
@@ -120,7 +524,7 @@ void proc_portUnregister(const char *name)
 	if (prev != NULL)
 		prev->next = entry->next;
 	else
-		name_common.dcache[hash] = NULL;
+		name_common.dcache[hash] = entry->next;
 	proc_lockClear(&name_common.dcache_lock);
 
 	vm_kfree(entry);
@@ -129,12 +533,13 @@ void proc_portUnregister(const char *name)
 
 int proc_portLookup(const char *name, oid_t *file, oid_t *dev)
 {
-	int err;
+	int err = EOK;
 	dcache_entry_t *entry;
-	msg_t *msg;
-	size_t len, i;
-	oid_t srv;
-	char pstack[16], *pheap = NULL, *pptr;
+	msg_t msg;
+	size_t len, i, clen;
+	oid_t srv, fil, dv;
+	unsigned int gen;
+	char pstack[32], *pheap = NULL, *pptr;
 
 	if (name == NULL || (file == NULL && dev == NULL))
 		return -EINVAL;
@@ -168,7 +573,6 @@ int proc_portLookup(const char *name, oid_t *file, oid_t *dev)
 
 	srv = name_common.root_oid;
 
-#if 1 /* (MOD) */
 	/* Search cache for starting point */
 	len = hal_strlen(name);
 
@@ -207,50 +611,71 @@ int proc_portLookup(const char *name, oid_t *file, oid_t *dev)
 		return -EINVAL;
 	}
 
-	if ((msg = vm_kmalloc(sizeof(msg_t))) == NULL) {
-		if (pheap != NULL)
-			vm_kfree(pheap);
-		return -ENOMEM;
-	}
+	hal_memset(&msg, 0, sizeof(msg_t));
+	msg.type = mtLookup;
 
-	hal_memset(msg, 0, sizeof(msg_t));
-	msg->type = mtLookup;
+	fil = dv = srv;
+
+	/* Walk remaining path one component at a time, asking servers only on cache miss */
+	while (i < len) {
+		while (name[i] == '/')
+			++i;
+
+		for (clen = 0; name[i + clen] != '\0' && name[i + clen] != '/'; ++clen)
+			;
+
+		if (!clen)
+			break;
+
+		if ((err = dentry_lookup(&srv, name + i, clen, &fil, &dv, &gen)) <= 0) {
+			if (err < 0)
+				break;
+
+			srv = dv;
+			i += clen;
+			continue;
+		}
 
-	/* Query servers */
-	do {
-		msg->i.lookup.dir = srv;
-		msg->i.size = len - i;
-		hal_memcpy(pptr, name + i + 1, len - i);
-		msg->i.data = pptr;
+		msg.i.lookup.dir = srv;
+		msg.i.size = clen + 1;
+		hal_memcpy(pptr, name + i, clen);
+		pptr[clen] = '\0';
+		msg.i.data = pptr;
 
-		if ((err = proc_send(srv.port, msg)) < 0)
+		if ((err = proc_send(srv.port, &msg)) < 0)
 			break;
 
-		srv = msg->o.lookup.dev;
+		fil = msg.o.lookup.fil;
+		dv = msg.o.lookup.dev;
 
-		if ((err = msg->o.lookup.err) < 0)
+		if ((err = msg.o.lookup.err) < 0) {
+			if (err == -ENOENT)
+				dentry_insert(&srv, name + i, clen, NULL, NULL, err, gen);
 			break;
+		}
 
-		if (i + err > len) {
+		if (!err || err > clen) {
 			err = -EINVAL;
 			break;
 		}
 
-		i += err + 1;
+		if (err == clen)
+			dentry_insert(&srv, name + i, clen, &fil, &dv, EOK, gen);
+
+		srv = dv;
+		i += err;
 	}
-	while (i != len);
 
-	if (file != NULL)
-		*file = msg->o.lookup.fil;
-	if (dev != NULL)
-		*dev = msg->o.lookup.dev;
+	if (err >= 0) {
+		if (file != NULL)
+			*file = fil;
+		if (dev != NULL)
+			*dev = dv;
+	}
 
-	vm_kfree(msg);
 	if (pheap != NULL)
 		vm_kfree(pheap);
 	return err < 0 ? err : EOK;
-#endif
-
 }
 
 
@@ -477,8 +902,32 @@ int proc_size(oid_t oid)
 
 void _name_init(void)
 {
-	proc_lockInit(&name_common.dcache_lock);
+	proc_lockInit(&name_common.dcache_lock, "name_common.dcache_lock");
 
 	hal_memset(name_common.dcache, NULL, sizeof(name_common.dcache));
 	name_common.root_registered = 0;
+
+	name_common.lru = NULL;
+	name_common.entries = 0;
+	name_common.negative = 0;
+	name_common.gen = 0;
+	name_common.hits = 0;
+	name_common.misses = 0;
+	name_common.invalidations = 0;
+
+	/* Without buckets lookups just bypass the cache */
+	name_common.size = DCACHE_SIZE_MIN;
+	name_common.dentries = vm_kmalloc(DCACHE_SIZE_MIN * sizeof(dentry_t *));
+	name_common.ddirs = vm_kmalloc(DCACHE_SIZE_MIN * sizeof(ddir_t *));
+
+	if (name_common.dentries == NULL || name_common.ddirs == NULL) {
+		vm_kfree(name_common.dentries);
+		vm_kfree(name_common.ddirs);
+		name_common.dentries = NULL;
+		name_common.ddirs = NULL;
+	}
+	else {
+		hal_memset(name_common.dentries, 0, DCACHE_SIZE_MIN * sizeof(dentry_t *));
+		hal_memset(name_common.ddirs, 0, DCACHE_SIZE_MIN * sizeof(ddir_t *));
+	}
 }
@@ -17,6 +17,8 @@
 #define _PROC_NAME_H_
 
 #include HAL
+#include "../include/msg.h"
+#include "../include/sysinfo.h"
 
 
 typedef struct {
@@ -67,6 +69,13 @@ extern int proc_portLookup(const char *name, oid_t *file, oid_t *dev);
 extern int proc_lookup(const char *name, oid_t *file, oid_t *dev);
 
 
+/* Drops dentries affected by namespace changing message after it has been responded */
+extern void proc_dcacheUpdate(const msg_t *msg);
+
+
+extern void proc_dcacheInfo(dcacheinfo_t *info);
+
+
 extern int proc_read(oid_t oid, size_t offs, void *buf, size_t sz, unsigned mode);
 
 
@@ -219,6 +219,7 @@ int proc_portCreate(u32 *id)
 	port->current = NULL;
 	port->refs = 1;
 	port->closed = 0;
+	port->pollnotify = 0;
 
 	*id = port->id;
 	proc_lockClear(&port_common.port_lock);
@@ -281,5 +282,5 @@ void proc_portsDestroy(process_t *proc)
 void _port_init(void)
 {
 	lib_rbInit(&port_common.tree, ports_cmp, ports_augment);
-	proc_lockInit(&port_common.port_lock);
+	proc_lockInit(&port_common.port_lock, "port_common.port_lock");
 }
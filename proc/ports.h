@@ -33,6 +33,7 @@ typedef struct _port_t {
 	kmsg_t *kmessages;
 	process_t *owner;
 	int refs, closed;
+	int pollnotify;
 
 	spinlock_t spinlock;
 	thread_t *threads;
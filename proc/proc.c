@@ -21,12 +21,16 @@
 
 int _proc_init(vm_map_t *kmap, vm_object_t *kernel)
 {
+	_ktimer_init();
 	_threads_init(kmap, kernel);
 	_process_init(kmap, kernel);
 	_port_init();
 	_msg_init(kmap, kernel);
 	_name_init();
 	_userintr_init();
+	_futex_init();
+	_trace_init(kmap, kernel);
+	_profile_init();
 
 	return EOK;
 }
@@ -21,14 +21,19 @@
 #include "threads.h"
 #include "process.h"
 #include "lock.h"
+#include "lockstat.h"
 #include "msg.h"
 #include "name.h"
 #include "resource.h"
 #include "mutex.h"
 #include "cond.h"
+#include "futex.h"
 #include "file.h"
 #include "userintr.h"
 #include "ports.h"
+#include "trace.h"
+#include "profile.h"
+#include "ktimer.h"
 
 
 extern int _proc_init(vm_map_t *kmap, vm_object_t *kernel);
@@ -28,6 +28,7 @@
 #include "msg.h"
 #include "ports.h"
 #include "userintr.h"
+#include "trace.h"
 
 
 typedef struct {
@@ -90,9 +91,9 @@ static void process_destroy(process_t *p)
 {
 	thread_t *ghost;
 
-	perf_kill(p);
+	trace_record(trace_evKill, p->id, 0, p->exit, 0);
 
-	posix_died(p->id, p->exit);
+	posix_died(p->id, p->exit, &p->usage);
 
 	if (p->mapp != NULL)
 		vm_mapDestroy(p, p->mapp);
@@ -189,6 +190,10 @@ static unsigned process_alloc(process_t *process)
 		process_common.idcounter = 1;
 
 	if (process->id) {
+		/* Kernel's own init process, the one starting syspage programs */
+		if (process_common.first == NULL)
+			process_common.first = process;
+
 		lib_rbInsert(&process_common.id, &process->idlinkage);
 		process_common.idcounter++;
 	}
@@ -273,13 +278,16 @@ int proc_start(void (*initthr)(void *), void *arg, const char *path)
 	process->reaper = NULL;
 	process->refs = 1;
 
-	proc_lockInit(&process->lock);
+	proc_lockInit(&process->lock, "process.lock");
 
 	process->ports = NULL;
 
 	process->sigpend = 0;
 	process->sigmask = 0;
 	process->sighandler = NULL;
+	process->posix = NULL;
+	process->priv = 0;
+	hal_memset(&process->usage, 0, sizeof(process->usage));
 
 #ifndef NOMMU
 	process->lazy = 0;
@@ -293,7 +301,7 @@ int proc_start(void (*initthr)(void *), void *arg, const char *path)
 	/* Initialize resources tree for mutex and cond handles */
 	_resource_init(process);
 	process_alloc(process);
-	perf_fork(process);
+	trace_event(trace_evFork, process->id, 0);
 
 	if (proc_threadCreate(process, (void *)initthr, NULL, 4, SIZE_KSTACK, NULL, 0, (void *)arg) < 0) {
 		vm_kfree(process->path);
@@ -311,6 +319,12 @@ void proc_kill(process_t *proc)
 }
 
 
+int proc_privileged(process_t *proc)
+{
+	return proc == NULL || proc == process_common.first || proc->priv;
+}
+
+
 void process_dumpException(unsigned int n, exc_context_t *ctx)
 {
 /*	thread_t *thread = proc_current();
@@ -813,6 +827,9 @@ static void proc_spawnThread(void *arg)
 	if (spawn->parent != NULL)
 		posix_clone(spawn->parent->process->id);
 
+	/* Granted only to programs started by the kernel itself, their children aren't privileged */
+	current->process->priv = spawn->parent != NULL && spawn->parent->process == process_common.first;
+
 	process_exec(current, spawn);
 }
 
@@ -973,6 +990,7 @@ static void process_vforkThread(void *arg)
 	current->process->pmapp = parent->process->pmapp;
 	current->process->sigmask = parent->process->sigmask;
 	current->process->sighandler = parent->process->sighandler;
+	current->process->priv = 0;
 	pmap_switch(current->process->pmapp);
 
 	hal_spinlockSet(&spawn->sl, &sc);
@@ -980,8 +998,8 @@ static void process_vforkThread(void *arg)
 		proc_threadWait(&spawn->wq, &spawn->sl, 0, &sc);
 	hal_spinlockClear(&spawn->sl, &sc);
 
-	/* Copy parent kernel stack */
-	if ((current->parentkstack = (void *)vm_kmalloc(parent->kstacksz)) == NULL) {
+	/* Copy parent FPU state and kernel stack */
+	if (threads_fpuCopy(current, parent) < 0 || (current->parentkstack = (void *)vm_kmalloc(parent->kstacksz)) == NULL) {
 		hal_spinlockSet(&spawn->sl, &sc);
 		spawn->state = -ENOMEM;
 		proc_threadWakeup(&spawn->wq);
@@ -1188,6 +1206,7 @@ static int process_execve(thread_t *current)
 
 	/* Close cloexec file descriptors */
 	posix_exec();
+	trace_event(trace_evExec, current->process->id, 0);
 	process_exec(current, spawn);
 
 	/* Not reached */
@@ -1302,7 +1321,7 @@ int _process_init(vm_map_t *kmap, vm_object_t *kernel)
 	process_common.first = NULL;
 	process_common.kernel = kernel;
 	process_common.idcounter = 1;
-	proc_lockInit(&process_common.lock);
+	proc_lockInit(&process_common.lock, "process_common.lock");
 	lib_rbInit(&process_common.id, proc_idcmp, process_augment);
 
 	hal_exceptionsSetHandler(EXC_DEFAULT, process_exception);
@@ -21,6 +21,7 @@
 #include "../vm/vm.h"
 #include "lock.h"
 #include "../vm/amap.h"
+#include "../include/sysinfo.h"
 
 #define MAX_PID ((1LL << (__CHAR_BIT__ * (sizeof(unsigned)) - 1)) - 1)
 
@@ -47,6 +48,7 @@ typedef struct _process_t {
 	unsigned lazy : 1;
 	unsigned lgap : 1;
 	unsigned rgap : 1;
+	unsigned priv : 1;  /* Started by the kernel, may observe the whole system; not inherited */
 
 	/*u32 uid;
 	u32 euid;
@@ -64,6 +66,11 @@ typedef struct _process_t {
 	unsigned sigmask;
 	void *sighandler;
 
+	void *posix;
+
+	/* Totals of exited threads, synchronized by threads spinlock */
+	usageinfo_t usage;
+
 	void *got;
 } process_t;
 
@@ -80,6 +87,10 @@ extern void proc_get(process_t *proc);
 extern void proc_kill(process_t *proc);
 
 
+/* Kernel threads and privileged processes may use system wide facilities such as tracing */
+extern int proc_privileged(process_t *proc);
+
+
 extern void proc_reap(void);
 
 
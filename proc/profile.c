@@ -0,0 +1,236 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Sampling profiler
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../include/errno.h"
+#include "../lib/lib.h"
+#include "proc.h"
+#include "profile.h"
+
+
+/* Samples buffered per CPU */
+#ifndef NOMMU
+#define PROFILE_SAMPLES 1024
+#else
+#define PROFILE_SAMPLES 64
+#endif
+
+
+typedef struct {
+	spinlock_t spinlock;
+	time_t next;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int lost;
+	profile_sample_t *samples;
+} profilecpu_t;
+
+
+static struct {
+	lock_t lock;
+	volatile unsigned int period;   /* Sampling period in us, 0 when stopped */
+
+	/* Buffers are allocated on first start and kept */
+	unsigned int ncpus;
+	profilecpu_t *cpus;
+} profile_common;
+
+
+void profile_sample(cpu_context_t *ctx)
+{
+	profilecpu_t *c;
+	profile_sample_t *s;
+	thread_t *current;
+	void *pcs[PROFILE_DEPTH];
+	unsigned int period, cpu, i;
+	time_t now;
+	spinlock_ctx_t sc;
+
+	if ((period = profile_common.period) == 0)
+		return;
+
+	cpu = hal_cpuGetID();
+	c = &profile_common.cpus[cpu];
+	now = proc_timestamp();
+
+	if (now < c->next || (current = proc_current()) == NULL)
+		return;
+
+	hal_spinlockSet(&c->spinlock, &sc);
+	c->next = now + period;
+
+	if (c->head - c->tail >= PROFILE_SAMPLES) {
+		c->lost++;
+	}
+	else {
+		s = &c->samples[c->head % PROFILE_SAMPLES];
+		s->timestamp = now;
+		s->pid = (current->process != NULL) ? current->process->id : 0;
+		s->tid = current->id;
+		s->cpu = cpu;
+		s->user = !hal_cpuSupervisorMode(ctx);
+#ifndef NPROFILE
+		s->depth = hal_cpuBacktrace(ctx, current->kstack, current->kstacksz, pcs, PROFILE_DEPTH);
+#else
+		/* Built without frame pointers, only the sampled address is reliable */
+		s->depth = hal_cpuBacktrace(ctx, current->kstack, current->kstacksz, pcs, 1);
+#endif
+
+		for (i = 0; i < s->depth; ++i)
+			s->pcs[i] = (unsigned long)pcs[i];
+
+		c->head++;
+	}
+	hal_spinlockClear(&c->spinlock, &sc);
+}
+
+
+int profile_start(unsigned int period)
+{
+	profilecpu_t *c;
+	unsigned int i;
+	int err = EOK;
+	spinlock_ctx_t sc;
+
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	if (period == 0)
+		return -EINVAL;
+
+	proc_lockSet(&profile_common.lock);
+
+	do {
+		if (profile_common.period) {
+			err = -EBUSY;
+			break;
+		}
+
+		if (profile_common.cpus == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+
+		for (i = 0; i < profile_common.ncpus; ++i) {
+			c = &profile_common.cpus[i];
+
+			if (c->samples == NULL && (c->samples = vm_kmalloc(PROFILE_SAMPLES * sizeof(profile_sample_t))) == NULL) {
+				err = -ENOMEM;
+				break;
+			}
+
+			hal_spinlockSet(&c->spinlock, &sc);
+			c->next = 0;
+			c->head = 0;
+			c->tail = 0;
+			c->lost = 0;
+			hal_spinlockClear(&c->spinlock, &sc);
+		}
+
+		if (err < 0)
+			break;
+
+		lib_atomicStore(&profile_common.period, period);
+	} while (0);
+
+	proc_lockClear(&profile_common.lock);
+
+	return err;
+}
+
+
+/* Copies out whole samples, CPU by CPU, consuming them */
+int profile_read(void *buffer, size_t bufsz)
+{
+	profilecpu_t *c;
+	profile_sample_t s;
+	unsigned int i;
+	size_t len = 0;
+	int empty;
+	spinlock_ctx_t sc;
+
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	proc_lockSet(&profile_common.lock);
+
+	for (i = 0; i < profile_common.ncpus; ++i) {
+		c = &profile_common.cpus[i];
+
+		if (c->samples == NULL)
+			break;
+
+		/* Buffer may be user memory, so it's never written with the spinlock set */
+		while (len + sizeof(s) <= bufsz) {
+			hal_spinlockSet(&c->spinlock, &sc);
+			if (!(empty = (c->tail == c->head))) {
+				hal_memcpy(&s, &c->samples[c->tail % PROFILE_SAMPLES], sizeof(s));
+				c->tail++;
+			}
+			hal_spinlockClear(&c->spinlock, &sc);
+
+			if (empty)
+				break;
+
+			hal_memcpy(buffer + len, &s, sizeof(s));
+			len += sizeof(s);
+		}
+	}
+
+	proc_lockClear(&profile_common.lock);
+
+	return len;
+}
+
+
+/* Returns number of samples lost because of full buffers */
+int profile_stop(void)
+{
+	unsigned int i, lost = 0;
+
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	proc_lockSet(&profile_common.lock);
+	lib_atomicStore(&profile_common.period, 0);
+
+	for (i = 0; i < profile_common.ncpus; ++i)
+		lost += profile_common.cpus[i].lost;
+
+	proc_lockClear(&profile_common.lock);
+
+	return lost;
+}
+
+
+void _profile_init(void)
+{
+	unsigned int i;
+
+	profile_common.period = 0;
+	profile_common.ncpus = hal_cpuGetCount();
+
+	proc_lockInit(&profile_common.lock, "profile_common.lock");
+
+	if ((profile_common.cpus = vm_kmalloc(profile_common.ncpus * sizeof(profilecpu_t))) == NULL) {
+		profile_common.ncpus = 0;
+		return;
+	}
+
+	for (i = 0; i < profile_common.ncpus; ++i) {
+		hal_spinlockCreate(&profile_common.cpus[i].spinlock, "profile.spinlock");
+		profile_common.cpus[i].samples = NULL;
+		profile_common.cpus[i].lost = 0;
+	}
+}
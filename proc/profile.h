@@ -0,0 +1,38 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Sampling profiler
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PROC_PROFILE_H_
+#define _PROC_PROFILE_H_
+
+#include HAL
+#include "../include/sysinfo.h"
+
+
+/* Called from timer interrupt on every CPU */
+extern void profile_sample(cpu_context_t *ctx);
+
+
+extern int profile_start(unsigned int period);
+
+
+extern int profile_read(void *buffer, size_t bufsz);
+
+
+extern int profile_stop(void);
+
+
+extern void _profile_init(void);
+
+
+#endif
@@ -23,6 +23,9 @@
 #include "resource.h"
 #include "msg.h"
 #include "ports.h"
+#include "trace.h"
+#include "userintr.h"
+#include "profile.h"
 
 
 struct {
@@ -36,8 +39,14 @@ struct {
 
 	unsigned int executions;
 
-	/* Synchronized by spinlock */
-	rbtree_t sleeping;
+	/* Default affinity, all but isolated CPUs */
+	unsigned int cpus;
+
+	/* Deadline class threads, admitted density per CPU is fixed point */
+	thread_t *dl;
+	time_t *dlbw;
+	time_t dlmax;
+	time_t dluser;
 
 	/* Synchronized by mutex */
 	unsigned int idcounter;
@@ -52,38 +61,15 @@ struct {
 
 	thread_t *volatile ghosts;
 	thread_t *reaper;
-
-	int perfGather;
-	time_t perfLastTimestamp;
-	cbuffer_t perfBuffer;
-	page_t *perfPages;
 } threads_common;
 
 
 static thread_t *_proc_current(void);
 static void _proc_threadDequeue(thread_t *t);
 static int _proc_threadWait(thread_t **queue, time_t timeout, spinlock_ctx_t *scp);
-
-
-static int threads_sleepcmp(rbnode_t *n1, rbnode_t *n2)
-{
-	thread_t *t1 = lib_treeof(thread_t, sleeplinkage, n1);
-	thread_t *t2 = lib_treeof(thread_t, sleeplinkage, n2);
-
-	if (t1->wakeup > t2->wakeup)
-		return 1;
-
-	else if (t1->wakeup < t2->wakeup)
-		return -1;
-
-	else if (t1->id < t2->id)
-		return -1;
-
-	else if (t1->id > t2->id)
-		return 1;
-
-	return 0;
-}
+static time_t threads_dlLimit(process_t *process);
+static int _threads_dlFits(thread_t *t, unsigned int cpus, time_t bw, time_t limit);
+static void _threads_dlReserve(unsigned int cpus, time_t bw, int reserve);
 
 
 static int threads_idcmp(rbnode_t *n1, rbnode_t *n2)
@@ -108,428 +94,608 @@ static int threads_idcmp(rbnode_t *n1, rbnode_t *n2)
 static inline time_t _threads_getTimer(void);
 static void _proc_threadWakeup(thread_t **queue);
 
-static unsigned perf_idpack(unsigned id)
-{
-	return id >> 8;
-}
-
-
 /* Note: always called with threads_common.spinlock set */
 static void _perf_event(thread_t *t, int type)
 {
-	perf_event_t ev;
 	time_t now = 0, wait;
 
 	now = TIMER_CYC2US(_threads_getTimer());
 
-	if (type == perf_evWaking || type == perf_evPreempted) {
+	if (type == trace_evWaking || type == trace_evPreempted) {
+		if (type == trace_evWaking && t->state == SLEEP)
+			t->usage.waitTime += now - t->waitStart;
+
 		t->readyTime = now;
 	}
-	else if (type == perf_evScheduling) {
+	else if (type == trace_evScheduling) {
 		wait = now - t->readyTime;
+		t->usage.readyTime += wait;
 
 		if (t->maxWait < wait)
 			t->maxWait = wait;
 	}
+	else if (type == trace_evEnqueued) {
+		t->waitStart = now;
+	}
 
-	if (!threads_common.perfGather)
-		return;
-
-	ev.type = type;
-
-	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
-	threads_common.perfLastTimestamp = now;
-	ev.tid = perf_idpack(t->id);
-
-	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
+	trace_record(type, (t->process != NULL) ? t->process->id : 0, t->id, t->priority, 0);
 }
 
 
 static void _perf_scheduling(thread_t *t)
 {
-	_perf_event(t, perf_evScheduling);
+	_perf_event(t, trace_evScheduling);
 }
 
 
 static void _perf_preempted(thread_t *t)
 {
-	_perf_event(t, perf_evPreempted);
+	_perf_event(t, trace_evPreempted);
 }
 
 
 static void _perf_enqueued(thread_t *t)
 {
-	_perf_event(t, perf_evEnqueued);
+	_perf_event(t, trace_evEnqueued);
 }
 
 
 static void _perf_waking(thread_t *t)
 {
-	_perf_event(t, perf_evWaking);
+	_perf_event(t, trace_evWaking);
 }
 
 
 static void _perf_begin(thread_t *t)
 {
-	perf_levent_begin_t ev;
-	time_t now;
+	trace_record(trace_evBegin, (t->process != NULL) ? t->process->id : 0, t->id, t->priority, 0);
+}
 
-	if (!threads_common.perfGather)
-		return;
 
-	ev.sbz = 0;
-	ev.type = perf_levBegin;
-	ev.prio = t->priority;
-	ev.tid = perf_idpack(t->id);
-	ev.pid = t->process != NULL ? perf_idpack(t->process->id) : -1;
+static void perf_end(thread_t *t)
+{
+	trace_record(trace_evEnd, (t->process != NULL) ? t->process->id : 0, t->id, t->priority, 0);
+}
 
-	now = TIMER_CYC2US(_threads_getTimer());
-	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
-	threads_common.perfLastTimestamp = now;
 
-	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
-}
+/*
+ * Time management
+ */
 
 
-void perf_end(thread_t *t)
+/* Sleeps of threads with lower priority may expire later, coalesced with other timers */
+#define THREADS_SLACKPRIO 4
+
+
+static void _threads_updateWakeup(time_t now)
 {
-	perf_levent_end_t ev;
-	time_t now;
-	spinlock_ctx_t sc;
+#ifdef HPTIMER_IRQ
+	time_t next, end = now + TIMER_US2CYC(SYSTICK_INTERVAL + SYSTICK_INTERVAL / 8);
+	time_t wakeup;
 
-	if (!threads_common.perfGather)
-		return;
+	next = ktimer_next(end);
 
-	hal_spinlockSet(&threads_common.spinlock, &sc);
-	ev.sbz = 0;
-	ev.type = perf_levEnd;
-	ev.tid = perf_idpack(t->id);
+	if (next >= end)
+		wakeup = TIMER_US2CYC(SYSTICK_INTERVAL);
+	else if (now >= next)
+		wakeup = 1;
+	else
+		wakeup = next - now;
 
-	now = TIMER_CYC2US(_threads_getTimer());
-	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
-	threads_common.perfLastTimestamp = now;
+	hal_setWakeup(wakeup);
+#endif
+}
 
-	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
-	hal_spinlockClear(&threads_common.spinlock, &sc);
+
+static inline time_t _threads_getTimer(void)
+{
+#ifdef HPTIMER_IRQ
+	return hal_getTimer();
+#else
+//	time_t t;
+//	hal_cpuGetCycles(&t);
+//	return t / 1900000;
+	return threads_common.jiffies;
+#endif
 }
 
 
-void perf_fork(process_t *p)
+/* Lockless, jiffies are only written on CPU 0 */
+static time_t threads_readTimer(void)
 {
-	perf_levent_fork_t ev;
+#ifdef HPTIMER_IRQ
+	return hal_getTimer();
+#else
 	time_t now;
-	spinlock_ctx_t sc;
 
-	if (!threads_common.perfGather)
-		return;
+	/* Retry torn reads of 64-bit jiffies */
+	do
+		now = threads_common.jiffies;
+	while (now != threads_common.jiffies);
+
+	return now;
+#endif
+}
+
+
+static void threads_timeout(ktimer_t *timer)
+{
+	thread_t *t = lib_containerof(thread_t, timer, timer);
+	spinlock_ctx_t sc;
 
 	hal_spinlockSet(&threads_common.spinlock, &sc);
-	ev.sbz = 0;
-	ev.type = perf_levFork;
-	ev.pid = perf_idpack(p->id);
-	// ev.ppid = p->parent != NULL ? perf_idpack(p->parent->id) : -1;
-	ev.tid = perf_idpack(_proc_current()->id);
 
-	now = TIMER_CYC2US(_threads_getTimer());
-	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
-	threads_common.perfLastTimestamp = now;
+	/* Thread may have been woken up and put to sleep again meanwhile */
+	if (t->wakeup && t->wakeup <= _threads_getTimer()) {
+		_proc_threadDequeue(t);
+		hal_cpuSetReturnValue(t->context, -ETIME);
+	}
 
-	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
 	hal_spinlockClear(&threads_common.spinlock, &sc);
 }
 
 
-void perf_kill(process_t *p)
+int threads_timeintr(unsigned int n, cpu_context_t *context, void *arg)
 {
-	perf_levent_kill_t ev;
 	time_t now;
 	spinlock_ctx_t sc;
 
-	if (!threads_common.perfGather)
-		return;
+	profile_sample(context);
+
+	/* Each CPU runs its own timers, CPU 0 keeps the time */
+	if (hal_cpuGetID()) {
+		ktimer_run(threads_readTimer());
+		return EOK;
+	}
 
 	hal_spinlockSet(&threads_common.spinlock, &sc);
-	ev.sbz = 0;
-	ev.type = perf_levKill;
-	ev.pid = perf_idpack(p->id);
-	ev.tid = perf_idpack(_proc_current()->id);
+#ifdef HPTIMER_IRQ
+	now = threads_common.jiffies = hal_getTimer();
+#else
+	now = threads_common.jiffies += TIMER_US2CYC(SYSTICK_INTERVAL);
+#endif
+	hal_spinlockClear(&threads_common.spinlock, &sc);
 
-	now = TIMER_CYC2US(_threads_getTimer());
-	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
-	threads_common.perfLastTimestamp = now;
+	ktimer_run(now);
 
-	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+	_threads_updateWakeup(now);
 	hal_spinlockClear(&threads_common.spinlock, &sc);
+
+	return EOK;
 }
 
 
-void perf_exec(process_t *p, char *path)
+/*
+ * Threads management
+ */
+
+
+static void thread_destroy(thread_t *t)
 {
-	perf_levent_exec_t ev;
-	time_t now;
-	int plen;
+	process_t *process;
 	spinlock_ctx_t sc;
 
-	if (!threads_common.perfGather)
-		return;
+	perf_end(t);
+	ktimer_done(&t->timer);
+	ktimer_done(&t->dlTimer);
 
-	hal_spinlockSet(&threads_common.spinlock, &sc);
-	ev.sbz = 0;
-	ev.type = perf_levExec;
-	ev.tid = perf_idpack(_proc_current()->id);
+	vm_kfree(t->kstack);
 
-	plen = hal_strlen(path);
-	plen = min(plen, sizeof(ev.path) - 1);
-	hal_memcpy(ev.path, path, plen);
-	ev.path[plen] = 0;
+#ifdef HAL_LAZYFPU
+	if (t->fpu != NULL)
+		vm_kfree(t->fpu);
+#endif
 
-	now = TIMER_CYC2US(_threads_getTimer());
-	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
-	threads_common.perfLastTimestamp = now;
+	if ((process = t->process) != NULL) {
+		userintr_threadDone(t);
 
-	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev) - sizeof(ev.path) + plen + 1);
-	hal_spinlockClear(&threads_common.spinlock, &sc);
+		hal_spinlockSet(&threads_common.spinlock, &sc);
+		t->usage.cpuTime = t->cpuTime;
+		proc_usageAdd(&process->usage, &t->usage);
+
+		LIST_REMOVE_EX(&process->threads, t, procnext, procprev);
+		LIST_ADD_EX(&process->ghosts, t, procnext, procprev);
+		_proc_threadWakeup(&process->reaper);
+		hal_spinlockClear(&threads_common.spinlock, &sc);
+
+		proc_put(process);
+	}
+	else
+		vm_kfree(t);
 }
 
 
-static void perf_bufferFree(void *data, page_t **pages)
+thread_t *threads_findThread(int tid)
 {
-	size_t sz = 0;
-	page_t *p;
+	thread_t *r, t;
+	t.id = tid;
 
-	while ((p = *pages) != NULL) {
-		*pages = p->next;
-		vm_pageFree(p);
-		sz += SIZE_PAGE;
-	}
+	proc_lockSet(&threads_common.lock);
+	if ((r = lib_treeof(thread_t, idlinkage, lib_rbFind(&threads_common.id, &t.idlinkage))) != NULL)
+		r->refs++;
+	proc_lockClear(&threads_common.lock);
 
-	vm_munmap(threads_common.kmap, data, sz);
+	return r;
 }
 
 
-static void *perf_bufferAlloc(page_t **pages, size_t sz)
+void threads_put(thread_t *t)
 {
-	page_t *p;
-	void *v, *data;
+	int remaining;
 
-	*pages = NULL;
-	data = vm_mapFind(threads_common.kmap, NULL, sz, MAP_NONE, PROT_READ | PROT_WRITE);
+	proc_lockSet(&threads_common.lock);
+	if (!(remaining = --t->refs))
+		lib_rbRemove(&threads_common.id, &t->idlinkage);
+	proc_lockClear(&threads_common.lock);
 
-	if (data == NULL)
-		return NULL;
+	if (!remaining)
+		thread_destroy(t);
+}
 
-	for (v = data; v < data + sz; v += SIZE_PAGE) {
-		p = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP);
 
-		if (p == NULL) {
-			perf_bufferFree(data, pages);
-			return NULL;
-		}
+/* Ready thread not allowed on this CPU preempts less important one where it may run, instead of waiting for a tick */
+static void _threads_kick(thread_t *t)
+{
+	unsigned int i;
+	thread_t *running;
 
-		p->next = *pages;
-		*pages = p;
-		page_map(&threads_common.kmap->pmap, v, p->addr, PGHD_PRESENT | PGHD_WRITE);
-	}
+	if (t->affinity & (1 << hal_cpuGetID()))
+		return;
+
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		if (!(t->affinity & (1 << i)))
+			continue;
 
-	return data;
+		if ((running = threads_common.current[i]) == NULL || running->priority > t->priority) {
+			hal_cpuSendReschedule(i);
+			break;
+		}
+	}
 }
 
 
-int perf_start(unsigned pid)
+/* Zero cpus only queries, running thread moves to allowed CPU when it's rescheduled */
+int proc_threadAffinity(int tid, unsigned int cpus, unsigned int *old)
 {
-	void *data;
+	thread_t *t, *current = proc_current();
+	unsigned int i, prev;
+	int err = EOK;
 	spinlock_ctx_t sc;
 
-	if (!pid)
-		return -EINVAL;
+	if (hal_cpuGetCount() < sizeof(cpus) * 8)
+		cpus &= (1 << hal_cpuGetCount()) - 1;
 
-	if (threads_common.perfGather)
+	if ((t = threads_findThread(tid ? tid : current->id)) == NULL)
 		return -EINVAL;
 
-	/* Allocate 4M for events */
-	data = perf_bufferAlloc(&threads_common.perfPages, 4 << 20);
+	hal_spinlockSet(&threads_common.spinlock, &sc);
 
-	if (data == NULL)
-		return -ENOMEM;
+	do {
+		prev = t->affinity;
+
+		if (t->process != current->process) {
+			err = -EPERM;
+			break;
+		}
 
-	_cbuffer_init(&threads_common.perfBuffer, data, 4 << 20);
+		if (!cpus)
+			break;
 
-	/* Start gathering events */
-	hal_spinlockSet(&threads_common.spinlock, &sc);
-	threads_common.perfGather = 1;
-	threads_common.perfLastTimestamp = TIMER_CYC2US(_threads_getTimer());
-	hal_spinlockClear(&threads_common.spinlock, &sc);
+		/* Deadline reservation moves with the thread */
+		if (t->deadline) {
+			if (!_threads_dlFits(t, cpus, t->dlBw, threads_dlLimit(current->process))) {
+				err = -EBUSY;
+				break;
+			}
 
-	return EOK;
-}
+			_threads_dlReserve(t->affinity, t->dlBw, 0);
+			_threads_dlReserve(cpus, t->dlBw, 1);
+		}
 
+		t->affinity = cpus;
 
-int perf_read(void *buffer, size_t bufsz)
-{
-	spinlock_ctx_t sc;
+		/* Yield CPU which is no longer allowed */
+		if (t == current && !(cpus & (1 << hal_cpuGetID()))) {
+			hal_cpuReschedule(&threads_common.spinlock, &sc);
+			threads_put(t);
+
+			if (old != NULL)
+				*old = prev;
+
+			return err;
+		}
+
+		for (i = 0; i < hal_cpuGetCount(); i++) {
+			if (threads_common.current[i] == t)
+				break;
+		}
+
+		/* Other CPU running it is made to give it up */
+		if (i < hal_cpuGetCount()) {
+			if (!(cpus & (1 << i)))
+				hal_cpuSendReschedule(i);
+		}
+		else if (t->state == READY) {
+			_threads_kick(t);
+		}
+	} while (0);
 
-	hal_spinlockSet(&threads_common.spinlock, &sc);
-	bufsz = _cbuffer_read(&threads_common.perfBuffer, buffer, bufsz);
 	hal_spinlockClear(&threads_common.spinlock, &sc);
+	threads_put(t);
+
+	if (err == EOK && old != NULL)
+		*old = prev;
 
-	return bufsz;
+	return err;
 }
 
 
-int perf_finish()
-{
-	spinlock_ctx_t sc;
+/*
+ * Deadline class
+ */
 
-	hal_spinlockSet(&threads_common.spinlock, &sc);
-	if (threads_common.perfGather) {
-		threads_common.perfGather = 0;
-		hal_spinlockClear(&threads_common.spinlock, &sc);
 
-		perf_bufferFree(threads_common.perfBuffer.data, &threads_common.perfPages);
+#define THREADS_DLSHIFT  20
+#define THREADS_DLLIMIT  95         /* Percent of each CPU reservations may take */
+#define THREADS_DLUSER   20         /* Percent unprivileged processes may reserve up to */
+#define THREADS_DLPERIOD 10000000   /* Longest period in us, keeps products in range */
+
+
+static int _threads_running(thread_t *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		if (t == threads_common.current[i])
+			return 1;
 	}
-	else
-		hal_spinlockClear(&threads_common.spinlock, &sc);
 
-	return EOK;
+	return 0;
 }
 
 
-/*
- * Time management
- */
+static unsigned int threads_dlShares(unsigned int cpus)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < hal_cpuGetCount(); i++)
+		n += (cpus >> i) & 1;
+
+	return n;
+}
 
 
-static void _threads_updateWakeup(time_t now, thread_t *min)
+/* Density of thread is split evenly among CPUs it may run on */
+static void _threads_dlReserve(unsigned int cpus, time_t bw, int reserve)
 {
-#ifdef HPTIMER_IRQ
-	thread_t *t;
-	time_t wakeup;
+	unsigned int i;
+	time_t share = bw / threads_dlShares(cpus);
 
-	if (min != NULL)
-		t = min;
-	else
-		t = lib_treeof(thread_t, sleeplinkage, lib_rbMinimum(threads_common.sleeping.root));
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		if (!(cpus & (1 << i)))
+			continue;
 
-	if (t != NULL) {
-		if (now >= t->wakeup)
-			wakeup = 1;
+		if (reserve)
+			threads_common.dlbw[i] += share;
 		else
-			wakeup = t->wakeup - now;
-	}
-	else {
-		wakeup = TIMER_US2CYC(SYSTICK_INTERVAL);
+			threads_common.dlbw[i] -= share;
 	}
+}
 
-	if (wakeup > TIMER_US2CYC(SYSTICK_INTERVAL + SYSTICK_INTERVAL / 8))
-		wakeup = TIMER_US2CYC(SYSTICK_INTERVAL);
 
-	hal_setWakeup(wakeup);
-#endif
+/* Unprivileged reservations can't starve fixed priority threads of system services */
+static time_t threads_dlLimit(process_t *process)
+{
+	return proc_privileged(process) ? threads_common.dlmax : threads_common.dluser;
 }
 
 
-static inline time_t _threads_getTimer(void)
+/* Checks density bw on cpus keeps each within limit, next to reservations other than t's own */
+static int _threads_dlFits(thread_t *t, unsigned int cpus, time_t bw, time_t limit)
 {
-#ifdef HPTIMER_IRQ
-	return hal_getTimer();
-#else
-//	time_t t;
-//	hal_cpuGetCycles(&t);
-//	return t / 1900000;
-	return threads_common.jiffies;
-#endif
+	unsigned int i;
+	time_t share = bw / threads_dlShares(cpus), own = t->dlBw / threads_dlShares(t->affinity);
+
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		if (!(cpus & (1 << i)))
+			continue;
+
+		if (threads_common.dlbw[i] - ((t->affinity & (1 << i)) ? own : 0) + share > limit)
+			return 0;
+	}
+
+	return 1;
 }
 
 
-int threads_timeintr(unsigned int n, cpu_context_t *context, void *arg)
+static void _threads_dlLeave(thread_t *t)
 {
-	thread_t *t;
-	unsigned int i = 0;
-	time_t now;
-	spinlock_ctx_t sc;
+	if (!t->deadline)
+		return;
 
-	if (hal_cpuGetID())
-		return EOK;
+	LIST_REMOVE_EX(&threads_common.dl, t, dlnext, dlprev);
+	_threads_dlReserve(t->affinity, t->dlBw, 0);
+	ktimer_cancel(&t->dlTimer);
 
-	hal_spinlockSet(&threads_common.spinlock, &sc);
+	t->deadline = 0;
+	t->throttled = 0;
+	t->dlBw = 0;
+}
 
-#ifdef HPTIMER_IRQ
-	now = threads_common.jiffies = hal_getTimer();
-#else
-	now = threads_common.jiffies += TIMER_US2CYC(SYSTICK_INTERVAL);
-#endif
 
-	for (;; i++) {
-		t = lib_treeof(thread_t, sleeplinkage, lib_rbMinimum(threads_common.sleeping.root));
+/* CBS wakeup rule, new deadline is given if remaining budget would exceed reserved density */
+static void _threads_dlWakeup(thread_t *t, time_t now)
+{
+	if (t->dlAbs > now && t->dlBudget * t->dlDeadline <= (t->dlAbs - now) * t->dlRuntime)
+		return;
 
-		if (t == NULL || t->wakeup > now)
-			break;
+	t->dlRelease = now;
+	t->dlAbs = now + t->dlDeadline;
+	t->dlBudget = t->dlRuntime;
+}
 
-		_proc_threadDequeue(t);
-		hal_cpuSetReturnValue(t->context, -ETIME);
-	}
 
-	_threads_updateWakeup(now, t);
+/* Reservation is hard, thread without budget isn't run until its next period */
+static void _threads_dlCharge(thread_t *t, time_t now)
+{
+	time_t used = now - t->dlLast;
 
-	hal_spinlockClear(&threads_common.spinlock, &sc);
+	t->dlLast = now;
 
-	return EOK;
-}
+	if (!t->deadline || t->throttled)
+		return;
 
+	if (used < t->dlBudget) {
+		t->dlBudget -= used;
+		return;
+	}
 
-/*
- * Threads management
- */
+	t->dlBudget = 0;
+	t->throttled = 1;
+	ktimer_arm(&t->dlTimer, t->dlRelease + t->dlPeriod, 0);
+}
 
 
-static void thread_destroy(thread_t *t)
+/* Replenishes throttled thread, otherwise enforces budget of running one */
+static void threads_dlTimer(ktimer_t *timer)
 {
-	process_t *process;
+	thread_t *t = lib_containerof(thread_t, dlTimer, timer);
+	unsigned int i;
+	time_t now;
 	spinlock_ctx_t sc;
 
-	perf_end(t);
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+	now = _threads_getTimer();
 
-	vm_kfree(t->kstack);
+	if (t->deadline && t->throttled) {
+		t->dlRelease += t->dlPeriod;
 
-	if ((process = t->process) != NULL) {
-		hal_spinlockSet(&threads_common.spinlock, &sc);
-		LIST_REMOVE_EX(&process->threads, t, procnext, procprev);
-		LIST_ADD_EX(&process->ghosts, t, procnext, procprev);
-		_proc_threadWakeup(&process->reaper);
-		hal_spinlockClear(&threads_common.spinlock, &sc);
+		/* Periods missed meanwhile aren't made up for */
+		if (t->dlRelease + t->dlPeriod <= now)
+			t->dlRelease = now;
 
-		proc_put(process);
+		t->dlAbs = t->dlRelease + t->dlDeadline;
+		t->dlBudget = t->dlRuntime;
+		t->dlLast = now;
+		t->throttled = 0;
 	}
-	else
-		vm_kfree(t);
+	else if (t->deadline) {
+		for (i = 0; i < hal_cpuGetCount(); i++) {
+			if (t == threads_common.current[i])
+				break;
+		}
+
+		/* Timer may have been armed on other CPU than the one running thread */
+		if (i < hal_cpuGetCount()) {
+			_threads_dlCharge(t, now);
+
+			if (t->throttled && i != hal_cpuGetID())
+				hal_cpuSendReschedule(i);
+		}
+	}
+
+	hal_spinlockClear(&threads_common.spinlock, &sc);
 }
 
 
-thread_t *threads_findThread(int tid)
+/* Earliest deadline first among threads with budget, before fixed priorities */
+static thread_t *_threads_dlPick(unsigned int cpu)
 {
-	thread_t *r, t;
-	t.id = tid;
+	thread_t *t, *selected = NULL;
 
-	proc_lockSet(&threads_common.lock);
-	if ((r = lib_treeof(thread_t, idlinkage, lib_rbFind(&threads_common.id, &t.idlinkage))) != NULL)
-		r->refs++;
-	proc_lockClear(&threads_common.lock);
+	if ((t = threads_common.dl) == NULL)
+		return NULL;
 
-	return r;
+	do {
+		if (t->state != READY || t->throttled || t->exit || !(t->affinity & cpu) || _threads_running(t))
+			continue;
+
+		if (selected == NULL || t->dlAbs < selected->dlAbs)
+			selected = t;
+	} while ((t = t->dlnext) != threads_common.dl);
+
+	/* Ready deadline thread waits in queue of its fixed priority */
+	if (selected != NULL)
+		LIST_REMOVE(&threads_common.ready[selected->priority], selected);
+
+	return selected;
 }
 
 
-void threads_put(thread_t *t)
+int proc_threadDeadline(int tid, time_t runtime, time_t deadline, time_t period)
 {
-	int remaining;
+	thread_t *t, *current = proc_current();
+	time_t bw = 0, limit = threads_dlLimit(current->process);
+	int err = EOK;
+	spinlock_ctx_t sc;
 
-	proc_lockSet(&threads_common.lock);
-	if (!(remaining = --t->refs))
-		lib_rbRemove(&threads_common.id, &t->idlinkage);
-	proc_lockClear(&threads_common.lock);
+	if (runtime != 0) {
+		if (runtime > deadline || deadline > period || period > THREADS_DLPERIOD)
+			return -EINVAL;
 
-	if (!remaining)
-		thread_destroy(t);
+		runtime = TIMER_US2CYC(runtime);
+		deadline = TIMER_US2CYC(deadline);
+		period = TIMER_US2CYC(period);
+
+		/* Density is exact test for constrained deadlines on single CPU */
+		bw = (runtime << THREADS_DLSHIFT) / deadline;
+
+		/* No CPU could take it */
+		if (bw > limit)
+			return (bw <= threads_common.dlmax) ? -EPERM : -EINVAL;
+	}
+
+	if ((t = threads_findThread(tid ? tid : current->id)) == NULL)
+		return -EINVAL;
+
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+
+	do {
+		if (t->process != current->process) {
+			err = -EPERM;
+			break;
+		}
+
+		/* Ghosts are marked exiting too */
+		if (t->exit) {
+			err = -EINVAL;
+			break;
+		}
+
+		if (!_threads_dlFits(t, t->affinity, bw, limit)) {
+			err = -EBUSY;
+			break;
+		}
+
+		_threads_dlLeave(t);
+
+		if (runtime == 0)
+			break;
+
+		t->dlRuntime = runtime;
+		t->dlDeadline = deadline;
+		t->dlPeriod = period;
+		t->dlBw = bw;
+		t->dlAbs = 0;
+		t->dlLast = _threads_getTimer();
+		_threads_dlWakeup(t, t->dlLast);
+
+		t->deadline = 1;
+		LIST_ADD_EX(&threads_common.dl, t, dlnext, dlprev);
+		_threads_dlReserve(t->affinity, bw, 1);
+
+		/* Scheduler arms budget timer only for thread it switches to */
+		if (_threads_running(t)) {
+			ktimer_arm(&t->dlTimer, t->dlLast + t->dlBudget, 0);
+			_threads_updateWakeup(t->dlLast);
+		}
+	} while (0);
+
+	hal_spinlockClear(&threads_common.spinlock, &sc);
+	threads_put(t);
+
+	return err;
 }
 
 
@@ -547,14 +713,49 @@ static void threads_cpuTimeCalc(thread_t *current, thread_t *selected)
 }
 
 
+/* Takes first thread allowed on CPU from ready queue, retiring exited ones on the way */
+static thread_t *_threads_pick(thread_t **queue, unsigned int cpu)
+{
+	thread_t *t, *next, *last;
+	int done;
+
+	if ((t = *queue) == NULL)
+		return NULL;
+
+	last = t->prev;
+
+	do {
+		next = t->next;
+		done = (t == last);
+
+		if (t->exit) {
+			LIST_REMOVE(queue, t);
+			_threads_dlLeave(t);
+			LIST_ADD(&threads_common.ghosts, t);
+			_proc_threadWakeup(&threads_common.reaper);
+		}
+		else if ((t->affinity & cpu) && !t->throttled) {
+			LIST_REMOVE(queue, t);
+			return t;
+		}
+
+		t = next;
+	} while (!done);
+
+	return NULL;
+}
+
+
 int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 {
 	thread_t *current, *selected;
 	unsigned int i, sig;
 	process_t *proc;
+	time_t now;
 	spinlock_ctx_t sc;
 
 	hal_spinlockSet(&threads_common.spinlock, &sc);
+	now = _threads_getTimer();
 
 	if (hal_cpuGetID() == 0) {
 		cpu_sendIPI(0, 32);
@@ -564,10 +765,12 @@ int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 
 	current = threads_common.current[hal_cpuGetID()];
 	threads_common.current[hal_cpuGetID()] = NULL;
+	hal_cpuSetCurrent(NULL);
 
 	/* Save current thread context */
 	if (current != NULL) {
 		current->context = context;
+		_threads_dlCharge(current, now);
 
 		/* Move thread to the end of queue */
 		if (current->state == READY) {
@@ -577,23 +780,31 @@ int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 	}
 
 	/* Get next thread */
-	for (i = 0; i < sizeof(threads_common.ready) / sizeof(thread_t *);) {
-		if ((selected = threads_common.ready[i]) == NULL) {
-			i++;
-			continue;
-		}
+	selected = _threads_dlPick(1 << hal_cpuGetID());
 
-		LIST_REMOVE(&threads_common.ready[i], selected);
+	for (i = 0; i < sizeof(threads_common.ready) / sizeof(thread_t *) && selected == NULL; i++)
+		selected = _threads_pick(&threads_common.ready[i], 1 << hal_cpuGetID());
 
-		if (!selected->exit /*|| hal_cpuSupervisorMode(selected->context)*/)
-			break;
+	if (current != NULL && current != selected) {
+		if (current->state == READY)
+			current->usage.nivcsw++;
+		else
+			current->usage.nvcsw++;
+
+		if (current->deadline && !current->throttled)
+			ktimer_cancel(&current->dlTimer);
+	}
 
-		LIST_ADD(&threads_common.ghosts, selected);
-		_proc_threadWakeup(&threads_common.reaper);
+	/* Budget is enforced by timer, as running thread may not be preempted before it runs out */
+	if (selected != NULL && selected != current && selected->deadline && !selected->throttled) {
+		selected->dlLast = now;
+		ktimer_arm(&selected->dlTimer, now + selected->dlBudget, 0);
+		_threads_updateWakeup(now);
 	}
 
 	if (selected != NULL) {
 		threads_common.current[hal_cpuGetID()] = selected;
+		hal_cpuSetCurrent(selected);
 
 		if (((proc = selected->process) != NULL) && (proc->mapp != NULL)) {
 			/* Switch address space */
@@ -615,6 +826,10 @@ int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 		hal_cpuRestore(context, selected->context);
 	}
 
+#ifdef HAL_LAZYFPU
+	hal_cpuFpuSwitch((selected != NULL) ? selected->fpu : NULL);
+#endif
+
 	/* Update CPU usage */
 	threads_cpuTimeCalc(current, selected);
 
@@ -642,16 +857,10 @@ static thread_t *_proc_current(void)
 }
 
 
+/* Per-CPU pointer is switched along with the context, so it's read without locking */
 thread_t *proc_current(void)
 {
-	thread_t *current;
-	spinlock_ctx_t sc;
-
-	hal_spinlockSet(&threads_common.spinlock, &sc);
-	current = threads_common.current[hal_cpuGetID()];
-	hal_spinlockClear(&threads_common.spinlock, &sc);
-
-	return current;
+	return hal_cpuGetCurrent();
 }
 
 
@@ -762,7 +971,7 @@ static void thread_augment(rbnode_t *node)
 }
 
 
-int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *stack, size_t stacksz, void *arg)
+static int threads_create(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *stack, size_t stacksz, void *arg, unsigned int affinity, unsigned int sigmask)
 {
 	/* TODO - save user stack and it's size in thread_t */
 	thread_t *t;
@@ -784,14 +993,19 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 
 	t->state = READY;
 	t->wakeup = 0;
+	ktimer_init(&t->timer, threads_timeout);
 	t->process = process;
 	t->parentkstack = NULL;
-	t->sigmask = t->sigpend = 0;
+	t->sigmask = sigmask;
+	t->sigpend = 0;
 	t->refs = 1;
 	t->interruptible = 0;
 	t->exit = 0;
 	t->execdata = NULL;
 	t->wait = NULL;
+#ifdef HAL_LAZYFPU
+	t->fpu = NULL;
+#endif
 
 	thread_alloc(t);
 
@@ -801,6 +1015,11 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 	t->stick = 0;
 	t->utick = 0;
 	t->priority = priority;
+	t->affinity = affinity;
+	t->deadline = 0;
+	t->throttled = 0;
+	t->dlBw = 0;
+	ktimer_init(&t->dlTimer, threads_dlTimer);
 
 	if (process != NULL) {
 		hal_spinlockSet(&threads_common.spinlock, &sc);
@@ -823,6 +1042,8 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 	t->startTime = TIMER_CYC2US(_threads_getTimer());
 	t->cpuTime = 0;
 	t->lastTime = t->startTime;
+	t->waitStart = 0;
+	hal_memset(&t->usage, 0, sizeof(t->usage));
 
 	/* Insert thread to scheduler queue */
 	hal_spinlockSet(&threads_common.spinlock, &sc);
@@ -840,6 +1061,22 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 }
 
 
+int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *stack, size_t stacksz, void *arg)
+{
+	thread_t *current = proc_current();
+
+	return threads_create(process, start, id, priority, kstacksz, stack, stacksz, arg, (current != NULL) ? current->affinity : threads_common.cpus, 0);
+}
+
+
+int proc_threadCreateKernel(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *arg)
+{
+	thread_t *current = proc_current();
+
+	return threads_create(process, start, id, priority, kstacksz, NULL, 0, arg, (current != NULL) ? current->affinity : threads_common.cpus, 0xffffffff);
+}
+
+
 static void _thread_interrupt(thread_t *t)
 {
 	_proc_threadDequeue(t);
@@ -858,6 +1095,9 @@ void proc_threadEnd(void)
 	cpu = hal_cpuGetID();
 	t = threads_common.current[cpu];
 	threads_common.current[cpu] = NULL;
+	hal_cpuSetCurrent(NULL);
+	t->exit = 1;
+	_threads_dlLeave(t);
 	LIST_ADD(&threads_common.ghosts, t);
 	_proc_threadWakeup(&threads_common.reaper);
 
@@ -904,6 +1144,67 @@ void proc_reap(void)
 }
 
 
+#ifdef HAL_LAZYFPU
+/* FPU use after context switch traps, state is allocated on the first one */
+static void threads_fpuTrap(unsigned int n, exc_context_t *ctx)
+{
+	thread_t *current = proc_current();
+	void *fpu;
+
+	if (current->fpu == NULL) {
+		hal_cpuEnableInterrupts();
+
+		if ((fpu = vm_kmalloc(hal_cpuFpuSize())) == NULL) {
+			process_dumpException(n, ctx);
+
+			if (current->process == NULL) {
+				hal_cpuDisableInterrupts();
+				hal_cpuHalt();
+			}
+
+			/* Returning would only trap again, thread ends here */
+			proc_kill(current->process);
+			proc_threadEnd();
+		}
+
+		hal_cpuFpuInit(fpu);
+		current->fpu = fpu;
+
+		hal_cpuDisableInterrupts();
+	}
+
+	hal_cpuFpuRestore(current->fpu);
+}
+#endif
+
+
+int threads_fpuCopy(thread_t *t, thread_t *src)
+{
+#ifdef HAL_LAZYFPU
+	spinlock_ctx_t sc;
+
+	/* Only src allocates its state, it's not running any more */
+	if (src->fpu == NULL)
+		return EOK;
+
+	if (t->fpu == NULL && (t->fpu = vm_kmalloc(hal_cpuFpuSize())) == NULL)
+		return -ENOMEM;
+
+	/* State of src is saved when it's switched out, it may still be on its way */
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+	while (_threads_running(src)) {
+		hal_spinlockClear(&threads_common.spinlock, &sc);
+		hal_spinlockSet(&threads_common.spinlock, &sc);
+	}
+
+	hal_cpuFpuCopy(t->fpu, src->fpu);
+	hal_spinlockClear(&threads_common.spinlock, &sc);
+#endif
+
+	return EOK;
+}
+
+
 /*
  * Sleeping and waiting
  */
@@ -918,21 +1219,26 @@ static void _proc_threadDequeue(thread_t *t)
 		LIST_REMOVE(t->wait, t);
 
 	if (t->wakeup)
-		lib_rbRemove(&threads_common.sleeping, &t->sleeplinkage);
+		ktimer_cancel(&t->timer);
 
 	t->wakeup = 0;
 	t->wait = NULL;
 	t->state = READY;
 	t->interruptible = 0;
 
+	if (t->deadline && !t->throttled)
+		_threads_dlWakeup(t, _threads_getTimer());
+
 	/* MOD */
 	for (i = 0; i < hal_cpuGetCount(); i++) {
 		if (t == threads_common.current[i])
 			break;
 	}
 
-	if (i == hal_cpuGetCount())
+	if (i == hal_cpuGetCount()) {
 		LIST_ADD(&threads_common.ready[t->priority], t);
+		_threads_kick(t);
+	}
 }
 
 
@@ -958,8 +1264,8 @@ static void _proc_threadEnqueue(thread_t **queue, time_t timeout, int interrupti
 	if (timeout) {
 		now = _threads_getTimer();
 		current->wakeup = now + TIMER_US2CYC(timeout);
-		lib_rbInsert(&threads_common.sleeping, &current->sleeplinkage);
-		_threads_updateWakeup(now, NULL);
+		ktimer_arm(&current->timer, current->wakeup, 0);
+		_threads_updateWakeup(now);
 	}
 
 	_perf_enqueued(current);
@@ -999,10 +1305,10 @@ int proc_threadSleep(unsigned long long us)
 	current->wakeup = now + TIMER_US2CYC(us);
 	current->interruptible = 1;
 
-	lib_rbInsert(&threads_common.sleeping, &current->sleeplinkage);
+	ktimer_arm(&current->timer, current->wakeup, (current->priority >= THREADS_SLACKPRIO) ? TIMER_US2CYC(us / 16) : 0);
 
 	_perf_enqueued(current);
-	_threads_updateWakeup(now, NULL);
+	_threads_updateWakeup(now);
 
 	if ((err = hal_cpuReschedule(&threads_common.spinlock, &sc)) == -ETIME)
 		err = EOK;
@@ -1146,6 +1452,13 @@ int proc_join(time_t timeout)
 }
 
 
+/* Lockless, for event timestamps */
+time_t proc_timestamp(void)
+{
+	return TIMER_CYC2US(threads_readTimer());
+}
+
+
 time_t proc_uptime(void)
 {
 	time_t time;
@@ -1184,31 +1497,61 @@ int proc_settime(time_t offs)
 
 time_t proc_nextWakeup(void)
 {
-	thread_t *thread;
 	time_t wakeup = 0;
-	time_t now;
+	time_t now, next;
 	spinlock_ctx_t sc;
 
 	hal_spinlockSet(&threads_common.spinlock, &sc);
-	thread = lib_treeof(thread_t, sleeplinkage, lib_rbMinimum(threads_common.sleeping.root));
-	if (thread != NULL) {
-		now = _threads_getTimer();
-		if (now >= thread->wakeup)
-			wakeup = 0;
-		else
-			wakeup = thread->wakeup - now;
-	}
+	now = _threads_getTimer();
 	hal_spinlockClear(&threads_common.spinlock, &sc);
 
+	if ((next = ktimer_next((time_t)-1)) != (time_t)-1 && next > now)
+		wakeup = next - now;
+
 	return wakeup;
 }
 
 
+/* Reprograms timer interrupt after kernel timer was armed outside of the scheduler */
+void proc_wakeupUpdate(void)
+{
+#ifdef HPTIMER_IRQ
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+	_threads_updateWakeup(_threads_getTimer());
+	hal_spinlockClear(&threads_common.spinlock, &sc);
+#endif
+}
+
+
 /*
  * Signals
  */
 
 
+/* Pends signal on process, first thread not masking it is interrupted */
+static void _threads_sigpend(process_t *process, int sigbit)
+{
+	thread_t *thread;
+
+	process->sigpend |= sigbit;
+
+	if ((thread = process->threads) == NULL)
+		return;
+
+	do {
+		if (sigbit & ~thread->sigmask) {
+			if (thread->interruptible)
+				_thread_interrupt(thread);
+
+			break;
+		}
+	}
+	while ((thread = thread->procnext) != process->threads);
+}
+
+
 int threads_sigpost(process_t *process, thread_t *thread, int sig)
 {
 	int sigbit = 1 << sig;
@@ -1246,18 +1589,7 @@ int threads_sigpost(process_t *process, thread_t *thread, int sig)
 		}
 	}
 	else {
-		process->sigpend |= sigbit;
-		thread = process->threads;
-
-		do {
-			if (sigbit & ~thread->sigmask) {
-				if (thread->interruptible)
-					_thread_interrupt(thread);
-
-				break;
-			}
-		}
-		while ((thread = thread->procnext) != process->threads);
+		_threads_sigpend(process, sigbit);
 	}
 
 	hal_cpuReschedule(&threads_common.spinlock, &sc);
@@ -1269,6 +1601,34 @@ int threads_sigpost(process_t *process, thread_t *thread, int sig)
 }
 
 
+/* Safe in interrupt context, signal is delivered when its thread is scheduled next */
+void threads_sigpend(process_t *process, thread_t *thread, int sig)
+{
+	int sigbit = 1 << sig;
+	spinlock_ctx_t sc;
+
+	/* Kill isn't delivered, it ends threads as sigpost does */
+	if (sig == signal_kill) {
+		proc_kill(process);
+		return;
+	}
+
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+
+	if (thread != NULL) {
+		thread->sigpend |= sigbit;
+
+		if ((sigbit & ~thread->sigmask) && thread->interruptible)
+			_thread_interrupt(thread);
+	}
+	else {
+		_threads_sigpend(process, sigbit);
+	}
+
+	hal_spinlockClear(&threads_common.spinlock, &sc);
+}
+
+
 /*
  * Locks
  */
@@ -1276,16 +1636,46 @@ int threads_sigpost(process_t *process, thread_t *thread, int sig)
 
 int _proc_lockSet(lock_t *lock, int interruptible, spinlock_ctx_t *sc)
 {
+	if (lock->v == 0)
+		trace_event(trace_evLockContended, 0, (unsigned long)lock);
+
 	while (lock->v == 0) {
 		if (proc_threadWaitEx(&lock->queue, &lock->spinlock, 0, interruptible, sc) == -EINTR)
 			return -EINTR;
 	}
 
 	lock->v = 0;
+#ifdef LOCKSTAT
+	hal_cpuGetCycles((void *)&lock->acquired);
+#endif
 	return EOK;
 }
 
 
+/* Accounts contention to the caller of lock function */
+static int _proc_lockSetCaller(lock_t *lock, int interruptible, spinlock_ctx_t *sc, void *pc)
+{
+#ifdef LOCKSTAT
+	cycles_t b, e;
+	int err;
+
+	if (lock->v != 0)
+		return _proc_lockSet(lock, interruptible, sc);
+
+	hal_cpuGetCycles((void *)&b);
+
+	if ((err = _proc_lockSet(lock, interruptible, sc)) == EOK) {
+		hal_cpuGetCycles((void *)&e);
+		lockstat_contended(&lock->stat, e - b, pc);
+	}
+
+	return err;
+#else
+	return _proc_lockSet(lock, interruptible, sc);
+#endif
+}
+
+
 int proc_lockSet(lock_t *lock)
 {
 	int err;
@@ -1295,7 +1685,7 @@ int proc_lockSet(lock_t *lock)
 		return -EINVAL;
 
 	hal_spinlockSet(&lock->spinlock, &sc);
-	err = _proc_lockSet(lock, 0, &sc);
+	err = _proc_lockSetCaller(lock, 0, &sc, __builtin_return_address(0));
 	hal_spinlockClear(&lock->spinlock, &sc);
 	return err;
 }
@@ -1307,7 +1697,7 @@ int proc_lockSetInterruptible(lock_t *lock)
 	spinlock_ctx_t sc;
 
 	hal_spinlockSet(&lock->spinlock, &sc);
-	err = _proc_lockSet(lock, 1, &sc);
+	err = _proc_lockSetCaller(lock, 1, &sc, __builtin_return_address(0));
 	hal_spinlockClear(&lock->spinlock, &sc);
 	return err;
 }
@@ -1325,6 +1715,10 @@ int proc_lockTry(lock_t *lock)
 	hal_spinlockSet(&lock->spinlock, &sc);
 	if (lock->v == 0)
 		err = -EBUSY;
+#ifdef LOCKSTAT
+	else
+		hal_cpuGetCycles((void *)&lock->acquired);
+#endif
 
 	lock->v = 0;
 	hal_spinlockClear(&lock->spinlock, &sc);
@@ -1335,6 +1729,13 @@ int proc_lockTry(lock_t *lock)
 
 int _proc_lockClear(lock_t *lock)
 {
+#ifdef LOCKSTAT
+	cycles_t now;
+
+	hal_cpuGetCycles((void *)&now);
+	lockstat_released(&lock->stat, now - lock->acquired);
+#endif
+
 	lock->v = 1;
 	if (lock->queue == NULL || lock->queue == (void *)-1)
 		return 0;
@@ -1392,19 +1793,65 @@ int proc_lockWait(thread_t **queue, lock_t *lock, time_t timeout)
 }
 
 
-int proc_lockInit(lock_t *lock)
+/* Wakes all threads waiting on queue, moving them onto lock queue instead of letting them race for the lock */
+void proc_lockRequeue(struct _thread_t **queue, lock_t *lock)
+{
+	thread_t *t;
+	int yield = 0;
+	spinlock_ctx_t sc, tsc;
+
+	hal_spinlockSet(&lock->spinlock, &sc);
+	hal_spinlockSet(&threads_common.spinlock, &tsc);
+
+	if (*queue == NULL || *queue == (void *)-1) {
+		*queue = (void *)-1;
+	}
+	else {
+		/* Lock waiters recheck it under its spinlock, so pending wakeup is meaningless there */
+		if (lock->queue == (void *)-1)
+			lock->queue = NULL;
+
+		/* With lock free one thread is woken, it wakes the next one on release */
+		if (lock->v) {
+			_proc_threadWakeup(queue);
+			yield = 1;
+		}
+
+		while ((t = *queue) != NULL) {
+			LIST_REMOVE(queue, t);
+			LIST_ADD(&lock->queue, t);
+			t->wait = &lock->queue;
+		}
+	}
+
+	hal_spinlockClear(&threads_common.spinlock, &tsc);
+
+	if (yield)
+		hal_cpuReschedule(&lock->spinlock, &sc);
+	else
+		hal_spinlockClear(&lock->spinlock, &sc);
+}
+
+
+int proc_lockInit(lock_t *lock, const char *name)
 {
 	lock->owner = NULL;
 	lock->priority = 0;
 	lock->queue = NULL;
 	lock->v = 1;
-	hal_spinlockCreate(&lock->spinlock, "lock.spinlock");
+	hal_spinlockCreate(&lock->spinlock, name);
+#ifdef LOCKSTAT
+	lockstat_register(lock);
+#endif
 	return EOK;
 }
 
 
 int proc_lockDone(lock_t *lock)
 {
+#ifdef LOCKSTAT
+	lockstat_unregister(lock);
+#endif
 	hal_spinlockDestroy(&lock->spinlock);
 	return EOK;
 }
@@ -1464,6 +1911,94 @@ void proc_threadsDump(unsigned int priority)
 }
 
 
+void proc_usageAdd(usageinfo_t *total, const usageinfo_t *u)
+{
+	total->cpuTime += u->cpuTime;
+	total->waitTime += u->waitTime;
+	total->readyTime += u->readyTime;
+	total->nvcsw += u->nvcsw;
+	total->nivcsw += u->nivcsw;
+	total->minflt += u->minflt;
+	total->majflt += u->majflt;
+	total->msgsnd += u->msgsnd;
+	total->msgrcv += u->msgrcv;
+	total->mapped += u->mapped;
+}
+
+
+/* Note: always called with threads_common.spinlock set */
+static void _threads_usage(thread_t *t, usageinfo_t *info)
+{
+	hal_memcpy(info, &t->usage, sizeof(usageinfo_t));
+	info->cpuTime = t->cpuTime;
+
+	/* Time since the last switch isn't accounted yet */
+	if (_threads_running(t))
+		info->cpuTime += TIMER_CYC2US(_threads_getTimer()) - t->lastTime;
+}
+
+
+int proc_usage(int who, usageinfo_t *info)
+{
+	thread_t *current = proc_current(), *t;
+	process_t *process = current->process;
+	usageinfo_t u;
+	spinlock_ctx_t sc;
+
+	if (who == RUSAGE_CHILDREN)
+		return (process != NULL) ? posix_childrenUsage(process->id, info) : -EINVAL;
+
+	if (who != RUSAGE_SELF && who != RUSAGE_THREAD)
+		return -EINVAL;
+
+	hal_spinlockSet(&threads_common.spinlock, &sc);
+	if (who == RUSAGE_THREAD || process == NULL) {
+		_threads_usage(current, info);
+	}
+	else {
+		hal_memcpy(info, &process->usage, sizeof(usageinfo_t));
+
+		if ((t = process->threads) != NULL) {
+			do {
+				_threads_usage(t, &u);
+				proc_usageAdd(info, &u);
+			} while ((t = t->procnext) != process->threads);
+		}
+	}
+	hal_spinlockClear(&threads_common.spinlock, &sc);
+
+	return EOK;
+}
+
+
+int proc_threadsUsage(int n, threadusage_t *info)
+{
+	int i = 0;
+	thread_t *t;
+	spinlock_ctx_t sc;
+
+	proc_lockSet(&threads_common.lock);
+
+	t = lib_treeof(thread_t, idlinkage, lib_rbMinimum(threads_common.id.root));
+
+	while (i < n && t != NULL) {
+		info[i].pid = (t->process != NULL) ? t->process->id : 0;
+		info[i].tid = t->id;
+
+		hal_spinlockSet(&threads_common.spinlock, &sc);
+		_threads_usage(t, &info[i].usage);
+		hal_spinlockClear(&threads_common.spinlock, &sc);
+
+		++i;
+		t = lib_treeof(thread_t, idlinkage, lib_rbNext(&t->idlinkage));
+	}
+
+	proc_lockClear(&threads_common.lock);
+
+	return i;
+}
+
+
 int proc_threadsList(int n, threadinfo_t *info)
 {
 	int i = 0, len, argc, space;
@@ -1569,9 +2104,38 @@ int proc_threadsList(int n, threadinfo_t *info)
 }
 
 
+/* Isolated CPUs run only threads pinned to them, given as isolcpus=1,3-5 on kernel command line */
+static unsigned int threads_isolated(char *cmdline)
+{
+	unsigned int cpus = 0, from, to;
+	char *p;
+
+	for (p = cmdline; p != NULL && *p != '\0'; p++) {
+		if ((p != cmdline && p[-1] != ' ') || hal_strncmp(p, "isolcpus=", 9) != 0)
+			continue;
+
+		p += 9;
+
+		do {
+			from = to = lib_strtoul(p, &p, 10);
+
+			if (*p == '-')
+				to = lib_strtoul(p + 1, &p, 10);
+
+			for (; from <= to && from < sizeof(cpus) * 8; from++)
+				cpus |= 1 << from;
+		} while (*p == ',' && *(++p) != '\0');
+
+		break;
+	}
+
+	return cpus;
+}
+
+
 int _threads_init(vm_map_t *kmap, vm_object_t *kernel)
 {
-	unsigned int i;
+	unsigned int i, all;
 	threads_common.kmap = kmap;
 	threads_common.executions = 0;
 	threads_common.jiffies = 0;
@@ -1580,15 +2144,12 @@ int _threads_init(vm_map_t *kmap, vm_object_t *kernel)
 	threads_common.utcoffs = 0;
 	threads_common.idcounter = 0;
 
-	threads_common.perfGather = 0;
-
-	proc_lockInit(&threads_common.lock);
+	proc_lockInit(&threads_common.lock, "threads_common.lock");
 
 	/* Initiaizlie scheduler queue */
 	for (i = 0; i < sizeof(threads_common.ready) / sizeof(thread_t *); i++)
 		threads_common.ready[i] = NULL;
 
-	lib_rbInit(&threads_common.sleeping, threads_sleepcmp, NULL);
 	lib_rbInit(&threads_common.id, threads_idcmp, thread_augment);
 
 	lib_printf("proc: Initializing thread scheduler, priorities=%d\n", sizeof(threads_common.ready) / sizeof(thread_t *));
@@ -1599,10 +2160,28 @@ int _threads_init(vm_map_t *kmap, vm_object_t *kernel)
 	if ((threads_common.current = (thread_t **)vm_kmalloc(sizeof(thread_t *) * hal_cpuGetCount())) == NULL)
 		return -ENOMEM;
 
-	/* Run idle thread on every cpu */
+	all = (hal_cpuGetCount() < sizeof(all) * 8) ? (1 << hal_cpuGetCount()) - 1 : (unsigned int)-1;
+
+	if ((threads_common.cpus = all & ~threads_isolated(syspage->arg)) == 0)
+		threads_common.cpus = all;
+
+	if (threads_common.cpus != all)
+		lib_printf("proc: Isolated CPUs mask 0x%x\n", all & ~threads_common.cpus);
+
+	if ((threads_common.dlbw = vm_kmalloc(sizeof(time_t) * hal_cpuGetCount())) == NULL)
+		return -ENOMEM;
+
+	hal_memset(threads_common.dlbw, 0, sizeof(time_t) * hal_cpuGetCount());
+
+	threads_common.dl = NULL;
+	threads_common.dlmax = ((time_t)THREADS_DLLIMIT << THREADS_DLSHIFT) / 100;
+	threads_common.dluser = ((time_t)THREADS_DLUSER << THREADS_DLSHIFT) / 100;
+
+	/* Run idle thread on every cpu, pinned to it */
 	for (i = 0; i < hal_cpuGetCount(); i++) {
 		threads_common.current[i] = NULL;
-		proc_threadCreate(NULL, threads_idlethr, NULL, sizeof(threads_common.ready) / sizeof(thread_t *) - 1, SIZE_KSTACK, NULL, 0, NULL);
+
+		threads_create(NULL, threads_idlethr, NULL, sizeof(threads_common.ready) / sizeof(thread_t *) - 1, SIZE_KSTACK, NULL, 0, NULL, 1 << i, 0);
 	}
 
 	/* Install scheduler on clock interrupt */
@@ -1613,6 +2192,11 @@ int _threads_init(vm_map_t *kmap, vm_object_t *kernel)
 	hal_interruptsSetHandler(&threads_common.pendsvHandler);
 #endif
 
+#ifdef HAL_LAZYFPU
+	if (hal_cpuFpuSize())
+		hal_exceptionsSetHandler(EXC_FPU, threads_fpuTrap);
+#endif
+
 	hal_memset(&threads_common.timeintrHandler, NULL, sizeof(threads_common.timeintrHandler));
 	threads_common.timeintrHandler.f = threads_timeintr;
 
@@ -21,6 +21,7 @@
 #include "../lib/lib.h"
 #include "process.h"
 #include "lock.h"
+#include "ktimer.h"
 #include "../include/sysinfo.h"
 
 #define MAX_TID ((1LL << (__CHAR_BIT__ * (sizeof(unsigned)) - 1)) - 1)
@@ -38,7 +39,7 @@ typedef struct _thread_t {
 	struct _thread_t *next;
 	struct _thread_t *prev;
 
-	rbnode_t sleeplinkage;
+	ktimer_t timer;
 	rbnode_t idlinkage;
 	unsigned lgap : 1;
 	unsigned rgap : 1;
@@ -58,6 +59,22 @@ typedef struct _thread_t {
 	unsigned exit : 1;
 	unsigned state : 1;
 	unsigned interruptible : 1;
+	unsigned deadline : 1;
+	unsigned throttled : 1;
+	unsigned affinity;
+
+	/* Deadline class, times in timer cycles */
+	struct _thread_t *dlnext;
+	struct _thread_t *dlprev;
+	ktimer_t dlTimer;
+	time_t dlRuntime;
+	time_t dlDeadline;
+	time_t dlPeriod;
+	time_t dlBw;
+	time_t dlBudget;
+	time_t dlAbs;
+	time_t dlRelease;
+	time_t dlLast;
 
 	unsigned sigmask;
 	unsigned sigpend;
@@ -79,26 +96,15 @@ typedef struct _thread_t {
 	time_t cpuTime;
 	time_t lastTime;
 
-	cpu_context_t *context;
-} thread_t;
-
-
-extern int perf_start(unsigned pid);
-
-
-extern int perf_read(void *buffer, size_t bufsz);
-
-
-extern int perf_finish(void);
-
-
-extern void perf_fork(process_t *p);
-
-
-extern void perf_kill(process_t *p);
+	time_t waitStart;
+	usageinfo_t usage;
 
+	cpu_context_t *context;
 
-extern void perf_exec(process_t *p, char *path);
+#ifdef HAL_LAZYFPU
+	void *fpu;   /* Allocated on first use */
+#endif
+} thread_t;
 
 
 extern thread_t *proc_current(void);
@@ -107,6 +113,10 @@ extern thread_t *proc_current(void);
 extern int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *stack, size_t stacksz, void *arg);
 
 
+/* Thread of process which never returns to user mode, all signals are masked as there's no user context to take them */
+extern int proc_threadCreateKernel(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *arg);
+
+
 extern void proc_threadProtect(void);
 
 
@@ -131,6 +141,15 @@ extern int proc_join(time_t timeout);
 extern int proc_threadsList(int n, threadinfo_t *info);
 
 
+extern int proc_threadsUsage(int n, threadusage_t *info);
+
+
+extern void proc_usageAdd(usageinfo_t *total, const usageinfo_t *u);
+
+
+extern int proc_usage(int who, usageinfo_t *info);
+
+
 extern void proc_zombie(process_t *proc);
 
 
@@ -167,6 +186,21 @@ extern thread_t *threads_findThread(int tid);
 extern void threads_put(thread_t *);
 
 
+/* Gives t copy of FPU state of src, which has to be sleeping */
+extern int threads_fpuCopy(thread_t *t, thread_t *src);
+
+
+/* Previous mask is stored in old, if it's not NULL */
+extern int proc_threadAffinity(int tid, unsigned int cpus, unsigned int *old);
+
+
+/* Times in us, zero runtime returns thread to its fixed priority, unprivileged callers get a smaller share */
+extern int proc_threadDeadline(int tid, time_t runtime, time_t deadline, time_t period);
+
+
+extern time_t proc_timestamp(void);
+
+
 extern time_t proc_uptime(void);
 
 
@@ -179,6 +213,9 @@ extern int proc_settime(time_t offs);
 extern time_t proc_nextWakeup(void);
 
 
+extern void proc_wakeupUpdate(void);
+
+
 extern void proc_threadsDump(unsigned int priority);
 
 
@@ -188,6 +225,9 @@ extern int _threads_init(vm_map_t *kmap, vm_object_t *kernel);
 extern int threads_sigpost(process_t *process, thread_t *thread, int sig);
 
 
+extern void threads_sigpend(process_t *process, thread_t *thread, int sig);
+
+
 extern void proc_sighandle(void *kstack);
 
 
@@ -0,0 +1,358 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Event tracing
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../include/errno.h"
+#include "../lib/lib.h"
+#include "proc.h"
+#include "trace.h"
+
+
+/* Ring size per CPU */
+#ifndef NOMMU
+#define TRACE_RINGSZ (64 * SIZE_PAGE)
+#else
+#define TRACE_RINGSZ (4 * SIZE_PAGE)
+#endif
+
+
+/*
+ * Indexing uses kernel's own head and size, the ring only gets copies of them.
+ * The reader can write tail alone, at worst making events dropped or overwritten.
+ */
+typedef struct {
+	spinlock_t spinlock;   /* Taken by the owning CPU only, keeps interrupts out of a record in progress */
+	trace_ring_t *ring;
+	volatile unsigned int *tail;
+	unsigned int head;
+	unsigned int size;
+	unsigned int lost;
+	page_t *pages;
+} tracecpu_t;
+
+
+static struct {
+	lock_t lock;
+	volatile unsigned int mask;
+	volatile unsigned int pid;
+
+	/* Rings are allocated on first start and never freed so user mappings stay valid */
+	unsigned int ncpus;
+	tracecpu_t *cpus;
+
+	vm_map_t *kmap;
+} trace_common;
+
+
+void trace_record(int type, unsigned int pid, unsigned int tid, unsigned int data, u64 addr)
+{
+	tracecpu_t *c;
+	trace_ring_t *r;
+	trace_event_t *ev;
+	unsigned int cpu, head;
+	spinlock_ctx_t sc;
+
+	if (!(trace_common.mask & TRACE_EVMASK(type)))
+		return;
+
+	if (trace_common.pid && pid != trace_common.pid)
+		return;
+
+	/* A thread migrating meanwhile writes to other CPU's ring, still under its spinlock */
+	cpu = hal_cpuGetID();
+	c = &trace_common.cpus[cpu];
+
+	hal_spinlockSet(&c->spinlock, &sc);
+	r = c->ring;
+	head = c->head;
+
+	if (head - lib_atomicLoad(c->tail) >= c->size) {
+		r->lost = ++c->lost;
+	}
+	else {
+		ev = &r->events[head & (c->size - 1)];
+		ev->timestamp = proc_timestamp();
+		ev->type = type;
+		ev->cpu = cpu;
+		ev->pid = pid;
+		ev->tid = tid;
+		ev->data = data;
+		ev->addr = addr;
+
+		c->head = head + 1;
+		lib_atomicStore(&r->head, c->head);
+	}
+	hal_spinlockClear(&c->spinlock, &sc);
+}
+
+
+void trace_event(int type, unsigned int data, u64 addr)
+{
+	thread_t *current;
+
+	if (!(trace_common.mask & TRACE_EVMASK(type)))
+		return;
+
+	if ((current = proc_current()) == NULL)
+		return;
+
+	trace_record(type, (current->process != NULL) ? current->process->id : 0, current->id, data, addr);
+}
+
+
+static void _trace_ringFree(tracecpu_t *c)
+{
+	size_t sz = 0;
+	page_t *p;
+
+	while ((p = c->pages) != NULL) {
+		c->pages = p->next;
+		vm_pageFree(p);
+		sz += SIZE_PAGE;
+	}
+
+	vm_munmap(trace_common.kmap, c->ring, sz);
+	c->ring = NULL;
+	c->tail = NULL;
+}
+
+
+/* Ring is built of single pages, listed in address order for trace_map, the last one holds tail */
+static int _trace_ringAlloc(tracecpu_t *c)
+{
+	page_t *p, **tail = &c->pages;
+	void *v;
+
+	c->pages = NULL;
+
+	if ((c->ring = vm_mapFind(trace_common.kmap, NULL, TRACE_RINGSZ, MAP_NONE, PROT_READ | PROT_WRITE)) == NULL)
+		return -ENOMEM;
+
+	for (v = c->ring; v < (void *)c->ring + TRACE_RINGSZ; v += SIZE_PAGE) {
+		if ((p = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP)) == NULL) {
+			_trace_ringFree(c);
+			return -ENOMEM;
+		}
+
+		p->next = NULL;
+		*tail = p;
+		tail = &p->next;
+		page_map(&trace_common.kmap->pmap, v, p->addr, PGHD_PRESENT | PGHD_WRITE);
+	}
+
+	/* Power of 2 for cheap indexing */
+	c->size = 1u << hal_cpuGetLastBit((TRACE_RINGSZ - SIZE_PAGE - sizeof(trace_ring_t)) / sizeof(trace_event_t));
+	c->ring->size = c->size;
+	c->ring->tailoffs = TRACE_RINGSZ - SIZE_PAGE;
+	c->tail = (void *)c->ring + c->ring->tailoffs;
+
+	return EOK;
+}
+
+
+static int _trace_ringsAlloc(void)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < trace_common.ncpus; ++i) {
+		if (trace_common.cpus[i].ring == NULL && (err = _trace_ringAlloc(&trace_common.cpus[i])) < 0)
+			return err;
+	}
+
+	return EOK;
+}
+
+
+int trace_start(unsigned int pid, unsigned int mask)
+{
+	tracecpu_t *c;
+	unsigned int i;
+	int err;
+
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	proc_lockSet(&trace_common.lock);
+
+	do {
+		if (trace_common.mask) {
+			err = -EBUSY;
+			break;
+		}
+
+		if (trace_common.cpus == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+
+		if ((err = _trace_ringsAlloc()) < 0)
+			break;
+
+		for (i = 0; i < trace_common.ncpus; ++i) {
+			c = &trace_common.cpus[i];
+			c->head = 0;
+			c->lost = 0;
+			c->ring->head = 0;
+			c->ring->lost = 0;
+			*c->tail = 0;
+		}
+
+		trace_common.pid = pid;
+		lib_atomicStore(&trace_common.mask, mask & TRACE_EVALL);
+	} while (0);
+
+	proc_lockClear(&trace_common.lock);
+
+	return err;
+}
+
+
+/* Copies out whole events, CPU by CPU, consuming them */
+int trace_read(void *buffer, size_t bufsz)
+{
+	tracecpu_t *c;
+	unsigned int i, tail, head;
+	size_t len = 0;
+
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	proc_lockSet(&trace_common.lock);
+
+	for (i = 0; i < trace_common.ncpus; ++i) {
+		c = &trace_common.cpus[i];
+
+		if (c->ring == NULL)
+			break;
+
+		head = lib_atomicLoad(&c->ring->head);
+		tail = lib_atomicLoad(c->tail);
+
+		/* Tail is written by the reader, don't trust it */
+		if (head - tail > c->size)
+			tail = head - c->size;
+
+		for (; tail != head && len + sizeof(trace_event_t) <= bufsz; ++tail) {
+			hal_memcpy(buffer + len, &c->ring->events[tail & (c->size - 1)], sizeof(trace_event_t));
+			len += sizeof(trace_event_t);
+		}
+
+		lib_atomicStore(c->tail, tail);
+	}
+
+	proc_lockClear(&trace_common.lock);
+
+	return len;
+}
+
+
+int trace_stop(void)
+{
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	proc_lockSet(&trace_common.lock);
+	lib_atomicStore(&trace_common.mask, 0);
+	proc_lockClear(&trace_common.lock);
+
+	return EOK;
+}
+
+
+/* Maps CPU's ring into the caller read-only but for the tail page, returns ring size in bytes */
+int trace_map(unsigned int cpu, void **ring)
+{
+	tracecpu_t *c;
+	int err = TRACE_RINGSZ;
+#ifndef NOMMU
+	process_t *process = proc_current()->process;
+	void *vaddr;
+	page_t *p;
+	unsigned int i;
+#endif
+
+	if (cpu >= trace_common.ncpus)
+		return -EINVAL;
+
+	if (!proc_privileged(proc_current()->process))
+		return -EPERM;
+
+	proc_lockSet(&trace_common.lock);
+
+	do {
+		if ((err = _trace_ringsAlloc()) < 0)
+			break;
+
+		c = &trace_common.cpus[cpu];
+		err = TRACE_RINGSZ;
+
+#ifndef NOMMU
+		if (process == NULL) {
+			err = -EINVAL;
+			break;
+		}
+
+		if ((vaddr = vm_mapFind(process->mapp, NULL, TRACE_RINGSZ, MAP_NOINHERIT, PROT_READ | PROT_USER)) == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+
+		/* Pages stay owned by the tracer, unmapping them doesn't free them */
+		for (p = c->pages, i = 0; p != NULL; p = p->next, ++i) {
+			if (page_map(&process->mapp->pmap, vaddr + i * SIZE_PAGE, p->addr, PGHD_PRESENT | PGHD_USER | ((p->next == NULL) ? PGHD_WRITE : 0)) < 0) {
+				vm_munmap(process->mapp, vaddr, TRACE_RINGSZ);
+				err = -ENOMEM;
+				break;
+			}
+		}
+
+		if (err < 0)
+			break;
+
+		*ring = vaddr;
+#else
+		*ring = c->ring;
+#endif
+	} while (0);
+
+	proc_lockClear(&trace_common.lock);
+
+	return err;
+}
+
+
+void _trace_init(vm_map_t *kmap, vm_object_t *kernel)
+{
+	unsigned int i;
+
+	trace_common.kmap = kmap;
+	trace_common.mask = 0;
+	trace_common.pid = 0;
+	trace_common.ncpus = hal_cpuGetCount();
+
+	proc_lockInit(&trace_common.lock, "trace_common.lock");
+
+	if ((trace_common.cpus = vm_kmalloc(trace_common.ncpus * sizeof(tracecpu_t))) == NULL) {
+		trace_common.ncpus = 0;
+		return;
+	}
+
+	for (i = 0; i < trace_common.ncpus; ++i) {
+		hal_spinlockCreate(&trace_common.cpus[i].spinlock, "trace.spinlock");
+		trace_common.cpus[i].ring = NULL;
+		trace_common.cpus[i].tail = NULL;
+		trace_common.cpus[i].pages = NULL;
+	}
+}
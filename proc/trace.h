@@ -0,0 +1,46 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Event tracing
+ *
+ * Copyright 2021 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PROC_TRACE_H_
+#define _PROC_TRACE_H_
+
+#include HAL
+#include "../include/sysinfo.h"
+#include "../vm/vm.h"
+
+
+/* Records event of given thread, safe with any spinlock held */
+extern void trace_record(int type, unsigned int pid, unsigned int tid, unsigned int data, u64 addr);
+
+
+/* Records event of the current thread */
+extern void trace_event(int type, unsigned int data, u64 addr);
+
+
+extern int trace_start(unsigned int pid, unsigned int mask);
+
+
+extern int trace_read(void *buffer, size_t bufsz);
+
+
+extern int trace_stop(void);
+
+
+extern int trace_map(unsigned int cpu, void **ring);
+
+
+extern void _trace_init(vm_map_t *kmap, vm_object_t *kernel);
+
+
+#endif
@@ -22,16 +22,44 @@
 
 struct {
 	userintr_t *volatile active;
+
+	spinlock_t spinlock;
+	userintr_t *threaded;
 } userintr_common;
 
 
+static int userintr_dispatch(unsigned int n, cpu_context_t *ctx, void *arg);
+
+
 int userintr_put(userintr_t *ui)
 {
 	int rem;
+	spinlock_ctx_t sc;
 
 	if (!(rem = resource_put(&ui->resource))) {
 		hal_interruptsDeleteHandler(&ui->handler);
 
+		if (ui->handler.f != userintr_dispatch) {
+			/* Thread killed with its process is ghosted without running, userintr_threadDone clears running then */
+			hal_spinlockSet(&ui->spinlock, &sc);
+			ui->stop = 1;
+			proc_threadWakeup(&ui->queue);
+
+			while (ui->running)
+				proc_threadWait(&ui->done, &ui->spinlock, 0, &sc);
+			hal_spinlockClear(&ui->spinlock, &sc);
+
+			hal_spinlockSet(&userintr_common.spinlock, &sc);
+			LIST_REMOVE(&userintr_common.threaded, ui);
+			hal_spinlockClear(&userintr_common.spinlock, &sc);
+
+			/* Line stays masked until pending run is done */
+			if (ui->pending)
+				hal_interruptsMask(ui->handler.n, 0);
+
+			hal_spinlockDestroy(&ui->spinlock);
+		}
+
 		if (ui->cond != NULL)
 			cond_put(ui->cond);
 
@@ -42,17 +70,10 @@ int userintr_put(userintr_t *ui)
 }
 
 
-static int userintr_dispatch(unsigned int n, cpu_context_t *ctx, void *arg)
+/* Handler address space has to be switched in */
+static int userintr_call(userintr_t *ui)
 {
-	userintr_t *ui = arg;
-	int ret, reschedule = 0;
-	process_t *p = NULL;
-
-	if (proc_current() != NULL)
-		p = (proc_current())->process;
-
-	/* Switch into the handler address space */
-	pmap_switch(ui->process->pmapp);
+	int ret;
 
 #ifdef TARGET_RISCV64
 	/* Clear PGHD_USER attribute in interrupt handler code page (RISC-V specification forbids user code execution in kernel mode) */
@@ -61,9 +82,7 @@ static int userintr_dispatch(unsigned int n, cpu_context_t *ctx, void *arg)
 	pmap_enter(ui->process->pmapp, pmap_resolve(ui->process->pmapp, ui->f), (void *)((u64)ui->f & ~(SIZE_PAGE - 1)), attr, NULL);
 #endif
 
-	userintr_common.active = ui;
 	ret = ui->f(ui->handler.n, ui->arg);
-	userintr_common.active = NULL;
 
 #ifdef TARGET_RISCV64
 	/* Restore PGHD_USER attribute */
@@ -71,6 +90,26 @@ static int userintr_dispatch(unsigned int n, cpu_context_t *ctx, void *arg)
 	pmap_enter(ui->process->pmapp, pmap_resolve(ui->process->pmapp, ui->f), (void *)((u64)ui->f & ~(SIZE_PAGE - 1)), attr, NULL);
 #endif
 
+	return ret;
+}
+
+
+static int userintr_dispatch(unsigned int n, cpu_context_t *ctx, void *arg)
+{
+	userintr_t *ui = arg;
+	int ret, reschedule = 0;
+	process_t *p = NULL;
+
+	if (proc_current() != NULL)
+		p = (proc_current())->process;
+
+	/* Switch into the handler address space */
+	pmap_switch(ui->process->pmapp);
+
+	userintr_common.active = ui;
+	ret = userintr_call(ui);
+	userintr_common.active = NULL;
+
 	if (ret >= 0 && ui->cond != NULL) {
 		reschedule = 1;
 		proc_threadWakeup(&ui->cond->queue);
@@ -84,31 +123,190 @@ static int userintr_dispatch(unsigned int n, cpu_context_t *ctx, void *arg)
 }
 
 
-int userintr_setHandler(unsigned int n, int (*f)(unsigned int, void *), void *arg, unsigned int c)
+/* Hard handler of threaded mode, device is serviced by thread with line masked */
+static int userintr_hard(unsigned int n, cpu_context_t *ctx, void *arg)
+{
+	userintr_t *ui = arg;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&ui->spinlock, &sc);
+	hal_interruptsMask(n, 1);
+
+	if (!ui->pending++)
+		ui->raised = proc_timestamp();
+	proc_threadWakeup(&ui->queue);
+	hal_spinlockClear(&ui->spinlock, &sc);
+
+	return 1;
+}
+
+
+static void _userintr_latency(userintr_t *ui, time_t latency)
+{
+	unsigned int b;
+
+	if (latency >> 32)
+		latency = (u32)-1;
+
+	if (latency > ui->latencyMax)
+		ui->latencyMax = latency;
+
+	b = (latency != 0) ? hal_cpuGetLastBit((u32)latency) : 0;
+	ui->latency[(b < IRQSTAT_BUCKETS) ? b : IRQSTAT_BUCKETS - 1]++;
+	ui->runs++;
+}
+
+
+/* Thread belongs to handler process, so no address space is switched for a run */
+static void userintr_thread(void *arg)
+{
+	userintr_t *ui = arg;
+	thread_t *current = proc_current();
+	int ret;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&ui->spinlock, &sc);
+
+	while (!ui->stop && !current->exit) {
+		if (!ui->pending) {
+			proc_threadWaitInterruptible(&ui->queue, &ui->spinlock, 0, &sc);
+			continue;
+		}
+
+		_userintr_latency(ui, proc_timestamp() - ui->raised);
+		hal_spinlockClear(&ui->spinlock, &sc);
+
+		if ((ret = userintr_call(ui)) >= 0 && ui->cond != NULL)
+			proc_threadWakeup(&ui->cond->queue);
+
+		/* Pending is cleared with unmasking, so it tells if line is masked */
+		hal_spinlockSet(&ui->spinlock, &sc);
+		ui->pending = 0;
+		hal_interruptsMask(ui->handler.n, 0);
+	}
+
+	ui->running = 0;
+	proc_threadWakeup(&ui->done);
+	hal_spinlockClear(&ui->spinlock, &sc);
+
+	proc_threadEnd();
+}
+
+
+/* Thread may be gone already, it's matched by id when destroyed */
+static void userintr_started(userintr_t *ui, unsigned int tid)
+{
+	thread_t *t;
+	int alive = 0;
+	spinlock_ctx_t sc;
+
+	hal_spinlockSet(&userintr_common.spinlock, &sc);
+	ui->tid = tid;
+	hal_spinlockClear(&userintr_common.spinlock, &sc);
+
+	if ((t = threads_findThread(tid)) != NULL) {
+		alive = (t->process == ui->process);
+		threads_put(t);
+	}
+
+	if (alive)
+		return;
+
+	hal_spinlockSet(&ui->spinlock, &sc);
+	ui->running = 0;
+	proc_threadWakeup(&ui->done);
+	hal_spinlockClear(&ui->spinlock, &sc);
+}
+
+
+void userintr_threadDone(thread_t *t)
+{
+	userintr_t *ui;
+	spinlock_ctx_t sc, uisc;
+
+	/* Handler of running thread stays on the list */
+	if (userintr_common.threaded == NULL)
+		return;
+
+	hal_spinlockSet(&userintr_common.spinlock, &sc);
+
+	if ((ui = userintr_common.threaded) != NULL) {
+		do {
+			if (ui->tid != t->id || ui->process != t->process || !ui->running)
+				continue;
+
+			hal_spinlockSet(&ui->spinlock, &uisc);
+			ui->running = 0;
+			proc_threadWakeup(&ui->done);
+			hal_spinlockClear(&ui->spinlock, &uisc);
+			break;
+		} while ((ui = ui->next) != userintr_common.threaded);
+	}
+
+	hal_spinlockClear(&userintr_common.spinlock, &sc);
+}
+
+
+int userintr_setHandler(unsigned int n, int (*f)(unsigned int, void *), void *arg, unsigned int c, int priority)
 {
 	process_t *process;
 	userintr_t *ui;
-	int res;
+	unsigned int tid;
+	int res, err;
+	spinlock_ctx_t sc;
 
 	process = proc_current()->process;
 
+	/* Timer line can't be masked */
+#ifdef HPTIMER_IRQ
+	if (priority >= 0 && n == HPTIMER_IRQ)
+#else
+	if (priority >= 0 && n == SYSTICK_IRQ)
+#endif
+		return -EINVAL;
+
 	if ((ui = vm_kmalloc(sizeof(userintr_t))) == NULL)
 		return -ENOMEM;
 
+	hal_memset(ui, 0, sizeof(userintr_t));
+
 	ui->handler.next = NULL;
 	ui->handler.prev = NULL;
-	ui->handler.f = userintr_dispatch;
+	ui->handler.f = (priority < 0) ? userintr_dispatch : userintr_hard;
 	ui->handler.data = ui;
 	ui->handler.n = n;
+	ui->handler.cpus = 0;
 
 	ui->f = f;
 	ui->arg = arg;
 	ui->process = process;
 	ui->cond = NULL;
 
+	if (priority >= 0) {
+		hal_spinlockCreate(&ui->spinlock, "userintr.spinlock");
+
+		hal_spinlockSet(&userintr_common.spinlock, &sc);
+		LIST_ADD(&userintr_common.threaded, ui);
+		hal_spinlockClear(&userintr_common.spinlock, &sc);
+	}
+
 	if (c == 0 || (ui->cond = cond_get(c)) != NULL) {
 		if ((res = hal_interruptsSetHandler(&ui->handler)) == EOK) {
 			if ((res = resource_alloc(process, &ui->resource, rtInth))) {
+				if (priority >= 0) {
+					ui->running = 1;
+
+					/* Interrupts coming before the thread starts are pending for it */
+					if ((err = proc_threadCreateKernel(process, userintr_thread, &tid, priority, SIZE_KSTACK, ui)) < 0) {
+						ui->running = 0;
+						resource_unlink(process, &ui->resource);
+						userintr_put(ui);
+						return err;
+					}
+
+					userintr_started(ui, tid);
+				}
+
 				userintr_put(ui);
 				return res;
 			}
@@ -125,11 +323,64 @@ int userintr_setHandler(unsigned int n, int (*f)(unsigned int, void *), void *ar
 		res = -EINVAL;
 	}
 
+	if (priority >= 0) {
+		hal_spinlockSet(&userintr_common.spinlock, &sc);
+		LIST_REMOVE(&userintr_common.threaded, ui);
+		hal_spinlockClear(&userintr_common.spinlock, &sc);
+
+		hal_spinlockDestroy(&ui->spinlock);
+	}
+
 	vm_kfree(ui);
 	return res;
 }
 
 
+/* Statistics of lines 0 to n - 1, info may be user memory so it's written with no spinlock set */
+int userintr_list(int n, irqinfo_t *info)
+{
+	userintr_t *ui;
+	irqinfo_t li;
+	unsigned int b;
+	int i;
+	spinlock_ctx_t sc, uisc;
+
+	for (i = 0; i < n; ++i) {
+		hal_memset(&li, 0, sizeof(li));
+		li.irq = i;
+
+		if (hal_interruptsCounter(i, &li.count) < 0)
+			break;
+
+		hal_spinlockSet(&userintr_common.spinlock, &sc);
+
+		if ((ui = userintr_common.threaded) != NULL) {
+			do {
+				if (ui->handler.n != i)
+					continue;
+
+				hal_spinlockSet(&ui->spinlock, &uisc);
+				li.threads++;
+				li.runs += ui->runs;
+
+				if (ui->latencyMax > li.latencyMax)
+					li.latencyMax = ui->latencyMax;
+
+				for (b = 0; b < IRQSTAT_BUCKETS; ++b)
+					li.latency[b] += ui->latency[b];
+				hal_spinlockClear(&ui->spinlock, &uisc);
+			} while ((ui = ui->next) != userintr_common.threaded);
+		}
+
+		hal_spinlockClear(&userintr_common.spinlock, &sc);
+
+		hal_memcpy(&info[i], &li, sizeof(li));
+	}
+
+	return i;
+}
+
+
 userintr_t *userintr_active(void)
 {
 	return userintr_common.active;
@@ -139,4 +390,6 @@ userintr_t *userintr_active(void)
 void _userintr_init(void)
 {
 	userintr_common.active = NULL;
+	userintr_common.threaded = NULL;
+	hal_spinlockCreate(&userintr_common.spinlock, "userintr_common.spinlock");
 }
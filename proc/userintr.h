@@ -19,22 +19,46 @@
 #include HAL
 #include "resource.h"
 #include "cond.h"
+#include "../include/sysinfo.h"
 
 
-typedef struct {
+typedef struct _userintr_t {
 	resource_t resource;
 	intr_handler_t handler;
 	process_t *process;
 	int (*f)(unsigned int, void *);
 	void *arg;
 	cond_t *cond;
+
+	/* Threaded handlers, line is masked from interrupt until thread is done */
+	struct _userintr_t *next, *prev;
+	spinlock_t spinlock;
+	thread_t *queue;
+	thread_t *done;
+	unsigned int pending;
+	int running;
+	int stop;
+	unsigned int tid;
+	time_t raised;
+
+	unsigned long long runs;
+	unsigned int latencyMax;
+	unsigned int latency[IRQSTAT_BUCKETS];
 } userintr_t;
 
 
 extern int userintr_put(userintr_t *ui);
 
 
-extern int userintr_setHandler(unsigned int n, int (*f)(unsigned int, void *), void *arg, unsigned int c);
+/* Negative priority runs handler in interrupt context, otherwise in thread of given priority */
+extern int userintr_setHandler(unsigned int n, int (*f)(unsigned int, void *), void *arg, unsigned int c, int priority);
+
+
+extern int userintr_list(int n, irqinfo_t *info);
+
+
+/* Called when thread is destroyed, handler thread may be ghosted without running */
+extern void userintr_threadDone(thread_t *t);
 
 
 extern userintr_t *userintr_active(void);
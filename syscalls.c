@@ -27,6 +27,21 @@
 
 #define SYSCALLS_NAME(name) syscalls_##name,
 #define SYSCALLS_STRING(name) #name,
+#define SYSCALLS_COUNT(name) + 1
+#define SYSCALLS_NR (0 SYSCALLS(SYSCALLS_COUNT))
+
+
+#ifdef SYSCALLSTAT
+typedef struct {
+	u32 count;
+	u32 max;
+	u32 hist[SYSCALLSTAT_BUCKETS];
+} syscalls_stat_t;
+
+
+/* Per-CPU tables allocated separately, updated atomically as thread may migrate during syscall */
+static syscalls_stat_t **syscalls_stats;
+#endif
 
 /*
  * Kernel
@@ -260,6 +275,33 @@ int syscalls_usleep(void *ustack)
 }
 
 
+int syscalls_threadAffinity(void *ustack)
+{
+	int tid;
+	unsigned int cpus, *old;
+
+	GETFROMSTACK(ustack, int, tid, 0);
+	GETFROMSTACK(ustack, unsigned int, cpus, 1);
+	GETFROMSTACK(ustack, unsigned int *, old, 2);
+
+	return proc_threadAffinity(tid, cpus, old);
+}
+
+
+int syscalls_threadDeadline(void *ustack)
+{
+	int tid;
+	time_t runtime, deadline, period;
+
+	GETFROMSTACK(ustack, int, tid, 0);
+	GETFROMSTACK(ustack, time_t, runtime, 1);
+	GETFROMSTACK(ustack, time_t, deadline, 2);
+	GETFROMSTACK(ustack, time_t, period, 3);
+
+	return proc_threadDeadline(tid, runtime, deadline, period);
+}
+
+
 int syscalls_priority(void *ustack)
 {
 	int priority;
@@ -303,6 +345,18 @@ int syscalls_threadsinfo(void *ustack)
 }
 
 
+int syscalls_threadsusage(void *ustack)
+{
+	int n;
+	threadusage_t *info;
+
+	GETFROMSTACK(ustack, int, n, 0);
+	GETFROMSTACK(ustack, threadusage_t *, info, 1);
+
+	return proc_threadsUsage(n, info);
+}
+
+
 void syscalls_meminfo(void *ustack)
 {
 	meminfo_t *info;
@@ -313,6 +367,76 @@ void syscalls_meminfo(void *ustack)
 }
 
 
+int syscalls_lockinfo(void *ustack)
+{
+	int n;
+	lockinfo_t *info;
+
+	GETFROMSTACK(ustack, int, n, 0);
+	GETFROMSTACK(ustack, lockinfo_t *, info, 1);
+
+	return lockstat_list(n, info);
+}
+
+
+#ifdef SYSCALLSTAT
+static u32 syscalls_statTake(u32 *v, int reset)
+{
+	return reset ? lib_atomicExchange(v, 0) : lib_atomicLoad(v);
+}
+#endif
+
+
+/* Sums statistics of all CPUs, optionally resetting them */
+static int syscalls_statGet(syscallstat_t *stat, int n, int reset)
+{
+#ifdef SYSCALLSTAT
+	syscalls_stat_t *s;
+	unsigned int i, j, cpu;
+	u32 max;
+
+	if (syscalls_stats == NULL)
+		return -ENOMEM;
+
+	if (n > SYSCALLS_NR)
+		n = SYSCALLS_NR;
+
+	for (i = 0; i < n; ++i) {
+		hal_memset(&stat[i], 0, sizeof(stat[i]));
+
+		for (cpu = 0; cpu < hal_cpuGetCount(); ++cpu) {
+			s = &syscalls_stats[cpu][i];
+
+			stat[i].count += syscalls_statTake(&s->count, reset);
+
+			if ((max = syscalls_statTake(&s->max, reset)) > stat[i].max)
+				stat[i].max = max;
+
+			for (j = 0; j < SYSCALLSTAT_BUCKETS; ++j)
+				stat[i].hist[j] += syscalls_statTake(&s->hist[j], reset);
+		}
+	}
+
+	return n;
+#else
+	return -ENOSYS;
+#endif
+}
+
+
+int syscalls_syscallstat(void *ustack)
+{
+	syscallstat_t *stat;
+	int n, reset;
+
+	GETFROMSTACK(ustack, syscallstat_t *, stat, 0);
+	GETFROMSTACK(ustack, int, n, 1);
+	GETFROMSTACK(ustack, int, reset, 2);
+
+	return syscalls_statGet(stat, n, reset);
+}
+
+
 int syscalls_syspageprog(void *ustack)
 {
 	int i;
@@ -335,17 +459,58 @@ int syscalls_syspageprog(void *ustack)
 }
 
 
-int syscalls_perf_start(void *ustack)
+int syscalls_trace_start(void *ustack)
+{
+	unsigned int pid, mask;
+
+	GETFROMSTACK(ustack, unsigned int, pid, 0);
+	GETFROMSTACK(ustack, unsigned int, mask, 1);
+
+	return trace_start(pid, mask);
+}
+
+
+int syscalls_trace_read(void *ustack)
+{
+	void *buffer;
+	size_t sz;
+
+	GETFROMSTACK(ustack, void *, buffer, 0);
+	GETFROMSTACK(ustack, size_t, sz, 1);
+
+	return trace_read(buffer, sz);
+}
+
+
+int syscalls_trace_stop(void *ustack)
+{
+	return trace_stop();
+}
+
+
+int syscalls_trace_map(void *ustack)
 {
-	unsigned pid;
+	unsigned int cpu;
+	void **ring;
 
-	GETFROMSTACK(ustack, unsigned, pid, 0);
+	GETFROMSTACK(ustack, unsigned int, cpu, 0);
+	GETFROMSTACK(ustack, void **, ring, 1);
 
-	return perf_start(pid);
+	return trace_map(cpu, ring);
 }
 
 
-int syscalls_perf_read(void *ustack)
+int syscalls_profile_start(void *ustack)
+{
+	unsigned int period;
+
+	GETFROMSTACK(ustack, unsigned int, period, 0);
+
+	return profile_start(period);
+}
+
+
+int syscalls_profile_read(void *ustack)
 {
 	void *buffer;
 	size_t sz;
@@ -353,13 +518,13 @@ int syscalls_perf_read(void *ustack)
 	GETFROMSTACK(ustack, void *, buffer, 0);
 	GETFROMSTACK(ustack, size_t, sz, 1);
 
-	return perf_read(buffer, sz);
+	return profile_read(buffer, sz);
 }
 
 
-int syscalls_perf_finish(void *ustack)
+int syscalls_profile_stop(void *ustack)
 {
-	return perf_finish();
+	return profile_stop();
 }
 
 /*
@@ -461,6 +626,35 @@ int syscalls_condBroadcast(void *ustack)
 }
 
 
+int syscalls_futexWait(void *ustack)
+{
+	u32 *addr;
+	u32 val;
+	time_t timeout;
+	int flags;
+
+	GETFROMSTACK(ustack, u32 *, addr, 0);
+	GETFROMSTACK(ustack, u32, val, 1);
+	GETFROMSTACK(ustack, time_t, timeout, 2);
+	GETFROMSTACK(ustack, int, flags, 3);
+
+	return proc_futexWait(addr, val, timeout, flags);
+}
+
+
+int syscalls_futexWake(void *ustack)
+{
+	u32 *addr;
+	int n, flags;
+
+	GETFROMSTACK(ustack, u32 *, addr, 0);
+	GETFROMSTACK(ustack, int, n, 1);
+	GETFROMSTACK(ustack, int, flags, 2);
+
+	return proc_futexWake(addr, n, flags);
+}
+
+
 /*
  * Resources
  */
@@ -496,7 +690,7 @@ int syscalls_interrupt(void *ustack)
 	GETFROMSTACK(ustack, unsigned int, cond, 3);
 	GETFROMSTACK(ustack, unsigned int *, handle, 4);
 
-	if ((res = userintr_setHandler(n, f, data, cond)) < 0)
+	if ((res = userintr_setHandler(n, f, data, cond, -1)) < 0)
 		return res;
 
 	*handle = res;
@@ -504,6 +698,47 @@ int syscalls_interrupt(void *ustack)
 }
 
 
+/* Handler runs in thread of given priority, with interrupt line masked */
+int syscalls_interruptThread(void *ustack)
+{
+	unsigned int n;
+	void *f;
+	void *data;
+	unsigned int cond;
+	int priority;
+	unsigned int *handle;
+	int res;
+
+	GETFROMSTACK(ustack, unsigned int, n, 0);
+	GETFROMSTACK(ustack, void *, f, 1);
+	GETFROMSTACK(ustack, void *, data, 2);
+	GETFROMSTACK(ustack, unsigned int, cond, 3);
+	GETFROMSTACK(ustack, int, priority, 4);
+	GETFROMSTACK(ustack, unsigned int *, handle, 5);
+
+	if (priority < 0)
+		return -EINVAL;
+
+	if ((res = userintr_setHandler(n, f, data, cond, priority)) < 0)
+		return res;
+
+	*handle = res;
+	return EOK;
+}
+
+
+int syscalls_irqinfo(void *ustack)
+{
+	int n;
+	irqinfo_t *info;
+
+	GETFROMSTACK(ustack, int, n, 0);
+	GETFROMSTACK(ustack, irqinfo_t *, info, 1);
+
+	return userintr_list(n, info);
+}
+
+
 /*
  * Message passing
  */
@@ -1248,6 +1483,238 @@ int syscalls_sys_poll(char *ustack)
 }
 
 
+int syscalls_sys_pollNotify(char *ustack)
+{
+	oid_t *oid;
+	unsigned events;
+
+	GETFROMSTACK(ustack, oid_t *, oid, 0);
+	GETFROMSTACK(ustack, unsigned, events, 1);
+
+	return posix_pollNotify(oid, events);
+}
+
+
+int syscalls_sys_eventQueue(char *ustack)
+{
+	return posix_eventQueue();
+}
+
+
+int syscalls_sys_eventCtl(char *ustack)
+{
+	int evfd;
+	const struct pollevent *ev;
+
+	GETFROMSTACK(ustack, int, evfd, 0);
+	GETFROMSTACK(ustack, const struct pollevent *, ev, 1);
+
+	return posix_eventCtl(evfd, ev);
+}
+
+
+int syscalls_sys_eventWait(char *ustack)
+{
+	int evfd, maxevents, timeout_ms;
+	struct pollevent *evs;
+
+	GETFROMSTACK(ustack, int, evfd, 0);
+	GETFROMSTACK(ustack, struct pollevent *, evs, 1);
+	GETFROMSTACK(ustack, int, maxevents, 2);
+	GETFROMSTACK(ustack, int, timeout_ms, 3);
+
+	return posix_eventWait(evfd, evs, maxevents, timeout_ms);
+}
+
+
+int syscalls_sys_timerCreate(char *ustack)
+{
+	int sig, tid, flags;
+
+	GETFROMSTACK(ustack, int, sig, 0);
+	GETFROMSTACK(ustack, int, tid, 1);
+	GETFROMSTACK(ustack, int, flags, 2);
+
+	return posix_timerCreate(sig, tid, flags);
+}
+
+
+int syscalls_sys_timerSet(char *ustack)
+{
+	int fd, flags;
+	const struct timerspec *value;
+	struct timerspec *ovalue;
+
+	GETFROMSTACK(ustack, int, fd, 0);
+	GETFROMSTACK(ustack, int, flags, 1);
+	GETFROMSTACK(ustack, const struct timerspec *, value, 2);
+	GETFROMSTACK(ustack, struct timerspec *, ovalue, 3);
+
+	return posix_timerSet(fd, flags, value, ovalue);
+}
+
+
+int syscalls_sys_timerGet(char *ustack)
+{
+	int fd;
+	struct timerspec *value;
+
+	GETFROMSTACK(ustack, int, fd, 0);
+	GETFROMSTACK(ustack, struct timerspec *, value, 1);
+
+	return posix_timerGet(fd, value);
+}
+
+
+int syscalls_sys_sendfile(char *ustack)
+{
+	int outfd, infd;
+	off_t *offset;
+	size_t count;
+
+	GETFROMSTACK(ustack, int, outfd, 0);
+	GETFROMSTACK(ustack, int, infd, 1);
+	GETFROMSTACK(ustack, off_t *, offset, 2);
+	GETFROMSTACK(ustack, size_t, count, 3);
+
+	return posix_sendfile(outfd, infd, offset, count);
+}
+
+
+int syscalls_sys_readv(char *ustack)
+{
+	int fildes, iovcnt;
+	const struct iovec *iov;
+
+	GETFROMSTACK(ustack, int, fildes, 0);
+	GETFROMSTACK(ustack, const struct iovec *, iov, 1);
+	GETFROMSTACK(ustack, int, iovcnt, 2);
+
+	return posix_readv(fildes, iov, iovcnt);
+}
+
+
+int syscalls_sys_writev(char *ustack)
+{
+	int fildes, iovcnt;
+	const struct iovec *iov;
+
+	GETFROMSTACK(ustack, int, fildes, 0);
+	GETFROMSTACK(ustack, const struct iovec *, iov, 1);
+	GETFROMSTACK(ustack, int, iovcnt, 2);
+
+	return posix_writev(fildes, iov, iovcnt);
+}
+
+
+int syscalls_sys_preadv(char *ustack)
+{
+	int fildes, iovcnt;
+	const struct iovec *iov;
+	off_t offset;
+
+	GETFROMSTACK(ustack, int, fildes, 0);
+	GETFROMSTACK(ustack, const struct iovec *, iov, 1);
+	GETFROMSTACK(ustack, int, iovcnt, 2);
+	GETFROMSTACK(ustack, off_t, offset, 3);
+
+	return posix_preadv(fildes, iov, iovcnt, offset);
+}
+
+
+int syscalls_sys_pwritev(char *ustack)
+{
+	int fildes, iovcnt;
+	const struct iovec *iov;
+	off_t offset;
+
+	GETFROMSTACK(ustack, int, fildes, 0);
+	GETFROMSTACK(ustack, const struct iovec *, iov, 1);
+	GETFROMSTACK(ustack, int, iovcnt, 2);
+	GETFROMSTACK(ustack, off_t, offset, 3);
+
+	return posix_pwritev(fildes, iov, iovcnt, offset);
+}
+
+
+int syscalls_sys_sendmmsg(char *ustack)
+{
+	int socket, flags;
+	struct mmsghdr *msgvec;
+	unsigned int vlen;
+
+	GETFROMSTACK(ustack, int, socket, 0);
+	GETFROMSTACK(ustack, struct mmsghdr *, msgvec, 1);
+	GETFROMSTACK(ustack, unsigned int, vlen, 2);
+	GETFROMSTACK(ustack, int, flags, 3);
+
+	return posix_sendmmsg(socket, msgvec, vlen, flags);
+}
+
+
+int syscalls_sys_recvmmsg(char *ustack)
+{
+	int socket, flags;
+	struct mmsghdr *msgvec;
+	unsigned int vlen;
+
+	GETFROMSTACK(ustack, int, socket, 0);
+	GETFROMSTACK(ustack, struct mmsghdr *, msgvec, 1);
+	GETFROMSTACK(ustack, unsigned int, vlen, 2);
+	GETFROMSTACK(ustack, int, flags, 3);
+
+	return posix_recvmmsg(socket, msgvec, vlen, flags);
+}
+
+
+void syscalls_dcacheinfo(void *ustack)
+{
+	dcacheinfo_t *info;
+
+	GETFROMSTACK(ustack, dcacheinfo_t *, info, 0);
+
+	proc_dcacheInfo(info);
+}
+
+
+int syscalls_sys_sendmsg(char *ustack)
+{
+	int socket, flags;
+	const struct msghdr *msg;
+
+	GETFROMSTACK(ustack, int, socket, 0);
+	GETFROMSTACK(ustack, const struct msghdr *, msg, 1);
+	GETFROMSTACK(ustack, int, flags, 2);
+
+	return posix_sendmsg(socket, msg, flags);
+}
+
+
+int syscalls_sys_recvmsg(char *ustack)
+{
+	int socket, flags;
+	struct msghdr *msg;
+
+	GETFROMSTACK(ustack, int, socket, 0);
+	GETFROMSTACK(ustack, struct msghdr *, msg, 1);
+	GETFROMSTACK(ustack, int, flags, 2);
+
+	return posix_recvmsg(socket, msg, flags);
+}
+
+
+int syscalls_getrusage(void *ustack)
+{
+	int who;
+	usageinfo_t *info;
+
+	GETFROMSTACK(ustack, int, who, 0);
+	GETFROMSTACK(ustack, usageinfo_t *, info, 1);
+
+	return proc_usage(who, info);
+}
+
+
 int syscalls_sys_utimes(char *ustack)
 {
 	const char *filename;
@@ -1350,15 +1817,76 @@ const void * const syscalls[] = { SYSCALLS(SYSCALLS_NAME) };
 const char * const syscall_strings[] = { SYSCALLS(SYSCALLS_STRING) };
 
 
+#ifdef SYSCALLSTAT
+/* One table per CPU keeps allocations small regardless of the CPU count */
+static void syscalls_statsAlloc(void)
+{
+	syscalls_stat_t **stats;
+	unsigned int cpu;
+
+	if ((stats = vm_kmalloc(hal_cpuGetCount() * sizeof(*stats))) == NULL)
+		return;
+
+	for (cpu = 0; cpu < hal_cpuGetCount(); ++cpu) {
+		if ((stats[cpu] = vm_kmalloc(SYSCALLS_NR * sizeof(syscalls_stat_t))) == NULL) {
+			while (cpu-- > 0)
+				vm_kfree(stats[cpu]);
+
+			vm_kfree(stats);
+			return;
+		}
+
+		hal_memset(stats[cpu], 0, SYSCALLS_NR * sizeof(syscalls_stat_t));
+	}
+
+	syscalls_stats = stats;
+}
+
+
+static void syscalls_account(int n, cycles_t t)
+{
+	syscalls_stat_t *s = &syscalls_stats[hal_cpuGetID()][n];
+	u32 c = ((u64)t >> 32) ? (u32)-1 : (u32)t, max;
+	unsigned int b = (c != 0) ? hal_cpuGetLastBit(c) : 0;
+
+	lib_atomicIncrement(&s->count);
+	lib_atomicIncrement(&s->hist[min(b, SYSCALLSTAT_BUCKETS - 1)]);
+
+	max = lib_atomicLoad(&s->max);
+	while (c > max && !lib_atomicCompareExchange(&s->max, &max, c))
+		;
+}
+#endif
+
+
 void *syscalls_dispatch(int n, char *ustack)
 {
 	void *retval;
+#ifdef SYSCALLSTAT
+	cycles_t b, e;
+#endif
 
 	if (n >= sizeof(syscalls) / sizeof(syscalls[0]))
 		return (void *)-EINVAL;
 
+	trace_event(trace_evSyscallEnter, n, 0);
+
+#ifdef SYSCALLSTAT
+	hal_cpuGetCycles((void *)&b);
+#endif
+
 	retval = ((void *(*)(char *))syscalls[n])(ustack);
 
+#ifdef SYSCALLSTAT
+	hal_cpuGetCycles((void *)&e);
+
+	/* Counters of CPUs aren't synchronized, migration may go back in time */
+	if (syscalls_stats != NULL)
+		syscalls_account(n, (e > b) ? e - b : 0);
+#endif
+
+	trace_event(trace_evSyscallExit, n, (unsigned long)retval);
+
 	if (proc_current()->exit)
 		proc_threadEnd();
 
@@ -1369,4 +1897,8 @@ void *syscalls_dispatch(int n, char *ustack)
 void _syscalls_init(void)
 {
 	lib_printf("syscalls: Initializing syscall table [%d]\n", sizeof(syscalls) / sizeof(syscalls[0]));
+
+#ifdef SYSCALLSTAT
+	syscalls_statsAlloc();
+#endif
 }
@@ -21,6 +21,9 @@
 extern const void * const syscalls[];
 
 
+extern void *syscalls_dispatch(int n, char *ustack);
+
+
 extern void _syscalls_init(void);
 
 
@@ -1,54 +1,148 @@
-#include <hal/if.h>
-#include <main/if.h>
-#include <proc/if.h>
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Tests for lazy FPU and SIMD context switching
+ *
+ * Copyright 2017 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
 
+#include HAL
+#include "../proc/proc.h"
+#include "proc-fpu.h"
 
-#define LEN 128
 
+#ifdef HAL_LAZYFPU
 
-int test_fpuThread1(void *arg)
+
+#define TEST_FPU_THREADS 4
+#define TEST_FPU_ROUNDS  256
+#define TEST_FPU_SPIN    (1 << 20)
+#define TEST_FPU_WORDS   (8 * 4)
+
+/* Kernel may be built without SSE, then compiler doesn't know xmm registers */
+#ifdef __SSE__
+#define TEST_FPU_CLOBBERS , "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+#define TEST_FPU_CLOBBERS
+#endif
+
+
+struct {
+	volatile unsigned int exited;
+	volatile unsigned int corrupted;
+	volatile int idleFpu;
+	volatile int stop;
+} test_fpu_common;
+
+
+/* Loads in to xmm0-xmm7, spins long enough to be preempted, then stores the registers to out */
+static void test_fpu_hold(const u32 *in, u32 *out, unsigned int n)
+{
+	__asm__ volatile (
+		"movups 0(%1), %%xmm0; movups 16(%1), %%xmm1; movups 32(%1), %%xmm2; movups 48(%1), %%xmm3;"
+		"movups 64(%1), %%xmm4; movups 80(%1), %%xmm5; movups 96(%1), %%xmm6; movups 112(%1), %%xmm7;"
+		"1: decl %0; jnz 1b;"
+		"movups %%xmm0, 0(%2); movups %%xmm1, 16(%2); movups %%xmm2, 32(%2); movups %%xmm3, 48(%2);"
+		"movups %%xmm4, 64(%2); movups %%xmm5, 80(%2); movups %%xmm6, 96(%2); movups %%xmm7, 112(%2);"
+	: "+r" (n)
+	: "r" (in), "r" (out)
+	: "memory" TEST_FPU_CLOBBERS);
+}
+
+
+/* Pattern differs per thread and round, so state leaked from any other thread shows up */
+static void test_fpu_thread(void *arg)
 {
-	int i;
-	double f[LEN];
-	main_printf(ATTR_INFO,"test: [fpuThread1] start\n");
-
-	f[0] = 1 - 0.0123456789;
-	while (1) {
-		for(i = 1;i < LEN;i++) {
-			f[i] = f[i-1] * (1 - 0.00123456789);
+	unsigned int i, round, id = (unsigned long)arg;
+	u32 in[TEST_FPU_WORDS], out[TEST_FPU_WORDS];
+
+	for (round = 0; round < TEST_FPU_ROUNDS; round++) {
+		for (i = 0; i < TEST_FPU_WORDS; i++)
+			in[i] = (id << 24) | (round << 8) | i;
+
+		test_fpu_hold(in, out, TEST_FPU_SPIN);
+
+		for (i = 0; i < TEST_FPU_WORDS; i++) {
+			if (out[i] != in[i]) {
+				test_fpu_common.corrupted++;
+				break;
+			}
 		}
-		for(i = 0;i < LEN;i++)
-			if(f[i] >= 1 || f[i] <= 0)
-				main_printf(ATTR_ERROR,"test: [fpuThread1] invalid result f[%d] = %f\n",i,f[i]);
-		f[0] = f[LEN - 1];
-		if(f[0] < 0.005)
-			f[0] = 1 - 0.0123456789;
+
+		/* Sleep now and then, so state is switched between threads and CPUs */
+		if (!(round % 16))
+			proc_threadSleep(1000);
 	}
-	return 0;
+
+	test_fpu_common.exited++;
+
+	proc_threadEnd();
 }
 
-int test_fpuThread2(void* arg)
+
+/* Never touches FPU, so it shouldn't take the lazy switching trap */
+static void test_fpu_idlethr(void *arg)
 {
-	int i;
-	double f[LEN];
-	main_printf(ATTR_INFO,"test: [fpuThread2] start\n");
-	f[0] = -1 + 0.0123456789;
-	while (1) {
-		for(i = 1;i < LEN;i++) {
-			f[i] = -1* f[i-1] * (-1 + 0.00123456789);
-		}
-		for(i = 0;i < LEN;i++)
-			if(f[i] <= -1 || f[i] >= 0)
-				main_printf(ATTR_ERROR,"test: [fpuThread2] invalid result f[%d] = %f\n",i,f[i]);
-		f[0] = f[LEN - 1];
-		if(f[0] > -0.005)
-			f[0] = -1 + 0.0123456789;
+	unsigned int i = 0;
+
+	while (!test_fpu_common.stop) {
+		if (!(++i % 65536))
+			proc_threadSleep(1000);
 	}
-	return 0;
+
+	test_fpu_common.idleFpu = (proc_current()->fpu != NULL);
+	test_fpu_common.exited++;
+
+	proc_threadEnd();
 }
 
-void test_fpuContextSwitching(void)
+
+int test_fpuContextSwitching(void)
 {
-	proc_thread(NULL, test_fpuThread1,NULL,0,NULL,ttRegular);
-	proc_thread(NULL, test_fpuThread2,NULL,0,NULL,ttRegular);
+	unsigned long i;
+	u32 eax, ebx, ecx, edx;
+
+	/* SSE needs FXSAVE support, without it there are no xmm registers to switch */
+	hal_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if ((edx & ((1 << 24) | (1 << 25))) != ((1 << 24) | (1 << 25))) {
+		lib_printf("test: [fpu] no SSE, skipped\n");
+		return EOK;
+	}
+
+	test_fpu_common.exited = 0;
+	test_fpu_common.corrupted = 0;
+	test_fpu_common.idleFpu = 0;
+	test_fpu_common.stop = 0;
+
+	if (proc_threadCreate(NULL, test_fpu_idlethr, NULL, 4, 1024, NULL, 0, NULL) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < TEST_FPU_THREADS; i++) {
+		if (proc_threadCreate(NULL, test_fpu_thread, NULL, 4, 1024, NULL, 0, (void *)(i + 1)) < 0) {
+			test_fpu_common.corrupted++;
+			test_fpu_common.exited++;
+		}
+	}
+
+	while (test_fpu_common.exited != TEST_FPU_THREADS)
+		proc_threadSleep(1000);
+
+	test_fpu_common.stop = 1;
+
+	while (test_fpu_common.exited != TEST_FPU_THREADS + 1)
+		proc_threadSleep(1000);
+
+	lib_printf("test: [fpu] %d threads, %u rounds corrupted, idle thread %s FPU state\n", TEST_FPU_THREADS,
+		test_fpu_common.corrupted, test_fpu_common.idleFpu ? "got" : "has no");
+
+	return (test_fpu_common.corrupted == 0 && !test_fpu_common.idleFpu) ? EOK : -EINVAL;
 }
+
+
+#endif
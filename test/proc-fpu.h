@@ -2,7 +2,7 @@
 #define _TEST_FPU_H_
 
 
-/* Function testing fpu context switching */
-extern void test_fpuContextSwitching(void);
+/* Checks SSE state survives switching between threads and CPUs, returns EOK on success */
+extern int test_fpuContextSwitching(void);
 
 #endif
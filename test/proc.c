@@ -16,6 +16,11 @@
 
 #include HAL
 #include "../proc/proc.h"
+#include "../include/syscalls.h"
+#include "../syscalls.h"
+#include "../proc/elf.h"
+#include "../posix/posix.h"
+#include "proc-fpu.h"
 
 
 struct {
@@ -174,6 +179,655 @@ void test_proc_threads2(void)
 }
 
 
+/*
+ * Benchmarks, run one at a time by test_proc_benchmarks, each checks its own bound.
+ * They are kernel threads of the process which started them, so they may use its handles.
+ */
+
+
+struct {
+	process_t *process;
+	spinlock_t spinlock;
+	thread_t *queue;
+	volatile int done;
+	unsigned int failed;
+} test_proc_bench;
+
+
+/* Reports result and ends benchmark thread, lets the next one start */
+static void test_proc_benchEnd(const char *name, int passed)
+{
+	spinlock_ctx_t sc;
+
+	lib_printf("test: [proc.%s] %s\n", name, passed ? "PASS" : "FAIL");
+
+	hal_spinlockSet(&test_proc_bench.spinlock, &sc);
+	if (!passed)
+		test_proc_bench.failed++;
+	test_proc_bench.done = 1;
+	proc_threadWakeup(&test_proc_bench.queue);
+	hal_spinlockClear(&test_proc_bench.spinlock, &sc);
+
+	proc_threadEnd();
+}
+
+
+static void test_proc_benchRun(void (*bench)(void *), unsigned int priority)
+{
+	spinlock_ctx_t sc;
+
+	test_proc_bench.done = 0;
+
+	if (proc_threadCreateKernel(test_proc_bench.process, bench, NULL, priority, 1024, NULL) < 0) {
+		test_proc_bench.failed++;
+		return;
+	}
+
+	hal_spinlockSet(&test_proc_bench.spinlock, &sc);
+	while (!test_proc_bench.done)
+		proc_threadWait(&test_proc_bench.queue, &test_proc_bench.spinlock, 0, &sc);
+	hal_spinlockClear(&test_proc_bench.spinlock, &sc);
+}
+
+
+/*
+ * Condition broadcast, waking all waiters vs requeueing them onto the mutex, each waiter passes once a round
+ */
+
+
+#define TEST_PROC_WAITERS 32
+#define TEST_PROC_ROUNDS  16
+
+
+struct {
+	unsigned int mutex;
+	unsigned int cond;
+	volatile unsigned int gen;
+	volatile unsigned int waiting;
+	volatile unsigned int passed;
+	volatile unsigned int woken;
+	volatile unsigned int exited;
+	volatile int stop;
+	volatile cycles_t end;
+} test_proc_bcast;
+
+
+static void test_proc_waitthr(void *arg)
+{
+	unsigned int gen = 0;
+
+	proc_mutexLock(test_proc_bcast.mutex);
+
+	for (;;) {
+		test_proc_bcast.waiting++;
+
+		while (test_proc_bcast.gen == gen)
+			proc_condWait(test_proc_bcast.cond, test_proc_bcast.mutex, 0);
+
+		gen = test_proc_bcast.gen;
+
+		if (test_proc_bcast.stop)
+			break;
+
+		test_proc_bcast.woken++;
+
+		if (++test_proc_bcast.passed == TEST_PROC_WAITERS)
+			hal_cpuGetCycles((void *)&test_proc_bcast.end);
+	}
+
+	test_proc_bcast.exited++;
+	proc_mutexUnlock(test_proc_bcast.mutex);
+
+	proc_threadEnd();
+}
+
+
+/* Returns with the mutex held once all waiters sleep */
+static void test_proc_bcastSettle(void)
+{
+	for (;;) {
+		proc_mutexLock(test_proc_bcast.mutex);
+		if (test_proc_bcast.waiting == TEST_PROC_WAITERS)
+			break;
+
+		proc_mutexUnlock(test_proc_bcast.mutex);
+		proc_threadSleep(1000);
+	}
+
+	test_proc_bcast.waiting = 0;
+	test_proc_bcast.passed = 0;
+	test_proc_bcast.gen++;
+}
+
+
+static void test_proc_bcastthr(void *arg)
+{
+	unsigned int i, requeue, created = 0;
+	cycles_t begin, total[2] = { 0, 0 };
+	process_t *process = proc_current()->process;
+	cond_t *cond;
+	int m, c;
+
+	if ((m = proc_mutexCreate()) < 0)
+		test_proc_benchEnd("broadcast", 0);
+
+	if ((c = proc_condCreate()) < 0) {
+		proc_resourceDestroy(process, m);
+		test_proc_benchEnd("broadcast", 0);
+	}
+
+	test_proc_bcast.mutex = m;
+	test_proc_bcast.cond = c;
+	test_proc_bcast.gen = 0;
+	test_proc_bcast.waiting = 0;
+	test_proc_bcast.woken = 0;
+	test_proc_bcast.exited = 0;
+	test_proc_bcast.stop = 0;
+
+	for (i = 0; i < TEST_PROC_WAITERS; i++) {
+		if (proc_threadCreateKernel(process, test_proc_waitthr, NULL, 4, 1024, NULL) == EOK)
+			created++;
+	}
+
+	/* Count one waiter short, settling would never end */
+	if (created != TEST_PROC_WAITERS) {
+		proc_mutexLock(m);
+		test_proc_bcast.stop = 1;
+		test_proc_bcast.gen++;
+		proc_condBroadcast(c);
+		proc_mutexUnlock(m);
+
+		while (test_proc_bcast.exited != created)
+			proc_threadSleep(1000);
+
+		proc_resourceDestroy(process, c);
+		proc_resourceDestroy(process, m);
+		test_proc_benchEnd("broadcast", 0);
+	}
+
+	for (i = 0; i < 2 * TEST_PROC_ROUNDS; i++) {
+		requeue = i & 1;
+
+		/* Waiters release the lock only when going to sleep */
+		test_proc_bcastSettle();
+
+		/* Condition without a mutex recorded by its waiters wakes them all */
+		if (!requeue && (cond = cond_get(c)) != NULL) {
+			cond->mutex = 0;
+			cond_put(cond);
+		}
+
+		hal_cpuGetCycles((void *)&begin);
+		proc_condBroadcast(c);
+		proc_mutexUnlock(m);
+
+		while (test_proc_bcast.passed != TEST_PROC_WAITERS)
+			proc_threadSleep(1000);
+
+		total[requeue] += test_proc_bcast.end - begin;
+	}
+
+	/* Let the waiters go */
+	test_proc_bcastSettle();
+	test_proc_bcast.stop = 1;
+	proc_condBroadcast(c);
+	proc_mutexUnlock(m);
+
+	while (test_proc_bcast.exited != TEST_PROC_WAITERS)
+		proc_threadSleep(1000);
+
+	proc_resourceDestroy(process, c);
+	proc_resourceDestroy(process, m);
+
+	lib_printf("test: [proc.broadcast] %d waiters, broadcast %u, requeue %u cycles\n", TEST_PROC_WAITERS,
+		(unsigned int)(total[0] / TEST_PROC_ROUNDS), (unsigned int)(total[1] / TEST_PROC_ROUNDS));
+
+	test_proc_benchEnd("broadcast", test_proc_bcast.woken == 2 * TEST_PROC_ROUNDS * TEST_PROC_WAITERS);
+}
+
+
+/*
+ * Sleep timers, real-time sleeps are late by timer resolution at most, coalesced ones by their slack too
+ */
+
+
+#define TEST_PROC_SLEEPERS 16
+#define TEST_PROC_SLEEPS   32
+#define TEST_PROC_SLEEPLATE 2000
+
+
+struct {
+	volatile time_t late[TEST_PROC_SLEEPERS];
+	volatile unsigned int done;
+} test_proc_sleeping;
+
+
+static time_t test_proc_sleepus(unsigned int n)
+{
+	return 1000 + 700 * n;
+}
+
+
+static void test_proc_sleepthr(void *arg)
+{
+	unsigned int i, n = (unsigned long)arg;
+	time_t us = test_proc_sleepus(n), begin, late;
+
+	for (i = 0; i < TEST_PROC_SLEEPS; i++) {
+		begin = proc_uptime();
+		proc_threadSleep(us);
+
+		if ((late = proc_uptime() - begin - us) > test_proc_sleeping.late[n])
+			test_proc_sleeping.late[n] = late;
+	}
+
+	lib_atomicIncrement(&test_proc_sleeping.done);
+
+	proc_threadEnd();
+}
+
+
+static void test_proc_sleepbench(void *arg)
+{
+	unsigned long i;
+	time_t late[2] = { 0, 0 };
+	int passed = 1;
+
+	test_proc_sleeping.done = 0;
+
+	/* Odd ones run below real-time priorities, so their sleeps have slack */
+	for (i = 0; i < TEST_PROC_SLEEPERS; i++) {
+		test_proc_sleeping.late[i] = 0;
+		proc_threadCreate(NULL, test_proc_sleepthr, NULL, (i & 1) ? 5 : 1, 1024, NULL, 0, (void *)i);
+	}
+
+	while (test_proc_sleeping.done != TEST_PROC_SLEEPERS)
+		proc_threadSleep(10000);
+
+	for (i = 0; i < TEST_PROC_SLEEPERS; i++) {
+		if (test_proc_sleeping.late[i] > TEST_PROC_SLEEPLATE + ((i & 1) ? test_proc_sleepus(i) / 16 : 0))
+			passed = 0;
+
+		late[i & 1] = max(late[i & 1], test_proc_sleeping.late[i]);
+	}
+
+	lib_printf("test: [proc.sleep] %d sleepers, max late %u us, with slack %u us\n", TEST_PROC_SLEEPERS,
+		(unsigned int)late[0], (unsigned int)late[1]);
+
+	test_proc_benchEnd("sleep", passed);
+}
+
+
+/*
+ * CPU affinity, thread follows its mask
+ */
+
+
+static void test_proc_affinitythr(void *arg)
+{
+	unsigned int i, cpus = 0, misplaced = 0;
+
+	proc_threadAffinity(0, 0, &cpus);
+
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		proc_threadAffinity(0, 1 << i, NULL);
+		proc_threadSleep(1000);
+
+		if (hal_cpuGetID() != i)
+			misplaced++;
+	}
+
+	proc_threadAffinity(0, cpus, NULL);
+
+	lib_printf("test: [proc.affinity] %d CPUs, default mask 0x%x, %u misplaced\n", hal_cpuGetCount(), cpus, misplaced);
+
+	test_proc_benchEnd("affinity", misplaced == 0);
+}
+
+
+/*
+ * Deadline class, busy thread gets no more than its reservation
+ */
+
+
+#define TEST_PROC_DLBUDGET 2000
+#define TEST_PROC_DLPERIOD 10000
+#define TEST_PROC_DLTIME   200000
+
+
+static void test_proc_deadlinethr(void *arg)
+{
+	thread_t *current = proc_current();
+	time_t start, cpu, reserved = TEST_PROC_DLTIME / TEST_PROC_DLPERIOD * TEST_PROC_DLBUDGET;
+	int err;
+
+	/* Thread itself runs above everything else */
+	if ((err = proc_threadDeadline(0, TEST_PROC_DLBUDGET, TEST_PROC_DLPERIOD, TEST_PROC_DLPERIOD)) < 0) {
+		lib_printf("test: [proc.deadline] reservation failed, err=%d\n", err);
+		test_proc_benchEnd("deadline", 0);
+	}
+
+	start = proc_timestamp();
+	cpu = current->cpuTime;
+
+	while (proc_timestamp() - start < TEST_PROC_DLTIME)
+		;
+
+	cpu = current->cpuTime - cpu;
+	proc_threadDeadline(0, 0, 0, 0);
+
+	lib_printf("test: [proc.deadline] used %u us of %u us, reserved %u us\n", (unsigned int)cpu, TEST_PROC_DLTIME, (unsigned int)reserved);
+
+	/* One period of overrun is tolerated for budget timer resolution */
+	test_proc_benchEnd("deadline", cpu > 0 && cpu <= reserved + TEST_PROC_DLBUDGET);
+}
+
+
+/*
+ * Null system call dispatch from a kernel thread, entry and return are covered by the getpid benchmark
+ */
+
+
+#define TEST_PROC_SYSCALLS 100000
+
+#define TEST_PROC_SYSCALLID(name) test_proc_syscall_##name,
+
+
+enum { SYSCALLS(TEST_PROC_SYSCALLID) };
+
+
+static void test_proc_dispatchthr(void *arg)
+{
+	unsigned int i, wrong = 0;
+	cycles_t b, e;
+
+	hal_cpuGetCycles((void *)&b);
+
+	for (i = 0; i < TEST_PROC_SYSCALLS; i++) {
+		if ((unsigned long)syscalls_dispatch(test_proc_syscall_gettid, NULL) != proc_current()->id)
+			wrong++;
+	}
+
+	hal_cpuGetCycles((void *)&e);
+
+	lib_printf("test: [proc.dispatch] null syscall dispatch %u cycles\n", (unsigned int)((e - b) / TEST_PROC_SYSCALLS));
+
+	test_proc_benchEnd("dispatch", wrong == 0);
+}
+
+
+/*
+ * Threaded interrupt handler of a process, line is fired with int instruction
+ */
+
+
+#ifdef __i386__
+
+
+#define TEST_PROC_IRQ      5   /* Unused on PC */
+#define TEST_PROC_IRQRUNS  64
+#define TEST_PROC_IRQPRIO  2
+
+
+struct {
+	unsigned long tid;
+	volatile unsigned int runs;
+	volatile unsigned int wrong;
+	volatile int fired;
+	irqinfo_t info;
+	irqinfo_t list[TEST_PROC_IRQ + 1];
+} test_proc_intr;
+
+
+/* Runs in handler thread of the test process, with line masked in 8259 */
+static int test_proc_intrHandler(unsigned int n, void *arg)
+{
+	thread_t *current = proc_current();
+
+	if (current->id == test_proc_intr.tid || current->priority != TEST_PROC_IRQPRIO || !(hal_inb((void *)0x21) & (1 << n)))
+		test_proc_intr.wrong++;
+
+	test_proc_intr.runs++;
+
+	return -1;
+}
+
+
+static void test_proc_intrProcess(void *arg)
+{
+	unsigned int i;
+	time_t start;
+
+	test_proc_intr.tid = proc_current()->id;
+
+	if (userintr_setHandler(TEST_PROC_IRQ, test_proc_intrHandler, NULL, 0, TEST_PROC_IRQPRIO) < 0) {
+		test_proc_intr.fired = -1;
+		proc_threadEnd();
+	}
+
+	for (i = 0; i < TEST_PROC_IRQRUNS; i++) {
+		__asm__ volatile ("int %0" : : "i" (32 + TEST_PROC_IRQ));
+
+		for (start = proc_timestamp(); test_proc_intr.runs <= i && proc_timestamp() - start < 100000;)
+			proc_threadSleep(1000);
+	}
+
+	if (userintr_list(TEST_PROC_IRQ + 1, test_proc_intr.list) == TEST_PROC_IRQ + 1)
+		hal_memcpy(&test_proc_intr.info, &test_proc_intr.list[TEST_PROC_IRQ], sizeof(irqinfo_t));
+
+	test_proc_intr.fired = 1;
+
+	/* Handler thread is ghosted without running, teardown of its process mustn't wait for it */
+	proc_kill(proc_current()->process);
+	proc_threadEnd();
+}
+
+
+static void test_proc_intrthr(void *arg)
+{
+	unsigned long long latency = 0;
+	unsigned int i;
+	int removed = 0;
+	time_t start;
+
+	hal_memset(&test_proc_intr, 0, sizeof(test_proc_intr));
+
+	if (proc_start(test_proc_intrProcess, NULL, (const char *)"intr") < 0)
+		test_proc_benchEnd("intr", 0);
+
+	while (!test_proc_intr.fired)
+		proc_threadSleep(1000);
+
+	/* Handler is gone once its process is destroyed */
+	for (start = proc_timestamp(); !removed && proc_timestamp() - start < 1000000;) {
+		proc_threadSleep(1000);
+		removed = (userintr_list(TEST_PROC_IRQ + 1, test_proc_intr.list) == TEST_PROC_IRQ + 1 && test_proc_intr.list[TEST_PROC_IRQ].threads == 0);
+	}
+
+	for (i = 0; i < IRQSTAT_BUCKETS; i++)
+		latency += test_proc_intr.info.latency[i];
+
+	lib_printf("test: [proc.intr] %u runs, %u wrong, %u threads, max latency %u us, handler %s\n", test_proc_intr.runs, test_proc_intr.wrong,
+		test_proc_intr.info.threads, test_proc_intr.info.latencyMax, removed ? "removed" : "stuck");
+
+	test_proc_benchEnd("intr", test_proc_intr.fired > 0 && test_proc_intr.runs == TEST_PROC_IRQRUNS && test_proc_intr.wrong == 0 &&
+		test_proc_intr.info.threads == 1 && test_proc_intr.info.runs == TEST_PROC_IRQRUNS && latency == TEST_PROC_IRQRUNS && removed);
+}
+
+
+/*
+ * User mode getpid through int gate and SYSENTER. Program is a single page ELF image spawned from physical memory,
+ * it exits with 1 if any getpid returns another pid. Spawn and exit cost is taken from a run making no calls.
+ */
+
+
+#define TEST_PROC_GETPIDS  (1 << 18)
+#define TEST_PROC_RING3VADDR 0x08048000
+#define TEST_PROC_RING3OFFS  256
+
+
+extern char test_proc_ring3[], test_proc_ring3Int[], test_proc_ring3Sysenter[], test_proc_ring3End[];
+
+
+static u8 test_proc_ring3Image[SIZE_PAGE] __attribute__((aligned(SIZE_PAGE)));
+
+
+/* Never called, holds user mode code copied into the image; ebx selects SYSENTER, edi counts calls */
+static void __attribute__((used)) test_proc_ring3Code(void)
+{
+	__asm__ volatile (
+		".pushsection .rodata\n"
+		"test_proc_ring3:\n"
+		"	xorl %%edi, %%edi\n"
+		"	jmp 3f\n"
+		"test_proc_ring3Int:\n"
+		"	movl %2, %%edi\n"
+		"	xorl %%ebx, %%ebx\n"
+		"	jmp 2f\n"
+		"test_proc_ring3Sysenter:\n"
+		"	movl %2, %%edi\n"
+		"	movl $1, %%ebx\n"
+		"2:	movl %0, %%eax\n"
+		"	int $0x80\n"
+		"	movl %%eax, %%ebp\n"
+		"	call 1f\n"
+		"1:	popl %%esi\n"
+		"4:	movl %0, %%eax\n"
+		"	testl %%ebx, %%ebx\n"
+		"	jnz 5f\n"
+		"	int $0x80\n"
+		"	jmp 6f\n"
+		"5:	movl %%esp, %%ecx\n"
+		"	leal (6f - 1b)(%%esi), %%edx\n"
+		"	sysenter\n"
+		"6:	cmpl %%ebp, %%eax\n"
+		"	jne 7f\n"
+		"	decl %%edi\n"
+		"	jnz 4b\n"
+		"3:	pushl $0\n"
+		"	jmp 8f\n"
+		"7:	pushl $1\n"
+		"8:	pushl $0\n"
+		"	movl %1, %%eax\n"
+		"	int $0x80\n"
+		"9:	jmp 9b\n"
+		"test_proc_ring3End:\n"
+		".popsection\n"
+	:
+	: "i" (test_proc_syscall_getpid), "i" (test_proc_syscall_sys_exit), "i" (TEST_PROC_GETPIDS));
+}
+
+
+/* Returns cycles from spawn to exit of program started at entry, 0 on failure */
+static cycles_t test_proc_ring3Run(char *entry)
+{
+	Elf32_Ehdr *ehdr = (void *)test_proc_ring3Image;
+	syspage_program_t prog;
+	char *argv[] = { "getpid", NULL };
+	cycles_t b, e;
+	int pid, status;
+
+	ehdr->e_entry = TEST_PROC_RING3VADDR + TEST_PROC_RING3OFFS + (entry - test_proc_ring3);
+
+	prog.start = (u32)test_proc_ring3Image - VADDR_KERNEL;
+	prog.end = prog.start + SIZE_PAGE;
+
+	hal_cpuGetCycles((void *)&b);
+
+	if ((pid = proc_syspageSpawn(&prog, NULL, "getpid", argv)) < 0)
+		return 0;
+
+	if (posix_waitpid(pid, &status, 0) != pid || status != 0)
+		return 0;
+
+	hal_cpuGetCycles((void *)&e);
+
+	return e - b;
+}
+
+
+static void test_proc_getpidthr(void *arg)
+{
+	Elf32_Ehdr *ehdr = (void *)test_proc_ring3Image;
+	Elf32_Phdr *phdr = (void *)(ehdr + 1);
+	cycles_t base, gate, sysenter = 0;
+	u32 eax, ebx, ecx, edx;
+
+	hal_memset(test_proc_ring3Image, 0, sizeof(test_proc_ring3Image));
+	hal_memcpy(ehdr->e_ident, "\177ELF", 4);
+	ehdr->e_ident[4] = 1;
+	ehdr->e_phoff = sizeof(*ehdr);
+	ehdr->e_phentsize = sizeof(*phdr);
+	ehdr->e_phnum = 1;
+
+	phdr->p_type = PT_LOAD;
+	phdr->p_vaddr = TEST_PROC_RING3VADDR;
+	phdr->p_filesz = SIZE_PAGE;
+	phdr->p_memsz = SIZE_PAGE;
+	phdr->p_flags = PF_R | PF_X;
+	phdr->p_align = SIZE_PAGE;
+
+	hal_memcpy(test_proc_ring3Image + TEST_PROC_RING3OFFS, test_proc_ring3, test_proc_ring3End - test_proc_ring3);
+
+	if ((base = test_proc_ring3Run(test_proc_ring3)) == 0 || (gate = test_proc_ring3Run(test_proc_ring3Int)) == 0)
+		test_proc_benchEnd("getpid", 0);
+
+	/* CPU may lack SEP, then there's no SYSENTER entry */
+	hal_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if ((edx & (1 << 11)) && (sysenter = test_proc_ring3Run(test_proc_ring3Sysenter)) == 0)
+		test_proc_benchEnd("getpid", 0);
+
+	lib_printf("test: [proc.getpid] int %u, sysenter %u cycles\n", (unsigned int)((gate > base) ? (gate - base) / TEST_PROC_GETPIDS : 0),
+		(unsigned int)((sysenter > base) ? (sysenter - base) / TEST_PROC_GETPIDS : 0));
+
+	test_proc_benchEnd("getpid", 1);
+}
+
+
+#endif
+
+
+#ifdef HAL_LAZYFPU
+static void test_proc_fputhr(void *arg)
+{
+	test_proc_benchEnd("fpu", test_fpuContextSwitching() == EOK);
+}
+#endif
+
+
+static void test_proc_benchthr(void *arg)
+{
+	test_proc_bench.failed = 0;
+
+	test_proc_benchRun(test_proc_bcastthr, 4);
+	test_proc_benchRun(test_proc_sleepbench, 4);
+	test_proc_benchRun(test_proc_affinitythr, 4);
+	test_proc_benchRun(test_proc_deadlinethr, 1);
+	test_proc_benchRun(test_proc_dispatchthr, 4);
+#ifdef __i386__
+	test_proc_benchRun(test_proc_intrthr, 4);
+	test_proc_benchRun(test_proc_getpidthr, 4);
+#endif
+#ifdef HAL_LAZYFPU
+	test_proc_benchRun(test_proc_fputhr, 4);
+#endif
+
+	lib_printf("test: [proc.benchmarks] %u failed\n", test_proc_bench.failed);
+
+	proc_threadEnd();
+}
+
+
+void test_proc_benchmarks(void)
+{
+	test_proc_bench.process = proc_current()->process;
+	test_proc_bench.queue = NULL;
+	hal_spinlockCreate(&test_proc_bench.spinlock, "test_proc_bench.spinlock");
+
+	proc_threadCreateKernel(test_proc_bench.process, test_proc_benchthr, NULL, 4, 1024, NULL);
+}
+
+
 /* Test process termination given terminating programs in syspage */
 static void test_proc_initthr(void *arg)
 {
@@ -26,6 +26,10 @@ extern void test_proc_threads2(void);
 extern void test_proc_conditional(void);
 
 
+/* Runs benchmarks one after another, each reports PASS or FAIL */
+extern void test_proc_benchmarks(void);
+
+
 extern void test_proc_exit(void);
 
 
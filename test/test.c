@@ -24,6 +24,7 @@
 void test_run(void)
 {
 	test_proc_threads1();
+	test_proc_benchmarks();
 //	test_vm_alloc();
 //	test_vm_kmalloc();
 //	test_rb();
@@ -88,6 +88,25 @@ void amap_getanons(amap_t *amap, int offset, int size)
 }
 
 
+/* Page of the anon stays allocated until unpinned, even when unmapped or copied on write */
+anon_t *amap_pin(amap_t *amap, int offset)
+{
+	anon_t *a;
+
+	proc_lockSet(&amap->lock);
+	a = amap_getanon(amap->anons[offset / SIZE_PAGE]);
+	proc_lockClear(&amap->lock);
+
+	return a;
+}
+
+
+void amap_unpin(anon_t *a)
+{
+	amap_putanon(a);
+}
+
+
 amap_t *amap_ref(amap_t *amap)
 {
 	if (amap == NULL)
@@ -128,7 +147,7 @@ amap_t *amap_create(amap_t *amap, int *offset, size_t size)
 		return NULL;
 	}
 
-	proc_lockInit(&new->lock);
+	proc_lockInit(&new->lock, "amap.lock");
 	new->size = i;
 	new->refs = 1;
 	*offset = *offset / SIZE_PAGE;
@@ -184,7 +203,7 @@ static anon_t *anon_new(page_t *p)
 
 	a->page = p;
 	a->refs = 1;
-	proc_lockInit(&a->lock);
+	proc_lockInit(&a->lock, "amap.lock");
 
 	return a;
 }
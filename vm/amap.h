@@ -49,6 +49,12 @@ extern void amap_putanons(amap_t *amap, int offs, int size);
 extern void amap_getanons(amap_t *amap, int offs, int size);
 
 
+extern anon_t *amap_pin(amap_t *amap, int offset);
+
+
+extern void amap_unpin(anon_t *a);
+
+
 extern amap_t *amap_create(amap_t *amap, int *offset, size_t size);
 
 
@@ -665,6 +665,7 @@ static void map_pageFault(unsigned int n, exc_context_t *ctx)
 	vm_map_t *map;
 	void *vaddr, *paddr;
 	int prot;
+	unsigned int majflt;
 
 	prot = hal_exceptionsFaultType(n, ctx);
 	vaddr = hal_exceptionsFaultAddr(n, ctx);
@@ -684,6 +685,9 @@ static void map_pageFault(unsigned int n, exc_context_t *ctx)
 	else
 		map = map_common.kmap;
 
+	majflt = thread->usage.majflt;
+	trace_event(trace_evPageFault, prot, (unsigned long)vaddr);
+
 	if (vm_mapForce(map, paddr, prot)) {
 		process_dumpException(n, ctx);
 
@@ -694,6 +698,9 @@ static void map_pageFault(unsigned int n, exc_context_t *ctx)
 
 		threads_sigpost(thread->process, thread, signal_segv);
 	}
+	else if (thread->usage.majflt == majflt) {
+		thread->usage.minflt++;
+	}
 }
 #endif
 
@@ -710,6 +717,137 @@ int vm_munmap(vm_map_t *map, void *vaddr, size_t size)
 }
 
 
+/* Maps pages backing a buffer of map into the kernel, they stay owned by map */
+/* Returns NULL if the buffer can't be loaned, e.g. it isn't private writable memory */
+void *vm_mapLoan(vm_map_t *map, void *data, size_t size, vm_loan_t **loan)
+{
+#ifndef NOMMU
+	void *vaddr;
+	size_t len, offs, i;
+	map_entry_t t, *e;
+	vm_loan_t *l;
+	int err = EOK;
+
+	vaddr = (void *)((ptr_t)data & ~(SIZE_PAGE - 1));
+	len = (((ptr_t)data + size + SIZE_PAGE - 1) & ~(SIZE_PAGE - 1)) - (ptr_t)vaddr;
+
+	if ((l = vm_kmalloc(sizeof(vm_loan_t) + (len / SIZE_PAGE) * sizeof(anon_t *))) == NULL)
+		return NULL;
+
+	l->len = len;
+	hal_memset(l->anons, 0, (len / SIZE_PAGE) * sizeof(anon_t *));
+
+	if ((l->w = vm_mapFind(map_common.kmap, NULL, len, MAP_NOINHERIT, PROT_READ)) == NULL) {
+		vm_kfree(l);
+		return NULL;
+	}
+
+	t.size = SIZE_PAGE;
+
+	proc_lockSet(&map->lock);
+
+	for (offs = 0, i = 0; offs < len && err == EOK; offs += SIZE_PAGE, ++i) {
+		t.vaddr = vaddr + offs;
+
+		/* Page gets a private anon, referencing it keeps the page when the writer unmaps or writes it */
+		if ((e = lib_treeof(map_entry_t, linkage, lib_rbFind(&map->tree, &t.linkage))) == NULL ||
+				_map_force(map, e, t.vaddr, PROT_READ | PROT_WRITE | PROT_USER) != EOK || e->amap == NULL ||
+				(l->anons[i] = amap_pin(e->amap, e->aoffs + (t.vaddr - e->vaddr))) == NULL) {
+			err = -EFAULT;
+			break;
+		}
+
+		proc_lockSet(&map_common.kmap->lock);
+		err = page_map(&map_common.kmap->pmap, l->w + offs, l->anons[i]->page->addr, PGHD_PRESENT);
+		proc_lockClear(&map_common.kmap->lock);
+	}
+
+	proc_lockClear(&map->lock);
+
+	if (err < 0) {
+		vm_mapUnloan(l);
+		return NULL;
+	}
+
+	*loan = l;
+	return l->w + ((ptr_t)data & (SIZE_PAGE - 1));
+#else
+	*loan = NULL;
+	return data;
+#endif
+}
+
+
+void vm_mapUnloan(vm_loan_t *loan)
+{
+#ifndef NOMMU
+	size_t i;
+
+	if (loan == NULL)
+		return;
+
+	vm_munmap(map_common.kmap, loan->w, loan->len);
+
+	for (i = 0; i < loan->len / SIZE_PAGE && loan->anons[i] != NULL; ++i)
+		amap_unpin(loan->anons[i]);
+
+	vm_kfree(loan);
+#endif
+}
+
+
+/* Faults in readable user memory at vaddr and pins its page, fails if there's none */
+int vm_mapPin(vm_map_t *map, void *vaddr, addr_t *paddr, vm_pin_t *pin)
+{
+#ifndef NOMMU
+	map_entry_t t, *e;
+	int err = EOK;
+
+	pin->anon = NULL;
+	pin->object = NULL;
+
+	t.vaddr = (void *)((ptr_t)vaddr & ~(SIZE_PAGE - 1));
+	t.size = SIZE_PAGE;
+
+	proc_lockSet(&map->lock);
+
+	if ((e = lib_treeof(map_entry_t, linkage, lib_rbFind(&map->tree, &t.linkage))) == NULL ||
+			_map_force(map, e, t.vaddr, PROT_READ | PROT_USER) != EOK) {
+		err = -EFAULT;
+	}
+	else {
+		*paddr = (pmap_resolve(&map->pmap, t.vaddr) & ~(SIZE_PAGE - 1)) | ((ptr_t)vaddr & (SIZE_PAGE - 1));
+
+		/* Page is either a private copy or the object's own page */
+		if (e->amap == NULL || (pin->anon = amap_pin(e->amap, e->aoffs + (t.vaddr - e->vaddr))) == NULL) {
+			if (e->object != NULL && e->object != (void *)-1)
+				pin->object = vm_objectRef(e->object);
+		}
+	}
+
+	proc_lockClear(&map->lock);
+
+	return err;
+#else
+	pin->anon = NULL;
+	pin->object = NULL;
+	*paddr = (addr_t)(ptr_t)vaddr;
+
+	return EOK;
+#endif
+}
+
+
+void vm_mapUnpin(vm_pin_t *pin)
+{
+	if (pin->anon != NULL)
+		amap_unpin(pin->anon);
+
+	if (pin->object != NULL)
+		vm_objectPut(pin->object);
+}
+
+
 void vm_mapDump(vm_map_t *map)
 {
 	if (map == NULL)
@@ -742,7 +880,7 @@ int vm_mapCreate(vm_map_t *map, void *start, void *stop)
 	pmap_create(&map->pmap, &map_common.kmap->pmap, NULL, NULL);
 #endif
 
-	proc_lockInit(&map->lock);
+	proc_lockInit(&map->lock, "map.lock");
 	lib_rbInit(&map->tree, map_cmp, map_augment);
 	return EOK;
 }
@@ -1154,12 +1292,12 @@ int _map_init(vm_map_t *kmap, vm_object_t *kernel, void **bss, void **top)
 	map_entry_t *e;
 	void *vaddr;
 
-	proc_lockInit(&map_common.lock);
+	proc_lockInit(&map_common.lock, "map_common.lock");
 
 	kmap->start = kmap->pmap.start;
 	kmap->stop = kmap->pmap.end;
 
-	proc_lockInit(&kmap->lock);
+	proc_lockInit(&kmap->lock, "map.lock");
 	lib_rbInit(&kmap->tree, map_cmp, map_augment);
 
 	map_common.kmap = kmap;
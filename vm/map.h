@@ -71,6 +71,21 @@ typedef struct _map_entry_t {
 } map_entry_t;
 
 
+/* User buffer mapped into the kernel, its pages are pinned until it is returned */
+typedef struct _vm_loan_t {
+	void *w;
+	size_t len;
+	struct _anon_t *anons[];
+} vm_loan_t;
+
+
+/* Keeps the page backing a user address allocated, so its physical address stays valid */
+typedef struct _vm_pin_t {
+	struct _anon_t *anon;
+	struct _vm_object_t *object;
+} vm_pin_t;
+
+
 extern void *vm_mapFind(vm_map_t *map, void *vaddr, size_t size, u8 flags, u8 prot);
 
 
@@ -95,6 +110,18 @@ extern int vm_munmap(vm_map_t *map, void *vaddr, size_t size);
 extern int _vm_munmap(vm_map_t *map, void *vaddr, size_t size);
 
 
+extern void *vm_mapLoan(vm_map_t *map, void *data, size_t size, vm_loan_t **loan);
+
+
+extern void vm_mapUnloan(vm_loan_t *loan);
+
+
+extern int vm_mapPin(vm_map_t *map, void *vaddr, addr_t *paddr, vm_pin_t *pin);
+
+
+extern void vm_mapUnpin(vm_pin_t *pin);
+
+
 extern void vm_mapDump(vm_map_t *map);
 
 
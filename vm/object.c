@@ -73,7 +73,7 @@ int vm_objectGet(vm_object_t **o, oid_t oid)
 		hal_memcpy(&(*o)->oid, &oid, sizeof(oid));
 		(*o)->size = sz;
 		(*o)->refs = 0;
-		proc_lockInit(&(*o)->lock);
+		proc_lockInit(&(*o)->lock, "object.lock");
 
 		for (i = 0; i < n; ++i)
 			(*o)->pages[i] = NULL;
@@ -156,6 +156,8 @@ static page_t *object_fetch(oid_t oid, offs_t offs)
 		return NULL;
 	}
 
+	proc_current()->usage.majflt++;
+
 	if (proc_read(oid, offs, v, SIZE_PAGE, 0) < 0) {
 		vm_munmap(object_common.kmap, v, SIZE_PAGE);
 		vm_pageFree(p);
@@ -251,7 +253,7 @@ vm_object_t *vm_objectContiguous(size_t size)
 	o->oid.id = -1;
 	o->refs = 1;
 	o->size = size;
-	proc_lockInit(&o->lock);
+	proc_lockInit(&o->lock, "object.lock");
 
 	for (i = 0; i < n; ++i)
 		o->pages[i] = p + i;
@@ -269,14 +271,14 @@ int _object_init(vm_map_t *kmap, vm_object_t *kernel)
 	object_common.kernel = kernel;
 	object_common.kmap = kmap;
 
-	proc_lockInit(&object_common.lock);
+	proc_lockInit(&object_common.lock, "object_common.lock");
 	lib_rbInit(&object_common.tree, object_cmp, NULL);
 
 	kernel->refs = 0;
 	kernel->oid.port = 0;
 	kernel->oid.id = 0;
 	lib_rbInsert(&object_common.tree, &kernel->linkage);
-	proc_lockInit(&kernel->lock);
+	proc_lockInit(&kernel->lock, "object.lock");
 
 	vm_objectGet(&o, kernel->oid);
 
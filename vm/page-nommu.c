@@ -169,7 +169,7 @@ void _page_init(pmap_t *pmap, void **bss, void **top)
 	page_t *p;
 	unsigned int i;
 
-	proc_lockInit(&pages.lock);
+	proc_lockInit(&pages.lock, "pages.lock");
 
 	pages.freesz = pmap_getMaxVAdrr() - (unsigned int)(*bss);
 	pages.bootsz = 0;